@@ -0,0 +1,137 @@
+/*
+ * Rewriting latency benchmark: kernels of the DBrew examples
+ *
+ * Kernels are copied from examples/, with the same configuration of
+ * static parameters as used there. The matrix example is not included, as
+ * its kernel has more than 6 parameters which DBrew does not support.
+ *
+ * Usage: bench-examples [iterations] [--noheader]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+// examples/simple.c
+int foo(int i, int j)
+{
+    if (i == 5) return 0;
+    return i+j;
+}
+
+// examples/strcmp.c
+int isHello(char* s)
+{
+    return strcmp(s, "Hello");
+}
+
+// examples/stencil.c
+typedef struct {
+    int xdiff, ydiff;
+    double factor;
+} StencilPoint;
+
+typedef struct {
+    int points;
+    StencilPoint p[];
+} Stencil;
+
+#define CO1 (.4)
+#define CO2 (.15)
+
+Stencil s5 = {5,{ { 0, 0, CO1},
+                  {-1, 0, CO2},
+                  { 1, 0, CO2},
+                  { 0,-1, CO2},
+                  { 0, 1, CO2} }};
+
+typedef double (*apply_func)(double*, int, Stencil*);
+
+double apply(double *m, int xsize, Stencil* s)
+{
+    double res;
+    int i;
+
+    res = 0;
+    for(i=0; i<s->points; i++) {
+        StencilPoint* p = s->p + i;
+        res += p->factor * m[p->xdiff + p->ydiff * xsize];
+    }
+    return res;
+}
+
+double apply2(double *m, int xsize, Stencil* s)
+{
+    (void)s; // unused
+    return CO1 * m[0] + CO2 * (m[-1] + m[1] + m[-xsize] + m[xsize]);
+}
+
+void applyLoop(int size, double* src, double* dst, apply_func af, Stencil* s)
+{
+    int x,y;
+
+    for(y=1;y<size-1;y++)
+        for(x=1;x<size-1;x++)
+            dst[x+y*size] = af(&(src[x+y*size]), size, s);
+}
+
+#define SIZE 50
+double m1[SIZE * SIZE], m2[SIZE * SIZE];
+
+int main(int argc, char* argv[])
+{
+    int iters = 100;
+    int failed = 0;
+    uint64_t par[8];
+    Rewriter* r;
+
+    if ((argc > 1) && (argv[1][0] != '-')) iters = atoi(argv[1]);
+    if ((argc < 2) || (strcmp(argv[argc-1], "--noheader") != 0))
+        benchHeader();
+
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) foo);
+    dbrew_config_staticpar(r, 0);
+    dbrew_config_parcount(r, 2);
+    par[0] = 2; par[1] = 3;
+    if (!benchRewrite("examples/simple", r, par, iters)) failed++;
+    dbrew_free(r);
+
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) isHello);
+    dbrew_config_staticpar(r, 0);
+    dbrew_config_parcount(r, 1);
+    par[0] = (uint64_t) "Bla";
+    // strcmp of libc is host dependent and may use instructions not
+    // supported by the decoder (e.g. EVEX on AVX-512): do not count as failed
+    if (!benchRewrite("examples/strcmp", r, par, iters))
+        fprintf(stderr, "examples/strcmp: libc variant not supported\n");
+    dbrew_free(r);
+
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) apply);
+    dbrew_config_staticpar(r, 1);
+    dbrew_config_staticpar(r, 2);
+    dbrew_config_parcount(r, 3);
+    dbrew_config_returnfp(r);
+    par[0] = (uint64_t) (m1 + SIZE + 1);
+    par[1] = SIZE; par[2] = (uint64_t) &s5;
+    if (!benchRewrite("examples/stencil-apply", r, par, iters)) failed++;
+    dbrew_free(r);
+
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) applyLoop);
+    dbrew_config_staticpar(r, 0);
+    dbrew_config_staticpar(r, 3);
+    dbrew_config_staticpar(r, 4);
+    dbrew_config_parcount(r, 5);
+    dbrew_config_force_unknown(r, 0);
+    par[0] = SIZE; par[1] = (uint64_t) m1; par[2] = (uint64_t) m2;
+    par[3] = (uint64_t) apply2; par[4] = (uint64_t) &s5;
+    if (!benchRewrite("examples/stencil-loop", r, par, iters)) failed++;
+    dbrew_free(r);
+
+    return failed;
+}
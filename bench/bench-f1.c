@@ -0,0 +1,55 @@
+/*
+ * Rewriting latency benchmark driver for a function "f1(long, long)"
+ *
+ * Used for test cases from tests/cases (same interface as the
+ * default test driver) and synthetic functions generated by gen-synth.py.
+ *
+ * Usage: bench-f1 <name> [iterations] [parameter] [--noheader]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+long f1(long, long);
+
+// data which may be read/written by test cases
+const uint64_t rdata[2] = {1,2}; // read-only data section (16 bytes)
+long wdata[2];                   // uninitialized data section (16 bytes)
+
+int main(int argc, char* argv[])
+{
+    int arg = 1;
+    int iters = 100;
+    bool header = true;
+    const char* name = "f1";
+    uint64_t par[2] = {1, 1};
+    Rewriter* r;
+
+    if ((argc > 1) && (strcmp(argv[argc-1], "--noheader") == 0)) {
+        header = false;
+        argc--;
+    }
+    if (arg < argc) name = argv[arg++];
+    if (arg < argc) iters = atoi(argv[arg++]);
+    if (arg < argc) par[0] = atol(argv[arg++]);
+
+    if (header) benchHeader();
+
+    r = dbrew_new();
+    // large synthetic functions need more buffer space than default
+    dbrew_set_decoding_capacity(r, 20000, 2000);
+    dbrew_set_capture_capacity(r, 50000, 2000, 1000000);
+    dbrew_set_function(r, (uint64_t) f1);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_staticpar(r, 0);
+    dbrew_config_set_memrange(r, "rdata", false, (uint64_t) rdata, 16);
+    dbrew_config_set_memrange(r, "wdata", true, (uint64_t) wdata, 16);
+
+    bool ok = benchRewrite(name, r, par, iters);
+    dbrew_free(r);
+
+    return ok ? 0 : 1;
+}
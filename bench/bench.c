@@ -0,0 +1,153 @@
+/**
+ * This file is part of DBrew, the dynamic binary rewriting library.
+ *
+ * (c) 2016, Josef Weidendorfer <josef.weidendorfer@gmx.de>
+ *
+ * DBrew is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License (LGPL)
+ * as published by the Free Software Foundation, either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * DBrew is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with DBrew.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "decode.h"
+#include "engine.h"
+#include "error.h"
+#include "vector.h"
+
+/*
+ * Latency of the phases of the rewriting pipeline
+ *
+ * A warm-up run detects the addresses of BBs to decode. Afterwards, each
+ * run first decodes these BBs into the emptied decode buffer, such that
+ * emulation/capturing afterwards finds all BBs already decoded. This
+ * separates decoding time from emulation time.
+ */
+
+enum { PH_Decode = 0, PH_Emulate, PH_Opt, PH_Generate, PH_Total, PH_Max };
+
+static
+int cmpU64(const void* a, const void* b)
+{
+    uint64_t va = *(const uint64_t*) a;
+    uint64_t vb = *(const uint64_t*) b;
+
+    return (va < vb) ? -1 : (va > vb) ? 1 : 0;
+}
+
+static
+uint64_t median(uint64_t* v, int n)
+{
+    qsort(v, n, sizeof(uint64_t), cmpU64);
+    return v[n / 2];
+}
+
+void benchHeader(void)
+{
+    printf("workload,iterations,decoded_bbs,decoded_instrs,"
+           "captured_bbs,captured_instrs,code_bytes,"
+           "decode_ns,emulate_ns,opt_ns,gen_ns,total_ns,instrs_per_sec\n");
+}
+
+bool benchRewrite(const char* name, Rewriter* r, uint64_t* par, int iters)
+{
+    uint64_t* addr;
+    uint64_t* t[PH_Max];
+    uint64_t med[PH_Max];
+    int bbCount, instrCount;
+    RContext c;
+    Error* e;
+
+    if (iters < 1) iters = 1;
+    if (r->decBB == 0) initRewriter(r);
+
+    // warm-up, also detects BBs to decode
+    e = emulateAndCapturePars(r, par);
+    if (!e) e = processCaptured(r);
+    if (e) {
+        logError(e, (char*) "Benchmark");
+        fprintf(stderr, "%s: rewriting failed, skipped\n", name);
+        return false;
+    }
+
+    bbCount = r->decBBCount;
+    instrCount = r->decInstrCount;
+    addr = (uint64_t*) malloc(sizeof(uint64_t) * bbCount);
+    for(int i = 0; i < bbCount; i++)
+        addr[i] = r->decBB[i].addr;
+    for(int p = 0; p < PH_Max; p++)
+        t[p] = (uint64_t*) malloc(sizeof(uint64_t) * iters);
+
+    for(int it = 0; it < iters; it++) {
+        uint64_t t0, t1, t2, t3, t4;
+
+        t0 = timeNs();
+        r->decBBCount = 0;
+        r->decInstrCount = 0;
+        for(int i = 0; i < bbCount; i++)
+            dbrew_decode(r, addr[i]);
+
+        t1 = timeNs();
+        e = emulateAndCapturePars(r, par);
+
+        t2 = timeNs();
+        c.r = r;
+        c.e = e;
+        if (!c.e && (r->vreq != VR_None))
+            runVectorization(&c);
+        if (!c.e)
+            runOptsOnCaptured(&c);
+
+        t3 = timeNs();
+        if (!c.e)
+            generateBinaryFromCaptured(&c);
+
+        t4 = timeNs();
+        if (c.e) {
+            logError(c.e, (char*) "Benchmark");
+            break;
+        }
+        t[PH_Decode][it] = t1 - t0;
+        t[PH_Emulate][it] = t2 - t1;
+        t[PH_Opt][it] = t3 - t2;
+        t[PH_Generate][it] = t4 - t3;
+        t[PH_Total][it] = t4 - t0;
+    }
+
+    if (!c.e) {
+        for(int p = 0; p < PH_Max; p++)
+            med[p] = median(t[p], iters);
+
+        printf("%s,%d,%d,%d,%d,%d,%d,"
+               "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+               ",%.0f\n",
+               name, iters, bbCount, instrCount,
+               r->capBBCount, r->capInstrCount, r->generatedCodeSize,
+               med[PH_Decode], med[PH_Emulate], med[PH_Opt],
+               med[PH_Generate], med[PH_Total],
+               (med[PH_Total] > 0) ?
+                   1e9 * r->capInstrCount / med[PH_Total] : 0.0);
+    }
+    else
+        fprintf(stderr, "%s: rewriting failed, skipped\n", name);
+
+    for(int p = 0; p < PH_Max; p++)
+        free(t[p]);
+    free(addr);
+
+    return (c.e == 0);
+}
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+
+"""
+Rewriting latency benchmark for the native DBrew backend.
+
+Runs the rewriting pipeline for a corpus of functions and reports median
+time per phase (decode, emulate/capture, optimization passes, generation),
+sizes and captured instructions per second as CSV. The corpus consists of
+
+ - kernels of the examples (bench-examples),
+ - test cases from tests/cases/integration (using the default test driver
+   interface "f1(long, long)", linked with bench-f1.c),
+ - synthetic functions of growing size and branchiness (gen-synth.py).
+
+Binaries and object files must be built before ("make" in this directory).
+"""
+
+from subprocess import Popen, PIPE
+import argparse
+import glob
+import os
+import sys
+
+# synthetic functions: (number of statements, number of dynamic branches)
+# (more than 4 branches exceed the maximum number of BBs for generation)
+SYNTH = [ (8, 0), (32, 0), (128, 0), (512, 0),
+          (32, 2), (128, 2), (128, 4), (512, 4) ]
+
+class Bench:
+
+    def __init__(self, args):
+        self.args = args
+        self.cc = os.environ.get("CC", "cc")
+        self.cflags = os.environ.get("CFLAGS", "-std=gnu99 -O2 -mavx -fno-pie")
+        self.ldflags = os.environ.get("LDFLAGS", "-no-pie")
+        self.failed = []
+        self.lines = []
+        os.makedirs(args.builddir, exist_ok=True)
+
+    def run(self, name, command):
+        proc = Popen(["/bin/sh", "-c", command], stdout=PIPE, stderr=PIPE)
+        out, err = proc.communicate()
+        if proc.returncode != 0:
+            self.failed.append(name)
+            if self.args.verbose:
+                sys.stderr.write(err.decode("utf-8"))
+        return proc.returncode, out.decode("utf-8").splitlines()
+
+    def result(self, name, command):
+        """Run benchmark binary, and collect CSV output lines"""
+        code, lines = self.run(name, command)
+        self.lines += [l for l in lines if l.strip() != ""]
+
+    def f1Case(self, name, source):
+        """Build binary for function f1 in <source>, and run it"""
+        base = os.path.join(self.args.builddir, name.replace("/", "_"))
+        if source.endswith(".s"):
+            compileObj = "as -o {0}.o {1}".format(base, source)
+        else:
+            compileObj = "{0} {1} -c -o {2}.o {3}".format(self.cc, self.cflags, base, source)
+        link = "{0} {1} -o {2} {2}.o bench-f1.o bench.o ../libdbrew.a -pthread".format(
+               self.cc, self.ldflags, base)
+        code, _ = self.run(name, compileObj + " && " + link)
+        if code != 0: return
+        self.result(name, "{0} {1} {2} 1 --noheader".format(base, name, self.args.iters))
+
+    def all(self):
+        self.result("examples", "./bench-examples {0} --noheader".format(self.args.iters))
+
+        for case in sorted(glob.glob("../tests/cases/integration/*.s")):
+            self.f1Case("tests/" + os.path.basename(case), case)
+
+        for size, branches in SYNTH:
+            name = "synth-{0}-{1}".format(size, branches)
+            source = os.path.join(self.args.builddir, name + ".c")
+            code, _ = self.run(name, "./gen-synth.py {0} {1} -o {2}".format(size, branches, source))
+            if code == 0:
+                self.f1Case("synth/" + name, source)
+
+    def write(self, f):
+        f.write("workload,iterations,decoded_bbs,decoded_instrs,"
+                "captured_bbs,captured_instrs,code_bytes,"
+                "decode_ns,emulate_ns,opt_ns,gen_ns,total_ns,instrs_per_sec\n")
+        for l in self.lines:
+            f.write(l + "\n")
+
+
+if __name__ == "__main__":
+    argparser = argparse.ArgumentParser(description="Run DBrew rewriting latency benchmarks")
+    argparser.add_argument("--iters", type=int, default=100, help="Runs per workload (median is reported)")
+    argparser.add_argument("--output", "-o", help="CSV output file (default: stdout)")
+    argparser.add_argument("--builddir", default="build", help="Directory for generated files")
+    argparser.add_argument("--verbose", "-v", action="store_true", help="Show errors of failing workloads")
+    args = argparser.parse_args()
+
+    b = Bench(args)
+    b.all()
+
+    if args.output:
+        with open(args.output, "w") as f:
+            b.write(f)
+    else:
+        b.write(sys.stdout)
+
+    if len(b.failed) > 0:
+        sys.stderr.write("Failed workloads: " + " ".join(b.failed) + "\n")
+        sys.exit(1)
@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+
+"""
+Generate a synthetic function "long f1(long n, long x)" for the rewriting
+latency benchmark.
+
+The function body has <size> arithmetic statements on dynamic values,
+split into <branches> parts each guarded by a branch on the dynamic
+parameter x. Parameter n (static when rewriting) is the trip count of an
+outer loop which gets unrolled by the rewriter.
+"""
+
+import argparse
+import sys
+
+def generate(size, branches, out):
+    out.write("// generated by gen-synth.py %d %d\n\n" % (size, branches))
+    out.write("long f1(long n, long x)\n{\n")
+    out.write("    long s = x, t = 1;\n\n")
+    out.write("    for(long i = 0; i < n; i++) {\n")
+
+    parts = branches if branches > 0 else 1
+    for p in range(parts):
+        indent = "        "
+        if branches > 0:
+            out.write("%sif (x & %d) {\n" % (indent, 1 << (p % 62)))
+            indent += "    "
+        for k in range(p * size // parts, (p + 1) * size // parts):
+            if k % 3 == 0:
+                out.write("%ss = s * %d + t;\n" % (indent, 2 * k + 3))
+            elif k % 3 == 1:
+                out.write("%st = t ^ (s >> %d);\n" % (indent, k % 13 + 2))
+            else:
+                out.write("%ss = s - (t << %d) + i;\n" % (indent, k % 7 + 2))
+        if branches > 0:
+            out.write("        }\n")
+            out.write("        else\n")
+            out.write("            t += %d;\n" % (p + 1))
+
+    out.write("    }\n")
+    out.write("    return s + t;\n}\n")
+
+
+if __name__ == "__main__":
+    argparser = argparse.ArgumentParser(description="Generate synthetic benchmark function")
+    argparser.add_argument("size", type=int, help="Number of statements")
+    argparser.add_argument("branches", type=int, help="Number of dynamic branches")
+    argparser.add_argument("-o", "--output", help="Output file (default: stdout)")
+    args = argparser.parse_args()
+
+    if args.output:
+        with open(args.output, "w") as f:
+            generate(args.size, args.branches, f)
+    else:
+        generate(args.size, args.branches, sys.stdout)
@@ -96,6 +96,7 @@
 #define DBREW_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -128,10 +129,140 @@ void dbrew_set_decoding_capacity(Rewriter* r,
 void dbrew_set_capture_capacity(Rewriter* r,
                                 int instrCapacity, int bbCapacity,
                                 int codeCapacity);
+// place generated code within +/- 2GB of the rewritten function, allowing
+// RIP-relative data access (default: off), and back it with 2MB huge pages
+// (default: off). Previously generated code gets invalid
+void dbrew_set_code_placement(Rewriter* r, bool nearCode, bool hugePages);
+
+// allocator hooks replacing malloc/free and mmap of executable memory.
+// Unset callbacks use the defaults. <allocCode> returns executable memory
+// of <size> bytes (multiple of 4KB), preferably near <hint> if not 0, or 0
+// to fall back to mmap. Hooks must be thread-safe for batch rewriting
+typedef struct _DBrewAllocator {
+    void* (*alloc)(size_t size, void* user);
+    void (*free)(void* p, void* user);
+    void* (*allocCode)(size_t size, uint64_t hint, void* user);
+    void (*freeCode)(void* p, size_t size, void* user);
+    void* user;
+} DBrewAllocator;
+
+// process-wide hooks (0: defaults), for rewriter and configuration
+// structs, the decode cache and dispatchers. Copied into new rewriters.
+// Set before creating any rewriter. Returns false without change if only
+// one of <alloc> and <free> is set
+bool dbrew_set_default_allocator(DBrewAllocator* a);
+// hooks for buffers, emulator states and generated code of <r> (0:
+// defaults). Buffers allocated before are released, but not installed code.
+// Returns false without change if only one of <alloc> and <free> is set
+bool dbrew_set_allocator(Rewriter* r, DBrewAllocator* a);
+
+// use a process-wide decode cache shared among rewriters (default: off)
+void dbrew_set_shared_decode_cache(Rewriter* r, bool b);
+// invalidate decoded code in an address range, e.g. when code gets
+// unmapped or patched. This also affects decoded code of each rewriter
+void dbrew_decode_cache_invalidate(uint64_t start, uint64_t size);
+// drop all entries of shared decode cache. Memory is released once no
+// lookup of a concurrent rewriting runs
+void dbrew_decode_cache_flush(void);
+
+// statistics of a rewriter, accumulated since creation or last reset
+typedef struct _DBrewStats {
+    uint64_t decodedInstrs;   // instructions decoded
+    uint64_t emulatedInstrs;  // instructions emulated
+    uint64_t capturedInstrs;  // instructions captured
+    uint64_t createdCBBs;     // captured basic blocks created
+    uint64_t savedStates;     // different emulator states saved
+    uint64_t generatedBytes;  // bytes of generated code
+    uint64_t decodeCacheHits; // BBs found already decoded (own/shared cache)
+    uint64_t decodeCacheMisses;
+    uint64_t rewrites;        // rewrite requests
+    uint64_t fallbacks;       // rewrites returning original function
+    // cumulative time spent in rewriting phases (nanoseconds)
+    uint64_t decodeNs, emulateNs, optNs, generateNs, totalNs;
+} DBrewStats;
+
+// get statistics of rewriter <r>, including its helpers for batch rewriting
+void dbrew_get_stats(Rewriter* r, DBrewStats* s);
+void dbrew_reset_stats(Rewriter* r);
+
+// limits of a single rewrite
+typedef enum _DBrewBudgetLimit {
+    BL_None = 0,
+    BL_Emulated,  // number of emulated instructions
+    BL_Captured,  // number of captured instructions
+    BL_CodeBytes, // size of generated code
+    BL_Time       // wall-clock time
+} DBrewBudgetLimit;
+
+// limit each rewrite to a maximum number of emulated/captured instructions,
+// generated code bytes and wall-clock time in microseconds (0: no limit).
+// If a limit is hit, the original function is returned
+void dbrew_set_budget(Rewriter* r, uint64_t maxEmulated, uint64_t maxCaptured,
+                      int maxCodeBytes, uint64_t maxTimeUs);
+// on exhausted budget, retry with calculated values assumed to be unknown
+// (prohibits loop unrolling), first at the call depth where the budget was
+// hit, then at all depths, instead of returning the original. Retries
+// share the time budget of the first attempt
+void dbrew_set_budget_degrade(Rewriter* r, bool b);
+// limit hit in last rewrite of <r>, BL_None if budget was sufficient
+DBrewBudgetLimit dbrew_budget_exceeded(Rewriter* r);
+
+// replace multiplication/division by constants in captured code with
+// cheaper instruction sequences (default: on)
+void dbrew_set_strength_reduction(Rewriter* r, bool b);
+// constant propagation and peephole patterns on captured code (default: on)
+void dbrew_set_peephole(Rewriter* r, bool b);
+// remove redundant loads and recalculations of values within captured
+// blocks via value numbering (default: off)
+void dbrew_set_value_numbering(Rewriter* r, bool b);
+// replace conditional branches around at most <maxInstr> register moves
+// on each side by cmov/setcc (default: off)
+void dbrew_set_if_conversion(Rewriter* r, bool b, int maxInstr);
+// re-encode legacy SSE instructions in captured code with VEX prefix,
+// using 3-operand forms to drop register copies. Avoids SSE/AVX transition
+// penalties (default: off; ignored without AVX in the CPU features)
+void dbrew_set_vex_transcoding(Rewriter* r, bool b);
+
+// CPU features which generated code may use (bit mask)
+typedef enum _DBrewCpuFeature {
+    CF_AVX    = 1 << 0,
+    CF_AVX2   = 1 << 1,
+    CF_FMA    = 1 << 2,
+    CF_BMI1   = 1 << 3,
+    CF_BMI2   = 1 << 4,
+    CF_LZCNT  = 1 << 5,
+    CF_POPCNT = 1 << 6,
+    CF_AVX512 = 1 << 7  // AVX-512 F and DQ
+} DBrewCpuFeature;
+
+// features of the CPU we are running on
+uint32_t dbrew_cpu_features(void);
+// restrict code generation of <r> to CPU features <f> (default: all
+// features of the running CPU). E.g. BMI1/BMI2 enable andn/shlx/shrx/sarx
+void dbrew_set_cpu_features(Rewriter* r, uint32_t f);
+// fuse scalar multiply with following add/sub into FMA instructions.
+// Skips intermediate rounding, thus results may differ in the last bit
+// (default: off; ignored without FMA in the CPU features)
+void dbrew_set_fp_contract(Rewriter* r, bool b);
+// generate one version per CPU feature level (baseline, AVX2, AVX-512),
+// restricted to the configured features, behind a stub selecting the best
+// version for the CPU executing it. Levels failing to rewrite are skipped,
+// only failure of the baseline version fails the rewrite (default: off)
+void dbrew_set_multiversion(Rewriter* r, bool b);
 
 // set function to rewrite
 // this clears any previously decoded/captured instructions
 void dbrew_set_function(Rewriter* rewriter, uint64_t f);
+// cheap reset for rewriting another function <f>: keeps all allocated
+// buffers, the emulator state and code storage (previously generated code
+// gets invalid). With near code placement, code storage out of reach of
+// <f> is reallocated. The configuration is kept if <keepConfig> is set,
+// otherwise cleared as with dbrew_set_function
+void dbrew_reuse(Rewriter* r, uint64_t f, bool keepConfig);
+
+// announce generated code to the "perf" profiler: append entries to
+// /tmp/perf-<pid>.map and/or write records to jitdump file /tmp/jit-<pid>.dump
+void dbrew_set_perf_output(Rewriter* r, bool perfMap, bool jitdump);
 
 // set rewriter activities to be verbose or quiet
 void dbrew_verbose(Rewriter* rewriter,
@@ -170,15 +301,32 @@ void dbrew_config_parcount(Rewriter* r, int parCount);
 void dbrew_config_force_unknown(Rewriter* r, int depth);
 // assume all branches to be fixed according to rewriter input parameters
 void dbrew_config_branches_known(Rewriter* r, bool);
+// when code is reached with more than <n> different emulator states,
+// static values differing between these states become dynamic (0: off).
+// This allows partial loop unrolling up to <n> iterations
+void dbrew_config_widening(Rewriter* r, int n);
+// unroll loops <factor> times; loops with static trip count are widened
+// at their header to not get fully unrolled (0/1: off)
+void dbrew_config_unroll(Rewriter* r, int factor);
+// unroll factor for the loop with header at address <header>
+void dbrew_config_loop_unroll(Rewriter* r, uint64_t header, int factor);
 // provide a name for a function (for debug)
 void dbrew_config_function_setname(Rewriter* r, uint64_t f, const char* name);
 // provide a code length in bytes for a function (for debugging)
 void dbrew_config_function_setsize(Rewriter* r, uint64_t f, int len);
+// width in bytes of integer parameter <par> (1, 2, 4 or 8; default 8).
+// Dispatchers compare only these bytes of key parameters, as upper bits
+// of narrower parameters are undefined in the calling convention
+void dbrew_config_par_width(Rewriter* r, int par, int bytes);
 // provide a name for a parameter of the function to rewrite (for debug)
 void dbrew_config_par_setname(Rewriter* c, int par, char* name);
 // register a valid memory range with permission and name (for debug)
 void dbrew_config_set_memrange(Rewriter* r, char* name, bool isWritable,
                                uint64_t start, int size);
+// declare a jump table at <table> with <entries> code addresses, for
+// indirect jumps with dynamic index (if size cannot be derived from a
+// preceding bounds check)
+void dbrew_config_jumptable(Rewriter* r, uint64_t table, int entries);
 
 // convenience functions, using default rewriter
 void dbrew_def_verbose(bool decode, bool emuState, bool emuSteps);
@@ -192,6 +340,46 @@ uint64_t dbrew_rewrite(Rewriter* r, ...);
 // rewrite <f> using default config, return pointer to rewritten code
 uint64_t dbrew_rewrite_func(uint64_t f, ...);
 
+// rewrite configured function for <count> parameter tuples in <pars>
+// (each with as many values as configured via dbrew_config_parcount).
+// Pointers to the specializations are stored in <funcs>, packed into the
+// code buffer of the rewriter (the original function on failure). Work is
+// spread over <threads> threads. Returns number of successful rewrites.
+// Requires linking with -pthread.
+int dbrew_rewrite_batch(Rewriter* r, int count, uint64_t* pars,
+                        uint64_t* funcs, int threads);
+
+// redirect all callers of the configured function to the code generated
+// last by atomically patching a jump into the function entry. Only valid
+// if the specialization matches all calls (e.g. no static parameters).
+// Undone by freeing the rewriter, and by rewriting again with it: callers
+// get the original function during and after the new rewrite, until
+// dbrew_install is called again for the new code.
+// Returns false if the entry cannot be patched safely.
+bool dbrew_install(Rewriter* r);
+// restore original function entry patched by dbrew_install
+void dbrew_uninstall(Rewriter* r);
+
+// Dispatcher over up to <maxVariants> specializations of the function
+// configured in <r>, keyed on the parameters configured as static.
+// Calling the stub jumps to the specialization matching the key values,
+// otherwise to the original function (or, with auto-specialization, a new
+// specialization is generated first). <r> is used for rewriting and must
+// not be used otherwise meanwhile.
+typedef struct _Dispatcher Dispatcher;
+Dispatcher* dbrew_dispatcher_new(Rewriter* r, int maxVariants);
+void dbrew_dispatcher_free(Dispatcher* d);
+// specialize for given parameter values, return specialization
+// (original function on failure or if maximum is reached)
+uint64_t dbrew_dispatcher_add(Dispatcher* d, ...);
+// specialize on calls of the stub with new key values. Returns false
+// (keeping the previous setting) if dispatch code cannot be generated
+bool dbrew_dispatcher_set_auto(Dispatcher* d, bool b);
+// entry of dispatch stub, to be called instead of the original function
+uint64_t dbrew_dispatcher_stub(Dispatcher* d);
+// number of specializations
+int dbrew_dispatcher_count(Dispatcher* d);
+
 
 
 // Vector API:
@@ -200,10 +388,13 @@ uint64_t dbrew_rewrite_func(uint64_t f, ...);
 typedef double (*dbrew_func_R8V8_t)(double);
 typedef double (*dbrew_func_R8V8V8_t)(double, double);
 typedef double (*dbrew_func_R8P8_t)(double*);
+typedef float (*dbrew_func_R4V4_t)(float);
+typedef float (*dbrew_func_R4V4V4_t)(float, float);
+typedef float (*dbrew_func_R4P4_t)(float*);
 
 // Configuration for expansion requests.
 // <s> is size in bytes of vector registers to use; default is 16.
-// May be set to 32 for AVX.
+// May be set to 32 for AVX, or 64 for AVX-512 (if supported by the CPU).
 // Returns actual value used; this can differ from requested.
 int dbrew_set_vectorsize(Rewriter *r, int s);
 
@@ -215,6 +406,25 @@ void dbrew_apply4_R8V8V8(dbrew_func_R8V8V8_t f,
 // 4x call f (signature double* => double), map to input array pointers/output vector
 void dbrew_apply4_R8P8(dbrew_func_R8P8_t f, double* ov, double* iv);
 
+// Loops over <n> elements, vectorized in rewritten code as the 4x variants.
+// Remaining elements not filling a vector are handled by scalar <f>.
+// Direct calls rewrite and cache a vectorized loop per <f> on first use,
+// and may split the range into chunks processed by multiple threads.
+// Within rewritten code, the loop runs in the calling thread.
+void dbrew_apply_R8V8(dbrew_func_R8V8_t f, double* ov, double* iv, int n);
+void dbrew_apply_R8V8V8(dbrew_func_R8V8V8_t f,
+                        double* ov, double* i1v, double* i2v, int n);
+void dbrew_apply_R8P8(dbrew_func_R8P8_t f, double* ov, double* iv, int n);
+// same for single precision kernels
+void dbrew_apply_R4V4(dbrew_func_R4V4_t f, float* ov, float* iv, int n);
+void dbrew_apply_R4V4V4(dbrew_func_R4V4V4_t f,
+                        float* ov, float* i1v, float* i2v, int n);
+void dbrew_apply_R4P4(dbrew_func_R4P4_t f, float* ov, float* iv, int n);
+
+// Use up to <threads> threads for direct calls of dbrew_apply_*, each
+// processing chunks of <chunk> elements (default: 1 thread, 16384)
+void dbrew_set_apply_threads(int threads, int chunk);
+
 #ifdef __cplusplus
 }
 #endif
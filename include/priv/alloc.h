@@ -0,0 +1,49 @@
+/**
+ * This file is part of DBrew, the dynamic binary rewriting library.
+ *
+ * (c) 2016, Josef Weidendorfer <josef.weidendorfer@gmx.de>
+ *
+ * DBrew is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License (LGPL)
+ * as published by the Free Software Foundation, either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * DBrew is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with DBrew.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include "common.h"
+
+#include <stddef.h>
+
+// allocation with the hooks of rewriter <r>, or process-wide hooks if 0
+void* memAlloc(Rewriter* r, size_t size);
+// resize <p> of <oldSize> bytes to <size> bytes (contents kept)
+void* memRealloc(Rewriter* r, void* p, size_t oldSize, size_t size);
+void memFree(Rewriter* r, void* p);
+
+// allocate from arena <a>, getting new chunks with hooks of <r>
+void* arenaAlloc(Rewriter* r, Arena* a, size_t size);
+// release all allocations from <a>, keeping chunks for reuse
+void arenaReset(Arena* a);
+void arenaFree(Rewriter* r, Arena* a);
+
+// process-wide hooks, copied into new rewriters
+DBrewAllocator* defaultAllocator(void);
+// are the hooks of <a> usable? alloc and free must be set together
+bool allocatorValid(DBrewAllocator* a);
+
+// code storage from the executable memory provider of <r>, near <hint>
+// if not 0. Returns 0 if no provider is set or it has no memory
+CodeStorage* providedCodeStorage(Rewriter* r, int size, uint64_t hint);
+
+#endif // ALLOC_H
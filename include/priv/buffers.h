@@ -20,6 +20,8 @@
 #ifndef BUFFERS_H
 #define BUFFERS_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // XXX: Move Struct in C file after removing all direct dependencies!
@@ -28,15 +30,33 @@ struct _CodeStorage {
     int fullsize; /* rounded to multiple of a page size */
     int used;
     uint8_t* buf;
+    // memory from a provider, released with <freeCode> if set
+    bool provided;
+    void (*freeCode)(void* p, size_t size, void* user);
+    void* user;
 };
 
 typedef struct _CodeStorage CodeStorage;
 
 CodeStorage* initCodeStorage(int size);
+// storage addressable with absolute 32-bit addresses (0 if not available)
+CodeStorage* initTableStorage(int size);
+// code storage within reach of rel32 jumps from <addr> (0 if not available)
+CodeStorage* initNearCodeStorage(uint64_t addr, int size);
+// code storage backed by 2MB huge pages, near <addr> if not 0
+// (0 if not available)
+CodeStorage* initHugeCodeStorage(uint64_t addr, int size);
+// is all of <cs> within reach of rel32 displacements from <addr>?
+bool isCodeStorageNear(CodeStorage* cs, uint64_t addr);
+// code storage using memory <buf> of <fullsize> bytes from a provider,
+// released with <freeCode>
+CodeStorage* initProvidedCodeStorage(uint8_t* buf, int size, int fullsize,
+                                     void (*freeCode)(void*, size_t, void*),
+                                     void* user);
 void freeCodeStorage(CodeStorage* cs);
 
 /* this checks whether enough storage is available, but does
- * not change <used>.
+ * not change <used>. Returns 0 if storage is too small.
  */
 uint8_t* reserveCodeStorage(CodeStorage* cs, int size);
 uint8_t* useCodeStorage(CodeStorage* cs, int size);
@@ -22,6 +22,7 @@
 
 #include "dbrew.h"
 #include "buffers.h"
+#include "error.h"
 #include "expr.h"
 #include "instr.h"
 
@@ -32,6 +33,7 @@
 typedef struct _MemRangeConfig MemRangeConfig;
 typedef struct _FunctionConfig FunctionConfig;
 typedef struct _CaptureConfig CaptureConfig;
+typedef struct _LoopConfig LoopConfig;
 
 // a decoded basic block
 struct _DBB {
@@ -60,8 +62,16 @@ struct _CBB {
     CBB *nextBranch, *nextFallThrough;
     // type of instruction ending this BB
     InstrType endType;
+    // for partial unrolling: copy index of loop body this BB belongs to,
+    // and index of detected loop (-1 if not in an unrolled copy)
+    int unrollIdx, loop;
     // a hint for conditional branches whether branching is more likely
     bool preferBranch;
+    // for indirect jump via jump table (endType IT_JMPI): table used by
+    // generated code, with entries pointing to successor CBBs until
+    // code for these is generated
+    int jtCount;
+    uint64_t* jtTable;
 
     // for DBrew's own code generation backend
     int size;
@@ -110,6 +120,7 @@ typedef enum _MemRangeType {
     MR_ConstantData,   // accessable, initialized with constant data
     MR_MutableData,    // accessable, writable
     MR_Function,       // accessable, compiled code
+    MR_JumpTable,      // constant addresses of indirect jump targets
 } MemRangeType;
 
 struct _MemRangeConfig
@@ -136,12 +147,22 @@ struct _FunctionConfig
     // TODO: extended config for functions
 };
 
+// per-loop configuration, loop identified by address of its header
+struct _LoopConfig
+{
+    uint64_t header;
+    int unroll; // unroll factor
+    LoopConfig* next;
+};
+
 struct _CaptureConfig
 {
     // specialise for some parameters to be constant?
     MetaState par_state[CC_MAXPARAM];
     // for debug: allow parameters to be named
     char* par_name[CC_MAXPARAM];
+    // width of integer parameters in bytes (default 8)
+    int par_width[CC_MAXPARAM];
 
      // does function to rewrite return floating point?
     bool hasReturnFP;
@@ -151,9 +172,15 @@ struct _CaptureConfig
     bool force_unknown[CC_MAXCALLDEPTH];
     // all branches forced known
     bool branches_known;
+    // generalize static values at code reached with more states (0: off)
+    int widen_states;
+    // default unroll factor for loops with dynamic trip count (0/1: off)
+    int unroll_factor;
 
     // linked list of memory range and function configurations
     MemRangeConfig* range_configs;
+    // linked list of loop configurations
+    LoopConfig* loop_configs;
 
 };
 
@@ -167,11 +194,30 @@ typedef enum _VectorizeReq {
     VR_DoubleX2_RP,  // scalar double => 2x double vector, ret + par1 pointer
     VR_DoubleX4_RV,  // scalar double => 4x double vector, ret + par1
     VR_DoubleX4_RVV, // scalar double => 4x double vector, ret + par1 + par2
-    VR_DoubleX4_RP   // scalar double => 4x double vector, ret + par1 pointer
+    VR_DoubleX4_RP,  // scalar double => 4x double vector, ret + par1 pointer
+    VR_DoubleX8_RV,  // scalar double => 8x double vector, ret + par1
+    VR_DoubleX8_RVV, // scalar double => 8x double vector, ret + par1 + par2
+    VR_DoubleX8_RP,  // scalar double => 8x double vector, ret + par1 pointer
+    VR_FloatX4_RV,   // scalar float => 4x float vector, ret + par1
+    VR_FloatX4_RVV,  // scalar float => 4x float vector, ret + par1 + par2
+    VR_FloatX4_RP,   // scalar float => 4x float vector, ret + par1 pointer
+    VR_FloatX8_RV,   // scalar float => 8x float vector, ret + par1
+    VR_FloatX8_RVV,  // scalar float => 8x float vector, ret + par1 + par2
+    VR_FloatX8_RP,   // scalar float => 8x float vector, ret + par1 pointer
+    VR_FloatX16_RV,  // scalar float => 16x float vector, ret + par1
+    VR_FloatX16_RVV, // scalar float => 16x float vector, ret + par1 + par2
+    VR_FloatX16_RP   // scalar float => 16x float vector, ret + par1 pointer
 } VectorizeReq;
 
 
 FunctionConfig* config_find_function(Rewriter* r, uint64_t f);
+bool config_is_constant(Rewriter* r, uint64_t addr);
+int config_loop_unroll(Rewriter* r, uint64_t header);
+int config_jumptable_entries(Rewriter* r, uint64_t table);
+void config_copy(Rewriter* dst, Rewriter* src);
+void config_copy_ranges(Rewriter* dst, Rewriter* src);
+void config_reinit(Rewriter* r);
+void config_free(Rewriter* r);
 
 
 
@@ -213,6 +259,13 @@ typedef struct _EmuValue {
 struct _EmuState;
 typedef struct _EmuState EmuState;
 
+// memory for allocations released all at once: list of chunks
+typedef struct _ArenaChunk ArenaChunk;
+typedef struct _Arena {
+    ArenaChunk* first;
+    ArenaChunk* current;
+} Arena;
+
 struct _EmuState {
 
     // when saving an EmuState, remember root
@@ -235,8 +288,8 @@ struct _EmuState {
     int stackSize;
     uint8_t* stack; // real memory backing
     uint64_t stackStart, stackAccessed, stackTop; // virtual stack boundaries
-    // capture state of stack
-    MetaState *stackState;
+    // capture state of stack: one CaptureState per byte
+    uint8_t *stackState;
 
     // own return stack
     uint64_t ret_stack[MAX_CALLDEPTH];
@@ -254,6 +307,9 @@ struct _Rewriter {
     // decoded basic blocks
     int decBBCount, decBBCapacity;
     DBB* decBB;
+    // use process-wide decode cache, generation of cache for decoded BBs
+    bool sharedDecodeCache;
+    uint64_t decodeGen;
 
     // captured instructions
     int capInstrCount, capInstrCapacity;
@@ -273,8 +329,24 @@ struct _Rewriter {
     // buffer for generated binary code
     int capCodeCapacity;
     CodeStorage* cs;
+    // full code storages still holding code from the current batch
+    int retiredCSCount;
+    CodeStorage** retiredCS;
+    // jump tables used by generated code
+    CodeStorage* ts;
     uint64_t generatedCodeAddr;
     int generatedCodeSize;
+    // hooks for allocations of this rewriter
+    DBrewAllocator allocator;
+
+    // place code near function to rewrite / use huge pages
+    bool nearCode, hugeCode;
+    // addresses of RIP-relative displacements in generated code,
+    // to adjust when code is moved
+    int ripFixCount, ripFixCapacity;
+    uint64_t* ripFix;
+    // keep previously generated code when rewriting (batch rewriting)
+    bool appendCode;
 
     // vectorization config
     VectorizeReq vreq;
@@ -283,24 +355,53 @@ struct _Rewriter {
     // structs for emulator & capture config
     CaptureConfig* cc;
     EmuState* es;
-    // saved emulator states
+    // saved emulator states, allocated from an arena
 #define SAVEDSTATE_MAX 20
     int savedStateCount;
     EmuState* savedState[SAVEDSTATE_MAX];
+    Arena stateArena;
+    // scratch memory of passes, released when capturing is reset
+    Arena tempArena;
 
     // stack of unfinished BBs to capture
-#define CAPTURESTACK_LEN 20
+#define CAPTURESTACK_LEN 64
     int capStackTop;
     CBB* capStack[CAPTURESTACK_LEN];
 
-    // capture order
-#define GENORDER_MAX 20
+    // loops detected from back-edges while capturing: code from header
+    // to end of the jump back to header
+#define LOOP_MAX 20
+    int loopCount;
+    struct {
+        uint64_t header, end;
+    } loop[LOOP_MAX];
+
+    // capture order (with space for terminating 0)
+#define GENORDER_MAX 50
     int genOrderCount;
-    CBB* genOrder[GENORDER_MAX];
+    CBB* genOrder[GENORDER_MAX + 1];
+
+    // budget for each rewrite (0: no limit), with the limit hit last
+    uint64_t budgetEmulated, budgetCaptured, budgetTimeNs;
+    int budgetCodeBytes;
+    bool budgetDegrade;
+    DBrewBudgetLimit budgetExceeded;
+    int budgetDepth; // call depth emulated when hit, -1 if unknown
+    // progress of current rewrite for budget checks
+    uint64_t emulatedCount, deadline;
 
     // for optimization passes
     bool addInliningHints;
     bool doCopyPass; // test pass
+    bool doStrengthReduction, doPeephole, doValueNumbering;
+    bool doIfConversion;
+    int ifConvMax; // max. instructions on each side of a converted branch
+    bool doVexTranscoding;
+    bool doFpContract;
+
+    // CPU features allowed in generated code, one version per feature level
+    uint32_t cpuFeatures;
+    bool multiVersion;
 
     // debug output
     bool showDecoding, showEmuState, showEmuSteps, showOptSteps;
@@ -308,8 +409,29 @@ struct _Rewriter {
     // printer config
     bool printBytes;
 
+    // announce generated code to perf profiler
+    bool perfMap, perfJitdump;
+
     // list of related rewriters
     Rewriter* next;
+
+    // helper rewriters for parallel batch rewriting, owning their code
+    int workerCount;
+    Rewriter** worker;
+
+    // patch of original function entry by dbrew_install (0: none), with
+    // aligned 8-byte word before/after patching, and trampoline if needed
+    uint64_t installAddr, installOrig, installPatch;
+    CodeStorage* installCS;
+
+    // statistics
+    DBrewStats stats;
+
+    // errors reported by this rewriter, with space for descriptions.
+    // Per rewriter, as batch workers rewrite concurrently
+    Error error;
+    GenerateError generateError;
+    char errorDesc[100];
 };
 
 
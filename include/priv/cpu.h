@@ -0,0 +1,40 @@
+/**
+ * This file is part of DBrew, the dynamic binary rewriting library.
+ *
+ * (c) 2016, Josef Weidendorfer <josef.weidendorfer@gmx.de>
+ *
+ * DBrew is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License (LGPL)
+ * as published by the Free Software Foundation, either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * DBrew is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with DBrew.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CPU_H
+#define CPU_H
+
+#include "common.h"
+#include "error.h"
+
+// feature levels for multi-versioning (see DBrewCpuFeature)
+#define CPU_LEVEL_AVX2   (CF_AVX | CF_AVX2 | CF_FMA | CF_BMI1 | CF_BMI2 | \
+                          CF_LZCNT | CF_POPCNT)
+#define CPU_LEVEL_AVX512 (CPU_LEVEL_AVX2 | CF_AVX512)
+
+// features of the running CPU, detected on first call
+uint32_t hostCpuFeatures(void);
+
+// rewrite with parameters <par> once for each feature level allowed for
+// <r>, and generate a stub selecting the version at runtime. The stub is
+// returned as generated code
+Error* rewriteVersions(Rewriter* r, uint64_t* par);
+
+#endif // CPU_H
@@ -37,4 +37,9 @@ Instr* addTernaryOp(Rewriter* r, DContext* c,
                     InstrType it, ValType vt,
                     Operand* o1, Operand* o2, Operand* o3);
 
+// process-wide decode cache shared among rewriters
+uint64_t decodeCacheGeneration(void);
+bool decodeCacheLookup(uint64_t f, DBB* dbb, Instr* buf, int capacity);
+void decodeCacheInsert(DBB* dbb);
+
 #endif // DECODE_H
@@ -42,16 +42,17 @@
  * saving emulator state. After emulating one path, we roll back and
  * go the other path. As this may happen recursively, we do a kind of
  * back-tracking, with emulator states stored as stacks.
- * To allow for fast saving/restoring of emulator states, each part of
- * the emulation state (registers, bytes on stack) is given by a
- * EmuStateEntry (linked) list with the current value/state in front.
- * Saving copies the complete EmuState, inheriting the individual states.
+ * To allow for fast saving/restoring of emulator states, the capture state
+ * of stack bytes is kept as one byte each (analysis information is kept
+ * for registers only), and saved states only hold the accessed part of
+ * the stack. They are allocated from an arena of the rewriter, released
+ * in one go when capturing is reset.
  */
 
 // exported functions
 
 // get a new emulator state with stack size <size>
-EmuState* allocEmuState(int size);
+EmuState* allocEmuState(Rewriter* r, int size);
 void freeEmuState(Rewriter* r);
 void resetEmuState(EmuState* es);
 // save current emulator state for later rollback, return ID
@@ -66,6 +67,8 @@ CBB* getCaptureBB(RContext* c, uint64_t f, int esID);
 int pushCaptureBB(RContext *c, CBB* bb);
 CBB* popCaptureBB(Rewriter* r);
 Instr* newCapInstr(RContext *c);
+// data for generated code, addressable with absolute 32-bit addresses
+uint8_t* newTableData(RContext* c, int size, int align);
 void capture(RContext* c, Instr* instr);
 void captureRet(RContext* c, Instr* orig, EmuState* es);
 
@@ -80,4 +83,7 @@ void processInstr(RContext*, Instr *instr);
 // process call or jump to known location
 uint64_t processKnownTargets(RContext* c, uint64_t f);
 
+// static jump backwards to loop header: end CBB for partial unrolling
+bool captureBackEdge(RContext* c, uint64_t t, uint64_t end);
+
 #endif // EMULATE_H
@@ -38,10 +38,34 @@ struct _RContext
 Rewriter* allocRewriter(void);
 void initRewriter(Rewriter* r);
 void freeRewriter(Rewriter* r);
+// release buffers allocated with the hooks of <r> (allocated again on demand)
+void releaseBuffers(Rewriter* r);
+// code storage for generated code, placed as configured in <r>
+CodeStorage* allocCodeStorage(Rewriter* r, int size);
+// continue generating into new code storage of <size> bytes, keeping the
+// current one with its code alive. Returns false if no storage available
+bool retireCodeStorage(Rewriter* r, int size);
+// free code storages retired before, invalidating their code
+void freeRetiredCodeStorage(Rewriter* r);
 
 // Rewrite engine
 Error* vEmulateAndCapture(Rewriter* r, va_list args);
+// same as vEmulateAndCapture, with parameters given as array
+Error* emulateAndCapturePars(Rewriter* r, uint64_t* par);
 void runOptsOnCaptured(RContext *c);
 void generateBinaryFromCaptured(RContext* c);
+// all steps after capturing: vectorization, passes, code generation
+Error* processCaptured(Rewriter* r);
+// read parameters for rewriting from <args> into <par>
+Error* vGetPars(Rewriter* r, va_list args, uint64_t* par);
+// complete rewrite with parameters <par>, obeying configured budget
+Error* rewritePars(Rewriter* r, uint64_t* par);
+// set error for exceeding budget limit <l>
+void setBudgetError(RContext* c, DBrewBudgetLimit l);
+
+// monotonic time in nanoseconds, for statistics
+uint64_t timeNs(void);
+// account a rewrite started at <t0> in statistics, failed if <e> is set
+void statsRewriteDone(Rewriter* r, uint64_t t0, Error* e);
 
 #endif // ENGINE_H
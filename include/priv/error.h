@@ -45,6 +45,7 @@ typedef enum _ErrorType {
     ET_NoError,
     ET_Unknown,
     ET_InvalidRequest, // Rewriter
+    ET_BudgetExceeded, // Rewriter
     ET_BufferOverflow, // Decoder, Generator, Rewriter
     ET_UnsupportedInstr, ET_UnsupportedOperands, // Generator, Emulator
     // Decoder
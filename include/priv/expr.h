@@ -15,6 +15,8 @@
 
 #include <stdint.h>
 
+#include "dbrew.h"
+
 typedef enum _NodeType {
     NT_Invalid, NT_Const, NT_Sum, NT_Scaled, NT_Par, NT_Ref
 } NodeType;
@@ -40,8 +42,9 @@ struct _ExprPool {
     ExprNode n[1];
 };
 
-ExprPool* expr_allocPool(int s);
-void expr_freePool(ExprPool* p);
+// pool allocated with the hooks of rewriter <r>
+ExprPool* expr_allocPool(Rewriter* r, int s);
+void expr_freePool(Rewriter* r, ExprPool* p);
 ExprNode* expr_newNode(ExprPool* p, NodeType t);
 int expr_nodeIndex(ExprPool* p, ExprNode* n);
 
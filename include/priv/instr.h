@@ -133,6 +133,8 @@ typedef enum _InstrType {
     IT_XOR, IT_AND, IT_OR,
     IT_CMP, IT_TEST, IT_BSF,
     IT_SHL, IT_SHR, IT_SAR,
+    // BMI1/BMI2
+    IT_ANDN, IT_SHLX, IT_SHRX, IT_SARX,
 
     IT_CALL, IT_RET, IT_JMP, IT_JMPI,
 
@@ -163,6 +165,7 @@ typedef enum _InstrType {
     IT_MINSS, IT_MINSD, IT_MINPS, IT_MINPD,
     IT_SQRTSS, IT_SQRTSD, IT_SQRTPS, IT_SQRTPD,
     IT_COMISS, IT_COMISD, IT_UCOMISS, IT_UCOMISD,
+    IT_CMPSS, IT_CMPSD, IT_CMPPS, IT_CMPPD,
     IT_ADDSUBPS, IT_ADDSUBPD,
     IT_HADDPS, IT_HADDPD,
     IT_HSUBPS, IT_HSUBPD,
@@ -178,6 +181,17 @@ typedef enum _InstrType {
     IT_VADDSS, IT_VADDSD, IT_VADDPS, IT_VADDPD,
     IT_VMULSS, IT_VMULSD, IT_VMULPS, IT_VMULPD,
     IT_VXORPS, IT_VXORPD,
+    IT_VSUBPD, IT_VDIVPD, IT_VMINPD, IT_VMAXPD, IT_VSQRTPD,
+    IT_VANDPD, IT_VANDNPD, IT_VORPD, IT_VCMPPD,
+    IT_VSUBPS, IT_VDIVPS, IT_VMINPS, IT_VMAXPS, IT_VSQRTPS,
+    IT_VANDPS, IT_VANDNPS, IT_VORPS, IT_VCMPPS,
+    IT_VSUBSS, IT_VSUBSD, IT_VDIVSS, IT_VDIVSD, IT_VMINSS, IT_VMINSD,
+    IT_VMAXSS, IT_VMAXSD, IT_VSQRTSS, IT_VSQRTSD, IT_VCMPSS, IT_VCMPSD,
+    IT_VUCOMISS, IT_VUCOMISD,
+    IT_VMOVDDUP, IT_VBROADCASTSS, IT_VBROADCASTSD,
+    // FMA
+    IT_VFMADD132SS, IT_VFMADD132SD, IT_VFMADD213SS, IT_VFMADD213SD,
+    IT_VFMSUB132SS, IT_VFMSUB132SD, IT_VFMSUB213SS, IT_VFMSUB213SD,
     IT_VZEROUPPER, IT_VZEROALL,
 
     //
@@ -216,6 +230,7 @@ typedef enum _VexPrefix {
     VEX_128, // Vex, length L=0: 128 bit
     VEX_256, // Vex, length L=1: 256 bit
     VEX_LIG, // Vex, ignore L setting (used in decoder)
+    VEX_512, // EVEX, length L'L=2: 512 bit (no masking, 16 registers)
 } VexPrefix;
 
 typedef struct _Operand {
@@ -233,7 +248,9 @@ typedef enum _OperandEncoding {
     OE_MR,  // 2 operands, ModRM byte, dest is reg or memory
     OE_RM,  // 2 operands, ModRM byte, src  is reg or memory
     OE_RMI, // 3 operands, ModRM byte, src  is reg or memory, Immediate
-    OE_RVM  // 3 operands, 2nd op is VEX vvvv reg
+    OE_MI,  // 2 operands, ModRM byte with opcode digit, Immediate
+    OE_RVM, // 3 operands, 2nd op is VEX vvvv reg
+    OE_RMV  // 3 operands, ModRM byte, src is reg or memory, 3rd op is vvvv
 } OperandEncoding;
 
 typedef enum _PrefixSet {
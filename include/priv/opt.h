@@ -0,0 +1,45 @@
+/**
+ * This file is part of DBrew, the dynamic binary rewriting library.
+ *
+ * (c) 2016, Josef Weidendorfer <josef.weidendorfer@gmx.de>
+ *
+ * DBrew is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License (LGPL)
+ * as published by the Free Software Foundation, either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * DBrew is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with DBrew.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OPT_H
+#define OPT_H
+
+#include "common.h"
+#include "engine.h"
+
+// are flags dead after instruction <i> of <cbb>?
+bool flagsDeadAfter(CBB* cbb, int i);
+// may instruction <instr> change GP register with index <ri>?
+bool gpWrittenBy(Instr* instr, RegIndex ri);
+
+// optimization passes on the instructions of one CBB
+void optStrengthReduction(RContext* c, CBB* cbb);
+void optPeephole(RContext* c, CBB* cbb);
+void optValueNumbering(RContext* c, CBB* cbb);
+void optVexTranscoding(RContext* c, CBB* cbb);
+void optFmaFusion(RContext* c, CBB* cbb);
+void optBmi(RContext* c, CBB* cbb);
+// insert vzeroupper before returns/calls if 256/512-bit registers are used,
+// unless 256/512-bit values may be returned or passed as arguments
+void optVZeroUpper(RContext* c);
+// convert small branch diamonds of the CBB graph into cmov/setcc
+void optIfConversion(RContext* c);
+
+#endif // OPT_H
@@ -27,6 +27,7 @@ void runVectorization(RContext* c);
 
 int maxVectorBytes(void);
 uint64_t expandedVectorVariant(uint64_t f, int s, VectorizeReq* vr);
+uint64_t scalarVectorVariant(uint64_t f);
 
 // replacement functions
 
@@ -41,3 +42,37 @@ void apply4_R8V8V8_X4(uint64_t f, double* ov, double* i1v, double* i2v);
 // for dbrew_apply4_R8P8
 void apply4_R8P8_X2(uint64_t f, double* ov, double* iv);
 void apply4_R8P8_X4(uint64_t f, double* ov, double* iv);
+
+// for dbrew_apply_R8V8/R8V8V8/R8P8: scalar kernel <f> handles the tail
+void apply_R8V8_X1(uint64_t f, double* ov, double* iv, int n);
+void apply_R8V8_X2(uint64_t vf, double* ov, double* iv, int n, uint64_t f);
+void apply_R8V8_X4(uint64_t vf, double* ov, double* iv, int n, uint64_t f);
+void apply_R8V8V8_X1(uint64_t f, double* ov, double* i1v, double* i2v, int n);
+void apply_R8V8V8_X2(uint64_t vf, double* ov, double* i1v, double* i2v,
+                     int n, uint64_t f);
+void apply_R8V8V8_X4(uint64_t vf, double* ov, double* i1v, double* i2v,
+                     int n, uint64_t f);
+void apply_R8P8_X1(uint64_t f, double* ov, double* iv, int n);
+void apply_R8P8_X2(uint64_t vf, double* ov, double* iv, int n, uint64_t f);
+void apply_R8P8_X4(uint64_t vf, double* ov, double* iv, int n, uint64_t f);
+void apply_R8V8_X8(uint64_t vf, double* ov, double* iv, int n, uint64_t f);
+void apply_R8V8V8_X8(uint64_t vf, double* ov, double* i1v, double* i2v,
+                     int n, uint64_t f);
+void apply_R8P8_X8(uint64_t vf, double* ov, double* iv, int n, uint64_t f);
+
+// for dbrew_apply_R4V4/R4V4V4/R4P4
+void apply_R4V4_X1(uint64_t f, float* ov, float* iv, int n);
+void apply_R4V4_X4(uint64_t vf, float* ov, float* iv, int n, uint64_t f);
+void apply_R4V4_X8(uint64_t vf, float* ov, float* iv, int n, uint64_t f);
+void apply_R4V4_X16(uint64_t vf, float* ov, float* iv, int n, uint64_t f);
+void apply_R4V4V4_X1(uint64_t f, float* ov, float* i1v, float* i2v, int n);
+void apply_R4V4V4_X4(uint64_t vf, float* ov, float* i1v, float* i2v,
+                     int n, uint64_t f);
+void apply_R4V4V4_X8(uint64_t vf, float* ov, float* i1v, float* i2v,
+                     int n, uint64_t f);
+void apply_R4V4V4_X16(uint64_t vf, float* ov, float* i1v, float* i2v,
+                      int n, uint64_t f);
+void apply_R4P4_X1(uint64_t f, float* ov, float* iv, int n);
+void apply_R4P4_X4(uint64_t vf, float* ov, float* iv, int n, uint64_t f);
+void apply_R4P4_X8(uint64_t vf, float* ov, float* iv, int n, uint64_t f);
+void apply_R4P4_X16(uint64_t vf, float* ov, float* iv, int n, uint64_t f);
@@ -47,6 +47,8 @@ void ll_basic_block_declare(LLBasicBlock*, LLState*);
 void ll_basic_block_add_predecessor(LLBasicBlock*, LLBasicBlock*);
 void ll_basic_block_truncate(LLBasicBlock*, size_t);
 LLBasicBlock* ll_basic_block_split(LLBasicBlock*, size_t, LLState*);
+void ll_basic_block_init_liveness(LLBasicBlock*);
+bool ll_basic_block_update_liveness(LLBasicBlock*);
 void ll_basic_block_build_ir(LLBasicBlock*, LLState*);
 void ll_basic_block_fill_phis(LLBasicBlock*, LLState*);
 
@@ -119,6 +119,24 @@ struct LLBasicBlock {
      * \brief The phi nodes for the flags
      **/
     LLVMValueRef phiNodesFlags[RFLAG_Max];
+
+    /**
+     * \brief Bit mask of GP registers live at the block entry
+     **/
+    uint32_t liveGpRegisters;
+    /**
+     * \brief Bit mask of SSE registers live at the block entry
+     **/
+    uint32_t liveSseRegisters;
+    /**
+     * \brief Bit mask of GP registers live at the block entry whose pointer
+     * facet is used, these get a PHI node for the pointer facet as well
+     **/
+    uint32_t livePtrRegisters;
+    /**
+     * \brief Whether the flags are live at the block entry
+     **/
+    bool liveFlags;
 };
 
 /**
@@ -145,6 +163,10 @@ ll_basic_block_new(uintptr_t address)
     bb->nextFallThrough = NULL;
     bb->predCount = 0;
     bb->predsAllocated = 0;
+    bb->liveGpRegisters = 0;
+    bb->liveSseRegisters = 0;
+    bb->livePtrRegisters = 0;
+    bb->liveFlags = false;
     bb->regfile = ll_regfile_new(bb);
 
     return bb;
@@ -415,7 +437,226 @@ ll_basic_block_split(LLBasicBlock* bb, size_t splitIndex, LLState* state)
 }
 
 /**
- * Build the LLVM IR.
+ * Mark a register as used in the liveness masks of the basic block.
+ *
+ * \private
+ *
+ * \param bb The basic block
+ * \param reg The register
+ **/
+static void
+ll_basic_block_use_register(LLBasicBlock* bb, Reg reg)
+{
+    switch (reg.rt)
+    {
+        case RT_GP8Leg:
+            if (reg.ri >= RI_AH && reg.ri < RI_R8L)
+                bb->liveGpRegisters |= 1u << (reg.ri - RI_AH);
+            else
+                bb->liveGpRegisters |= 1u << reg.ri;
+            break;
+        case RT_GP8:
+        case RT_GP16:
+        case RT_GP32:
+        case RT_GP64:
+            bb->liveGpRegisters |= 1u << reg.ri;
+            break;
+        case RT_XMM:
+        case RT_YMM:
+            bb->liveSseRegisters |= 1u << reg.ri;
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Mark the pointer facet of a GP register as used in the liveness masks of
+ * the basic block.
+ *
+ * \private
+ *
+ * \param bb The basic block
+ * \param reg The register
+ **/
+static void
+ll_basic_block_use_pointer(LLBasicBlock* bb, Reg reg)
+{
+    if (reg.rt != RT_GP64)
+        return;
+
+    bb->liveGpRegisters |= 1u << reg.ri;
+    bb->livePtrRegisters |= 1u << reg.ri;
+}
+
+/**
+ * Mark the registers of an operand as used, including base and index
+ * registers of memory operands. The address of memory operands is derived
+ * from the pointer facet of the base register.
+ *
+ * \private
+ *
+ * \param bb The basic block
+ * \param operand The operand
+ **/
+static void
+ll_basic_block_use_operand(LLBasicBlock* bb, Operand* operand)
+{
+    if (opIsReg(operand))
+        ll_basic_block_use_register(bb, operand->reg);
+    else if (opIsInd(operand))
+    {
+        ll_basic_block_use_pointer(bb, operand->reg);
+        if (operand->scale > 0)
+            ll_basic_block_use_register(bb, operand->ireg);
+    }
+}
+
+/**
+ * Initialize the liveness information of the basic block with the registers
+ * and flags referenced by its instructions, including implicit operands. A
+ * register which is only written is conservatively treated as used as well,
+ * as partial writes keep the remaining bits of the register. The pointer
+ * facet is tracked separately: it is used by memory operands, by 64-bit
+ * add/sub (computing a GEP), by the stack instructions, by returning a
+ * pointer, and by 64-bit register moves copying all facets.
+ *
+ * \private
+ *
+ * \param bb The basic block
+ **/
+void
+ll_basic_block_init_liveness(LLBasicBlock* bb)
+{
+    static const RegIndex argRegisters[] = {
+        RI_DI, RI_SI, RI_D, RI_C, RI_8, RI_9
+    };
+
+    bb->liveGpRegisters = 0;
+    bb->liveSseRegisters = 0;
+    bb->livePtrRegisters = 0;
+    bb->liveFlags = false;
+
+    for (size_t i = 0; i < bb->instrCount; i++)
+    {
+        LLInstr* instr = bb->instrs + i;
+
+        ll_basic_block_use_operand(bb, &instr->dst);
+        ll_basic_block_use_operand(bb, &instr->src);
+        ll_basic_block_use_operand(bb, &instr->src2);
+
+        switch (instr->type)
+        {
+            case IT_PUSHF:
+            case IT_PUSHFQ:
+                bb->liveFlags = true;
+                // fallthrough
+            case IT_PUSH:
+            case IT_POP:
+                ll_basic_block_use_pointer(bb, getReg(RT_GP64, RI_SP));
+                break;
+            case IT_LEAVE:
+                ll_basic_block_use_pointer(bb, getReg(RT_GP64, RI_SP));
+                ll_basic_block_use_pointer(bb, getReg(RT_GP64, RI_BP));
+                break;
+            case IT_ADD:
+            case IT_SUB:
+                if (opIsGPReg(&instr->dst) && opTypeWidth(&instr->dst) == 64)
+                    ll_basic_block_use_pointer(bb, instr->dst.reg);
+                break;
+            case IT_MOV:
+                if (opIsGPReg(&instr->dst) && opIsGPReg(&instr->src) && opTypeWidth(&instr->dst) == 64 && opTypeWidth(&instr->src) == 64)
+                    ll_basic_block_use_pointer(bb, instr->src.reg);
+                break;
+            case IT_CALL:
+                for (size_t j = 0; j < sizeof(argRegisters) / sizeof(argRegisters[0]); j++)
+                    bb->liveGpRegisters |= 1u << argRegisters[j];
+                break;
+            case IT_RET:
+                ll_basic_block_use_pointer(bb, getReg(RT_GP64, RI_A));
+                bb->liveSseRegisters |= 1u << RI_XMM0;
+                break;
+            case IT_CLTQ:
+            case IT_CWTL:
+            case IT_CQTO:
+            case IT_IMUL:
+            case IT_MUL:
+            case IT_IDIV1:
+            case IT_DIV:
+                bb->liveGpRegisters |= 1u << RI_A | 1u << RI_D;
+                break;
+            default:
+                if ((instr->type >= IT_CMOVO && instr->type <= IT_CMOVG) ||
+                    (instr->type >= IT_SETO && instr->type <= IT_SETG))
+                    bb->liveFlags = true;
+                break;
+        }
+    }
+
+    InstrType endType = IT_None;
+
+    if (bb->dbrewBB != NULL)
+        endType = bb->dbrewBB->endType;
+    else if (bb->instrCount != 0)
+        endType = bb->instrs[bb->instrCount - 1].type;
+
+    if (instrIsJcc(endType))
+        bb->liveFlags = true;
+    else if (endType == IT_RET)
+    {
+        ll_basic_block_use_pointer(bb, getReg(RT_GP64, RI_A));
+        bb->liveSseRegisters |= 1u << RI_XMM0;
+    }
+}
+
+/**
+ * Propagate the liveness information of the successors into the basic block.
+ * As no register is killed, this has to be repeated for all basic blocks of
+ * the function until no block changes anymore.
+ *
+ * \private
+ *
+ * \param bb The basic block
+ * \returns Whether the liveness information of the block changed
+ **/
+bool
+ll_basic_block_update_liveness(LLBasicBlock* bb)
+{
+    LLBasicBlock* succs[2] = { bb->nextBranch, bb->nextFallThrough };
+    uint32_t liveGp = bb->liveGpRegisters;
+    uint32_t liveSse = bb->liveSseRegisters;
+    uint32_t livePtr = bb->livePtrRegisters;
+    bool liveFlags = bb->liveFlags;
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        if (succs[i] == NULL)
+            continue;
+
+        liveGp |= succs[i]->liveGpRegisters;
+        liveSse |= succs[i]->liveSseRegisters;
+        livePtr |= succs[i]->livePtrRegisters;
+        liveFlags |= succs[i]->liveFlags;
+    }
+
+    if (liveGp == bb->liveGpRegisters && liveSse == bb->liveSseRegisters && livePtr == bb->livePtrRegisters && liveFlags == bb->liveFlags)
+        return false;
+
+    bb->liveGpRegisters = liveGp;
+    bb->liveSseRegisters = liveSse;
+    bb->livePtrRegisters = livePtr;
+    bb->liveFlags = liveFlags;
+
+    return true;
+}
+
+/**
+ * Build the LLVM IR. PHI nodes are only created for registers and flags which
+ * are live at the entry of the block, and only for the native facet of each
+ * register; all other facets are derived from it on demand. GP registers
+ * whose pointer facet is used additionally get a PHI node for the pointer
+ * facet, keeping the pointer provenance (e.g. of the stack pointer) across
+ * blocks instead of converting the integer value back into a pointer.
  *
  * \private
  *
@@ -441,28 +682,54 @@ ll_basic_block_build_ir(LLBasicBlock* bb, LLState* state)
 
     for (int i = 0; i < RI_GPMax; i++)
     {
-        for (size_t k = 0; k < FACET_COUNT; k++)
-        {
-            phiNode = LLVMBuildPhi(state->builder, ll_register_facet_type(k, state), "");
+        bb->phiNodesGpRegisters[i].facets[FACET_I64] = NULL;
+        bb->phiNodesGpRegisters[i].facets[FACET_PTR] = NULL;
 
-            ll_regfile_set(bb->regfile, k, getReg(RT_GP64, i), phiNode, false, state);
-            bb->phiNodesGpRegisters[i].facets[k] = phiNode;
+        if (!(bb->liveGpRegisters & (1u << i)))
+        {
+            ll_regfile_clear(bb->regfile, getReg(RT_GP64, i), state);
+            continue;
         }
+
+        phiNode = LLVMBuildPhi(state->builder, ll_register_facet_type(FACET_I64, state), "");
+
+        ll_regfile_set(bb->regfile, FACET_I64, getReg(RT_GP64, i), phiNode, true, state);
+        bb->phiNodesGpRegisters[i].facets[FACET_I64] = phiNode;
+
+        if (!(bb->livePtrRegisters & (1u << i)))
+            continue;
+
+        phiNode = LLVMBuildPhi(state->builder, ll_register_facet_type(FACET_PTR, state), "");
+
+        ll_regfile_set(bb->regfile, FACET_PTR, getReg(RT_GP64, i), phiNode, false, state);
+        bb->phiNodesGpRegisters[i].facets[FACET_PTR] = phiNode;
     }
 
     for (int i = 0; i < RI_XMMMax; i++)
     {
-        for (size_t k = 0; k < FACET_COUNT; k++)
-        {
-            phiNode = LLVMBuildPhi(state->builder, ll_register_facet_type(k, state), "");
+        bb->phiNodesSseRegisters[i].facets[FACET_IVEC] = NULL;
 
-            ll_regfile_set(bb->regfile, k, getReg(RT_XMM, i), phiNode, false, state);
-            bb->phiNodesSseRegisters[i].facets[k] = phiNode;
+        if (!(bb->liveSseRegisters & (1u << i)))
+        {
+            ll_regfile_clear(bb->regfile, getReg(RT_XMM, i), state);
+            continue;
         }
+
+        phiNode = LLVMBuildPhi(state->builder, ll_register_facet_type(FACET_IVEC, state), "");
+
+        ll_regfile_set(bb->regfile, FACET_IVEC, getReg(RT_XMM, i), phiNode, true, state);
+        bb->phiNodesSseRegisters[i].facets[FACET_IVEC] = phiNode;
     }
 
     for (int i = 0; i < RFLAG_Max; i++)
     {
+        if (!bb->liveFlags)
+        {
+            bb->phiNodesFlags[i] = NULL;
+            ll_regfile_set_flag(bb->regfile, i, LLVMGetUndef(LLVMInt1TypeInContext(state->context)));
+            continue;
+        }
+
         phiNode = LLVMBuildPhi(state->builder, LLVMInt1TypeInContext(state->context), "");
 
         ll_regfile_set_flag(bb->regfile, i, phiNode);
@@ -514,41 +781,52 @@ ll_basic_block_fill_phis(LLBasicBlock* bb, LLState* state)
     LLVMValueRef values[bb->predCount];
     LLVMBasicBlockRef bbs[bb->predCount];
 
+    for (size_t i = 0; i < bb->predCount; i++)
+        bbs[i] = bb->preds[i]->llvmBB;
+
     for (int j = 0; j < RI_GPMax; j++)
     {
-        for (size_t k = 0; k < FACET_COUNT; k++)
-        {
-            for (size_t i = 0; i < bb->predCount; i++)
-            {
-                bbs[i] = bb->preds[i]->llvmBB;
-                values[i] = ll_basic_block_get_register(bb->preds[i], k, getReg(RT_GP64, j), state); //bb->preds[i]->gpRegisters[j].facets[k];
-            }
+        LLVMValueRef phiNode = bb->phiNodesGpRegisters[j].facets[FACET_I64];
 
-            LLVMAddIncoming(bb->phiNodesGpRegisters[j].facets[k], values, bbs, bb->predCount);
-        }
+        if (phiNode == NULL)
+            continue;
+
+        for (size_t i = 0; i < bb->predCount; i++)
+            values[i] = ll_basic_block_get_register(bb->preds[i], FACET_I64, getReg(RT_GP64, j), state);
+
+        LLVMAddIncoming(phiNode, values, bbs, bb->predCount);
+
+        phiNode = bb->phiNodesGpRegisters[j].facets[FACET_PTR];
+
+        if (phiNode == NULL)
+            continue;
+
+        for (size_t i = 0; i < bb->predCount; i++)
+            values[i] = ll_basic_block_get_register(bb->preds[i], FACET_PTR, getReg(RT_GP64, j), state);
+
+        LLVMAddIncoming(phiNode, values, bbs, bb->predCount);
     }
 
     for (int j = 0; j < RI_XMMMax; j++)
     {
-        for (size_t k = 0; k < FACET_COUNT; k++)
-        {
-            for (size_t i = 0; i < bb->predCount; i++)
-            {
-                bbs[i] = bb->preds[i]->llvmBB;
-                values[i] = ll_basic_block_get_register(bb->preds[i], k, getReg(RT_XMM, j), state); //bb->preds[i]->gpRegisters[j].facets[k];
-            }
+        LLVMValueRef phiNode = bb->phiNodesSseRegisters[j].facets[FACET_IVEC];
 
-            LLVMAddIncoming(bb->phiNodesSseRegisters[j].facets[k], values, bbs, bb->predCount);
-        }
+        if (phiNode == NULL)
+            continue;
+
+        for (size_t i = 0; i < bb->predCount; i++)
+            values[i] = ll_basic_block_get_register(bb->preds[i], FACET_IVEC, getReg(RT_XMM, j), state);
+
+        LLVMAddIncoming(phiNode, values, bbs, bb->predCount);
     }
 
+    if (!bb->liveFlags)
+        return;
+
     for (int j = 0; j < RFLAG_Max; j++)
     {
         for (size_t i = 0; i < bb->predCount; i++)
-        {
-            bbs[i] = bb->preds[i]->llvmBB;
             values[i] = ll_regfile_get_flag(bb->preds[i]->regfile, j);
-        }
 
         LLVMAddIncoming(bb->phiNodesFlags[j], values, bbs, bb->predCount);
     }
@@ -522,6 +522,18 @@ ll_function_build_ir(LLFunction* function, LLState* state)
                 LLVMPositionBuilderAtEnd(state->builder, ll_basic_block_llvm(function->u.definition.initialBB));
                 LLVMBuildBr(state->builder, ll_basic_block_llvm(function->u.definition.bbs[0]));
 
+                // Registers live at block entries, determines the PHI nodes
+                for (size_t i = 0; i < bbCount; i++)
+                    ll_basic_block_init_liveness(function->u.definition.bbs[i]);
+
+                bool changed = true;
+                while (changed)
+                {
+                    changed = false;
+                    for (size_t i = bbCount; i > 0; i--)
+                        changed |= ll_basic_block_update_liveness(function->u.definition.bbs[i - 1]);
+                }
+
                 for (size_t i = 0; i < bbCount; i++)
                     ll_basic_block_build_ir(function->u.definition.bbs[i], state);
 
@@ -0,0 +1,171 @@
+/**
+ * This file is part of DBrew, the dynamic binary rewriting library.
+ *
+ * (c) 2016, Josef Weidendorfer <josef.weidendorfer@gmx.de>
+ *
+ * DBrew is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License (LGPL)
+ * as published by the Free Software Foundation, either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * DBrew is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with DBrew.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffers.h"
+
+// process-wide hooks (all unset: malloc/free and mmap)
+static DBrewAllocator globalAllocator;
+
+static
+DBrewAllocator* hooks(Rewriter* r)
+{
+    return r ? &(r->allocator) : &globalAllocator;
+}
+
+void* memAlloc(Rewriter* r, size_t size)
+{
+    DBrewAllocator* a = hooks(r);
+
+    if (a->alloc)
+        return (a->alloc)(size, a->user);
+    return malloc(size);
+}
+
+void* memRealloc(Rewriter* r, void* p, size_t oldSize, size_t size)
+{
+    DBrewAllocator* a = hooks(r);
+    void* n;
+
+    if (!a->alloc)
+        return realloc(p, size);
+
+    // hooks have no realloc: copy into new allocation. On failure, keep
+    // <p> as realloc does
+    n = (a->alloc)(size, a->user);
+    if (!n) return 0;
+    if (p) {
+        memcpy(n, p, (oldSize < size) ? oldSize : size);
+        memFree(r, p);
+    }
+    return n;
+}
+
+void memFree(Rewriter* r, void* p)
+{
+    DBrewAllocator* a = hooks(r);
+
+    if (!p) return;
+    if (a->free)
+        (a->free)(p, a->user);
+    else
+        free(p);
+}
+
+// chunks grow to at least this size
+#define ARENA_CHUNKSIZE (64 * 1024)
+
+struct _ArenaChunk {
+    ArenaChunk* next;
+    size_t size, used;
+    uint8_t data[] __attribute__((aligned(16)));
+};
+
+void* arenaAlloc(Rewriter* r, Arena* a, size_t size)
+{
+    ArenaChunk* c = a->current;
+    size_t csize;
+
+    size = (size + 15) & ~15ul;
+    // try current and following (reset) chunks
+    while(c && (c->used + size > c->size)) {
+        c = c->next;
+        if (c) a->current = c;
+    }
+    if (!c) {
+        csize = (size > ARENA_CHUNKSIZE) ? size : ARENA_CHUNKSIZE;
+        if (a->current && (2 * a->current->size > csize))
+            csize = 2 * a->current->size;
+        c = (ArenaChunk*) memAlloc(r, sizeof(ArenaChunk) + csize);
+        c->next = 0;
+        c->size = csize;
+        c->used = 0;
+        if (a->current)
+            a->current->next = c;
+        else
+            a->first = c;
+        a->current = c;
+    }
+    c->used += size;
+    return c->data + c->used - size;
+}
+
+void arenaReset(Arena* a)
+{
+    for(ArenaChunk* c = a->first; c != 0; c = c->next)
+        c->used = 0;
+    a->current = a->first;
+}
+
+void arenaFree(Rewriter* r, Arena* a)
+{
+    ArenaChunk* c = a->first;
+
+    while(c) {
+        ArenaChunk* next = c->next;
+        memFree(r, c);
+        c = next;
+    }
+    a->first = 0;
+    a->current = 0;
+}
+
+DBrewAllocator* defaultAllocator(void)
+{
+    return &globalAllocator;
+}
+
+bool allocatorValid(DBrewAllocator* a)
+{
+    // memory from one hook is released by the other
+    return (a->alloc == 0) == (a->free == 0);
+}
+
+CodeStorage* providedCodeStorage(Rewriter* r, int size, uint64_t hint)
+{
+    DBrewAllocator* a = hooks(r);
+    int fullsize = (size + 4095) & ~4095;
+    uint8_t* buf;
+
+    if (!a->allocCode) return 0;
+    buf = (uint8_t*) (a->allocCode)(fullsize, hint, a->user);
+    if (!buf) return 0;
+    return initProvidedCodeStorage(buf, size, fullsize, a->freeCode, a->user);
+}
+
+
+//---------------------------------------------------------------------
+// DBrew API functions for allocator hooks
+
+bool dbrew_set_default_allocator(DBrewAllocator* a)
+{
+    if (a && !allocatorValid(a))
+        return false;
+
+    if (a)
+        globalAllocator = *a;
+    else
+        memset(&globalAllocator, 0, sizeof(DBrewAllocator));
+    return true;
+}
@@ -0,0 +1,261 @@
+/**
+ * This file is part of DBrew, the dynamic binary rewriting library.
+ *
+ * (c) 2016, Josef Weidendorfer <josef.weidendorfer@gmx.de>
+ *
+ * DBrew is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License (LGPL)
+ * as published by the Free Software Foundation, either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * DBrew is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with DBrew.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dbrew.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "buffers.h"
+#include "common.h"
+#include "engine.h"
+#include "error.h"
+
+/*
+ * Batch rewriting: specialize the configured function for many
+ * parameter tuples in one go.
+ *
+ * Decoded instructions and all buffers of the rewriter are reused for
+ * each tuple, and generated code of all specializations is packed into
+ * the same code storage one after the other. The size needed is estimated
+ * from the first specialization; if it is exceeded, packing continues in
+ * a larger code storage.
+ * For parallel rewriting, helper rewriters get a copy of the configuration
+ * and the already decoded instructions; each helper packs the code of its
+ * share of the batch into its own code storage.
+ */
+
+typedef struct _BatchJob {
+    Rewriter* r;
+    int from, to; // range of parameter tuples to rewrite
+    int parCount;
+    uint64_t* pars;
+    uint64_t* funcs;
+    int done; // number of successful rewrites
+} BatchJob;
+
+// retries after running out of code storage
+#define BATCH_GROW_MAX 4
+
+// returns 0 on error
+static
+uint64_t rewriteOne(Rewriter* r, uint64_t* par)
+{
+    Error* e;
+    uint64_t t0 = timeNs();
+
+    e = rewritePars(r, par);
+    // specialization larger than estimated: continue in larger storage,
+    // keeping code of previous specializations
+    for(int i = 0; e && (i < BATCH_GROW_MAX); i++) {
+        if ((e->et != ET_BufferOverflow) || (e->em != EM_Generator)) break;
+        if (!retireCodeStorage(r, 2 * r->cs->fullsize)) break;
+        e = rewritePars(r, par);
+    }
+    statsRewriteDone(r, t0, e);
+
+    if (e) {
+        logError(e, (char*) "Stopped rewriting; batch entry uses original");
+        return 0;
+    }
+    return r->generatedCodeAddr;
+}
+
+static
+void* runBatchJob(void* arg)
+{
+    BatchJob* job = (BatchJob*) arg;
+    Rewriter* r = job->r;
+
+    for(int i = job->from; i < job->to; i++) {
+        uint64_t f = rewriteOne(r, job->pars + i * job->parCount);
+        if (f) job->done++;
+        job->funcs[i] = f ? f : r->func;
+    }
+    return 0;
+}
+
+// copy decoded BBs of <src> into <dst>, with same capacities
+static
+void copyDecoded(Rewriter* dst, Rewriter* src)
+{
+    assert(dst->decInstrCapacity >= src->decInstrCount);
+    assert(dst->decBBCapacity >= src->decBBCount);
+
+    memcpy(dst->decInstr, src->decInstr, sizeof(Instr) * src->decInstrCount);
+    dst->decInstrCount = src->decInstrCount;
+
+    for(int i = 0; i < src->decBBCount; i++) {
+        DBB* dbb = dst->decBB + i;
+
+        *dbb = src->decBB[i];
+        dbb->instr = dst->decInstr + (dbb->instr - src->decInstr);
+        dbb->fc = config_find_function(dst, dbb->addr);
+    }
+    dst->decBBCount = src->decBBCount;
+    dst->decodeGen = src->decodeGen;
+}
+
+// get helper rewriter <i> for <r>, with code storage of at least <codeSize>
+static
+Rewriter* getWorker(Rewriter* r, int i, int codeSize)
+{
+    Rewriter* w = r->worker[i];
+
+    if (w && ((w->decInstrCapacity != r->decInstrCapacity) ||
+              (w->decBBCapacity != r->decBBCapacity) ||
+              (w->capInstrCapacity != r->capInstrCapacity) ||
+              (w->capBBCapacity != r->capBBCapacity) ||
+              (w->cs == 0) || (w->cs->fullsize < codeSize))) {
+        freeRewriter(w);
+        w = 0;
+    }
+    if (!w) {
+        w = allocRewriter();
+        w->decInstrCapacity = r->decInstrCapacity;
+        w->decBBCapacity = r->decBBCapacity;
+        w->capInstrCapacity = r->capInstrCapacity;
+        w->capBBCapacity = r->capBBCapacity;
+        w->capCodeCapacity = codeSize;
+        r->worker[i] = w;
+    }
+
+    w->func = r->func;
+    w->nearCode = r->nearCode;
+    w->hugeCode = r->hugeCode;
+    initRewriter(w);
+    config_copy(w, r);
+    copyDecoded(w, r);
+
+    w->vreq = r->vreq;
+    w->vectorsize = r->vectorsize;
+    w->addInliningHints = r->addInliningHints;
+    w->doCopyPass = r->doCopyPass;
+    w->doStrengthReduction = r->doStrengthReduction;
+    w->doPeephole = r->doPeephole;
+    w->doValueNumbering = r->doValueNumbering;
+    w->doIfConversion = r->doIfConversion;
+    w->ifConvMax = r->ifConvMax;
+    w->doVexTranscoding = r->doVexTranscoding;
+    w->doFpContract = r->doFpContract;
+    w->cpuFeatures = r->cpuFeatures;
+    w->multiVersion = r->multiVersion;
+    w->sharedDecodeCache = r->sharedDecodeCache;
+    w->perfMap = r->perfMap;
+    w->perfJitdump = r->perfJitdump;
+    w->budgetEmulated = r->budgetEmulated;
+    w->budgetCaptured = r->budgetCaptured;
+    w->budgetCodeBytes = r->budgetCodeBytes;
+    w->budgetTimeNs = r->budgetTimeNs;
+    w->budgetDegrade = r->budgetDegrade;
+    w->appendCode = true;
+
+    return w;
+}
+
+int dbrew_rewrite_batch(Rewriter* r, int count, uint64_t* pars,
+                        uint64_t* funcs, int threads)
+{
+    int parCount, perItem, jobCount, chunk, done;
+    uint64_t f;
+    BatchJob* job;
+    pthread_t* tid;
+    bool* started;
+
+    if (count <= 0) return 0;
+    if (r->decBB == 0) initRewriter(r);
+    parCount = r->cc ? r->cc->parCount : 0;
+    if (parCount < 0) parCount = 0;
+
+    // first specialization also decodes the function
+    r->appendCode = false;
+    f = rewriteOne(r, pars);
+    funcs[0] = f ? f : r->func;
+    done = f ? 1 : 0;
+    if (count == 1) return done;
+
+    // estimate code size needed per specialization from first one,
+    // with some slack for larger variants and the holes of pass 1
+    perItem = f ? 2 * r->cs->used + 64 : r->capCodeCapacity;
+
+    jobCount = (threads > 1) ? threads : 1;
+    if (jobCount > count - 1) jobCount = count - 1;
+    chunk = (count - 1 + jobCount - 1) / jobCount;
+
+    // enlarge code storage of <r> if needed; redo first specialization
+    if (f && (r->cs->fullsize < perItem * (chunk + 1))) {
+        freeCodeStorage(r->cs);
+        r->capCodeCapacity = perItem * (chunk + 1);
+        r->cs = allocCodeStorage(r, r->capCodeCapacity);
+        f = rewriteOne(r, pars);
+        funcs[0] = f ? f : r->func;
+        done = f ? 1 : 0;
+    }
+
+    if (jobCount > 1 && r->workerCount < jobCount - 1) {
+        r->worker = (Rewriter**) memRealloc(0, r->worker,
+                                            sizeof(Rewriter*) * r->workerCount,
+                                            sizeof(Rewriter*) * (jobCount - 1));
+        for(int i = r->workerCount; i < jobCount - 1; i++)
+            r->worker[i] = 0;
+        r->workerCount = jobCount - 1;
+    }
+
+    job = (BatchJob*) memAlloc(r, sizeof(BatchJob) * jobCount);
+    tid = (pthread_t*) memAlloc(r, sizeof(pthread_t) * jobCount);
+    started = (bool*) memAlloc(r, sizeof(bool) * jobCount);
+    for(int i = 0; i < jobCount; i++) {
+        job[i].from = 1 + i * chunk;
+        job[i].to = job[i].from + chunk;
+        if (job[i].to > count) job[i].to = count;
+        job[i].parCount = parCount;
+        job[i].pars = pars;
+        job[i].funcs = funcs;
+        job[i].done = 0;
+        // job 0 is run by the calling thread with the rewriter itself
+        job[i].r = (i == 0) ? r : getWorker(r, i - 1, perItem * chunk);
+        started[i] = false;
+    }
+
+    for(int i = 1; i < jobCount; i++)
+        started[i] = (pthread_create(tid + i, 0, runBatchJob, job + i) == 0);
+
+    r->appendCode = true;
+    runBatchJob(job);
+    r->appendCode = false;
+
+    for(int i = 1; i < jobCount; i++) {
+        if (started[i])
+            pthread_join(tid[i], 0);
+        else
+            runBatchJob(job + i);
+    }
+
+    for(int i = 0; i < jobCount; i++)
+        done += job[i].done;
+
+    memFree(r, job);
+    memFree(r, tid);
+    memFree(r, started);
+
+    return done;
+}
@@ -20,9 +20,11 @@
 #include "buffers.h"
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 
 
@@ -51,30 +53,231 @@ CodeStorage* initCodeStorage(int size)
     cs->fullsize = fullsize;
     cs->buf = buf;
     cs->used = 0;
+    cs->provided = false;
+    cs->freeCode = 0;
+    cs->user = 0;
 
     //fprintf(stderr, "Allocated Code Storage (size %d)\n", fullsize);
 
     return cs;
 }
 
+/* Storage for data accessed by generated code via absolute 32-bit
+ * addresses, such as jump tables. It is located in the lowest 2GB of the
+ * address space. Returns 0 if no such memory is available.
+ */
+CodeStorage* initTableStorage(int size)
+{
+    int fullsize;
+    uint8_t* buf;
+    CodeStorage* cs;
+
+    fullsize = (size + 4095) & ~4095;
+    buf = (uint8_t*) mmap(0, fullsize, PROT_READ | PROT_WRITE,
+                          MAP_ANONYMOUS | MAP_PRIVATE | MAP_32BIT, -1, 0);
+    if ((buf == (uint8_t*)-1) || ((uint64_t) buf + fullsize > (1ul << 31)))
+        return 0;
+
+    cs = (CodeStorage*) malloc(sizeof(CodeStorage));
+    cs->size = size;
+    cs->fullsize = fullsize;
+    cs->buf = buf;
+    cs->used = 0;
+    cs->provided = false;
+    cs->freeCode = 0;
+    cs->user = 0;
+
+    return cs;
+}
+
+// size of huge pages used for code storage
+#define HUGEPAGE_SIZE (2ul << 20)
+
+static
+CodeStorage* newCodeStorage(uint8_t* buf, int size, int fullsize)
+{
+    CodeStorage* cs;
+
+    cs = (CodeStorage*) malloc(sizeof(CodeStorage));
+    cs->size = size;
+    cs->fullsize = fullsize;
+    cs->buf = buf;
+    cs->used = 0;
+    cs->provided = false;
+    cs->freeCode = 0;
+    cs->user = 0;
+    return cs;
+}
+
+// is range [a, a+size[ reachable from <addr> with 32-bit displacements?
+static
+bool isNear(uint64_t a, uint64_t size, uint64_t addr)
+{
+    int64_t d1 = (int64_t) (a - addr);
+    int64_t d2 = (int64_t) (a + size - addr);
+
+    return (d1 > INT32_MIN) && (d1 < INT32_MAX) &&
+           (d2 > INT32_MIN) && (d2 < INT32_MAX);
+}
+
+/* Find an unmapped range of <size> bytes aligned to <align> as near as
+ * possible to <addr>, and within reach of rel32 displacements from it,
+ * by looking at the gaps between mappings in /proc/self/maps. Space above
+ * the heap is kept free for its growth. Returns 0 if nothing was found.
+ */
+static
+uint64_t findNearGap(uint64_t addr, uint64_t size, uint64_t align)
+{
+    uint64_t start, end, gapStart = 1ul << 16, best = 0, bestDist = ~0ul;
+    char line[300];
+    FILE* f;
+
+    f = fopen("/proc/self/maps", "r");
+    if (!f) return 0;
+    while(fgets(line, sizeof(line), f)) {
+        uint64_t a, dist;
+
+        if (sscanf(line, "%lx-%lx", &start, &end) != 2) continue;
+        if (start >= gapStart + size) {
+            // highest candidate below <addr>, lowest above
+            if (start <= addr)
+                a = (start - size) & ~(align - 1);
+            else
+                a = (gapStart + align - 1) & ~(align - 1);
+            dist = (a > addr) ? a - addr : addr - a;
+            if ((a >= gapStart) && (a + size <= start) &&
+                isNear(a, size, addr) && (dist < bestDist)) {
+                best = a;
+                bestDist = dist;
+            }
+        }
+        gapStart = end;
+        if (strstr(line, "[heap]")) gapStart += 256ul << 20;
+    }
+    fclose(f);
+    return best;
+}
+
+/* Map <fullsize> bytes of executable memory aligned to <align>, at <hint>
+ * if possible. With huge page alignment, ask for transparent huge pages.
+ * Returns 0 on failure.
+ */
+static
+uint8_t* mapCode(uint64_t hint, uint64_t fullsize, uint64_t align)
+{
+    int flags = MAP_ANONYMOUS | MAP_PRIVATE;
+    uint64_t extra = (hint || (align <= 4096)) ? 0 : align;
+    uint8_t* buf;
+
+#ifdef MAP_FIXED_NOREPLACE
+    if (hint) flags |= MAP_FIXED_NOREPLACE;
+#endif
+    buf = (uint8_t*) mmap((void*) hint, fullsize + extra,
+                          PROT_READ | PROT_WRITE | PROT_EXEC, flags, -1, 0);
+    if (buf == (uint8_t*)-1) return 0;
+    if (extra) {
+        // cut off unaligned parts
+        uint64_t a = ((uint64_t) buf + align - 1) & ~(align - 1);
+        if (a > (uint64_t) buf)
+            munmap(buf, a - (uint64_t) buf);
+        munmap((uint8_t*) a + fullsize, (uint64_t) buf + extra - a);
+        buf = (uint8_t*) a;
+    }
+#ifdef MADV_HUGEPAGE
+    if (align >= HUGEPAGE_SIZE)
+        madvise(buf, fullsize, MADV_HUGEPAGE);
+#endif
+    return buf;
+}
+
+/* Code storage within +/- 2GB of <addr>, for generated code using
+ * RIP-relative addressing and rel32 jumps to original code. First tries
+ * free gaps found in the process mappings, then address hints in steps
+ * of 64MB away from <addr>. Returns 0 if no such memory is available.
+ */
+static
+CodeStorage* initPlacedCodeStorage(uint64_t addr, int size, uint64_t align)
+{
+    uint64_t fullsize, hint;
+    uint8_t* buf;
+
+    fullsize = (size + align - 1) & ~(align - 1);
+    hint = findNearGap(addr, fullsize, align);
+    if (hint) {
+        buf = mapCode(hint, fullsize, align);
+        if (buf && isNear((uint64_t) buf, fullsize, addr))
+            return newCodeStorage(buf, size, fullsize);
+        if (buf) munmap(buf, fullsize);
+    }
+
+    for(int i = 1; i < 64; i++) {
+        int64_t diff = ((i & 1) ? 1 : -1) * (int64_t) (i/2 + 1) * (64l << 20);
+        hint = (addr & ~(align - 1)) + diff;
+
+        buf = mapCode(hint, fullsize, align);
+        if (!buf) continue;
+        if (isNear((uint64_t) buf, fullsize, addr) &&
+            (((uint64_t) buf & (align - 1)) == 0))
+            return newCodeStorage(buf, size, fullsize);
+        munmap(buf, fullsize);
+    }
+    return 0;
+}
+
+CodeStorage* initNearCodeStorage(uint64_t addr, int size)
+{
+    return initPlacedCodeStorage(addr, size, 4096);
+}
+
+CodeStorage* initHugeCodeStorage(uint64_t addr, int size)
+{
+    uint64_t fullsize = (size + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+    uint8_t* buf;
+
+    if (addr)
+        return initPlacedCodeStorage(addr, size, HUGEPAGE_SIZE);
+
+    buf = mapCode(0, fullsize, HUGEPAGE_SIZE);
+    if (!buf) return 0;
+    return newCodeStorage(buf, size, fullsize);
+}
+
+bool isCodeStorageNear(CodeStorage* cs, uint64_t addr)
+{
+    return isNear((uint64_t) cs->buf, cs->fullsize, addr);
+}
+
+CodeStorage* initProvidedCodeStorage(uint8_t* buf, int size, int fullsize,
+                                     void (*freeCode)(void*, size_t, void*),
+                                     void* user)
+{
+    CodeStorage* cs = newCodeStorage(buf, size, fullsize);
+
+    cs->provided = true;
+    cs->freeCode = freeCode;
+    cs->user = user;
+    return cs;
+}
+
 void freeCodeStorage(CodeStorage* cs)
 {
-    if (cs)
+    if (cs && cs->provided) {
+        if (cs->freeCode)
+            (cs->freeCode)(cs->buf, cs->fullsize, cs->user);
+    }
+    else if (cs)
         munmap(cs->buf, cs->fullsize);
     free(cs);
 }
 
 /* this checks whether enough storage is available, but does
- * not change <used>.
+ * not change <used>. Returns 0 if storage is too small.
  */
 uint8_t* reserveCodeStorage(CodeStorage* cs, int size)
 {
-    if (cs->fullsize - cs->used < size) {
-        fprintf(stderr,
-                "Error: CodeStorage (size %d) too small: used %d, need %d\n",
-                cs->fullsize, cs->used, size);
-        exit(1);
-    }
+    if (cs->fullsize - cs->used < size)
+        return 0;
+
     return cs->buf + cs->used;
 }
 
@@ -17,6 +17,7 @@
  * along with DBrew.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "alloc.h"
 #include "common.h"
 
 #include <assert.h>
@@ -30,30 +31,49 @@ void cc_init(CaptureConfig* cc)
         initMetaState(&(cc->par_state[i]), CS_DYNAMIC);
     for(int i=0; i < CC_MAXPARAM; i++)
         cc->par_name[i] = 0;
+    for(int i=0; i < CC_MAXPARAM; i++)
+        cc->par_width[i] = 8;
     for(int i=0; i < CC_MAXCALLDEPTH; i++)
         cc->force_unknown[i] = false;
     cc->hasReturnFP = false;
     cc->parCount = -1; // unknown
     cc->branches_known = false;
+    cc->widen_states = 0;
+    cc->unroll_factor = 0;
     cc->range_configs = 0;
+    cc->loop_configs = 0;
 
 }
 
+// release memory of configurations referenced from <cc>
 static
-void cc_free(CaptureConfig* cc)
+void cc_clear(CaptureConfig* cc)
 {
-    if (!cc) return;
-
     for(int i=0; i < CC_MAXPARAM; i++)
         free(cc->par_name[i]);
 
     MemRangeConfig* fc = cc->range_configs;
     while(fc) {
         MemRangeConfig* next = fc->next;
-        free(fc);
+        free(fc->name);
+        memFree(0, fc);
         fc = next;
     }
-    free(cc);
+    LoopConfig* lc = cc->loop_configs;
+    while(lc) {
+        LoopConfig* next = lc->next;
+        memFree(0, lc);
+        lc = next;
+    }
+}
+
+static
+void cc_free(CaptureConfig* cc)
+{
+    if (!cc) return;
+
+    cc_clear(cc);
+    memFree(0, cc);
 }
 
 static
@@ -61,7 +81,7 @@ CaptureConfig* cc_new(void)
 {
     CaptureConfig* cc;
 
-    cc = (CaptureConfig*) malloc(sizeof(CaptureConfig));
+    cc = (CaptureConfig*) memAlloc(0, sizeof(CaptureConfig));
     cc_init(cc);
 
     return cc;
@@ -85,11 +105,11 @@ MemRangeConfig* mrc_new(MemRangeType type, char* name,
     MemRangeConfig* mrc;
 
     if (type == MR_Function) {
-        FunctionConfig* fc = (FunctionConfig*) malloc(sizeof(FunctionConfig));
+        FunctionConfig* fc = (FunctionConfig*) memAlloc(0, sizeof(FunctionConfig));
         mrc = (MemRangeConfig*) fc;
     }
     else
-        mrc = (MemRangeConfig*) malloc(sizeof(MemRangeConfig));
+        mrc = (MemRangeConfig*) memAlloc(0, sizeof(MemRangeConfig));
 
     mrc->type = type;
     mrc->name = (name == 0) ? 0 : strdup(name);
@@ -136,6 +156,17 @@ FunctionConfig* fc_get(CaptureConfig* cc, uint64_t func)
 
 // DBrew internal, called by other modules
 
+// unroll factor for loop with header at <header> (0/1: no unrolling)
+int config_loop_unroll(Rewriter* r, uint64_t header)
+{
+    CaptureConfig* cc = cc_get(r);
+    LoopConfig* lc;
+
+    for(lc = cc->loop_configs; lc != 0; lc = lc->next)
+        if (lc->header == header) return lc->unroll;
+    return cc->unroll_factor;
+}
+
 FunctionConfig* config_find_function(Rewriter* r, uint64_t f)
 {
     CaptureConfig* cc = cc_get(r);
@@ -147,6 +178,91 @@ FunctionConfig* config_find_function(Rewriter* r, uint64_t f)
     return 0;
 }
 
+// is <addr> in a memory range configured to contain constant data?
+bool config_is_constant(Rewriter* r, uint64_t addr)
+{
+    CaptureConfig* cc = cc_get(r);
+    return (mrc_find(cc, MR_ConstantData, addr) != 0);
+}
+
+// number of entries configured for jump table at <table> (0: unknown)
+int config_jumptable_entries(Rewriter* r, uint64_t table)
+{
+    CaptureConfig* cc = cc_get(r);
+    MemRangeConfig* mrc = mrc_find(cc, MR_JumpTable, table);
+
+    if (!mrc || (mrc->start != table)) return 0;
+    return mrc->size / 8;
+}
+
+// append the memory range configurations of rewriter <src> to <dst>
+void config_copy_ranges(Rewriter* dst, Rewriter* src)
+{
+    CaptureConfig *cc = cc_get(dst), *srcCC = cc_get(src);
+    MemRangeConfig *mrc, **last;
+
+    // keep order of range configurations, as first match is used
+    last = &(cc->range_configs);
+    while(*last) last = &((*last)->next);
+    for(mrc = srcCC->range_configs; mrc != 0; mrc = mrc->next) {
+        MemRangeConfig* copy = mrc_new(mrc->type, mrc->name,
+                                       mrc->start, mrc->size, 0, cc);
+        *last = copy;
+        last = &(copy->next);
+    }
+}
+
+// copy the configuration of rewriter <src> into rewriter <dst>
+void config_copy(Rewriter* dst, Rewriter* src)
+{
+    CaptureConfig *cc, *srcCC = cc_get(src);
+
+    if (dst->cc)
+        cc_free(dst->cc);
+    cc = cc_new();
+    dst->cc = cc;
+
+    for(int i=0; i < CC_MAXPARAM; i++) {
+        cc->par_state[i] = srcCC->par_state[i];
+        if (srcCC->par_name[i])
+            cc->par_name[i] = strdup(srcCC->par_name[i]);
+        cc->par_width[i] = srcCC->par_width[i];
+    }
+    for(int i=0; i < CC_MAXCALLDEPTH; i++)
+        cc->force_unknown[i] = srcCC->force_unknown[i];
+    cc->hasReturnFP = srcCC->hasReturnFP;
+    cc->parCount = srcCC->parCount;
+    cc->branches_known = srcCC->branches_known;
+    cc->widen_states = srcCC->widen_states;
+    cc->unroll_factor = srcCC->unroll_factor;
+
+    config_copy_ranges(dst, src);
+    for(LoopConfig* lc = srcCC->loop_configs; lc != 0; lc = lc->next) {
+        LoopConfig* copy = (LoopConfig*) memAlloc(0, sizeof(LoopConfig));
+        *copy = *lc;
+        copy->next = cc->loop_configs;
+        cc->loop_configs = copy;
+    }
+}
+
+// release configuration of <r> with everything it references
+void config_free(Rewriter* r)
+{
+    cc_free(r->cc);
+    r->cc = 0;
+}
+
+// reset configuration of <r> to defaults, keeping the allocated struct
+void config_reinit(Rewriter* r)
+{
+    if (r->cc == 0) {
+        r->cc = cc_new();
+        return;
+    }
+    cc_clear(r->cc);
+    cc_init(r->cc);
+}
+
 
 //---------------------------------------------------------------------
 // DBrew API functions for configuration
@@ -167,6 +283,15 @@ void dbrew_config_staticpar(Rewriter* r, int staticParPos)
     initMetaState(&(cc->par_state[staticParPos]), CS_STATIC2);
 }
 
+void dbrew_config_par_width(Rewriter* r, int par, int bytes)
+{
+    CaptureConfig* cc = cc_get(r);
+
+    assert((par >= 0) && (par < CC_MAXPARAM));
+    assert((bytes == 1) || (bytes == 2) || (bytes == 4) || (bytes == 8));
+    cc->par_width[par] = bytes;
+}
+
 void dbrew_config_par_setname(Rewriter* c, int par, char* name)
 {
     CaptureConfig* cc = cc_get(c);
@@ -209,10 +334,39 @@ void dbrew_config_branches_known(Rewriter* r, bool b)
     cc->branches_known = b;
 }
 
+void dbrew_config_widening(Rewriter* r, int n)
+{
+    CaptureConfig* cc = cc_get(r);
+    cc->widen_states = n;
+}
+
+void dbrew_config_unroll(Rewriter* r, int factor)
+{
+    CaptureConfig* cc = cc_get(r);
+    cc->unroll_factor = factor;
+}
+
+void dbrew_config_loop_unroll(Rewriter* r, uint64_t header, int factor)
+{
+    CaptureConfig* cc = cc_get(r);
+    LoopConfig* lc;
+
+    for(lc = cc->loop_configs; lc != 0; lc = lc->next)
+        if (lc->header == header) break;
+    if (!lc) {
+        lc = (LoopConfig*) memAlloc(0, sizeof(LoopConfig));
+        lc->header = header;
+        lc->next = cc->loop_configs;
+        cc->loop_configs = lc;
+    }
+    lc->unroll = factor;
+}
+
 void dbrew_config_function_setname(Rewriter* r, uint64_t f, const char* name)
 {
     CaptureConfig* cc = cc_get(r);
     FunctionConfig* fc = fc_get(cc, f);
+    free(fc->name);
     fc->name = strdup(name);
 }
 
@@ -235,3 +389,12 @@ void dbrew_config_set_memrange(Rewriter* r, char* name, bool isWritable,
                   name, start, size, cc->range_configs, cc);
     cc->range_configs = mrc;
 }
+
+void dbrew_config_jumptable(Rewriter* r, uint64_t table, int entries)
+{
+    MemRangeConfig* mrc;
+    CaptureConfig* cc = cc_get(r);
+
+    mrc = mrc_new(MR_JumpTable, 0, table, entries * 8, cc->range_configs, cc);
+    cc->range_configs = mrc;
+}
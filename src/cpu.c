@@ -0,0 +1,187 @@
+/**
+ * This file is part of DBrew, the dynamic binary rewriting library.
+ *
+ * (c) 2016, Josef Weidendorfer <josef.weidendorfer@gmx.de>
+ *
+ * DBrew is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License (LGPL)
+ * as published by the Free Software Foundation, either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * DBrew is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with DBrew.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "cpu.h"
+
+#include <assert.h>
+#include <cpuid.h>
+#include <string.h>
+
+#include "buffers.h"
+#include "engine.h"
+#include "perfmap.h"
+
+/*
+ * CPU feature model
+ *
+ * Code generation and optimization passes check the features configured
+ * for a rewriter (default: features of the running CPU) before using
+ * instructions beyond x86-64 baseline (SSE2).
+ *
+ * With multi-versioning, the function is rewritten once per feature level
+ * allowed. A stub generated after the versions checks the features of the
+ * executing CPU and jumps to the best version, with the baseline version
+ * always last:
+ *
+ *   movabs $hostFeatures, %r11
+ *   mov (%r11), %r11d
+ *   and $level, %r11d
+ *   cmp $level, %r11d
+ *   jne next
+ *   movabs $version, %r11
+ *   jmp *%r11
+ * next: ...
+ */
+
+// marks features to be detected already
+#define CF_Detected (1u << 31)
+
+static uint32_t hostFeatures = 0;
+
+uint32_t hostCpuFeatures(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    uint32_t f;
+
+    f = __atomic_load_n(&hostFeatures, __ATOMIC_RELAXED);
+    if (f) return f & ~CF_Detected;
+
+    // checks for AVX include OS support for saving upper register parts
+    f = CF_Detected;
+    if (__builtin_cpu_supports("avx"))    f |= CF_AVX;
+    if (__builtin_cpu_supports("avx2"))   f |= CF_AVX2;
+    if (__builtin_cpu_supports("fma"))    f |= CF_FMA;
+    if (__builtin_cpu_supports("bmi"))    f |= CF_BMI1;
+    if (__builtin_cpu_supports("bmi2"))   f |= CF_BMI2;
+    if (__builtin_cpu_supports("popcnt")) f |= CF_POPCNT;
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512dq"))
+        f |= CF_AVX512;
+    // LZCNT (ABM) is not known to __builtin_cpu_supports
+    if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && (ecx & (1 << 5)))
+        f |= CF_LZCNT;
+
+    __atomic_store_n(&hostFeatures, f, __ATOMIC_RELAXED);
+    return f & ~CF_Detected;
+}
+
+// feature levels, best first. Baseline must be last
+static uint32_t cpuLevel[] = { CPU_LEVEL_AVX512, CPU_LEVEL_AVX2, 0 };
+#define CPU_LEVELS (int)(sizeof(cpuLevel) / sizeof(cpuLevel[0]))
+
+// byte sizes of stub code
+#define STUB_CHECKSIZE 29 // movabs, mov, and, cmp, jne
+#define STUB_JMPSIZE   13 // movabs, jmp
+
+// 'movabs $v, %r11'
+static
+uint8_t* emitMovR11(uint8_t* buf, uint64_t v)
+{
+    buf[0] = 0x49;
+    buf[1] = 0xBB;
+    *(uint64_t*)(buf + 2) = v;
+    return buf + 10;
+}
+
+// jump to <target> if executing CPU supports features <req>
+static
+uint8_t* emitCheckedJmp(uint8_t* buf, uint32_t req, uint64_t target)
+{
+    static const uint8_t load[] = { 0x45, 0x8B, 0x1B };  // mov (%r11),%r11d
+    static const uint8_t jmp[] = { 0x41, 0xFF, 0xE3 };   // jmp *%r11
+
+    if (req) {
+        buf = emitMovR11(buf, (uint64_t) &hostFeatures);
+        memcpy(buf, load, 3);
+        buf += 3;
+        // and $req, %r11d; cmp $req, %r11d; jne next
+        buf[0] = 0x41; buf[1] = 0x81; buf[2] = 0xE3;
+        *(uint32_t*)(buf + 3) = req;
+        buf[7] = 0x41; buf[8] = 0x81; buf[9] = 0xFB;
+        *(uint32_t*)(buf + 10) = req;
+        buf[14] = 0x75;
+        buf[15] = STUB_JMPSIZE;
+        buf += 16;
+    }
+    buf = emitMovR11(buf, target);
+    memcpy(buf, jmp, 3);
+    return buf + 3;
+}
+
+Error* rewriteVersions(Rewriter* r, uint64_t* par)
+{
+    uint32_t features = r->cpuFeatures;
+    bool appendCode = r->appendCode;
+    uint32_t req[CPU_LEVELS];
+    uint64_t addr[CPU_LEVELS];
+    uint8_t *buf0, *buf;
+    Error* re = 0;
+    int i, n = 0, size;
+
+    // stub may be run before any other use of the feature model
+    hostCpuFeatures();
+
+    r->multiVersion = false;
+    for(i = 0; i < CPU_LEVELS; i++) {
+        uint32_t f = cpuLevel[i] & features;
+
+        // same features as previous level: no separate version needed
+        if ((n > 0) && (req[n-1] == f)) continue;
+
+        r->cpuFeatures = f;
+        re = rewritePars(r, par);
+        if (re) {
+            // only the baseline version is required
+            if (f == 0) break;
+            logError(re, (char*) "Skipping version for CPU feature level");
+            re = 0;
+            continue;
+        }
+        // keep code of previous versions
+        r->appendCode = true;
+
+        req[n] = f;
+        addr[n] = r->generatedCodeAddr;
+        n++;
+    }
+    r->multiVersion = true;
+    r->cpuFeatures = features;
+    r->appendCode = appendCode;
+    if (re) return re;
+
+    // baseline version is last
+    assert((n > 0) && (req[n-1] == 0));
+    size = (n - 1) * STUB_CHECKSIZE + n * STUB_JMPSIZE;
+    if (reserveCodeStorage(r->cs, size) == 0) {
+        setError(&(r->error), ET_BufferOverflow, EM_Rewriter, r,
+                 "no space for multi-version stub");
+        return &(r->error);
+    }
+    buf0 = useCodeStorage(r->cs, size);
+    buf = buf0;
+    for(i = 0; i < n; i++)
+        buf = emitCheckedJmp(buf, req[i], addr[i]);
+    assert(buf - buf0 == size);
+
+    perfRegisterCode(r, (uint64_t) buf0, size);
+    r->generatedCodeAddr = (uint64_t) buf0;
+    r->generatedCodeSize = size;
+    return 0;
+}
@@ -23,9 +23,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
+#include "alloc.h"
 #include "buffers.h"
 #include "common.h"
+#include "cpu.h"
 #include "instr.h"
 #include "printer.h"
 #include "decode.h"
@@ -72,12 +75,17 @@ void dbrew_decode_print(Rewriter* r, uint64_t f, int count)
 void dbrew_set_decoding_capacity(Rewriter* r,
                                  int instrCapacity, int bbCapacity)
 {
+    // keep buffers if capacities do not change
+    if ((r->decInstrCapacity == instrCapacity) &&
+        (r->decBBCapacity == bbCapacity))
+        return;
+
     r->decInstrCapacity = instrCapacity;
-    free(r->decInstr);
+    memFree(r, r->decInstr);
     r->decInstr = 0;
 
     r->decBBCapacity = bbCapacity;
-    free(r->decBB);
+    memFree(r, r->decBB);
     r->decBB = 0;
 }
 
@@ -85,30 +93,200 @@ void dbrew_set_capture_capacity(Rewriter* r,
                                 int instrCapacity, int bbCapacity,
                                 int codeCapacity)
 {
-    r->capInstrCapacity = instrCapacity;
-    free(r->capInstr);
-    r->capInstr = 0;
+    if (r->capInstrCapacity != instrCapacity) {
+        r->capInstrCapacity = instrCapacity;
+        memFree(r, r->capInstr);
+        r->capInstr = 0;
+    }
+
+    if (r->capBBCapacity != bbCapacity) {
+        r->capBBCapacity = bbCapacity;
+        memFree(r, r->capBB);
+        r->capBB = 0;
+    }
+
+    if (r->capCodeCapacity != codeCapacity) {
+        if (r->cs)
+            freeCodeStorage(r->cs);
+        r->cs = 0;
+        r->capCodeCapacity = codeCapacity;
+    }
+}
 
-    r->capBBCapacity = bbCapacity;
-    free(r->capBB);
-    r->capBB = 0;
+void dbrew_set_code_placement(Rewriter* r, bool nearCode, bool hugePages)
+{
+    r->nearCode = nearCode;
+    r->hugeCode = hugePages;
 
-    if (r->cs)
+    // installed code must stay valid
+    if (r->cs && (r->installAddr == 0)) {
         freeCodeStorage(r->cs);
-    r->cs = 0;
-    r->capCodeCapacity = codeCapacity;
+        r->cs = allocCodeStorage(r, r->capCodeCapacity);
+        r->generatedCodeAddr = 0;
+        r->generatedCodeSize = 0;
+    }
+}
+
+
+bool dbrew_set_allocator(Rewriter* r, DBrewAllocator* a)
+{
+    if (a && !allocatorValid(a)) {
+        setError(&(r->error), ET_InvalidRequest, EM_Rewriter, r,
+                 "alloc and free hooks must be set together");
+        logError(&(r->error), (char*) "Allocator not changed");
+        return false;
+    }
+
+    releaseBuffers(r);
+    if (r->cs && (r->installAddr == 0)) {
+        // code storage knows how to release its memory
+        freeCodeStorage(r->cs);
+        r->cs = 0;
+    }
+    if (a)
+        r->allocator = *a;
+    else
+        memset(&(r->allocator), 0, sizeof(DBrewAllocator));
+    // reallocate with new hooks
+    if (r->func)
+        initRewriter(r);
+    return true;
+}
+
+void dbrew_set_shared_decode_cache(Rewriter* r, bool b)
+{
+    r->sharedDecodeCache = b;
+}
+
+static
+void addStats(DBrewStats* s, DBrewStats* add)
+{
+    s->decodedInstrs += add->decodedInstrs;
+    s->emulatedInstrs += add->emulatedInstrs;
+    s->capturedInstrs += add->capturedInstrs;
+    s->createdCBBs += add->createdCBBs;
+    s->savedStates += add->savedStates;
+    s->generatedBytes += add->generatedBytes;
+    s->decodeCacheHits += add->decodeCacheHits;
+    s->decodeCacheMisses += add->decodeCacheMisses;
+    s->rewrites += add->rewrites;
+    s->fallbacks += add->fallbacks;
+    s->decodeNs += add->decodeNs;
+    s->emulateNs += add->emulateNs;
+    s->optNs += add->optNs;
+    s->generateNs += add->generateNs;
+    s->totalNs += add->totalNs;
+}
+
+void dbrew_get_stats(Rewriter* r, DBrewStats* s)
+{
+    *s = r->stats;
+    for(int i = 0; i < r->workerCount; i++)
+        if (r->worker[i])
+            addStats(s, &(r->worker[i]->stats));
+}
+
+void dbrew_reset_stats(Rewriter* r)
+{
+    memset(&(r->stats), 0, sizeof(DBrewStats));
+    for(int i = 0; i < r->workerCount; i++)
+        if (r->worker[i])
+            memset(&(r->worker[i]->stats), 0, sizeof(DBrewStats));
+}
+
+void dbrew_set_perf_output(Rewriter* r, bool perfMap, bool jitdump)
+{
+    r->perfMap = perfMap;
+    r->perfJitdump = jitdump;
+}
+
+void dbrew_set_budget(Rewriter* r, uint64_t maxEmulated, uint64_t maxCaptured,
+                      int maxCodeBytes, uint64_t maxTimeUs)
+{
+    r->budgetEmulated = maxEmulated;
+    r->budgetCaptured = maxCaptured;
+    r->budgetCodeBytes = maxCodeBytes;
+    r->budgetTimeNs = maxTimeUs * 1000;
+}
+
+void dbrew_set_budget_degrade(Rewriter* r, bool b)
+{
+    r->budgetDegrade = b;
+}
+
+void dbrew_set_strength_reduction(Rewriter* r, bool b)
+{
+    r->doStrengthReduction = b;
+}
+
+void dbrew_set_peephole(Rewriter* r, bool b)
+{
+    r->doPeephole = b;
+}
+
+void dbrew_set_value_numbering(Rewriter* r, bool b)
+{
+    r->doValueNumbering = b;
+}
+
+void dbrew_set_if_conversion(Rewriter* r, bool b, int maxInstr)
+{
+    r->doIfConversion = b;
+    r->ifConvMax = maxInstr;
+}
+
+void dbrew_set_vex_transcoding(Rewriter* r, bool b)
+{
+    r->doVexTranscoding = b;
+}
+
+uint32_t dbrew_cpu_features(void)
+{
+    return hostCpuFeatures();
 }
 
+void dbrew_set_cpu_features(Rewriter* r, uint32_t f)
+{
+    r->cpuFeatures = f;
+}
+
+void dbrew_set_fp_contract(Rewriter* r, bool b)
+{
+    r->doFpContract = b;
+}
+
+void dbrew_set_multiversion(Rewriter* r, bool b)
+{
+    r->multiVersion = b;
+}
+
+DBrewBudgetLimit dbrew_budget_exceeded(Rewriter* r)
+{
+    return r->budgetExceeded;
+}
 
 void dbrew_set_function(Rewriter* rewriter, uint64_t f)
 {
-    rewriter->func = f;
+    dbrew_reuse(rewriter, f, false);
+}
 
-    // reset all decoding/state
-    initRewriter(rewriter);
-    dbrew_config_reset(rewriter);
+void dbrew_reuse(Rewriter* r, uint64_t f, bool keepConfig)
+{
+    r->func = f;
 
-    freeEmuState(rewriter);
+    // code storage near the previous function may be out of reach of <f>:
+    // get new one near <f>, falling back to any address
+    if (r->cs && !r->appendCode && r->nearCode && (r->installAddr == 0) &&
+        !r->cs->provided && !isCodeStorageNear(r->cs, f)) {
+        freeCodeStorage(r->cs);
+        r->cs = 0;
+    }
+
+    // reset all decoding/state, keeping allocated buffers
+    initRewriter(r);
+    if (!keepConfig)
+        config_reinit(r);
+    r->budgetExceeded = BL_None;
 }
 
 void dbrew_verbose(Rewriter* rewriter,
@@ -142,8 +320,10 @@ int dbrew_generated_size(Rewriter* r)
 int dbrew_set_vectorsize(Rewriter* r, int s)
 {
     int m = maxVectorBytes();
+    if (!(r->cpuFeatures & CF_AVX512) && (m > 32)) m = 32;
+    if (!(r->cpuFeatures & CF_AVX)) m = 16;
     if (s > m) s = m;
-    assert((s == 16) || (s==32));
+    assert((s == 16) || (s == 32) || (s == 64));
 
     r->vectorsize = s;
     return s;
@@ -186,24 +366,16 @@ uint64_t dbrew_rewrite(Rewriter* r, ...)
 {
     va_list argptr;
     Error* e;
+    uint64_t par[6];
+    uint64_t t0 = timeNs();
 
     va_start(argptr, r);
-    e = vEmulateAndCapture(r, argptr);
+    e = vGetPars(r, argptr, par);
     va_end(argptr);
 
-    if (!e) {
-        RContext c;
-        c.r = r;
-        c.e = 0;
-
-        if (r->vreq != VR_None)
-            runVectorization(&c);
-        if (!c.e)
-            runOptsOnCaptured(&c);
-        if (!c.e)
-            generateBinaryFromCaptured(&c);
-        e = c.e;
-    }
+    if (!e)
+        e = rewritePars(r, par);
+    statsRewriteDone(r, t0, e);
 
     if (e) {
         // on error, return original function
@@ -219,24 +391,19 @@ uint64_t dbrew_rewrite_func(uint64_t f, ...)
     Rewriter* r;
     va_list argptr;
     Error* e;
+    uint64_t par[6];
+    uint64_t t0 = timeNs();
 
     r = getDefaultRewriter();
     dbrew_set_function(r, f);
 
     va_start(argptr, f);
-    e = vEmulateAndCapture(r, argptr);
+    e = vGetPars(r, argptr, par);
     va_end(argptr);
 
-    if (!e) {
-        RContext c;
-        c.r = r;
-        c.e = 0;
-
-        runOptsOnCaptured(&c);
-        if (!c.e)
-            generateBinaryFromCaptured(&c);
-        e = c.e;
-    }
+    if (!e)
+        e = rewritePars(r, par);
+    statsRewriteDone(r, t0, e);
 
     if (e) {
         // on error, return original function
@@ -31,6 +31,7 @@
 #include "decode.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
@@ -53,6 +54,9 @@ struct _DContext {
     // decoded prefixes
     VexPrefix vex;
     int vex_vvvv; // vex register specifier
+    int vexMap; // opcode map with VEX/EVEX: 1 for 0x0F, 2 for 0x0F38
+    bool evexBad; // EVEX prefix with unsupported features (masking, ...)
+    int disp8N; // scaling of 8bit displacements (EVEX compressed disp8)
     bool hasRex;
     int rex; // REX prefix
     PrefixSet ps; // detected prefix set
@@ -72,6 +76,7 @@ struct _DContext {
     // decoding result
     bool exit;   // control flow change instruction detected
     DecodeError error; // if not-null, an decoding error was detected
+    char errorDesc[64]; // description of error
 };
 
 // returns 0 if decoding buffer full
@@ -105,11 +110,9 @@ Instr* nextInstrForDContext(Rewriter* r, DContext* c)
     Instr* i = nextInstr(r, c->iaddr, len);
 
     if (!i) {
-        static char buf[64];
-
-        sprintf(buf, "decode buffer full (size: %d instrs)",
+        sprintf(c->errorDesc, "decode buffer full (size: %d instrs)",
                     r->decInstrCapacity);
-        setDecodeError(&(c->error), c->r, buf, ET_BufferOverflow,
+        setDecodeError(&(c->error), c->r, c->errorDesc, ET_BufferOverflow,
                        c->dbb, c->off);
     }
 
@@ -312,7 +315,7 @@ void parseModRM(DContext* cxt, ValType vt, RegTypes rts,
     disp = 0;
     if (hasDisp8) {
         // 8bit disp: sign extend
-        disp = *((signed char*) (cxt->f + cxt->off));
+        disp = *((signed char*) (cxt->f + cxt->off)) * cxt->disp8N;
         cxt->off++;
     }
     if (hasDisp32) {
@@ -430,6 +433,7 @@ void decodeVex2(DContext* c, uint8_t b)
     }
     c->vex_vvvv = 15 - ((b >> 3) & 15);
     if ((b & 128) == 0) c->rex |= REX_MASK_R;
+    c->vexMap = 1;
     c->hasRex = true;
     c->opc1 = 0x0F;
 }
@@ -448,12 +452,39 @@ void decodeVex3(DContext* c, uint8_t b1, uint8_t b2)
     if ((b1 & 128) == 0) c->rex |= REX_MASK_R;
     if ((b1 &  64) == 0) c->rex |= REX_MASK_X;
     if ((b1 &  32) == 0) c->rex |= REX_MASK_B;
-    if ((b2 & 128) == 0) c->rex |= REX_MASK_W;
-    assert((b1 & 31) == 1); // 0x0F leading opcode
+    if (b2 & 128) c->rex |= REX_MASK_W; // not inverted
+    c->vexMap = b1 & 31; // leading opcode bytes, checked on table lookup
     c->hasRex = true;
     c->opc1 = 0x0F;
 }
 
+// EVEX prefix (AVX-512): only 512-bit operations on zmm0-15 without
+// masking, broadcast or embedded rounding are supported. Most supported
+// instructions work on full vectors, so disp8 by default is scaled by 64.
+static
+void decodeEvex(DContext* c, uint8_t p0, uint8_t p1, uint8_t p2)
+{
+    c->vex = VEX_512;
+    switch(p1 & 3) {
+    case 1: c->ps |= PS_66; break;
+    case 2: c->ps |= PS_F3; break;
+    case 3: c->ps |= PS_F2; break;
+    default: break;
+    }
+    c->vex_vvvv = 15 - ((p1 >> 3) & 15);
+    if ((p0 & 128) == 0) c->rex |= REX_MASK_R;
+    if ((p0 &  64) == 0) c->rex |= REX_MASK_X;
+    if ((p0 &  32) == 0) c->rex |= REX_MASK_B;
+    if (p1 & 128) c->rex |= REX_MASK_W;
+    c->vexMap = p0 & 3;
+    c->hasRex = true;
+    c->opc1 = 0x0F;
+    c->disp8N = 64;
+
+    // R' not set (inverted), V' not set, L'L = 2, no z/b/aaa
+    c->evexBad = ((p0 & 0x1C) != 0x10) || ((p1 & 4) == 0) || (p2 != 0x48);
+}
+
 
 // possible prefixes:
 // - REX: bits extended 64bit architecture
@@ -470,6 +501,9 @@ void decodePrefixes(DContext* cxt)
     cxt->ps = PS_No;
     cxt->vex = VEX_No;
     cxt->vex_vvvv = -1;
+    cxt->vexMap = 0;
+    cxt->evexBad = false;
+    cxt->disp8N = 1;
     cxt->oe = OE_None;
 
     cxt->opc1 = -1;
@@ -493,6 +527,13 @@ void decodePrefixes(DContext* cxt)
             decodeVex3(cxt, b, cxt->f[cxt->off++]);
             break;
         }
+        else if (b == 0x62) {
+            // EVEX prefix (0x62 is no valid opcode in 64bit mode)
+            uint8_t* p = cxt->f + cxt->off + 1;
+            decodeEvex(cxt, p[0], p[1], p[2]);
+            cxt->off += 4;
+            break;
+        }
 
         if ((b >= 0x40) && (b <= 0x4F)) {
             cxt->rex = b & 15;
@@ -544,6 +585,10 @@ static OpcInfo opcTable[256];
 static OpcInfo opcTable0F[256];
 static OpcInfo opcTable0F_V128[256];
 static OpcInfo opcTable0F_V256[256];
+static OpcInfo opcTable0F_V512[256];
+static OpcInfo opcTable0F38_V128[256];
+static OpcInfo opcTable0F38_V256[256];
+static OpcInfo opcTable0F38_V512[256];
 
 #define OPCENTRY_SIZE 1000
 static OpcEntry opcEntry[OPCENTRY_SIZE];
@@ -566,9 +611,22 @@ int setOpcInfo(VexPrefix vp, int opc, OpcType t)
             oi = &(opcTable0F_V128[opc - 0x0F00]);
         else if (vp == VEX_256)
             oi = &(opcTable0F_V256[opc - 0x0F00]);
+        else if (vp == VEX_512)
+            oi = &(opcTable0F_V512[opc - 0x0F00]);
         else
             oi = &(opcTable0F[opc - 0x0F00]);
     }
+    else if ((opc>=0x0F3800) && (opc<=0x0F38FF)) {
+        // only VEX/EVEX encoded opcodes supported in map 0x0F38
+        if (vp == VEX_128)
+            oi = &(opcTable0F38_V128[opc - 0x0F3800]);
+        else if (vp == VEX_256)
+            oi = &(opcTable0F38_V256[opc - 0x0F3800]);
+        else if (vp == VEX_512)
+            oi = &(opcTable0F38_V512[opc - 0x0F3800]);
+        else
+            assert(0); // never should happen
+    }
     else assert(0); // never should happen
 
     if (oi->t == OT_Invalid) {
@@ -648,7 +706,7 @@ OpcEntry* setOpcPV(VexPrefix vp, int opc, PrefixSet ps,
         OpcEntry* e;
         e = getOpcEntry(VEX_128, opc, OT_Four, off);
         initOpcEntry(e, it, vt, h1, h2, h3);
-        e = getOpcEntry(VEX_128, opc, OT_Four, off);
+        e = getOpcEntry(VEX_256, opc, OT_Four, off);
         initOpcEntry(e, it, vt, h1, h2, h3);
         return 0; // return 0 with VEX_LIG request, to catch wrong use
     }
@@ -714,7 +772,7 @@ OpcEntry* setOpcGH(int opc, int digit, DecHandler h)
 static
 void markDecodeError(DContext* c, bool showDigit, ErrorType et)
 {
-    static char buf[64];
+    char* buf = c->errorDesc;
     int o = 0;
 
     switch(et) {
@@ -730,6 +788,7 @@ void markDecodeError(DContext* c, bool showDigit, ErrorType et)
 
     if (c->vex == VEX_128) o += sprintf(buf+o, " Vex128");
     if (c->vex == VEX_256) o += sprintf(buf+o, " Vex256");
+    if (c->vex == VEX_512) o += sprintf(buf+o, " Evex512");
 
     if (c->ps & PS_66) o += sprintf(buf+o, " 0x66");
     if (c->ps & PS_F2) o += sprintf(buf+o, " 0xF2");
@@ -823,14 +882,33 @@ static void parseMR(DContext* c)
     parseModRM(c, c->vt, RTS_G_G, &c->o1, &c->o2, 0);
 }
 
+// register types for 2 vector operands of given width
+static RegTypes vRegTypes(ValType vt)
+{
+    switch(vt) {
+    case VT_128: return RTS_VX_VX;
+    case VT_256: return RTS_VY_VY;
+    case VT_512: return RTS_VZ_VZ;
+    default: assert(0);
+    }
+    return RTS_Invalid;
+}
+
+// with EVEX, X extends r/m to zmm16-31 for register operands: unsupported
+static void checkEvexRM(DContext* c, Operand* o)
+{
+    if ((c->vex == VEX_512) && opIsReg(o) && (c->rex & REX_MASK_X))
+        markDecodeError(c, false, ET_BadOperands);
+}
+
 // RM encoding for 2 vector registers, remember encoding for pass-through
 static void parseRMVV(DContext* c)
 {
     // for parseModRM use VT_128 (MMX) if operand type is VT_32/VT_64
     ValType vt = c->vt;
     if ((vt == VT_32) || (vt == VT_64)) vt = VT_128;
-    RegTypes rts = (vt == VT_128) ? RTS_VX_VX : RTS_VY_VY;
-    parseModRM(c, vt, rts, &c->o2, &c->o1, 0);
+    parseModRM(c, vt, vRegTypes(vt), &c->o2, &c->o1, 0);
+    checkEvexRM(c, &c->o2);
     c->oe = OE_RM;
 }
 
@@ -840,11 +918,28 @@ static void parseMRVV(DContext* c)
     // for parseModRM use VT_128 (MMX) if operand type is VT_32/VT_64
     ValType vt = c->vt;
     if ((vt == VT_32) || (vt == VT_64)) vt = VT_128;
-    RegTypes rts = (vt == VT_128) ? RTS_VX_VX : RTS_VY_VY;
-    parseModRM(c, vt, rts, &c->o1, &c->o2, 0);
+    parseModRM(c, vt, vRegTypes(vt), &c->o1, &c->o2, 0);
+    checkEvexRM(c, &c->o1);
     c->oe = OE_MR;
 }
 
+// RM encoding for 2 vector registers with 8bit immediate in op 3
+static void parseRMVVI(DContext* c)
+{
+    parseRMVV(c);
+    parseImm(c, VT_8, &c->o3, false);
+    c->oe = OE_RMI;
+}
+
+// RVMI encoding with 8bit immediate (AVX): only the destructive form with
+// VEX vvvv being the destination is supported, represented as RMI
+static void parseRVMI(DContext* c)
+{
+    parseRMVVI(c);
+    if ((int) regVIndex(c->o1.reg) != c->vex_vvvv)
+        markDecodeError(c, false, ET_BadOperands);
+}
+
 // RVM ternary encoding for 3 vector registers (AVX)
 static void parseRVM(DContext* c)
 {
@@ -862,10 +957,15 @@ static void parseRVM(DContext* c)
         rts = RTS_VY_VY;
         c->o2.type = OT_Reg256;
         c->o2.reg = getReg(RT_YMM, c->vex_vvvv);
+    } else if (c->vt == VT_512) {
+        rts = RTS_VZ_VZ;
+        c->o2.type = OT_Reg512;
+        c->o2.reg = getReg(RT_ZMM, c->vex_vvvv);
     } else
         assert(0);
 
     parseModRM(c, vt, rts, &c->o3, &c->o1, 0);
+    checkEvexRM(c, &c->o3);
     c->oe = OE_RVM;
 }
 
@@ -960,8 +1060,56 @@ static void reqExit(DContext* c)
 // attach pass-through information
 static void attach(DContext* c)
 {
-    attachPassthrough(c->ii, c->vex,
-                      c->ps, c->oe, SC_None, c->opc1, c->opc2, -1);
+    if (c->vexMap == 2)
+        attachPassthrough(c->ii, c->vex,
+                          c->ps, c->oe, SC_None, 0x0F, 0x38, c->opc2);
+    else
+        attachPassthrough(c->ii, c->vex,
+                          c->ps, c->oe, SC_None, c->opc1, c->opc2, -1);
+}
+// vbroadcastss/vbroadcastsd vector,m32/m64 (RM): register sources (AVX2)
+// are not supported. With EVEX, W must match the element size, and disp8
+// is scaled by the element size
+static void parseBroadcast(DContext* c)
+{
+    bool sd = (c->it == IT_VBROADCASTSD);
+    bool w = (c->rex & REX_MASK_W) != 0;
+
+    if ((c->vex == VEX_512) ? (w != sd) : w) {
+        markDecodeError(c, false, ET_BadPrefix);
+        return;
+    }
+    if (c->vex == VEX_512) c->disp8N = sd ? 8 : 4;
+    parseRMVV(c);
+    if (isErrorSet(&(c->error.e))) return;
+    if (!opIsInd(&(c->o2))) {
+        markDecodeError(c, false, ET_BadOperands);
+        return;
+    }
+    if (w) c->ps |= PS_REXW; // keep EVEX.W1 for pass-through
+}
+
+// opcode table for VEX/EVEX prefix <vp> with opcode map <map>, 0 if not
+// supported
+static OpcInfo* vexOpcTable(VexPrefix vp, int map)
+{
+    if (map == 1) {
+        switch(vp) {
+        case VEX_128: return opcTable0F_V128;
+        case VEX_256: return opcTable0F_V256;
+        case VEX_512: return opcTable0F_V512;
+        default: break;
+        }
+    }
+    else if (map == 2) {
+        switch(vp) {
+        case VEX_128: return opcTable0F38_V128;
+        case VEX_256: return opcTable0F38_V256;
+        case VEX_512: return opcTable0F38_V512;
+        default: break;
+        }
+    }
+    return 0;
 }
 
 
@@ -1123,11 +1271,20 @@ void decode0F_29(DContext* c)
 static
 void decode0F_2E(DContext* c)
 {
-    assert(c->ps & PS_66);
-    // ucomisd xmm1,xmm2/m64 (RM)
-    parseModRM(c, VT_64, RTS_VX_VX, &c->o2, &c->o1, 0);
-    c->ii = addBinaryOp(c->r, c, IT_UCOMISD, VT_Implicit, &c->o1, &c->o2);
-    attachPassthrough(c->ii, VEX_No, PS_66, OE_RM, SC_None, 0x0F, 0x2E, -1);
+    switch(c->ps) {
+    case PS_66:
+        // ucomisd xmm1,xmm2/m64 (RM)
+        parseModRM(c, VT_64, RTS_VX_VX, &c->o2, &c->o1, 0);
+        c->ii = addBinaryOp(c->r, c, IT_UCOMISD, VT_Implicit, &c->o1, &c->o2);
+        break;
+    case PS_No:
+        // ucomiss xmm1,xmm2/m32 (RM)
+        parseModRM(c, VT_32, RTS_VX_VX, &c->o2, &c->o1, 0);
+        c->ii = addBinaryOp(c->r, c, IT_UCOMISS, VT_Implicit, &c->o1, &c->o2);
+        break;
+    default: markDecodeError(c, false, ET_BadPrefix); return;
+    }
+    attachPassthrough(c->ii, VEX_No, c->ps, OE_RM, SC_None, 0x0F, 0x2E, -1);
 }
 
 // 0x40: cmovo   r,r/m 16/32/64
@@ -1290,6 +1447,15 @@ void decode0F_80(DContext* c)
     c->exit = true;
 }
 
+// 0x90-0x9F: setcc r/m8, conditions in same order as jcc
+static
+void decode0F_90(DContext* c)
+{
+    c->it = IT_SETO + (c->opc2 & 0xf);
+    parseModRM(c, VT_8, RTS_G, &c->o1, 0, 0);
+    c->ii = addUnaryOp(c->r, c, c->it, &c->o1);
+}
+
 static
 void decode0F_B6(DContext* c)
 {
@@ -1874,18 +2040,17 @@ void decode_FF(DContext* c)
 }
 
 static
-void initDecodeTables(void)
+void fillDecodeTables(void)
 {
-    static bool done = false;
-    // initialize only once
-    if (done) return;
-    done = true;
-
     for(int i = 0; i<256; i++) {
         opcTable[i].t        = OT_Invalid;
         opcTable0F[i].t      = OT_Invalid;
         opcTable0F_V128[i].t = OT_Invalid;
         opcTable0F_V256[i].t = OT_Invalid;
+        opcTable0F_V512[i].t = OT_Invalid;
+        opcTable0F38_V128[i].t = OT_Invalid;
+        opcTable0F38_V256[i].t = OT_Invalid;
+        opcTable0F38_V512[i].t = OT_Invalid;
     }
 
     // 0x00: add r/m8,r8 (MR, dst: r/m, src: r)
@@ -2175,6 +2340,10 @@ void initDecodeTables(void)
     setOpcPV(VEX_256, 0x0F10, PS_No, IT_VMOVUPS, VT_256, parseRMVV, addBInsImp, attach);
     setOpcPV(VEX_256, 0x0F10, PS_66, IT_VMOVUPD, VT_256, parseRMVV, addBInsImp, attach);
 
+    // EVEX.512.0F/66.0F 10: vmovups/vmovupd zmm1,zmm2/m512 (RM)
+    setOpcPV(VEX_512, 0x0F10, PS_No, IT_VMOVUPS, VT_512, parseRMVV, addBInsImp, attach);
+    setOpcPV(VEX_512, 0x0F10, PS_66, IT_VMOVUPD, VT_512, parseRMVV, addBInsImp, attach);
+
     // 0x0F11/No: movups xmm1/m128,xmm2 (MR)
     // 0x0F11/66: movupd xmm1/m128,xmm2 (MR)
     // 0x0F11/F3: movss xmm1/m32,xmm2 (MR)
@@ -2197,6 +2366,10 @@ void initDecodeTables(void)
     setOpcPV(VEX_256, 0x0F11, PS_No, IT_VMOVUPS, VT_256, parseMRVV, addBInsImp, attach);
     setOpcPV(VEX_256, 0x0F11, PS_66, IT_VMOVUPD, VT_256, parseMRVV, addBInsImp, attach);
 
+    // EVEX.512.0F/66.0F 11: vmovups/vmovupd zmm1/m512,zmm2 (MR)
+    setOpcPV(VEX_512, 0x0F11, PS_No, IT_VMOVUPS, VT_512, parseMRVV, addBInsImp, attach);
+    setOpcPV(VEX_512, 0x0F11, PS_66, IT_VMOVUPD, VT_512, parseMRVV, addBInsImp, attach);
+
     setOpcH(0x0F12, decode0F_12);
     setOpcH(0x0F13, decode0F_13);
     setOpcH(0x0F14, decode0F_14);
@@ -2216,6 +2389,10 @@ void initDecodeTables(void)
     setOpcPV(VEX_256, 0x0F28, PS_No, IT_VMOVAPS, VT_256, parseRMVV, addBInsImp, attach);
     setOpcPV(VEX_256, 0x0F28, PS_66, IT_VMOVAPD, VT_256, parseRMVV, addBInsImp, attach);
 
+    // EVEX.512.0F/66.0F 28: vmovaps/vmovapd zmm1,zmm2/m512 (RM)
+    setOpcPV(VEX_512, 0x0F28, PS_No, IT_VMOVAPS, VT_512, parseRMVV, addBInsImp, attach);
+    setOpcPV(VEX_512, 0x0F28, PS_66, IT_VMOVAPD, VT_512, parseRMVV, addBInsImp, attach);
+
     setOpcH(0x0F29, decode0F_29);
 
     // VEX.128.   0F.WIG 29: vmovaps xmm1/m128,xmm2 (MR)
@@ -2227,8 +2404,27 @@ void initDecodeTables(void)
     setOpcPV(VEX_256, 0x0F29, PS_No, IT_VMOVAPS, VT_256, parseMRVV, addBInsImp, attach);
     setOpcPV(VEX_256, 0x0F29, PS_66, IT_VMOVAPD, VT_256, parseMRVV, addBInsImp, attach);
 
+    // EVEX.512.0F/66.0F 29: vmovaps/vmovapd zmm1/m512,zmm2 (MR)
+    setOpcPV(VEX_512, 0x0F29, PS_No, IT_VMOVAPS, VT_512, parseMRVV, addBInsImp, attach);
+    setOpcPV(VEX_512, 0x0F29, PS_66, IT_VMOVAPD, VT_512, parseMRVV, addBInsImp, attach);
+
     setOpcH(0x0F2E, decode0F_2E);
 
+    // VEX.LIG.0F.WIG 2E:    vucomiss xmm1,xmm2/m32 (RM)
+    // VEX.LIG.66.0F.WIG 2E: vucomisd xmm1,xmm2/m64 (RM)
+    setOpcPV(VEX_LIG, 0x0F2E, PS_No, IT_VUCOMISS, VT_32, parseRMVV, addBInsImp, attach);
+    setOpcPV(VEX_LIG, 0x0F2E, PS_66, IT_VUCOMISD, VT_64, parseRMVV, addBInsImp, attach);
+
+    // VEX.128 0xF2 0x0F 0x12: vmovddup xmm1,xmm2/m64 (RM)
+    setOpcPV(VEX_128, 0x0F12, PS_F2, IT_VMOVDDUP, VT_128, parseRMVV, addBInsImp, attach);
+    // VEX/EVEX 0x66 0x0F38 0x18: vbroadcastss xmm/ymm/zmm,m32 (RM)
+    // VEX/EVEX 0x66 0x0F38 0x19: vbroadcastsd ymm/zmm,m64 (RM)
+    setOpcPV(VEX_128, 0x0F3818, PS_66, IT_VBROADCASTSS, VT_128, parseBroadcast, addBInsImp, attach);
+    setOpcPV(VEX_256, 0x0F3818, PS_66, IT_VBROADCASTSS, VT_256, parseBroadcast, addBInsImp, attach);
+    setOpcPV(VEX_512, 0x0F3818, PS_66, IT_VBROADCASTSS, VT_512, parseBroadcast, addBInsImp, attach);
+    setOpcPV(VEX_256, 0x0F3819, PS_66, IT_VBROADCASTSD, VT_256, parseBroadcast, addBInsImp, attach);
+    setOpcPV(VEX_512, 0x0F3819, PS_66, IT_VBROADCASTSD, VT_512, parseBroadcast, addBInsImp, attach);
+
     // 0x0F40-0x0F4F: cmovcc r,r/m 16/32/64
     setOpcH(0x0F40, decode0F_40);
     setOpcH(0x0F41, decode0F_40);
@@ -2256,6 +2452,24 @@ void initDecodeTables(void)
     setOpcP(0x0F51, PS_No, IT_SQRTPS, VT_128, parseRMVV, addBInsImp, attach);
     setOpcP(0x0F51, PS_66, IT_SQRTPD, VT_128, parseRMVV, addBInsImp, attach);
 
+    // VEX.NDS.LIG.F3.0F.WIG 51: vsqrtss xmm1,xmm2,xmm3/m32 (RVM)
+    // VEX.NDS.LIG.F2.0F.WIG 51: vsqrtsd xmm1,xmm2,xmm3/m64 (RVM)
+    setOpcPV(VEX_LIG, 0x0F51, PS_F3, IT_VSQRTSS, VT_32, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_LIG, 0x0F51, PS_F2, IT_VSQRTSD, VT_64, parseRVM, addTInsImp, attach);
+
+    // VEX.128.0F.WIG 51: vsqrtps xmm1,xmm2/m128 (RM)
+    // VEX.256.0F.WIG 51: vsqrtps ymm1,ymm2/m256 (RM)
+    // VEX.128.66.0F.WIG 51: vsqrtpd xmm1,xmm2/m128 (RM)
+    // VEX.256.66.0F.WIG 51: vsqrtpd ymm1,ymm2/m256 (RM)
+    setOpcPV(VEX_128, 0x0F51, PS_No, IT_VSQRTPS, VT_128, parseRMVV, addBInsImp, attach);
+    setOpcPV(VEX_256, 0x0F51, PS_No, IT_VSQRTPS, VT_256, parseRMVV, addBInsImp, attach);
+    setOpcPV(VEX_128, 0x0F51, PS_66, IT_VSQRTPD, VT_128, parseRMVV, addBInsImp, attach);
+    setOpcPV(VEX_256, 0x0F51, PS_66, IT_VSQRTPD, VT_256, parseRMVV, addBInsImp, attach);
+
+    // EVEX.512.0F/66.0F 51: vsqrtps/vsqrtpd zmm1,zmm2/m512 (RM)
+    setOpcPV(VEX_512, 0x0F51, PS_No, IT_VSQRTPS, VT_512, parseRMVV, addBInsImp, attach);
+    setOpcPV(VEX_512, 0x0F51, PS_66, IT_VSQRTPD, VT_512, parseRMVV, addBInsImp, attach);
+
     // 0x0F52/F3: rsqrtss xmm1,xmm2/m32 (RM)
     // 0x0F52/No: rsqrtps xmm1,xmm2/m128 (RM)
     setOpcP(0x0F52, PS_F3, IT_RSQRTSS, VT_32,  parseRMVV, addBInsImp, attach);
@@ -2271,16 +2485,55 @@ void initDecodeTables(void)
     setOpcP(0x0F54, PS_No, IT_ANDPS, VT_128, parseRMVV, addBInsImp, attach);
     setOpcP(0x0F54, PS_66, IT_ANDPD, VT_128, parseRMVV, addBInsImp, attach);
 
+    // VEX.NDS.128.0F.WIG 54: vandps xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.0F.WIG 54: vandps ymm1,ymm2,ymm3/m256 (RVM)
+    // VEX.NDS.128.66.0F.WIG 54: vandpd xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.66.0F.WIG 54: vandpd ymm1,ymm2,ymm3/m256 (RVM)
+    setOpcPV(VEX_128, 0x0F54, PS_No, IT_VANDPS, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F54, PS_No, IT_VANDPS, VT_256, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_128, 0x0F54, PS_66, IT_VANDPD, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F54, PS_66, IT_VANDPD, VT_256, parseRVM, addTInsImp, attach);
+
+    // EVEX.512.0F/66.0F 54: vandps/vandpd zmm1,zmm2,zmm3/m512 (RVM)
+    setOpcPV(VEX_512, 0x0F54, PS_No, IT_VANDPS, VT_512, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_512, 0x0F54, PS_66, IT_VANDPD, VT_512, parseRVM, addTInsImp, attach);
+
     // 0x0F55/No: andnps xmm1,xmm2/m128 (RM)
     // 0x0F55/66: andnpd xmm1,xmm2/m128 (RM)
     setOpcP(0x0F55, PS_No, IT_ANDNPS, VT_128, parseRMVV, addBInsImp, attach);
     setOpcP(0x0F55, PS_66, IT_ANDNPD, VT_128, parseRMVV, addBInsImp, attach);
 
+    // VEX.NDS.128.0F.WIG 55: vandnps xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.0F.WIG 55: vandnps ymm1,ymm2,ymm3/m256 (RVM)
+    // VEX.NDS.128.66.0F.WIG 55: vandnpd xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.66.0F.WIG 55: vandnpd ymm1,ymm2,ymm3/m256 (RVM)
+    setOpcPV(VEX_128, 0x0F55, PS_No, IT_VANDNPS, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F55, PS_No, IT_VANDNPS, VT_256, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_128, 0x0F55, PS_66, IT_VANDNPD, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F55, PS_66, IT_VANDNPD, VT_256, parseRVM, addTInsImp, attach);
+
+    // EVEX.512.0F/66.0F 55: vandnps/vandnpd zmm1,zmm2,zmm3/m512 (RVM)
+    setOpcPV(VEX_512, 0x0F55, PS_No, IT_VANDNPS, VT_512, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_512, 0x0F55, PS_66, IT_VANDNPD, VT_512, parseRVM, addTInsImp, attach);
+
     // 0x0F56/No: orps xmm1,xmm2/m128 (RM)
     // 0x0F56/66: orpd xmm1,xmm2/m128 (RM)
     setOpcP(0x0F56, PS_No, IT_ORPS, VT_128, parseRMVV, addBInsImp, attach);
     setOpcP(0x0F56, PS_66, IT_ORPD, VT_128, parseRMVV, addBInsImp, attach);
 
+    // VEX.NDS.128.0F.WIG 56: vorps xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.0F.WIG 56: vorps ymm1,ymm2,ymm3/m256 (RVM)
+    // VEX.NDS.128.66.0F.WIG 56: vorpd xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.66.0F.WIG 56: vorpd ymm1,ymm2,ymm3/m256 (RVM)
+    setOpcPV(VEX_128, 0x0F56, PS_No, IT_VORPS, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F56, PS_No, IT_VORPS, VT_256, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_128, 0x0F56, PS_66, IT_VORPD, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F56, PS_66, IT_VORPD, VT_256, parseRVM, addTInsImp, attach);
+
+    // EVEX.512.0F/66.0F 56: vorps/vorpd zmm1,zmm2,zmm3/m512 (RVM)
+    setOpcPV(VEX_512, 0x0F56, PS_No, IT_VORPS, VT_512, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_512, 0x0F56, PS_66, IT_VORPD, VT_512, parseRVM, addTInsImp, attach);
+
     // 0x0F57/No: xorps xmm1,xmm2/m128 (RM)
     // 0x0F57/66: xorpd xmm1,xmm2/m128 (RM)
     setOpcP(0x0F57, PS_No, IT_XORPS, VT_128, parseRMVV, addBInsImp, attach);
@@ -2295,6 +2548,10 @@ void initDecodeTables(void)
     setOpcPV(VEX_128, 0x0F57, PS_66, IT_VXORPD, VT_128, parseRVM, addTInsImp, attach);
     setOpcPV(VEX_256, 0x0F57, PS_66, IT_VXORPD, VT_256, parseRVM, addTInsImp, attach);
 
+    // EVEX.512.0F/66.0F 57: vxorps/vxorpd zmm1,zmm2,zmm3/m512 (RVM)
+    setOpcPV(VEX_512, 0x0F57, PS_No, IT_VXORPS, VT_512, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_512, 0x0F57, PS_66, IT_VXORPD, VT_512, parseRVM, addTInsImp, attach);
+
     // 0x0F58/F3: addss xmm1,xmm2/m32 (RM)
     // 0x0F58/F2: addsd xmm1,xmm2/m64 (RM)
     // 0x0F58/No: addps xmm1,xmm2/m128 (RM)
@@ -2317,6 +2574,10 @@ void initDecodeTables(void)
     setOpcPV(VEX_128, 0x0F58, PS_66, IT_VADDPD, VT_128, parseRVM, addTInsImp, attach);
     setOpcPV(VEX_256, 0x0F58, PS_66, IT_VADDPD, VT_256, parseRVM, addTInsImp, attach);
 
+    // EVEX.512.0F/66.0F 58: vaddps/vaddpd zmm1,zmm2,zmm3/m512 (RVM)
+    setOpcPV(VEX_512, 0x0F58, PS_No, IT_VADDPS, VT_512, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_512, 0x0F58, PS_66, IT_VADDPD, VT_512, parseRVM, addTInsImp, attach);
+
     // 0x0F59/F3: mulss xmm1,xmm2/m32 (RM)
     // 0x0F59/F2: mulsd xmm1,xmm2/m64 (RM)
     // 0x0F59/No: mulps xmm1,xmm2/m128 (RM)
@@ -2339,6 +2600,10 @@ void initDecodeTables(void)
     setOpcPV(VEX_128, 0x0F59, PS_66, IT_VMULPD, VT_128, parseRVM, addTInsImp, attach);
     setOpcPV(VEX_256, 0x0F59, PS_66, IT_VMULPD, VT_256, parseRVM, addTInsImp, attach);
 
+    // EVEX.512.0F/66.0F 59: vmulps/vmulpd zmm1,zmm2,zmm3/m512 (RVM)
+    setOpcPV(VEX_512, 0x0F59, PS_No, IT_VMULPS, VT_512, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_512, 0x0F59, PS_66, IT_VMULPD, VT_512, parseRVM, addTInsImp, attach);
+
     // 0x0F5C/F3: subss xmm1,xmm2/m32 (RM)
     // 0x0F5C/F2: subsd xmm1,xmm2/m64 (RM)
     // 0x0F5C/No: subps xmm1,xmm2/m128 (RM)
@@ -2348,6 +2613,24 @@ void initDecodeTables(void)
     setOpcP(0x0F5C, PS_No, IT_SUBPS, VT_128, parseRMVV, addBInsImp, attach);
     setOpcP(0x0F5C, PS_66, IT_SUBPD, VT_128, parseRMVV, addBInsImp, attach);
 
+    // VEX.NDS.LIG.F3.0F.WIG 5C: vsubss xmm1,xmm2,xmm3/m32 (RVM)
+    // VEX.NDS.LIG.F2.0F.WIG 5C: vsubsd xmm1,xmm2,xmm3/m64 (RVM)
+    setOpcPV(VEX_LIG, 0x0F5C, PS_F3, IT_VSUBSS, VT_32, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_LIG, 0x0F5C, PS_F2, IT_VSUBSD, VT_64, parseRVM, addTInsImp, attach);
+
+    // VEX.NDS.128.0F.WIG 5C: vsubps xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.0F.WIG 5C: vsubps ymm1,ymm2,ymm3/m256 (RVM)
+    // VEX.NDS.128.66.0F.WIG 5C: vsubpd xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.66.0F.WIG 5C: vsubpd ymm1,ymm2,ymm3/m256 (RVM)
+    setOpcPV(VEX_128, 0x0F5C, PS_No, IT_VSUBPS, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F5C, PS_No, IT_VSUBPS, VT_256, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_128, 0x0F5C, PS_66, IT_VSUBPD, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F5C, PS_66, IT_VSUBPD, VT_256, parseRVM, addTInsImp, attach);
+
+    // EVEX.512.0F/66.0F 5C: vsubps/vsubpd zmm1,zmm2,zmm3/m512 (RVM)
+    setOpcPV(VEX_512, 0x0F5C, PS_No, IT_VSUBPS, VT_512, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_512, 0x0F5C, PS_66, IT_VSUBPD, VT_512, parseRVM, addTInsImp, attach);
+
     // 0x0F5D/F3: minss xmm1,xmm2/m32 (RM)
     // 0x0F5D/F2: minsd xmm1,xmm2/m64 (RM)
     // 0x0F5D/No: minps xmm1,xmm2/m128 (RM)
@@ -2357,6 +2640,24 @@ void initDecodeTables(void)
     setOpcP(0x0F5D, PS_No, IT_MINPS, VT_128, parseRMVV, addBInsImp, attach);
     setOpcP(0x0F5D, PS_66, IT_MINPD, VT_128, parseRMVV, addBInsImp, attach);
 
+    // VEX.NDS.LIG.F3.0F.WIG 5D: vminss xmm1,xmm2,xmm3/m32 (RVM)
+    // VEX.NDS.LIG.F2.0F.WIG 5D: vminsd xmm1,xmm2,xmm3/m64 (RVM)
+    setOpcPV(VEX_LIG, 0x0F5D, PS_F3, IT_VMINSS, VT_32, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_LIG, 0x0F5D, PS_F2, IT_VMINSD, VT_64, parseRVM, addTInsImp, attach);
+
+    // VEX.NDS.128.0F.WIG 5D: vminps xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.0F.WIG 5D: vminps ymm1,ymm2,ymm3/m256 (RVM)
+    // VEX.NDS.128.66.0F.WIG 5D: vminpd xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.66.0F.WIG 5D: vminpd ymm1,ymm2,ymm3/m256 (RVM)
+    setOpcPV(VEX_128, 0x0F5D, PS_No, IT_VMINPS, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F5D, PS_No, IT_VMINPS, VT_256, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_128, 0x0F5D, PS_66, IT_VMINPD, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F5D, PS_66, IT_VMINPD, VT_256, parseRVM, addTInsImp, attach);
+
+    // EVEX.512.0F/66.0F 5D: vminps/vminpd zmm1,zmm2,zmm3/m512 (RVM)
+    setOpcPV(VEX_512, 0x0F5D, PS_No, IT_VMINPS, VT_512, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_512, 0x0F5D, PS_66, IT_VMINPD, VT_512, parseRVM, addTInsImp, attach);
+
     // 0x0F5E/F3: divss xmm1,xmm2/m32 (RM)
     // 0x0F5E/F2: divsd xmm1,xmm2/m64 (RM)
     // 0x0F5E/No: divps xmm1,xmm2/m128 (RM)
@@ -2366,6 +2667,24 @@ void initDecodeTables(void)
     setOpcP(0x0F5E, PS_No, IT_DIVPS, VT_128, parseRMVV, addBInsImp, attach);
     setOpcP(0x0F5E, PS_66, IT_DIVPD, VT_128, parseRMVV, addBInsImp, attach);
 
+    // VEX.NDS.LIG.F3.0F.WIG 5E: vdivss xmm1,xmm2,xmm3/m32 (RVM)
+    // VEX.NDS.LIG.F2.0F.WIG 5E: vdivsd xmm1,xmm2,xmm3/m64 (RVM)
+    setOpcPV(VEX_LIG, 0x0F5E, PS_F3, IT_VDIVSS, VT_32, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_LIG, 0x0F5E, PS_F2, IT_VDIVSD, VT_64, parseRVM, addTInsImp, attach);
+
+    // VEX.NDS.128.0F.WIG 5E: vdivps xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.0F.WIG 5E: vdivps ymm1,ymm2,ymm3/m256 (RVM)
+    // VEX.NDS.128.66.0F.WIG 5E: vdivpd xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.66.0F.WIG 5E: vdivpd ymm1,ymm2,ymm3/m256 (RVM)
+    setOpcPV(VEX_128, 0x0F5E, PS_No, IT_VDIVPS, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F5E, PS_No, IT_VDIVPS, VT_256, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_128, 0x0F5E, PS_66, IT_VDIVPD, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F5E, PS_66, IT_VDIVPD, VT_256, parseRVM, addTInsImp, attach);
+
+    // EVEX.512.0F/66.0F 5E: vdivps/vdivpd zmm1,zmm2,zmm3/m512 (RVM)
+    setOpcPV(VEX_512, 0x0F5E, PS_No, IT_VDIVPS, VT_512, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_512, 0x0F5E, PS_66, IT_VDIVPD, VT_512, parseRVM, addTInsImp, attach);
+
     // 0x0F5F/F3: maxss xmm1,xmm2/m32 (RM)
     // 0x0F5F/F2: maxsd xmm1,xmm2/m64 (RM)
     // 0x0F5F/No: maxps xmm1,xmm2/m128 (RM)
@@ -2375,6 +2694,24 @@ void initDecodeTables(void)
     setOpcP(0x0F5F, PS_No, IT_MAXPS, VT_128, parseRMVV, addBInsImp, attach);
     setOpcP(0x0F5F, PS_66, IT_MAXPD, VT_128, parseRMVV, addBInsImp, attach);
 
+    // VEX.NDS.LIG.F3.0F.WIG 5F: vmaxss xmm1,xmm2,xmm3/m32 (RVM)
+    // VEX.NDS.LIG.F2.0F.WIG 5F: vmaxsd xmm1,xmm2,xmm3/m64 (RVM)
+    setOpcPV(VEX_LIG, 0x0F5F, PS_F3, IT_VMAXSS, VT_32, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_LIG, 0x0F5F, PS_F2, IT_VMAXSD, VT_64, parseRVM, addTInsImp, attach);
+
+    // VEX.NDS.128.0F.WIG 5F: vmaxps xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.0F.WIG 5F: vmaxps ymm1,ymm2,ymm3/m256 (RVM)
+    // VEX.NDS.128.66.0F.WIG 5F: vmaxpd xmm1,xmm2,xmm3/m128 (RVM)
+    // VEX.NDS.256.66.0F.WIG 5F: vmaxpd ymm1,ymm2,ymm3/m256 (RVM)
+    setOpcPV(VEX_128, 0x0F5F, PS_No, IT_VMAXPS, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F5F, PS_No, IT_VMAXPS, VT_256, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_128, 0x0F5F, PS_66, IT_VMAXPD, VT_128, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0F5F, PS_66, IT_VMAXPD, VT_256, parseRVM, addTInsImp, attach);
+
+    // EVEX.512.0F/66.0F 5F: vmaxps/vmaxpd zmm1,zmm2,zmm3/m512 (RVM)
+    setOpcPV(VEX_512, 0x0F5F, PS_No, IT_VMAXPS, VT_512, parseRVM, addTInsImp, attach);
+    setOpcPV(VEX_512, 0x0F5F, PS_66, IT_VMAXPD, VT_512, parseRVM, addTInsImp, attach);
+
     // 0x0F6E/66: movd/q xmm,r/m 32/64 (RM)
     setOpcPH(0x0F6E, PS_66, decode0F_6E_P66);
 
@@ -2443,6 +2780,24 @@ void initDecodeTables(void)
     setOpcH(0x0F8E, decode0F_80);
     setOpcH(0x0F8F, decode0F_80);
 
+    // 0x0F90-0F9F: setcc r/m8
+    setOpcH(0x0F90, decode0F_90);
+    setOpcH(0x0F91, decode0F_90);
+    setOpcH(0x0F92, decode0F_90);
+    setOpcH(0x0F93, decode0F_90);
+    setOpcH(0x0F94, decode0F_90);
+    setOpcH(0x0F95, decode0F_90);
+    setOpcH(0x0F96, decode0F_90);
+    setOpcH(0x0F97, decode0F_90);
+    setOpcH(0x0F98, decode0F_90);
+    setOpcH(0x0F99, decode0F_90);
+    setOpcH(0x0F9A, decode0F_90);
+    setOpcH(0x0F9B, decode0F_90);
+    setOpcH(0x0F9C, decode0F_90);
+    setOpcH(0x0F9D, decode0F_90);
+    setOpcH(0x0F9E, decode0F_90);
+    setOpcH(0x0F9F, decode0F_90);
+
     // 0x0FAF: imul r,rm16/32/64 (RM), signed mul (d/q)word by r/m
     setOpc(0x0FAF, IT_IMUL, VT_Def, parseRM, addBInstr, 0);
 
@@ -2455,6 +2810,29 @@ void initDecodeTables(void)
     setOpcH(0x0FBE, decode0F_BE); // movsx r16/32/64,r/m8 (RM)
     setOpcH(0x0FBF, decode0F_BF); // movsx r32/64,r/m16 (RM)
 
+    // 0x0FC2/F3: cmpss xmm1,xmm2/m32,imm8 (RMI)
+    // 0x0FC2/F2: cmpsd xmm1,xmm2/m64,imm8 (RMI)
+    // 0x0FC2/No: cmpps xmm1,xmm2/m128,imm8 (RMI)
+    // 0x0FC2/66: cmppd xmm1,xmm2/m128,imm8 (RMI)
+    setOpcP(0x0FC2, PS_F3, IT_CMPSS, VT_32,  parseRMVVI, addTInsImp, attach);
+    setOpcP(0x0FC2, PS_F2, IT_CMPSD, VT_64,  parseRMVVI, addTInsImp, attach);
+    setOpcP(0x0FC2, PS_No, IT_CMPPS, VT_128, parseRMVVI, addTInsImp, attach);
+    setOpcP(0x0FC2, PS_66, IT_CMPPD, VT_128, parseRMVVI, addTInsImp, attach);
+
+    // VEX.NDS.LIG.F3.0F.WIG C2: vcmpss xmm1,xmm2,xmm3/m32,imm8 (RVMI)
+    // VEX.NDS.LIG.F2.0F.WIG C2: vcmpsd xmm1,xmm2,xmm3/m64,imm8 (RVMI)
+    setOpcPV(VEX_LIG, 0x0FC2, PS_F3, IT_VCMPSS, VT_32, parseRVMI, addTInsImp, attach);
+    setOpcPV(VEX_LIG, 0x0FC2, PS_F2, IT_VCMPSD, VT_64, parseRVMI, addTInsImp, attach);
+
+    // VEX.NDS.128.0F.WIG C2: vcmpps xmm1,xmm2,xmm3/m128,imm8 (RVMI)
+    // VEX.NDS.256.0F.WIG C2: vcmpps ymm1,ymm2,ymm3/m256,imm8 (RVMI)
+    // VEX.NDS.128.66.0F.WIG C2: vcmppd xmm1,xmm2,xmm3/m128,imm8 (RVMI)
+    // VEX.NDS.256.66.0F.WIG C2: vcmppd ymm1,ymm2,ymm3/m256,imm8 (RVMI)
+    setOpcPV(VEX_128, 0x0FC2, PS_No, IT_VCMPPS, VT_128, parseRVMI, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0FC2, PS_No, IT_VCMPPS, VT_256, parseRVMI, addTInsImp, attach);
+    setOpcPV(VEX_128, 0x0FC2, PS_66, IT_VCMPPD, VT_128, parseRVMI, addTInsImp, attach);
+    setOpcPV(VEX_256, 0x0FC2, PS_66, IT_VCMPPD, VT_256, parseRVMI, addTInsImp, attach);
+
     // 0x0FD0/66: addsubpd xmm1,xmm2/m128 (RM)
     // 0x0FD0/F2: addsubps xmm1,xmm2/m128 (RM)
     setOpcP(0x0FD0, PS_66, IT_ADDSUBPD, VT_128, parseRMVV, addBInsImp, attach);
@@ -2473,11 +2851,21 @@ void initDecodeTables(void)
     setOpcH(0x0FEF, decode0F_EF); // pxor xmm1,xmm2/m 64/128 (RM)
 }
 
+// fill the tables exactly once, also with multiple threads decoding
+static
+void initDecodeTables(void)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, fillDecodeTables);
+}
+
 // decode the basic block starting at f (automatically triggered by emulator)
 DBB* dbrew_decode(Rewriter* r, uint64_t f)
 {
     DContext cxt;
     int i, old_icount;
+    uint64_t t0;
+    bool failed = false;
     DBB* dbb;
 
     if (f == 0) return 0; // nothing to decode
@@ -2486,7 +2874,10 @@ DBB* dbrew_decode(Rewriter* r, uint64_t f)
 
     // already decoded?
     for(i = 0; i < r->decBBCount; i++)
-        if (r->decBB[i].addr == f) return &(r->decBB[i]);
+        if (r->decBB[i].addr == f) {
+            r->stats.decodeCacheHits++;
+            return &(r->decBB[i]);
+        }
 
     // start decoding of new BB beginning at f
     assert(r->decBBCount < r->decBBCapacity);
@@ -2494,6 +2885,22 @@ DBB* dbrew_decode(Rewriter* r, uint64_t f)
     r->decBBCount++;
     dbb->addr = f;
     dbb->fc = config_find_function(r, f);
+
+    if (r->sharedDecodeCache &&
+        decodeCacheLookup(f, dbb, r->decInstr + r->decInstrCount,
+                          r->decInstrCapacity - r->decInstrCount)) {
+        r->decInstrCount += dbb->count;
+        r->stats.decodeCacheHits++;
+        if (r->showDecoding) {
+            printf("Decoding BB %s ...\n", prettyAddress(f, dbb->fc));
+            dbrew_print_decoded(dbb, r->printBytes);
+        }
+        return dbb;
+    }
+
+    r->stats.decodeCacheMisses++;
+    t0 = timeNs();
+
     dbb->count = 0;
     dbb->size = 0;
     dbb->instr = r->decInstr + r->decInstrCount;
@@ -2509,15 +2916,17 @@ DBB* dbrew_decode(Rewriter* r, uint64_t f)
 
         // parse opcode by running handlers defined in opcode tables
 
-        if (cxt.vex == VEX_128) {
-            assert(cxt.opc1 == 0x0F);
-            cxt.opc2 = cxt.f[cxt.off++];
-            processOpc(&(opcTable0F_V128[cxt.opc2]), &cxt);
-        }
-        else if (cxt.vex == VEX_256) {
+        if (cxt.vex != VEX_No) {
+            OpcInfo* t = vexOpcTable(cxt.vex, cxt.vexMap);
+
             assert(cxt.opc1 == 0x0F);
             cxt.opc2 = cxt.f[cxt.off++];
-            processOpc(&(opcTable0F_V256[cxt.opc2]), &cxt);
+            if (t == 0)
+                markDecodeError(&cxt, false, ET_BadOpcode);
+            else if (cxt.evexBad)
+                markDecodeError(&cxt, false, ET_BadPrefix);
+            else
+                processOpc(&(t[cxt.opc2]), &cxt);
         }
         else {
             cxt.opc1 = cxt.f[cxt.off++];
@@ -2533,6 +2942,7 @@ DBB* dbrew_decode(Rewriter* r, uint64_t f)
         if (isErrorSet(&(cxt.error.e))) {
             // current "fall-back": output error, stop decoding
             logError(&(cxt.error.e), (char*) "Stopped decoding");
+            failed = true;
             break;
         }
     }
@@ -2540,6 +2950,11 @@ DBB* dbrew_decode(Rewriter* r, uint64_t f)
     assert(dbb->addr == dbb->instr->addr);
     dbb->count = r->decInstrCount - old_icount;
     dbb->size = cxt.off;
+    r->stats.decodedInstrs += dbb->count;
+    r->stats.decodeNs += timeNs() - t0;
+
+    if (r->sharedDecodeCache && !failed)
+        decodeCacheInsert(dbb);
 
     if (r->showDecoding)
         dbrew_print_decoded(dbb, r->printBytes);
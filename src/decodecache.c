@@ -0,0 +1,203 @@
+/**
+ * This file is part of DBrew, the dynamic binary rewriting library.
+ *
+ * (c) 2016, Josef Weidendorfer <josef.weidendorfer@gmx.de>
+ *
+ * DBrew is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License (LGPL)
+ * as published by the Free Software Foundation, either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * DBrew is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with DBrew.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "decode.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+
+/*
+ * Process-wide decode cache shared among rewriters
+ *
+ * Decoded BBs are immutable once published: an entry holds a private copy
+ * of the decoded instructions, which gets copied into the decode buffer of
+ * a rewriter on lookup. Thus, no rewriter keeps pointers into the cache.
+ * Lookups are lock-free: entries only get prepended to the chain of a hash
+ * bucket using atomic compare-and-swap. Invalidation marks entries as
+ * invalid, unlinks them and bumps a generation counter, such that rewriters
+ * can drop their own decoded BBs. Memory of unlinked entries is released
+ * by an invalidation or flush finding no lookup running.
+ */
+
+typedef struct _DCEntry DCEntry;
+struct _DCEntry {
+    uint64_t addr;
+    int size;
+    int count;
+    Instr* instr;
+    int valid;
+    DCEntry* next;
+};
+
+#define DC_BUCKETS 4096
+
+static DCEntry* dcBucket[DC_BUCKETS];
+static uint64_t dcGeneration = 0;
+// number of running lookups
+static int dcReaders = 0;
+// unlinked entries, not yet freed (protected by dcLock)
+static DCEntry* dcRetired = 0;
+// serializes unlinking of entries
+static pthread_mutex_t dcLock = PTHREAD_MUTEX_INITIALIZER;
+
+static
+int dcHash(uint64_t addr)
+{
+    return (int) ((addr ^ (addr >> 12) ^ (addr >> 24)) & (DC_BUCKETS - 1));
+}
+
+static
+void freeEntries(DCEntry* e)
+{
+    while(e) {
+        DCEntry* next = e->next;
+        memFree(0, e->instr);
+        memFree(0, e);
+        e = next;
+    }
+}
+
+// free retired entries if no lookup is running: then nobody can see them
+// any more. Otherwise, they get freed by a later invalidation or flush.
+// Called with dcLock held
+static
+void freeRetired(void)
+{
+    if (__atomic_load_n(&dcReaders, __ATOMIC_SEQ_CST) != 0) return;
+    freeEntries(dcRetired);
+    dcRetired = 0;
+}
+
+uint64_t decodeCacheGeneration(void)
+{
+    return __atomic_load_n(&dcGeneration, __ATOMIC_ACQUIRE);
+}
+
+// fill <dbb> from shared cache, copying instructions into <buf> with space
+// for <capacity> instructions. Return false if not found or not fitting
+bool decodeCacheLookup(uint64_t f, DBB* dbb, Instr* buf, int capacity)
+{
+    DCEntry* e;
+    bool found = false;
+
+    // unlinked entries are not freed while we may still traverse them
+    __atomic_add_fetch(&dcReaders, 1, __ATOMIC_SEQ_CST);
+    e = __atomic_load_n(&dcBucket[dcHash(f)], __ATOMIC_SEQ_CST);
+    for(; e != 0; e = __atomic_load_n(&(e->next), __ATOMIC_ACQUIRE)) {
+        if (e->addr != f) continue;
+        if (!__atomic_load_n(&(e->valid), __ATOMIC_ACQUIRE)) continue;
+        if (e->count > capacity) break;
+
+        dbb->addr = e->addr;
+        dbb->size = e->size;
+        dbb->count = e->count;
+        dbb->instr = buf;
+        memcpy(buf, e->instr, sizeof(Instr) * e->count);
+        found = true;
+        break;
+    }
+    __atomic_sub_fetch(&dcReaders, 1, __ATOMIC_SEQ_CST);
+
+    return found;
+}
+
+// publish a copy of the decoded BB <dbb>
+void decodeCacheInsert(DBB* dbb)
+{
+    DCEntry *e, **head;
+
+    if (dbb->count == 0) return;
+
+    e = (DCEntry*) memAlloc(0, sizeof(DCEntry));
+    e->addr = dbb->addr;
+    e->size = dbb->size;
+    e->count = dbb->count;
+    e->instr = (Instr*) memAlloc(0, sizeof(Instr) * dbb->count);
+    memcpy(e->instr, dbb->instr, sizeof(Instr) * dbb->count);
+    e->valid = 1;
+
+    head = &dcBucket[dcHash(dbb->addr)];
+    e->next = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+    while(!__atomic_compare_exchange_n(head, &(e->next), e, true,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE));
+}
+
+// unlink invalid entries of bucket <b> into retired list. Inserts only
+// change the bucket head, so only unlinking from the head needs a CAS
+static
+void unlinkInvalid(int b)
+{
+    DCEntry *e, *next, **prev = &dcBucket[b];
+
+    e = __atomic_load_n(prev, __ATOMIC_ACQUIRE);
+    while(e) {
+        next = e->next;
+        if (__atomic_load_n(&(e->valid), __ATOMIC_ACQUIRE)) {
+            prev = &(e->next);
+            e = next;
+            continue;
+        }
+        if (!__atomic_compare_exchange_n(prev, &e, next, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE))
+            continue; // new entry prepended meanwhile: <e> now is new head
+        e->next = dcRetired;
+        dcRetired = e;
+        e = next;
+    }
+}
+
+void dbrew_decode_cache_invalidate(uint64_t start, uint64_t size)
+{
+    pthread_mutex_lock(&dcLock);
+    for(int i = 0; i < DC_BUCKETS; i++) {
+        DCEntry* e = __atomic_load_n(&dcBucket[i], __ATOMIC_ACQUIRE);
+        bool found = false;
+        for(; e != 0; e = e->next) {
+            if ((e->addr + e->size <= start) || (e->addr >= start + size))
+                continue;
+            __atomic_store_n(&(e->valid), 0, __ATOMIC_RELEASE);
+            found = true;
+        }
+        if (found) unlinkInvalid(i);
+    }
+    __atomic_add_fetch(&dcGeneration, 1, __ATOMIC_RELEASE);
+    freeRetired();
+    pthread_mutex_unlock(&dcLock);
+}
+
+void dbrew_decode_cache_flush(void)
+{
+    pthread_mutex_lock(&dcLock);
+    for(int i = 0; i < DC_BUCKETS; i++) {
+        // lookups may still traverse the unlinked chain: retire it
+        DCEntry* e = __atomic_exchange_n(&dcBucket[i], 0, __ATOMIC_SEQ_CST);
+        DCEntry* last = e;
+        if (!e) continue;
+        while(last->next) last = last->next;
+        last->next = dcRetired;
+        dcRetired = e;
+    }
+    __atomic_add_fetch(&dcGeneration, 1, __ATOMIC_RELEASE);
+    freeRetired();
+    pthread_mutex_unlock(&dcLock);
+}
@@ -0,0 +1,449 @@
+/**
+ * This file is part of DBrew, the dynamic binary rewriting library.
+ *
+ * (c) 2016, Josef Weidendorfer <josef.weidendorfer@gmx.de>
+ *
+ * DBrew is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License (LGPL)
+ * as published by the Free Software Foundation, either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * DBrew is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with DBrew.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dbrew.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "buffers.h"
+#include "common.h"
+#include "engine.h"
+#include "error.h"
+
+/*
+ * Dispatcher over specializations of one function
+ *
+ * Specializations are keyed on the values of the parameters configured
+ * as static. Callers use the entry of a dispatch stub generated into own
+ * code storage. The stub compares the key parameters with the values of
+ * each specialization and jumps to the matching one. On a miss, it jumps
+ * to the original function, or with auto-specialization, to a handler
+ * generating a new specialization.
+ *
+ * Layout of code storage:
+ * - 8-byte slot with address of current dispatch code
+ * - entry: 'jmp *slot(%rip)'
+ * - miss handler: save parameter registers, call dispatchMiss()
+ * - dispatch code, appended anew for each added specialization. The slot
+ *   is switched atomically, such that concurrent callers always see
+ *   complete dispatch code
+ */
+
+struct _Dispatcher {
+    Rewriter* r;
+    // parameters used as key and their width in bytes
+    int keyCount;
+    int keyPar[CC_MAXPARAM];
+    int keyWidth[CC_MAXPARAM];
+    // specializations with their key values
+    int count, max;
+    uint64_t* key;
+    uint64_t* func;
+    bool autoSpecialize;
+    // generated code
+    CodeStorage* cs;
+    uint64_t* slot;
+    uint64_t entry, missHandler;
+    pthread_mutex_t lock;
+};
+
+// GP register numbers of integer parameters
+static int parGPReg[CC_MAXPARAM] = { 7, 6, 2, 1, 8, 9 };
+
+// byte sizes of generated code
+#define DISPATCH_CMP64SIZE  19 // movabs, cmp, jne
+#define DISPATCH_CMP32SIZE  13 // cmp imm32, jne
+#define DISPATCH_CMPZXSIZE  17 // movzx, cmp imm32, jne
+#define DISPATCH_JMPSIZE    13 // movabs, jmp
+#define DISPATCH_MISSSIZE  256
+
+static
+uint8_t* emitBytes(uint8_t* buf, int n, const uint8_t* b)
+{
+    memcpy(buf, b, n);
+    return buf + n;
+}
+
+// 'movabs $v, %r10/%r11'
+static
+uint8_t* emitMovR(uint8_t* buf, int r, uint64_t v)
+{
+    buf[0] = 0x49;
+    buf[1] = 0xB8 + (r & 7);
+    *(uint64_t*)(buf + 2) = v;
+    return buf + 10;
+}
+
+// 'movabs $target, %r11; jmp *%r11'
+static
+uint8_t* emitJmpAbs(uint8_t* buf, uint64_t target)
+{
+    static const uint8_t jmp[] = { 0x41, 0xFF, 0xE3 };
+
+    buf = emitMovR(buf, 11, target);
+    return emitBytes(buf, 3, jmp);
+}
+
+// size of compare code for key <k>
+static
+int keyCmpSize(Dispatcher* d, int k)
+{
+    switch(d->keyWidth[k]) {
+    case 8: return DISPATCH_CMP64SIZE;
+    case 4: return DISPATCH_CMP32SIZE;
+    default: break;
+    }
+    return DISPATCH_CMPZXSIZE;
+}
+
+// value of key <k> in parameter value <v>: only lower bytes are defined
+static
+uint64_t keyValue(Dispatcher* d, int k, uint64_t v)
+{
+    if (d->keyWidth[k] == 8) return v;
+    return v & ((1ul << (8 * d->keyWidth[k])) - 1);
+}
+
+// size of dispatch code for <n> specializations
+static
+int dispatchCodeSize(Dispatcher* d, int n)
+{
+    int cmpSize = 0;
+
+    for(int k = 0; k < d->keyCount; k++)
+        cmpSize += keyCmpSize(d, k);
+    return n * (cmpSize + DISPATCH_JMPSIZE) + DISPATCH_JMPSIZE + 10;
+}
+
+// compare key <k> in its parameter register with <key> at the key width,
+// 'jne' <skip> bytes forward on mismatch
+static
+uint8_t* emitKeyCmp(Dispatcher* d, uint8_t* buf, int k, uint64_t key,
+                    int skip)
+{
+    int reg = parGPReg[d->keyPar[k]];
+
+    switch(d->keyWidth[k]) {
+    case 8:
+        // movabs $key, %r11; cmp %r11, %reg
+        buf = emitMovR(buf, 11, key);
+        buf[0] = 0x4C | ((reg >> 3) & 1);
+        buf[1] = 0x39;
+        buf[2] = 0xC0 | (3 << 3) | (reg & 7);
+        buf += 3;
+        break;
+    case 4:
+        // cmp $key, %reg32 (REX prefix always, for fixed size)
+        buf[0] = 0x40 | ((reg >> 3) & 1);
+        buf[1] = 0x81;
+        buf[2] = 0xC0 | (7 << 3) | (reg & 7);
+        *(uint32_t*)(buf + 3) = (uint32_t) key;
+        buf += 7;
+        break;
+    default:
+        // movzx %reg8/16, %r11d; cmp $key, %r11d
+        buf[0] = 0x44 | ((reg >> 3) & 1);
+        buf[1] = 0x0F;
+        buf[2] = (d->keyWidth[k] == 1) ? 0xB6 : 0xB7;
+        buf[3] = 0xC0 | (3 << 3) | (reg & 7);
+        buf[4] = 0x41;
+        buf[5] = 0x81;
+        buf[6] = 0xC0 | (7 << 3) | 3;
+        *(uint32_t*)(buf + 7) = (uint32_t) key;
+        buf += 11;
+        break;
+    }
+    // jne next
+    buf[0] = 0x0F;
+    buf[1] = 0x85;
+    *(int32_t*)(buf + 2) = skip;
+    return buf + 6;
+}
+
+// generate dispatch code for current specializations and switch to it.
+// Returns false if code storage is exhausted
+static
+bool genDispatchCode(Dispatcher* d)
+{
+    int size = dispatchCodeSize(d, d->count);
+    uint8_t *buf0, *buf;
+
+    if (reserveCodeStorage(d->cs, size) == 0) return false;
+    buf0 = useCodeStorage(d->cs, size);
+    buf = buf0;
+
+    for(int i = 0; i < d->count; i++) {
+        // jne skips rest of compares and jump of this specialization
+        int skip = DISPATCH_JMPSIZE;
+
+        for(int k = 1; k < d->keyCount; k++)
+            skip += keyCmpSize(d, k);
+        for(int k = 0; k < d->keyCount; k++) {
+            buf = emitKeyCmp(d, buf, k, d->key[i * d->keyCount + k], skip);
+            if (k + 1 < d->keyCount)
+                skip -= keyCmpSize(d, k + 1);
+        }
+        buf = emitJmpAbs(buf, d->func[i]);
+    }
+    if (d->autoSpecialize && (d->count < d->max)) {
+        buf = emitMovR(buf, 10, (uint64_t) d);
+        buf = emitJmpAbs(buf, d->missHandler);
+    }
+    else
+        buf = emitJmpAbs(buf, d->r->func);
+    assert(buf - buf0 <= size);
+
+    __atomic_store_n(d->slot, (uint64_t) buf0, __ATOMIC_RELEASE);
+    return true;
+}
+
+// add specialization for parameter values <par>, if not yet existing.
+// Returns specialization, or original function if not possible
+static
+uint64_t addVariant(Dispatcher* d, uint64_t* par)
+{
+    Rewriter* r = d->r;
+    uint64_t f, t0;
+    bool appendCode;
+    Error* re;
+    int i, k;
+
+    pthread_mutex_lock(&(d->lock));
+
+    // already specialized, e.g. by another thread?
+    for(i = 0; i < d->count; i++) {
+        for(k = 0; k < d->keyCount; k++)
+            if (d->key[i * d->keyCount + k] !=
+                keyValue(d, k, par[d->keyPar[k]])) break;
+        if (k == d->keyCount) break;
+    }
+    if (i < d->count) {
+        f = d->func[i];
+        pthread_mutex_unlock(&(d->lock));
+        return f;
+    }
+    if (d->count == d->max) {
+        pthread_mutex_unlock(&(d->lock));
+        return r->func;
+    }
+
+    // keep code of previous specializations
+    appendCode = r->appendCode;
+    r->appendCode = true;
+    t0 = timeNs();
+    re = rewritePars(r, par);
+    statsRewriteDone(r, t0, re);
+    r->appendCode = appendCode;
+
+    if (re) {
+        // dispatch to original for this key from now on
+        logError(re, (char*) "Dispatch to original");
+        f = r->func;
+    }
+    else
+        f = r->generatedCodeAddr;
+
+    for(k = 0; k < d->keyCount; k++)
+        d->key[d->count * d->keyCount + k] =
+            keyValue(d, k, par[d->keyPar[k]]);
+    d->func[d->count] = f;
+    d->count++;
+    if (!genDispatchCode(d)) {
+        setError(&(r->error), ET_BufferOverflow, EM_Rewriter, r,
+                 "No space for dispatch code");
+        logError(&(r->error), (char*) "Specialization not dispatched to");
+        d->count--;
+    }
+
+    pthread_mutex_unlock(&(d->lock));
+    return f;
+}
+
+// handler for calls without matching specialization, called from stub
+// with saved parameter registers <gp> (order r9, r8, rcx, rdx, rsi, rdi)
+static
+uint64_t dispatchMiss(Dispatcher* d, uint64_t* gp)
+{
+    uint64_t par[CC_MAXPARAM];
+
+    for(int i = 0; i < CC_MAXPARAM; i++)
+        par[i] = gp[CC_MAXPARAM - 1 - i];
+
+    return addVariant(d, par);
+}
+
+// generate miss handler: save parameter registers (GP, XMM, RAX for
+// varargs) and call dispatchMiss(d, gp) with <d> in r10, jump to result
+static
+uint64_t genMissHandler(Dispatcher* d)
+{
+    static const uint8_t save[] = {
+        0x57, 0x56, 0x52, 0x51, 0x41, 0x50, 0x41, 0x51, // push rdi..r9
+        0x48, 0x81, 0xEC, 0x88, 0x00, 0x00, 0x00,       // sub $136,%rsp
+    };
+    static const uint8_t saveRAX[] = {
+        0x48, 0x89, 0x84, 0x24, 0x80, 0x00, 0x00, 0x00, // mov %rax,128(%rsp)
+        0x4C, 0x89, 0xD7,                               // mov %r10,%rdi
+        0x48, 0x8D, 0xB4, 0x24, 0x88, 0x00, 0x00, 0x00, // lea 136(%rsp),%rsi
+    };
+    static const uint8_t call[] = {
+        0x41, 0xFF, 0xD3,                               // call *%r11
+        0x49, 0x89, 0xC3,                               // mov %rax,%r11
+        0x48, 0x8B, 0x84, 0x24, 0x80, 0x00, 0x00, 0x00, // mov 128(%rsp),%rax
+    };
+    static const uint8_t restore[] = {
+        0x48, 0x81, 0xC4, 0x88, 0x00, 0x00, 0x00,       // add $136,%rsp
+        0x41, 0x59, 0x41, 0x58, 0x59, 0x5A, 0x5E, 0x5F, // pop r9..rdi
+        0x41, 0xFF, 0xE3,                               // jmp *%r11
+    };
+    uint8_t *buf0, *buf;
+
+    buf0 = useCodeStorage(d->cs, DISPATCH_MISSSIZE);
+    buf = emitBytes(buf0, sizeof(save), save);
+    for(int i = 0; i < 8; i++) {
+        // movdqu %xmm<i>, 16*i(%rsp)
+        uint8_t mov[] = { 0xF3, 0x0F, 0x7F, 0x44 | (i << 3), 0x24, 16 * i };
+        buf = emitBytes(buf, sizeof(mov), mov);
+    }
+    buf = emitBytes(buf, sizeof(saveRAX), saveRAX);
+    buf = emitMovR(buf, 11, (uint64_t) dispatchMiss);
+    buf = emitBytes(buf, sizeof(call), call);
+    for(int i = 0; i < 8; i++) {
+        // movdqu 16*i(%rsp), %xmm<i>
+        uint8_t mov[] = { 0xF3, 0x0F, 0x6F, 0x44 | (i << 3), 0x24, 16 * i };
+        buf = emitBytes(buf, sizeof(mov), mov);
+    }
+    buf = emitBytes(buf, sizeof(restore), restore);
+    assert(buf - buf0 <= DISPATCH_MISSSIZE);
+
+    return (uint64_t) buf0;
+}
+
+Dispatcher* dbrew_dispatcher_new(Rewriter* r, int maxVariants)
+{
+    Dispatcher* d;
+    int size;
+    uint8_t* buf;
+
+    if (r->decBB == 0) initRewriter(r);
+
+    d = (Dispatcher*) memAlloc(0, sizeof(Dispatcher));
+    d->r = r;
+    d->keyCount = 0;
+    for(int i = 0; i < r->cc->parCount && i < CC_MAXPARAM; i++) {
+        CaptureState cs = r->cc->par_state[i].cState;
+        if ((cs == CS_STATIC) || (cs == CS_STATIC2)) {
+            d->keyPar[d->keyCount] = i;
+            d->keyWidth[d->keyCount] = r->cc->par_width[i];
+            d->keyCount++;
+        }
+    }
+    d->count = 0;
+    d->max = (maxVariants > 0) ? maxVariants : 1;
+    d->key = (uint64_t*) memAlloc(0, sizeof(uint64_t) * d->max *
+                                   (d->keyCount > 0 ? d->keyCount : 1));
+    d->func = (uint64_t*) memAlloc(0, sizeof(uint64_t) * d->max);
+    d->autoSpecialize = false;
+    pthread_mutex_init(&(d->lock), 0);
+
+    // space for slot, entry, miss handler and dispatch code for each add,
+    // with slack for switching auto-specialization
+    size = 16 + DISPATCH_MISSSIZE + 2 * dispatchCodeSize(d, d->max);
+    for(int n = 0; n <= d->max; n++)
+        size += dispatchCodeSize(d, n);
+    d->cs = providedCodeStorage(0, size, 0);
+    if (!d->cs)
+        d->cs = initCodeStorage(size);
+
+    d->slot = (uint64_t*) useCodeStorage(d->cs, 8);
+    buf = useCodeStorage(d->cs, 8);
+    // jmp *slot(%rip)
+    buf[0] = 0xFF;
+    buf[1] = 0x25;
+    *(int32_t*)(buf + 2) = (int32_t) ((uint64_t) d->slot - (uint64_t) buf - 6);
+    d->entry = (uint64_t) buf;
+    d->missHandler = genMissHandler(d);
+    // cannot fail: space for dispatch code reserved above
+    genDispatchCode(d);
+
+    return d;
+}
+
+void dbrew_dispatcher_free(Dispatcher* d)
+{
+    if (!d) return;
+
+    freeCodeStorage(d->cs);
+    pthread_mutex_destroy(&(d->lock));
+    memFree(0, d->key);
+    memFree(0, d->func);
+    memFree(0, d);
+}
+
+bool dbrew_dispatcher_set_auto(Dispatcher* d, bool b)
+{
+    Rewriter* r = d->r;
+    bool old, done;
+
+    pthread_mutex_lock(&(d->lock));
+    old = d->autoSpecialize;
+    d->autoSpecialize = b;
+    done = genDispatchCode(d);
+    if (!done) {
+        // previous dispatch code stays active
+        d->autoSpecialize = old;
+        setError(&(r->error), ET_BufferOverflow, EM_Rewriter, r,
+                 "No space for dispatch code");
+        logError(&(r->error), (char*) "Auto-specialization not changed");
+    }
+    pthread_mutex_unlock(&(d->lock));
+    return done;
+}
+
+uint64_t dbrew_dispatcher_stub(Dispatcher* d)
+{
+    return d->entry;
+}
+
+int dbrew_dispatcher_count(Dispatcher* d)
+{
+    return d->count;
+}
+
+uint64_t dbrew_dispatcher_add(Dispatcher* d, ...)
+{
+    va_list argptr;
+    Error* e;
+    uint64_t par[CC_MAXPARAM];
+
+    va_start(argptr, d);
+    e = vGetPars(d->r, argptr, par);
+    va_end(argptr);
+
+    if (e) {
+        logError(e, (char*) "Specialization not added");
+        return d->r->func;
+    }
+    return addVariant(d, par);
+}
@@ -26,6 +26,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "alloc.h"
 #include "common.h"
 #include "decode.h"
 #include "engine.h"
@@ -34,6 +35,8 @@
 #include "expr.h"
 #include "error.h"
 #include "vector.h"
+#include "opt.h"
+#include "buffers.h"
 
 
 
@@ -135,10 +138,8 @@ void resetEmuState(EmuState* es)
         initMetaState(&(es->flag_state[i]), CS_DEAD);
     }
 
-    for(i=0; i< es->stackSize; i++)
-        es->stack[i] = 0;
-    for(i=0; i< es->stackSize; i++)
-        initMetaState(&(es->stackState[i]), CS_DEAD);
+    memset(es->stack, 0, es->stackSize);
+    memset(es->stackState, CS_DEAD, es->stackSize);
 
     // use real addresses for now
     es->stackStart = (uint64_t) es->stack;
@@ -155,25 +156,53 @@ void resetEmuState(EmuState* es)
     es->depth = 0;
 }
 
-EmuState* allocEmuState(int size)
+EmuState* allocEmuState(Rewriter* r, int size)
 {
     EmuState* es;
 
-    es = (EmuState*) malloc(sizeof(EmuState));
+    es = (EmuState*) memAlloc(r, sizeof(EmuState));
     es->stackSize = size;
-    es->stack = (uint8_t*) malloc(size);
-    es->stackState = (MetaState*) malloc(sizeof(MetaState) * size);
+    es->stack = (uint8_t*) memAlloc(r, size);
+    es->stackState = (uint8_t*) memAlloc(r, size);
 
     return es;
 }
 
+// get an emulator state for a snapshot from the arena of <r>,
+// released with all other snapshots in one go by freeSavedStates()
+static
+EmuState* allocSavedState(Rewriter* r, int size)
+{
+    EmuState* es;
+    int off = (sizeof(EmuState) + 15) & ~15;
+
+    es = (EmuState*) arenaAlloc(r, &(r->stateArena), off + 2 * size);
+    es->stackSize = size;
+    es->stack = (uint8_t*) es + off;
+    es->stackState = es->stack + size;
+
+    return es;
+}
+
+// release emulator states saved while capturing, keeping arena memory
+static
+void freeSavedStates(Rewriter* r)
+{
+    for(int i = 0; i < r->savedStateCount; i++)
+        r->savedState[i] = 0;
+    r->savedStateCount = 0;
+    arenaReset(&(r->stateArena));
+}
+
 void freeEmuState(Rewriter* r)
 {
+    freeSavedStates(r);
+    arenaFree(r, &(r->stateArena));
     if (!r->es) return;
 
-    free(r->es->stack);
-    free(r->es->stackState);
-    free(r->es);
+    memFree(r, r->es->stack);
+    memFree(r, r->es->stackState);
+    memFree(r, r->es);
     r->es = 0;
 }
 
@@ -239,13 +268,13 @@ bool esIsEqual(EmuState* es1, EmuState* es2)
         int diff = es2->stackSize - es1->stackSize;
         // stack of es2 is larger: bottom should not be static
         for(i = 0; i < diff; i++) {
-            if (msIsStatic(es2->stackState[i]))
+            if (csIsStatic(es2->stackState[i]))
                 return false;
         }
         // check for equal state at byte granularity
         for(i = 0; i < es1->stackSize; i++) {
-            if (!csIsEqual(es1, es1->stackState[i].cState, es1->stack[i],
-                           es2, es2->stackState[i+diff].cState, es2->stack[i+diff]))
+            if (!csIsEqual(es1, es1->stackState[i], es1->stack[i],
+                           es2, es2->stackState[i+diff], es2->stack[i+diff]))
                 return false;
         }
     }
@@ -254,13 +283,13 @@ bool esIsEqual(EmuState* es1, EmuState* es2)
         int diff = es1->stackSize - es2->stackSize;
         // bottom of es1 should not be static
         for(i = 0; i < diff; i++) {
-            if (msIsStatic(es1->stackState[i]))
+            if (csIsStatic(es1->stackState[i]))
                 return false;
         }
         // check for equal state at byte granularity
         for(i = 0; i < es2->stackSize; i++) {
-            if (!csIsEqual(es1, es1->stackState[i+diff].cState, es1->stack[i+diff],
-                           es2, es2->stackState[i].cState, es2->stack[i]))
+            if (!csIsEqual(es1, es1->stackState[i+diff], es1->stack[i+diff],
+                           es2, es2->stackState[i], es2->stack[i]))
                 return false;
         }
     }
@@ -293,14 +322,10 @@ void copyEmuState(EmuState* dst, EmuState* src)
         int diff = dst->stackSize - src->stackSize;
 
         dst->stackStart = src->stackStart - diff;
-        for(i = 0; i < diff; i++) {
-            initMetaState(&(dst->stackState[i]), CS_DEAD);
-            dst->stack[i] = 0;
-        }
-        for(i = 0; i < src->stackSize; i++) {
-            dst->stack[i+diff] = src->stack[i];
-            dst->stackState[i+diff] = src->stackState[i];
-        }
+        memset(dst->stack, 0, diff);
+        memset(dst->stackState, CS_DEAD, diff);
+        memcpy(dst->stack + diff, src->stack, src->stackSize);
+        memcpy(dst->stackState + diff, src->stackState, src->stackSize);
     }
     else {
         // stack to restore is larger than at destination:
@@ -309,10 +334,8 @@ void copyEmuState(EmuState* dst, EmuState* src)
         assert(src->stackAccessed - src->stackStart >= diff);
 
         dst->stackStart = src->stackStart + diff;
-        for(i = 0; i < dst->stackSize; i++) {
-            dst->stack[i] = src->stack[i+diff];
-            dst->stackState[i] = src->stackState[i+diff];
-        }
+        memcpy(dst->stack, src->stack + diff, dst->stackSize);
+        memcpy(dst->stackState, src->stackState + diff, dst->stackSize);
     }
     assert(dst->stackTop == dst->stackStart + dst->stackSize);
 
@@ -322,12 +345,12 @@ void copyEmuState(EmuState* dst, EmuState* src)
 }
 
 static
-EmuState* cloneEmuState(EmuState* src)
+EmuState* cloneEmuState(Rewriter* r, EmuState* src)
 {
     EmuState* dst;
 
     // allocate only stack space that was accessed in source
-    dst = allocEmuState(src->stackTop - src->stackAccessed);
+    dst = allocSavedState(r, src->stackTop - src->stackAccessed);
     copyEmuState(dst, src);
 
     // remember that we cloned dst from src
@@ -340,7 +363,6 @@ EmuState* cloneEmuState(EmuState* src)
 // (which is the index in the saved state list of the rewriter)
 int saveEmuState(RContext* c)
 {
-    static Error e;
     int i;
     Rewriter* r = c->r;
 
@@ -359,13 +381,14 @@ int saveEmuState(RContext* c)
     if (r->showEmuSteps)
         printf("new with esID %d\n", i);
     if (i >= SAVEDSTATE_MAX) {
-        setError(&e, ET_BufferOverflow, EM_Rewriter, r,
+        setError(&(r->error), ET_BufferOverflow, EM_Rewriter, r,
                  "Too many different emulation states");
-        c->e = &e;
+        c->e = &(r->error);
         return -1;
     }
-    r->savedState[i] = cloneEmuState(r->es);
+    r->savedState[i] = cloneEmuState(r, r->es);
     r->savedStateCount++;
+    r->stats.savedStates++;
 
     return i;
 }
@@ -440,7 +463,7 @@ void printEmuState(EmuState* es)
             printf("   %016lx ", (uint64_t) (es->stackStart + o));
             for(oo = o; oo < o+8 && oo <= spMax; oo++) {
                 printf(" %s%02x %c", (oo == spOff) ? "*" : " ", es->stack[oo],
-                       captureState2Char(es->stackState[oo].cState));
+                       captureState2Char(es->stackState[oo]));
             }
             printf("\n");
         }
@@ -500,7 +523,7 @@ void printStaticEmuState(EmuState* es, int esID)
     cc = 0;
     c = 0;
     for(i = 0; i < es->stackSize; i++) {
-        if (!msIsStatic(es->stackState[i])) {
+        if (!csIsStatic(es->stackState[i])) {
             c = 0;
             continue;
         }
@@ -579,42 +602,49 @@ void resetCapturing(Rewriter* r)
     r->currentCapBB = 0;
 
     r->capStackTop = -1;
-    r->savedStateCount = 0;
+    r->genOrderCount = 0;
+    r->loopCount = 0;
+    freeSavedStates(r);
+    arenaReset(&(r->tempArena));
 }
 
 // return 0 if not found
 static
-CBB *findCaptureBB(Rewriter* r, uint64_t f, int esID)
+CBB *findCaptureBB(Rewriter* r, uint64_t f, int esID, int unrollIdx)
 {
     int i;
 
     for(i = 0; i < r->capBBCount; i++)
-        if ((r->capBB[i].dec_addr == f) && (r->capBB[i].esID == esID))
+        if ((r->capBB[i].dec_addr == f) && (r->capBB[i].esID == esID) &&
+            (r->capBB[i].unrollIdx == unrollIdx))
             return &(r->capBB[i]);
 
     return 0;
 }
 
-// allocate a BB structure to collect instructions for capturing
-CBB* getCaptureBB(RContext* c, uint64_t f, int esID)
+// allocate a BB structure to collect instructions for capturing,
+// in copy <unrollIdx> of the body of detected loop <loop>
+static
+CBB* getLoopCaptureBB(RContext* c, uint64_t f, int esID,
+                      int loop, int unrollIdx)
 {
     CBB* bb;
     Rewriter* r = c->r;
 
     // already captured?
-    bb = findCaptureBB(r, f, esID);
+    bb = findCaptureBB(r, f, esID, unrollIdx);
     if (bb) return bb;
 
     // start capturing of new BB beginning at f
     if (r->capBBCount >= r->capBBCapacity) {
-        static Error e;
-        setError(&e, ET_BufferOverflow, EM_Rewriter, r,
+        setError(&(r->error), ET_BufferOverflow, EM_Rewriter, r,
                  "Too many captured blocks");
-        c->e = &e;
+        c->e = &(r->error);
         return 0;
     }
     bb = &(r->capBB[r->capBBCount]);
     r->capBBCount++;
+    r->stats.createdCBBs++;
     bb->dec_addr = f;
     bb->esID = esID;
     bb->fc = config_find_function(r, f);
@@ -625,6 +655,10 @@ CBB* getCaptureBB(RContext* c, uint64_t f, int esID)
     bb->nextFallThrough = 0;
     bb->endType = IT_None;
     bb->preferBranch = false;
+    bb->jtCount = 0;
+    bb->jtTable = 0;
+    bb->unrollIdx = unrollIdx;
+    bb->loop = loop;
 
     bb->size = -1; // size of 0 could be valid
     bb->addr1 = 0;
@@ -638,9 +672,14 @@ CBB* getCaptureBB(RContext* c, uint64_t f, int esID)
     return bb;
 }
 
+CBB* getCaptureBB(RContext* c, uint64_t f, int esID)
+{
+    return getLoopCaptureBB(c, f, esID, -1, 0);
+}
+
 char* cbb_prettyName(CBB* bb)
 {
-    static char buf[100];
+    static __thread char buf[100];
     int off;
 
     if ((bb->fc == 0) || (bb->fc->start > bb->dec_addr))
@@ -651,7 +690,9 @@ char* cbb_prettyName(CBB* bb)
         off = sprintf(buf, "%s+%lx", bb->fc->name, bb->dec_addr - bb->fc->start);
 
     if (bb->esID >=0)
-        sprintf(buf+off, "|%d", bb->esID);
+        off += sprintf(buf+off, "|%d", bb->esID);
+    if (bb->unrollIdx > 0)
+        sprintf(buf+off, "#%d", bb->unrollIdx);
 
     return buf;
 }
@@ -660,10 +701,9 @@ int pushCaptureBB(RContext* c, CBB* bb)
 {
     Rewriter* r = c->r;
     if (r->capStackTop + 1 >= CAPTURESTACK_LEN) {
-        static Error e;
-        setError(&e, ET_BufferOverflow, EM_Rewriter, r,
+        setError(&(r->error), ET_BufferOverflow, EM_Rewriter, r,
                  "Too many blocks on capture stack");
-        c->e = &e;
+        c->e = &(r->error);
         return -1;
     }
     r->capStackTop++;
@@ -688,10 +728,9 @@ Instr* newCapInstr(RContext* c)
     Rewriter* r = c->r;
 
     if (r->capInstrCount >= r->capInstrCapacity) {
-        static Error e;
-        setError(&e, ET_BufferOverflow, EM_Capture, r,
+        setError(&(r->error), ET_BufferOverflow, EM_Capture, r,
                  "Too many captured instructions");
-        c->e = &e;
+        c->e = &(r->error);
         return 0;
     }
     instr = r->capInstr + r->capInstrCount;
@@ -712,6 +751,11 @@ void capture(RContext* c, Instr* instr)
         printf("Capture '%s' (into %s + %d)\n",
                instr2string(instr, 0, cbb->fc), cbb_prettyName(cbb), cbb->count);
 
+    if (r->budgetCaptured &&
+        ((uint64_t) r->capInstrCount >= r->budgetCaptured)) {
+        setBudgetError(c, BL_Captured);
+        return;
+    }
     newInstr = newCapInstr(c);
     if (c->e) return;
     if (cbb->instr == 0) {
@@ -720,6 +764,7 @@ void capture(RContext* c, Instr* instr)
     }
     copyInstr(newInstr, instr);
     cbb->count++;
+    r->stats.capturedInstrs++;
 }
 
 // clone a decoded BB as a CBB
@@ -944,7 +989,7 @@ CaptureState getStackState(EmuState* es, EmuValue* off)
         if (off->val >= (uint64_t) es->stackSize) cs = CS_DEAD;
         if (off->val < es->stackAccessed - es->stackStart) cs = CS_DEAD;
         else
-            return es->stackState[off->val].cState;
+            return es->stackState[off->val];
     }
     return cs;
 }
@@ -979,7 +1024,7 @@ void getStackValue(EmuState* es, EmuValue* v, EmuValue* off)
     if (off->state.cState == CS_STATIC) {
         state = getStackState(es, off);
         for(i=1; i<count; i++)
-            state = combineState(state, es->stackState[off->val + i].cState, 1);
+            state = combineState(state, es->stackState[off->val + i], 1);
     }
     else
         state = CS_DYNAMIC;
@@ -990,7 +1035,7 @@ void getStackValue(EmuState* es, EmuValue* v, EmuValue* off)
 static
 void setStackState(EmuState* es, EmuValue* off, ValType vt, MetaState ms)
 {
-    int i, count;
+    int count;
 
     assert(msIsStatic(off->state));
 
@@ -1002,8 +1047,8 @@ void setStackState(EmuState* es, EmuValue* off, ValType vt, MetaState ms)
     default: assert(0);
     }
 
-    for(i=0; i<count; i++)
-        es->stackState[off->val + i] = ms;
+    // analysis information is not kept for stack values
+    memset(es->stackState + off->val, ms.cState, count);
 
     if (es->stackStart + off->val < es->stackAccessed)
         es->stackAccessed = es->stackStart + off->val;
@@ -1513,6 +1558,7 @@ void captureBinaryOp(RContext* c, Instr* orig, EmuState* es, EmuValue* res)
     EmuValue opval;
     Instr i;
     Operand *o;
+    ValType vt;
 
     if (res->state.cState == CS_DEAD) return;
 
@@ -1573,12 +1619,36 @@ void captureBinaryOp(RContext* c, Instr* orig, EmuState* es, EmuValue* res)
         }
         o = getImmOp(opval.type, opval.val);
     }
-    initBinaryInstr(&i, orig->type, res->type, &(orig->dst), o);
+    // shift count in %cl has other type than destination
+    vt = res->type;
+    if (!opIsImm(o) && (opValType(o) != vt)) vt = VT_None;
+    initBinaryInstr(&i, orig->type, vt, &(orig->dst), o);
     applyStaticToInd(&(i.dst), es);
     applyStaticToInd(&(i.src), es);
     capture(c, &i);
 }
 
+// dst = src * imm (3-operand imul): as dst is not an input, capture as
+// move of src into dst and multiply of dst with the immediate
+static
+void captureIMul3(RContext* c, Instr* orig, EmuState* es, EmuValue* res)
+{
+    Instr i;
+
+    if (msIsStatic(res->state)) {
+        captureBinaryOp(c, orig, es, res);
+        return;
+    }
+
+    if (!opIsEqual(&(orig->dst), &(orig->src))) {
+        initBinaryInstr(&i, IT_MOV, res->type, &(orig->dst), &(orig->src));
+        applyStaticToInd(&(i.src), es);
+        capture(c, &i);
+    }
+    initBinaryInstr(&i, IT_IMUL, res->type, &(orig->dst), &(orig->src2));
+    capture(c, &i);
+}
+
 // dst = unary-op dst
 static
 void captureUnaryOp(RContext* c, Instr* orig, EmuState* es, EmuValue* res)
@@ -1805,11 +1875,237 @@ void capturePassThrough(RContext* c, Instr* orig, EmuState* es)
         applyStaticToInd(&(i.src), es);
         break;
 
+    case OE_RMI:
+        assert(opIsReg(&(orig->dst)));
+        assert(opIsReg(&(orig->src)) || opIsInd(&(orig->src)));
+        assert(opIsImm(&(orig->src2)));
+
+        i.form = OF_3;
+        copyOperand( &(i.dst), &(orig->dst));
+        copyOperand( &(i.src), &(orig->src));
+        copyOperand( &(i.src2), &(orig->src2));
+        applyStaticToInd(&(i.src), es);
+        break;
+
     default: assert(0);
     }
     capture(c, &i);
 }
 
+// is static value <v> at stack address <a> in <es> different in <es2>?
+static
+bool stackDiffers(EmuState* es, uint64_t a, EmuState* es2)
+{
+    uint64_t i = a - es->stackStart;
+    uint64_t i2 = a - es2->stackStart;
+
+    if ((a < es2->stackStart) || (i2 >= (uint64_t) es2->stackSize))
+        return true;
+    if (!csIsStatic(es2->stackState[i2])) return true;
+    return (es->stack[i] != es2->stack[i2]);
+}
+
+// capture a mov of immediate <v> into <o>, not changing flags
+static
+void captureMaterialize(RContext* c, Operand* o, ValType vt, uint64_t v)
+{
+    Instr i;
+
+    if ((vt == VT_64) && ((int64_t) v != (int32_t) v)) {
+        // 'mov r64,imm64', only used for values not fitting into imm32
+        initBinaryInstr(&i, IT_MOV, vt, o, getImmOp(VT_64, v));
+    }
+    else {
+        // 'mov r/m 32/64, imm32' (0xC7/0 MI) as pass-through, as
+        // the generator would use 'xor' for setting registers to 0
+        initBinaryInstr(&i, IT_MOV, vt, o, getImmOp(VT_32, v));
+        attachPassthrough(&i, VEX_No, PS_No, OE_MI, SC_None, 0xC7, 0, -1);
+    }
+    capture(c, &i);
+}
+
+// are all flags dead at <f>, i.e. overwritten before being read?
+// Only looks at the first decoded BB, with a few common instructions
+static
+bool flagsDeadAt(Rewriter* r, uint64_t f)
+{
+    DBB* dbb = dbrew_decode(r, f);
+
+    for(int i = 0; i < dbb->count; i++) {
+        switch(dbb->instr[i].type) {
+        case IT_MOV: case IT_MOVSX: case IT_MOVZX: case IT_LEA:
+        case IT_PUSH: case IT_POP: case IT_NOP:
+            break;
+        case IT_CMP: case IT_TEST:
+        case IT_ADD: case IT_SUB: case IT_AND: case IT_OR: case IT_XOR:
+            return true;
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+// Widening: if code at <f> was already reached with at least <n>
+// different emulator states, static registers and stack values of
+// current state differing from any of these states become dynamic. Their
+// values get materialized by captured movs. This way, the next state at <f>
+// likely is equal to a previous one, ending exploration (e.g. of a loop).
+static
+void widenState(RContext* c, uint64_t f, int n)
+{
+    Rewriter* r = c->r;
+    EmuState* es = r->es;
+    EmuState* states[SAVEDSTATE_MAX];
+    bool widenReg[RI_GPMax], flagsDead;
+    uint64_t a, start;
+    int count = 0, i, j, k;
+
+    for(i = 0; i < r->capBBCount; i++) {
+        CBB* cbb = r->capBB + i;
+        if ((cbb->dec_addr != f) || (cbb->esID < 0)) continue;
+        for(j = 0; j < count; j++)
+            if (states[j] == r->savedState[cbb->esID]) break;
+        if (j == count)
+            states[count++] = r->savedState[cbb->esID];
+    }
+    if ((count == 0) || (count < n)) return;
+
+    // flags cannot be materialized: give up if a static flag differs,
+    // unless flags are dead at <f>
+    flagsDead = flagsDeadAt(r, f);
+    for(i = 0; i < FT_Max; i++) {
+        if (flagsDead || !msIsStatic(es->flag_state[i])) continue;
+        for(j = 0; j < count; j++)
+            if (!msIsStatic(states[j]->flag_state[i]) ||
+                (states[j]->flag[i] != es->flag[i]))
+                return;
+    }
+
+    // registers
+    for(i = 0; i < RI_GPMax; i++) {
+        widenReg[i] = false;
+        if (!msIsStatic(es->reg_state[i])) {
+            // stack relative addresses cannot be generalized
+            if (es->reg_state[i].cState != CS_STACKRELATIVE) continue;
+            for(j = 0; j < count; j++)
+                if ((states[j]->reg_state[i].cState != CS_STACKRELATIVE) ||
+                    (states[j]->reg[i] != es->reg[i]))
+                    return;
+            continue;
+        }
+        for(j = 0; j < count; j++)
+            if (!msIsStatic(states[j]->reg_state[i]) ||
+                (states[j]->reg[i] != es->reg[i]))
+                widenReg[i] = true;
+    }
+
+    // stack: check 8-byte slots with differing static bytes.
+    // To be materialized, all bytes of such a slot must be static
+    if (es->reg_state[RI_SP].cState != CS_STACKRELATIVE) return;
+    start = es->stackAccessed & ~7ull;
+    if (start < es->stackStart) start += 8;
+    for(a = start; a + 8 <= es->stackTop; a += 8) {
+        bool differs = false, allStatic = true;
+        for(k = 0; k < 8; k++) {
+            if (!csIsStatic(es->stackState[a + k - es->stackStart])) {
+                allStatic = false;
+                continue;
+            }
+            for(j = 0; j < count; j++)
+                if (stackDiffers(es, a + k, states[j])) differs = true;
+        }
+        if (!differs) continue;
+        // below stack pointer, only the red zone can be written
+        if (!allStatic || (a + 128 < es->reg[RI_SP])) return;
+    }
+
+    // apply widening, materialize values
+    if (r->showEmuSteps)
+        printf("Widening state at %s\n", prettyAddress(f, 0));
+
+    if (flagsDead)
+        for(i = 0; i < FT_Max; i++)
+            initMetaState(&(es->flag_state[i]), CS_DYNAMIC);
+
+    for(i = 0; i < RI_GPMax; i++) {
+        if (!widenReg[i]) continue;
+        captureMaterialize(c, getRegOp(getReg(RT_GP64, (RegIndex) i)),
+                           VT_64, es->reg[i]);
+        initMetaState(&(es->reg_state[i]), CS_DYNAMIC);
+    }
+    for(a = start; a + 8 <= es->stackTop; a += 8) {
+        bool differs = false;
+        uint64_t off = a - es->stackStart;
+        Operand o;
+
+        for(k = 0; k < 8; k++)
+            for(j = 0; j < count; j++)
+                if (csIsStatic(es->stackState[off + k]) &&
+                    stackDiffers(es, a + k, states[j]))
+                    differs = true;
+        if (!differs) continue;
+
+        // materialize as two 32-bit immediates
+        o.type = OT_Ind32;
+        o.reg = getReg(RT_GP64, RI_SP);
+        o.ireg = getReg(RT_None, (RegIndex) 0);
+        o.scale = 0;
+        o.seg = OSO_None;
+        for(k = 0; k < 8; k += 4) {
+            o.val = a + k - es->reg[RI_SP];
+            captureMaterialize(c, &o, VT_32, *(uint32_t*) (es->stack + off + k));
+        }
+        memset(es->stackState + off, CS_DYNAMIC, 8);
+    }
+}
+
+// get index of detected loop with header <h>, with a back-edge jump
+// ending at <end>. Registers new loops, returns -1 if too many
+static
+int getLoop(Rewriter* r, uint64_t h, uint64_t end)
+{
+    int i;
+
+    for(i = 0; i < r->loopCount; i++) {
+        if (r->loop[i].header != h) continue;
+        if (r->loop[i].end < end) r->loop[i].end = end;
+        return i;
+    }
+    if (r->loopCount >= LOOP_MAX) return -1;
+    r->loop[i].header = h;
+    r->loop[i].end = end;
+    r->loopCount++;
+
+    return i;
+}
+
+// get CBB at <t> as successor of <cbb>, ending with a jump at <end>.
+// For partial unrolling, a back-edge to the header of a loop to be unrolled
+// goes to the next copy of the loop body. Other jumps stay in the same
+// copy as long as they do not leave the loop
+static
+CBB* getSuccessorBB(RContext* c, CBB* cbb, uint64_t t, uint64_t end, int esID)
+{
+    Rewriter* r = c->r;
+    int loop = cbb->loop;
+    int idx = cbb->unrollIdx;
+
+    if ((t < end) && ((loop < 0) || (r->loop[loop].header == t))) {
+        int factor = config_loop_unroll(r, t);
+        if (factor > 1) {
+            loop = getLoop(r, t, end);
+            idx = (loop < 0) ? 0 : (idx + 1) % factor;
+        }
+    }
+    else if ((loop >= 0) &&
+             ((t < r->loop[loop].header) || (t >= r->loop[loop].end)))
+        idx = 0;
+
+    if (idx == 0) loop = -1;
+    return getLoopCaptureBB(c, t, esID, loop, idx);
+}
+
 // this ends a captured BB, queuing new paths to be traced
 static
 void captureJcc(RContext* c, InstrType it,
@@ -1823,6 +2119,19 @@ void captureJcc(RContext* c, InstrType it,
     // TODO: this config is a hack which should be removed
     if (r->cc->branches_known) return;
 
+    if (r->cc->widen_states > 0) {
+        widenState(c, branchTarget, r->cc->widen_states);
+        widenState(c, fallthroughTarget, r->cc->widen_states);
+        if (c->e) return;
+    }
+    // a loop to be unrolled gets widened on its first back-edge, as a
+    // static trip count otherwise would result in full unrolling
+    if ((branchTarget < fallthroughTarget) &&
+        (config_loop_unroll(r, branchTarget) > 1)) {
+        widenState(c, branchTarget, 1);
+        if (c->e) return;
+    }
+
     cbb = popCaptureBB(r);
     cbb->endType = it;
     // use static prediction: 1st follow branch if backwards
@@ -1830,8 +2139,8 @@ void captureJcc(RContext* c, InstrType it,
     cbb->preferBranch = (branchTarget < fallthroughTarget);
 
     esID = saveEmuState(c);
-    cbbFT = getCaptureBB(c, fallthroughTarget, esID);
-    cbbBR = getCaptureBB(c, branchTarget, esID);
+    cbbFT = getSuccessorBB(c, cbb, fallthroughTarget, fallthroughTarget, esID);
+    cbbBR = getSuccessorBB(c, cbb, branchTarget, fallthroughTarget, esID);
     if (c->e) return;
 
     cbb->nextFallThrough = cbbFT;
@@ -1854,6 +2163,34 @@ void captureJcc(RContext* c, InstrType it,
 }
 
 
+// a static jump from <end> backwards to <t> was taken: if this is a back-edge
+// of a loop to be unrolled, end current CBB with a jump, allowing the state
+// at the loop header to be widened. Returns false if nothing was done
+bool captureBackEdge(RContext* c, uint64_t t, uint64_t end)
+{
+    CBB *cbb, *next;
+    int esID;
+    Rewriter* r = c->r;
+
+    if ((t >= end) || (r->currentCapBB == 0)) return false;
+    if (config_loop_unroll(r, t) <= 1) return false;
+
+    widenState(c, t, 1);
+    if (c->e) return true;
+
+    cbb = popCaptureBB(r);
+    cbb->endType = IT_JMP;
+
+    esID = saveEmuState(c);
+    next = getSuccessorBB(c, cbb, t, end, esID);
+    if (c->e) return true;
+
+    cbb->nextBranch = next;
+    pushCaptureBB(c, next);
+    return true;
+}
+
+
 //----------------------------------------------------------
 // Emulator for instruction types
 
@@ -1861,8 +2198,7 @@ static
 void setEmulatorError(RContext* c, Instr* instr,
                       ErrorType et, const char* d)
 {
-    static Error e;
-    static char buf[100];
+    char* buf = c->r->errorDesc;
 
     if (d == 0) {
         d = buf;
@@ -1875,8 +2211,177 @@ void setEmulatorError(RContext* c, Instr* instr,
         else
             d = 0;
     }
-    setError(&e, et, EM_Emulator, c->r, d);
-    c->e = &e;
+    setError(&(c->r->error), et, EM_Emulator, c->r, d);
+    c->e = &(c->r->error);
+}
+
+// number of entries of jump table <table>, indexed by register <idx> in
+// indirect jump <instr>: from configuration, or from a bounds check
+// 'cmp $n,idx; ja' ending the decoded BB which falls through into the BB
+// of <instr>. Returns 0 if unknown
+static
+int jumpTableEntries(Rewriter* r, uint64_t table, Instr* instr, RegIndex idx)
+{
+    DBB *dbb = 0, *prev = 0;
+    Instr *jcc, *cmp;
+    int i, n;
+
+    n = config_jumptable_entries(r, table);
+    if (n > 0) return n;
+
+    for(i = 0; i < r->decBBCount; i++) {
+        DBB* d = r->decBB + i;
+        if ((instr >= d->instr) && (instr < d->instr + d->count)) dbb = d;
+    }
+    if (!dbb) return 0;
+    for(i = 0; i < r->decBBCount; i++) {
+        DBB* d = r->decBB + i;
+        if ((d->addr + d->size == dbb->addr) && (d->count >= 2)) prev = d;
+    }
+    if (!prev) return 0;
+
+    // index must not change after the check, apart from zero-extension
+    // and being overwritten by the table load itself
+    for(Instr* ii = dbb->instr; ii < instr; ii++) {
+        if (!gpWrittenBy(ii, idx)) continue;
+        if ((ii->type == IT_MOV) && (ii->dst.type == OT_Reg32) &&
+            opIsEqual(&(ii->dst), &(ii->src)))
+            continue;
+        if ((ii == instr - 1) && (ii->type == IT_MOV) &&
+            opIsInd(&(ii->src)) && (ii->src.scale == 8) &&
+            (ii->src.ireg.ri == idx))
+            continue;
+        return 0;
+    }
+
+    jcc = prev->instr + prev->count - 1;
+    cmp = jcc - 1;
+    if ((cmp->type != IT_CMP) || !opIsImm(&(cmp->src)) ||
+        !opIsGPReg(&(cmp->dst)) || (regGP64Index(cmp->dst.reg) != idx))
+        return 0;
+    n = (int) cmp->src.val;
+    if ((cmp->src.val > 1024) || (jcc->dst.val == dbb->addr)) return 0;
+    if (jcc->type == IT_JA) return n + 1; // jump to default if idx > n
+    if (jcc->type == IT_JNC) return n;    // jump to default if idx >= n
+    return 0;
+}
+
+// allocate <size> bytes of data with alignment <align> (power of 2) to be
+// accessed by generated code via absolute 32-bit addresses
+uint8_t* newTableData(RContext* c, int size, int align)
+{
+    Rewriter* r = c->r;
+    int pad;
+
+    if (!r->ts)
+        r->ts = initTableStorage(r->capCodeCapacity);
+    if (r->ts) {
+        pad = (int) (-(uint64_t) (r->ts->buf + r->ts->used) & (align - 1));
+        if (reserveCodeStorage(r->ts, pad + size) != 0) {
+            useCodeStorage(r->ts, pad);
+            return useCodeStorage(r->ts, size);
+        }
+    }
+    setError(&(r->error), ET_BufferOverflow, EM_Capture, r,
+             "No storage for table data");
+    c->e = &(r->error);
+    return 0;
+}
+
+// allocate jump table with <n> entries, to be used by generated code
+static
+uint64_t* newJumpTable(RContext* c, int n)
+{
+    return (uint64_t*) newTableData(c, 8 * n, 8);
+}
+
+// indirect jump <instr> to dynamic target <t>: if the target is loaded from
+// a jump table ('jmp *T(,%idx,8)', or 'mov T(,%idx,8),%reg' captured before
+// 'jmp *%reg'), follow the table entry as constant if the index is static.
+// With dynamic index, end the CBB with an indirect jump via a new table
+// pointing to the CBBs of all table targets.
+// Returns false if no jump table is used
+static
+bool captureJumpTable(RContext* c, Instr* instr, EmuState* es, uint64_t t)
+{
+    Rewriter* r = c->r;
+    CBB* cbb = r->currentCapBB;
+    Instr *load = 0, i;
+    Operand o;
+    MetaState ms;
+    uint64_t table, *jt;
+    int n, esID;
+
+    if (!cbb) return false;
+    if (instr->dst.type == OT_Reg64) {
+        // load of table entry has to be last captured instruction
+        if (cbb->count == 0) return false;
+        load = cbb->instr + cbb->count - 1;
+        if ((load->type != IT_MOV) || (load->ptLen > 0) ||
+            !opIsEqual(&(load->dst), &(instr->dst)) ||
+            (load->src.type != OT_Ind64))
+            return false;
+        copyOperand(&o, &(load->src));
+    }
+    else {
+        copyOperand(&o, &(instr->dst));
+        applyStaticToInd(&o, es);
+    }
+    if ((o.seg != OSO_None) || (o.reg.rt != RT_None)) return false;
+
+    if (o.scale == 0) {
+        // static index: remove load, target becomes static
+        assert(load != 0);
+        cbb->count--;
+        r->capInstrCount--;
+        initMetaState(&ms, CS_STATIC);
+        setOpState(ms, es, &(instr->dst));
+        c->exit = t;
+        return true;
+    }
+    if (o.scale != 8) return false;
+
+    table = o.val;
+    n = jumpTableEntries(r, table, instr, o.ireg.ri);
+    if (n == 0) {
+        setEmulatorError(c, instr, ET_UnsupportedOperands,
+                         "Jump table with unknown number of entries");
+        return true;
+    }
+    jt = newJumpTable(c, n);
+    if (!jt) return true;
+
+    // jump via new table
+    if (load) {
+        load->src.val = (uint64_t) jt;
+        initUnaryInstr(&i, IT_JMPI, &(instr->dst));
+    }
+    else {
+        o.val = (uint64_t) jt;
+        initUnaryInstr(&i, IT_JMPI, &o);
+    }
+    capture(c, &i);
+    if (c->e) return true;
+
+    esID = saveEmuState(c);
+    cbb = popCaptureBB(r);
+    cbb->endType = IT_JMPI;
+    cbb->jtCount = n;
+    cbb->jtTable = jt;
+    for(int k = 0; k < n; k++) {
+        CBB* next = getSuccessorBB(c, cbb, ((uint64_t*) table)[k],
+                                   instr->addr + instr->len, esID);
+        if (c->e) return true;
+        jt[k] = (uint64_t) next;
+
+        // queue each target only once
+        int j = 0;
+        while((j < k) && (jt[j] != jt[k])) j++;
+        if (j == k) pushCaptureBB(c, next);
+        if (c->e) return true;
+    }
+    c->exit = t;
+    return true;
 }
 
 static
@@ -1924,6 +2429,7 @@ void processInstr(RContext* c, Instr* instr)
     EmuValue vres, v1, v2, addr;
     CaptureState cs;
     ValType vt;
+    Instr shift1;
 
     Rewriter* r = c->r;
     EmuState* es = c->r->es;
@@ -1934,6 +2440,15 @@ void processInstr(RContext* c, Instr* instr)
         return;
     }
 
+    // shift by 1 (unary form): handle as shift by immediate 1
+    if (((instr->type == IT_SHL) || (instr->type == IT_SHR) ||
+         (instr->type == IT_SAR)) && (instr->form == OF_1)) {
+        shift1 = *instr;
+        shift1.form = OF_2;
+        copyOperand(&(shift1.src), getImmOp(VT_8, 1));
+        instr = &shift1;
+    }
+
     switch(instr->type) {
 
     case IT_ADD:
@@ -2154,7 +2669,10 @@ void processInstr(RContext* c, Instr* instr)
         initMetaState(&(vres.state), cs);
 
         // for capture we need state of dst, do before setting dst
-        captureBinaryOp(c, instr, es, &vres);
+        if (instr->form == OF_3)
+            captureIMul3(c, instr, es, &vres);
+        else
+            captureBinaryOp(c, instr, es, &vres);
         setOpValue(&vres, es, &(instr->dst));
         setOpState(vres.state, es, &(instr->dst));
         break;
@@ -2289,7 +2807,7 @@ void processInstr(RContext* c, Instr* instr)
     case IT_JBE:
         if (msIsDynamic(es->flag_state[FT_Carry]) ||
             msIsDynamic(es->flag_state[FT_Zero])) {
-            captureJcc(c, IT_JLE, instr->dst.val, instr->addr + instr->len);
+            captureJcc(c, IT_JBE, instr->dst.val, instr->addr + instr->len);
         }
         if ((es->flag[FT_Carry] == true) ||
             (es->flag[FT_Zero] == true))
@@ -2301,7 +2819,7 @@ void processInstr(RContext* c, Instr* instr)
     case IT_JA:
         if (msIsDynamic(es->flag_state[FT_Carry]) ||
             msIsDynamic(es->flag_state[FT_Zero])) {
-            captureJcc(c, IT_JG, instr->dst.val, instr->addr + instr->len);
+            captureJcc(c, IT_JA, instr->dst.val, instr->addr + instr->len);
         }
         if ((es->flag[FT_Carry] == false) &&
             (es->flag[FT_Zero] == false))
@@ -2423,6 +2941,8 @@ void processInstr(RContext* c, Instr* instr)
         }
 
         if (!msIsStatic(v1.state)) {
+            if (captureJumpTable(c, instr, es, v1.val)) break;
+
             // call target must be known
             setEmulatorError(c, instr, ET_BufferOverflow,
                              "Call to unknown target not supported");
@@ -2575,6 +3095,29 @@ void processInstr(RContext* c, Instr* instr)
         setOpState(v1.state, es, &(instr->dst));
         break;
 
+    case IT_NOT:
+        // flags are not affected
+        getOpValue(&v1, es, &(instr->dst));
+        switch(instr->dst.type) {
+        case OT_Reg32:
+        case OT_Ind32:
+            v1.val = (uint32_t) ~v1.val;
+            break;
+
+        case OT_Reg64:
+        case OT_Ind64:
+            v1.val = ~v1.val;
+            break;
+
+        default:
+            setEmulatorError(c, instr, ET_UnsupportedOperands, 0);
+            return;
+        }
+        captureUnaryOp(c, instr, es, &v1);
+        setOpValue(&v1, es, &(instr->dst));
+        setOpState(v1.state, es, &(instr->dst));
+        break;
+
 
     case IT_POP:
         switch(instr->dst.type) {
@@ -2832,7 +3375,13 @@ uint64_t processKnownTargets(RContext* c, uint64_t f)
     // vector API
     if ( (f == (uint64_t) dbrew_apply4_R8V8) ||
          (f == (uint64_t) dbrew_apply4_R8V8V8) ||
-         (f == (uint64_t) dbrew_apply4_R8P8) )
+         (f == (uint64_t) dbrew_apply4_R8P8) ||
+         (f == (uint64_t) dbrew_apply_R8V8) ||
+         (f == (uint64_t) dbrew_apply_R8V8V8) ||
+         (f == (uint64_t) dbrew_apply_R8P8) ||
+         (f == (uint64_t) dbrew_apply_R4V4) ||
+         (f == (uint64_t) dbrew_apply_R4V4V4) ||
+         (f == (uint64_t) dbrew_apply_R4P4) )
         return handleVectorCall(c->r, f, es);
 
     return f;
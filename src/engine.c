@@ -22,15 +22,21 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
+#include "alloc.h"
 #include "common.h"
+#include "cpu.h"
 #include "printer.h"
 #include "engine.h"
 #include "emulate.h"
 #include "decode.h"
 #include "generate.h"
 #include "expr.h"
+#include "opt.h"
+#include "perfmap.h"
 #include "error.h"
+#include "vector.h"
 
 
 Rewriter* allocRewriter(void)
@@ -38,7 +44,8 @@ Rewriter* allocRewriter(void)
     Rewriter* r;
     int i;
 
-    r = (Rewriter*) malloc(sizeof(Rewriter));
+    r = (Rewriter*) memAlloc(0, sizeof(Rewriter));
+    r->allocator = *defaultAllocator();
 
     // allocation of other members on demand, capacities may be reset
 
@@ -49,6 +56,8 @@ Rewriter* allocRewriter(void)
     r->decBBCount = 0;
     r->decBBCapacity = 0;
     r->decBB = 0;
+    r->sharedDecodeCache = false;
+    r->decodeGen = 0;
 
     r->capInstrCount = 0;
     r->capInstrCapacity = 0;
@@ -60,15 +69,46 @@ Rewriter* allocRewriter(void)
     r->currentCapBB = 0;
     r->capStackTop = -1;
     r->genOrderCount = 0;
+    r->loopCount = 0;
 
     r->savedStateCount = 0;
     for(i=0; i< SAVEDSTATE_MAX; i++)
         r->savedState[i] = 0;
+    r->stateArena.first = 0;
+    r->stateArena.current = 0;
+    r->tempArena.first = 0;
+    r->tempArena.current = 0;
 
     r->capCodeCapacity = 0;
+    r->ts = 0;
+    r->installAddr = 0;
+    r->installCS = 0;
     r->cs = 0;
+    r->retiredCSCount = 0;
+    r->retiredCS = 0;
     r->generatedCodeAddr = 0;
     r->generatedCodeSize = 0;
+    r->appendCode = false;
+    r->nearCode = false;
+    r->hugeCode = false;
+    r->ripFixCount = 0;
+    r->ripFixCapacity = 0;
+    r->ripFix = 0;
+
+    r->workerCount = 0;
+    r->worker = 0;
+
+    memset(&(r->stats), 0, sizeof(DBrewStats));
+
+    r->budgetEmulated = 0;
+    r->budgetCaptured = 0;
+    r->budgetTimeNs = 0;
+    r->budgetCodeBytes = 0;
+    r->budgetDegrade = false;
+    r->budgetExceeded = BL_None;
+    r->budgetDepth = -1;
+    r->emulatedCount = 0;
+    r->deadline = 0;
 
     r->cc = 0;
     r->vreq = VR_None;
@@ -80,8 +120,19 @@ Rewriter* allocRewriter(void)
     // optimization passes
     r->addInliningHints = true;
     r->doCopyPass = true;
+    r->doStrengthReduction = true;
+    r->doPeephole = true;
+    r->doValueNumbering = false;
+    r->doIfConversion = false;
+    r->ifConvMax = 4;
+    r->doVexTranscoding = false;
+    r->doFpContract = false;
+    r->cpuFeatures = hostCpuFeatures();
+    r->multiVersion = false;
 
     // default: debug off
+    r->perfMap = false;
+    r->perfJitdump = false;
     r->showDecoding = false;
     r->showEmuState = false;
     r->showEmuSteps = false;
@@ -98,28 +149,28 @@ void initRewriter(Rewriter* r)
     if (r->decInstr == 0) {
         // default
         if (r->decInstrCapacity == 0) r->decInstrCapacity = 500;
-        r->decInstr = (Instr*) malloc(sizeof(Instr) * r->decInstrCapacity);
+        r->decInstr = (Instr*) memAlloc(r, sizeof(Instr) * r->decInstrCapacity);
     }
     r->decInstrCount = 0;
 
     if (r->decBB == 0) {
         // default
         if (r->decBBCapacity == 0) r->decBBCapacity = 50;
-        r->decBB = (DBB*) malloc(sizeof(DBB) * r->decBBCapacity);
+        r->decBB = (DBB*) memAlloc(r, sizeof(DBB) * r->decBBCapacity);
     }
     r->decBBCount = 0;
 
     if (r->capInstr == 0) {
         // default
         if (r->capInstrCapacity == 0) r->capInstrCapacity = 500;
-        r->capInstr = (Instr*) malloc(sizeof(Instr) * r->capInstrCapacity);
+        r->capInstr = (Instr*) memAlloc(r, sizeof(Instr) * r->capInstrCapacity);
     }
     r->capInstrCount = 0;
 
     if (r->capBB == 0) {
         // default
         if (r->capBBCapacity == 0) r->capBBCapacity = 50;
-        r->capBB = (CBB*) malloc(sizeof(CBB) * r->capBBCapacity);
+        r->capBB = (CBB*) memAlloc(r, sizeof(CBB) * r->capBBCapacity);
     }
     r->capBBCount = 0;
     r->currentCapBB = 0;
@@ -128,8 +179,9 @@ void initRewriter(Rewriter* r)
     if (r->cs == 0) {
         if (r->capCodeCapacity == 0) r->capCodeCapacity = 3000;
         if (r->capCodeCapacity >0)
-            r->cs = initCodeStorage(r->capCodeCapacity);
+            r->cs = allocCodeStorage(r, r->capCodeCapacity);
     }
+    freeRetiredCodeStorage(r);
     if (r->cs) {
         r->cs->used = 0;
         // any previously generated code is invalid
@@ -138,25 +190,114 @@ void initRewriter(Rewriter* r)
     }
 
     if (r->ePool == 0)
-        r->ePool = expr_allocPool(1000);
+        r->ePool = expr_allocPool(r, 1000);
+}
+
+/* Code storage for generated code of <r>, if near placement is enabled
+ * within +/- 2GB of the function to rewrite. This allows RIP-relative
+ * addressing of its data, and keeps jumps to original code short. Falls
+ * back to any address.
+ */
+CodeStorage* allocCodeStorage(Rewriter* r, int size)
+{
+    uint64_t near = r->nearCode ? r->func : 0;
+    CodeStorage* cs = 0;
+
+    cs = providedCodeStorage(r, size, near);
+    if (cs)
+        return cs;
+
+    if (r->hugeCode) {
+        cs = initHugeCodeStorage(near, size);
+        if (!cs && near)
+            cs = initHugeCodeStorage(0, size);
+    }
+    else if (near)
+        cs = initNearCodeStorage(near, size);
+    if (!cs)
+        cs = initCodeStorage(size);
+    return cs;
+}
+
+bool retireCodeStorage(Rewriter* r, int size)
+{
+    CodeStorage** retired;
+    CodeStorage* cs;
+
+    cs = allocCodeStorage(r, size);
+    if (!cs) return false;
+    retired = (CodeStorage**) memRealloc(r, r->retiredCS,
+                                         sizeof(CodeStorage*) * r->retiredCSCount,
+                                         sizeof(CodeStorage*) * (r->retiredCSCount + 1));
+    if (!retired) {
+        freeCodeStorage(cs);
+        return false;
+    }
+    retired[r->retiredCSCount] = r->cs;
+    r->retiredCS = retired;
+    r->retiredCSCount++;
+    r->cs = cs;
+    r->capCodeCapacity = size;
+    return true;
+}
+
+void freeRetiredCodeStorage(Rewriter* r)
+{
+    for(int i = 0; i < r->retiredCSCount; i++)
+        freeCodeStorage(r->retiredCS[i]);
+    memFree(r, r->retiredCS);
+    r->retiredCS = 0;
+    r->retiredCSCount = 0;
+}
+
+void releaseBuffers(Rewriter* r)
+{
+    memFree(r, r->decInstr);
+    r->decInstr = 0;
+    r->decInstrCount = 0;
+    memFree(r, r->decBB);
+    r->decBB = 0;
+    r->decBBCount = 0;
+    memFree(r, r->capInstr);
+    r->capInstr = 0;
+    r->capInstrCount = 0;
+    memFree(r, r->capBB);
+    r->capBB = 0;
+    r->capBBCount = 0;
+    r->currentCapBB = 0;
+    memFree(r, r->ripFix);
+    r->ripFix = 0;
+    r->ripFixCount = 0;
+    r->ripFixCapacity = 0;
+
+    freeEmuState(r);
+    arenaFree(r, &(r->tempArena));
+    expr_freePool(r, r->ePool);
+    r->ePool = 0;
 }
 
 void freeRewriter(Rewriter* r)
 {
     if (!r) return;
 
-    free(r->decInstr);
-    free(r->decBB);
-    free(r->capInstr);
-    free(r->capBB);
-    free(r->cc);
+    releaseBuffers(r);
+    config_free(r);
 
-    freeEmuState(r);
+    for(int i = 0; i < r->workerCount; i++)
+        freeRewriter(r->worker[i]);
+    memFree(0, r->worker);
+
+    // generated code goes away: callers must use original again
+    dbrew_uninstall(r);
     if (r->cs)
         freeCodeStorage(r->cs);
-    expr_freePool(r->ePool);
+    freeRetiredCodeStorage(r);
+    if (r->ts)
+        freeCodeStorage(r->ts);
+    if (r->installCS)
+        freeCodeStorage(r->installCS);
 
-    free(r);
+    memFree(0, r);
 }
 
 
@@ -171,6 +312,44 @@ void freeRewriter(Rewriter* r)
  */
 
 
+void setBudgetError(RContext* c, DBrewBudgetLimit l)
+{
+    const char* d = 0;
+
+    switch(l) {
+    case BL_Emulated:  d = "budget of emulated instructions exhausted"; break;
+    case BL_Captured:  d = "budget of captured instructions exhausted"; break;
+    case BL_CodeBytes: d = "budget of generated code bytes exhausted"; break;
+    case BL_Time:      d = "time budget exhausted"; break;
+    default: assert(0);
+    }
+    setError(&(c->r->error), ET_BudgetExceeded, EM_Rewriter, c->r, d);
+    c->r->budgetExceeded = l;
+    // call depth being emulated, to restrict degradation on retry
+    c->r->budgetDepth = -1;
+    if (((l == BL_Emulated) || (l == BL_Captured)) && c->r->es &&
+        (c->r->es->depth >= 0) && (c->r->es->depth < CC_MAXCALLDEPTH))
+        c->r->budgetDepth = c->r->es->depth;
+    c->e = &(c->r->error);
+}
+
+// check budget before emulating next instruction
+static
+void checkBudget(RContext* c)
+{
+    Rewriter* r = c->r;
+
+    r->emulatedCount++;
+    if (r->budgetEmulated && (r->emulatedCount > r->budgetEmulated)) {
+        setBudgetError(c, BL_Emulated);
+        return;
+    }
+    // getting the time is more expensive: only check every 64 instructions
+    if (r->deadline && ((r->emulatedCount & 63) == 0) &&
+        (timeNs() > r->deadline))
+        setBudgetError(c, BL_Time);
+}
+
 /* See dbrew_emulate to see how to call this from a function
  * which acts almost as drop-in replacement (only one additional par).
  *
@@ -178,7 +357,7 @@ void freeRewriter(Rewriter* r)
  * value of the emulated function)
  */
 static
-Error* emulateAndCapture(Rewriter* r, int parCount, uint64_t* par)
+Error* emulateAndCapturePaths(Rewriter* r, int parCount, uint64_t* par)
 {
     // calling convention x86-64: parameters are stored in registers
     // see https://en.wikipedia.org/wiki/X86_calling_conventions
@@ -196,14 +375,26 @@ Error* emulateAndCapture(Rewriter* r, int parCount, uint64_t* par)
     cxt.r = r;
     cxt.e = 0;
 
+    // drop decoded BBs if any code was invalidated meanwhile
+    if (r->decodeGen != decodeCacheGeneration()) {
+        r->decBBCount = 0;
+        r->decInstrCount = 0;
+        r->decodeGen = decodeCacheGeneration();
+    }
+
     if (!r->es)
-        r->es = allocEmuState(1024);
+        r->es = allocEmuState(r, 1024);
     resetEmuState(r->es);
     es = r->es;
 
     resetCapturing(r);
-    if (r->cs)
+    if (r->cs && !r->appendCode) {
+        freeRetiredCodeStorage(r);
         r->cs->used = 0;
+    }
+    if (r->ts && !r->appendCode)
+        r->ts->used = 0;
+    r->emulatedCount = 0;
 
     for(i=0;i<parCount;i++) {
         MetaState* ms = &(es->reg_state[parReg[i]]);
@@ -297,7 +488,10 @@ Error* emulateAndCapture(Rewriter* r, int parCount, uint64_t* par)
             es->regIP = instr->addr + instr->len;
 
             cxt.exit = 0;
-            processInstr(&cxt, instr);
+            r->stats.emulatedInstrs++;
+            checkBudget(&cxt);
+            if (!cxt.e)
+                processInstr(&cxt, instr);
             if (cxt.e) {
                 assert(isErrorSet(cxt.e));
                 r->capBBCount = 0;
@@ -306,6 +500,11 @@ Error* emulateAndCapture(Rewriter* r, int parCount, uint64_t* par)
 
             if (cxt.exit) assert(i == dbb->count - 1);
             nextbb_addr = processKnownTargets(&cxt, cxt.exit);
+            if ((nextbb_addr != 0) && (nextbb_addr == cxt.exit) &&
+                (instrIsJcc(instr->type) || (instr->type == IT_JMP))) {
+                captureBackEdge(&cxt, nextbb_addr, instr->addr + instr->len);
+                if (cxt.e) return cxt.e;
+            }
 
             if (r->showEmuState) {
                 if (nextbb_addr != 0) es->regIP = nextbb_addr;
@@ -334,25 +533,52 @@ Error* emulateAndCapture(Rewriter* r, int parCount, uint64_t* par)
     return 0;
 }
 
-Error* vEmulateAndCapture(Rewriter* r, va_list args)
+// same as emulateAndCapturePaths, with time accounted in statistics.
+// Time spent in decoding is not included
+static
+Error* emulateAndCapture(Rewriter* r, int parCount, uint64_t* par)
 {
-    static Error e;
-    int i, parCount;
-    uint64_t par[6];
+    uint64_t t0 = timeNs();
+    uint64_t decodeNs0 = r->stats.decodeNs;
+    Error* e;
+
+    e = emulateAndCapturePaths(r, parCount, par);
+    r->stats.emulateNs += timeNs() - t0 - (r->stats.decodeNs - decodeNs0);
+
+    return e;
+}
+
+// check number of parameters configured for the function to rewrite
+static
+Error* checkParCount(Rewriter* r)
+{
+    int parCount;
 
     parCount = r->cc->parCount;
     if (parCount == -1) {
-        setError(&e, ET_InvalidRequest, EM_Rewriter, r,
+        setError(&(r->error), ET_InvalidRequest, EM_Rewriter, r,
                  "number of parameters not set");
-        return &e;
+        return &(r->error);
     }
 
     if (parCount > 6) {
-        setError(&e, ET_InvalidRequest, EM_Rewriter, r,
+        setError(&(r->error), ET_InvalidRequest, EM_Rewriter, r,
                  "number of parameters >6 not supported");
-        return &e;
+        return &(r->error);
     }
+    return 0;
+}
+
+Error* vEmulateAndCapture(Rewriter* r, va_list args)
+{
+    Error* e;
+    int i, parCount;
+    uint64_t par[6];
+
+    e = checkParCount(r);
+    if (e) return e;
 
+    parCount = r->cc->parCount;
     for(i = 0; i < parCount; i++) {
         par[i] = va_arg(args, uint64_t);
     }
@@ -360,6 +586,146 @@ Error* vEmulateAndCapture(Rewriter* r, va_list args)
     return emulateAndCapture(r, parCount, par);
 }
 
+Error* emulateAndCapturePars(Rewriter* r, uint64_t* par)
+{
+    Error* e;
+
+    e = checkParCount(r);
+    if (e) return e;
+
+    return emulateAndCapture(r, r->cc->parCount, par);
+}
+
+// run passes on captured instructions and generate code from them
+Error* processCaptured(Rewriter* r)
+{
+    RContext c;
+    uint64_t t0, t1;
+
+    c.r = r;
+    c.e = 0;
+
+    t0 = timeNs();
+    if (r->vreq != VR_None) {
+        // vectorization needs branch diamonds to be merged before
+        if (r->doIfConversion)
+            optIfConversion(&c);
+        if (!c.e)
+            runVectorization(&c);
+    }
+    if (!c.e)
+        runOptsOnCaptured(&c);
+
+    t1 = timeNs();
+    r->stats.optNs += t1 - t0;
+    if (!c.e && r->deadline && (t1 > r->deadline))
+        setBudgetError(&c, BL_Time);
+    if (!c.e)
+        generateBinaryFromCaptured(&c);
+    r->stats.generateNs += timeNs() - t1;
+
+    return c.e;
+}
+
+Error* vGetPars(Rewriter* r, va_list args, uint64_t* par)
+{
+    Error* e;
+
+    e = checkParCount(r);
+    if (e) return e;
+
+    for(int i = 0; i < r->cc->parCount; i++)
+        par[i] = va_arg(args, uint64_t);
+
+    return 0;
+}
+
+static
+Error* rewriteOnce(Rewriter* r, uint64_t* par)
+{
+    Error* e;
+
+    r->budgetExceeded = BL_None;
+    e = emulateAndCapturePars(r, par);
+    if (!e)
+        e = processCaptured(r);
+
+    return e;
+}
+
+Error* rewritePars(Rewriter* r, uint64_t* par)
+{
+    bool forceUnknown[CC_MAXCALLDEPTH];
+    DBrewBudgetLimit l;
+    Error* e;
+    int depth;
+
+    if (r->multiVersion)
+        return rewriteVersions(r, par);
+
+    // code storage gets reused, and decoding needs the original function
+    // entry: redirect callers to original again. Installing the new code
+    // is up to the caller (see dbrew_install)
+    if (!r->appendCode)
+        dbrew_uninstall(r);
+
+    // retries share the deadline of the first attempt
+    r->deadline = r->budgetTimeNs ? timeNs() + r->budgetTimeNs : 0;
+    e = rewriteOnce(r, par);
+    if (!e || (r->budgetExceeded == BL_None) || !r->budgetDegrade ||
+        (r->budgetExceeded == BL_Time)) {
+        r->deadline = 0;
+        return e;
+    }
+
+    // degrade: retry with calculated values unknown, avoiding unrolling.
+    // First only at the call depth where the budget got exhausted, then
+    // at all depths
+    l = r->budgetExceeded;
+    depth = r->budgetDepth;
+    for(int i = 0; i < CC_MAXCALLDEPTH; i++)
+        forceUnknown[i] = r->cc->force_unknown[i];
+    if ((depth >= 0) && forceUnknown[depth])
+        depth = -1;
+    while(1) {
+        logError(e, (char*) ((depth >= 0) ?
+                 "Retry with calculated values unknown at call depth" :
+                 "Retry with calculated values unknown"));
+        for(int i = 0; i < CC_MAXCALLDEPTH; i++)
+            r->cc->force_unknown[i] = forceUnknown[i] ||
+                                      (depth < 0) || (i == depth);
+        e = rewriteOnce(r, par);
+        if (!e || (depth < 0) || (r->budgetExceeded == BL_None) ||
+            (r->budgetExceeded == BL_Time))
+            break;
+        depth = -1;
+    }
+    for(int i = 0; i < CC_MAXCALLDEPTH; i++)
+        r->cc->force_unknown[i] = forceUnknown[i];
+    r->deadline = 0;
+
+    // report first limit hit if retry succeeded
+    if (!e) r->budgetExceeded = l;
+
+    return e;
+}
+
+uint64_t timeNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+void statsRewriteDone(Rewriter* r, uint64_t t0, Error* e)
+{
+    r->stats.rewrites++;
+    if (e)
+        r->stats.fallbacks++;
+    r->stats.totalNs += timeNs() - t0;
+}
+
 
 //----------------------------------------------------------
 // example optimization passes on captured instructions
@@ -401,6 +767,18 @@ void optPass(RContext* c, CBB* cbb)
         if (newInstrs)
             cbb->instr = newInstrs;
     }
+    if (r->doStrengthReduction)
+        optStrengthReduction(c, cbb);
+    if (r->doPeephole)
+        optPeephole(c, cbb);
+    if (r->doValueNumbering)
+        optValueNumbering(c, cbb);
+    if (r->doFpContract && (r->cpuFeatures & CF_FMA))
+        optFmaFusion(c, cbb);
+    if (r->cpuFeatures & (CF_BMI1 | CF_BMI2))
+        optBmi(c, cbb);
+    if (r->doVexTranscoding && (r->cpuFeatures & CF_AVX))
+        optVexTranscoding(c, cbb);
 }
 
 
@@ -408,11 +786,17 @@ void optPass(RContext* c, CBB* cbb)
 void runOptsOnCaptured(RContext* c)
 {
     Rewriter* r = c->r;
+
+    if (r->doIfConversion)
+        optIfConversion(c);
+    if (c->e) return;
+
     for(int i = 0; i < r->capBBCount; i++) {
         CBB* cbb = r->capBB + i;
         optPass(c, cbb);
         if (c->e) return;
     }
+    optVZeroUpper(c);
 }
 
 
@@ -433,12 +817,21 @@ void generateBinaryFromCaptured(RContext *c)
     // align address to cacheline boundary (multiple of 64)
     int cl_off = ((uint64_t)buf0) & 63;
     if (cl_off >0) {
+        if (reserveCodeStorage(r->cs, 64 - cl_off) == 0) {
+            setError(&(r->error), ET_BufferOverflow, EM_Generator, r,
+                     "code buffer too small");
+            c->e = &(r->error);
+            return;
+        }
         useCodeStorage(r->cs, 64 - cl_off);
         buf0 = reserveCodeStorage(r->cs, 0);
     }
 
     int usedPass0 = r->cs->used;
     int genOrder0 = r->genOrderCount;
+    int genBytes = 0; // without holes: lower bound for final code size
+    int fix = 0;
+    r->ripFixCount = 0;
 
     assert(r->capStackTop == -1);
     assert(r->capBBCount > 0);
@@ -451,15 +844,33 @@ void generateBinaryFromCaptured(RContext *c)
         r->capStackTop--;
         if (cbb->size >= 0) continue;
 
-        assert(r->genOrderCount < GENORDER_MAX);
+        if (r->genOrderCount >= GENORDER_MAX) {
+            setError(&(r->error), ET_BufferOverflow, EM_Generator, r,
+                     "Too many blocks to generate");
+            r->generatedCodeAddr = 0;
+            r->generatedCodeSize = 0;
+            c->e = &(r->error);
+            return;
+        }
         r->genOrder[r->genOrderCount++] = cbb;
 
-        Error* e = (Error*) generate(r, cbb);
-        if (e) {
-            assert(isErrorSet(e));
+        Error* ge = (Error*) generate(r, cbb);
+        if (ge) {
+            assert(isErrorSet(ge));
+            r->generatedCodeAddr = 0;
+            r->generatedCodeSize = 0;
+            c->e = ge;
+            return;
+        }
+
+        // stop as soon as code size budget is known to be exceeded
+        genBytes += cbb->size;
+        if (r->budgetCodeBytes && (genBytes > r->budgetCodeBytes)) {
+            r->cs->used = usedPass0;
+            r->genOrderCount = genOrder0;
             r->generatedCodeAddr = 0;
             r->generatedCodeSize = 0;
-            c->e = e;
+            setBudgetError(c, BL_CodeBytes);
             return;
         }
 
@@ -469,9 +880,30 @@ void generateBinaryFromCaptured(RContext *c)
             pushCaptureBB(c, cbb->nextFallThrough);
             if (c->e) return;
         }
+        else if (cbb->endType == IT_JMP) {
+            pushCaptureBB(c, cbb->nextBranch);
+            if (c->e) return;
+        }
+        else if (cbb->endType == IT_JMPI) {
+            // jump table entries point to CBBs until pass 3
+            for(int k = 0; k < cbb->jtCount; k++) {
+                CBB* next = (CBB*) cbb->jtTable[k];
+                if (next->size >= 0) continue;
+                pushCaptureBB(c, next);
+                if (c->e) return;
+            }
+        }
 
         // add a hole with size maximally needed (shrinks in pass 2)
         // pc-relative Jcc (6) + PC-relative Jmp (5) + alignment (15) = 26
+        if (reserveCodeStorage(r->cs, 26) == 0) {
+            setError(&(r->error), ET_BufferOverflow, EM_Generator, r,
+                     "code buffer too small");
+            r->generatedCodeAddr = 0;
+            r->generatedCodeSize = 0;
+            c->e = &(r->error);
+            return;
+        }
         useCodeStorage(r->cs, 26);
     }
 
@@ -497,6 +929,20 @@ void generateBinaryFromCaptured(RContext *c)
             char* dst = (char*)cbb->addr2;
             for(int j=0; j<cbb->size; j++)
                 dst[j] = src[j];
+
+            // RIP-relative displacements: target did not move
+            while((fix < r->ripFixCount) &&
+                  (r->ripFix[fix] < cbb->addr1 + cbb->size)) {
+                uint64_t a = r->ripFix[fix++] - cbb->addr1 + cbb->addr2;
+                *(int32_t*)a += (int32_t) (cbb->addr1 - cbb->addr2);
+            }
+        }
+        if (cbb->endType == IT_JMP) {
+            if (cbb->nextBranch != r->genOrder[i+1]) {
+                cbb->genJump = true;
+                buf1 += 5;
+            }
+            continue;
         }
         if (!instrIsJcc(cbb->endType)) continue;
 
@@ -526,9 +972,18 @@ void generateBinaryFromCaptured(RContext *c)
         int diff;
 
         cbb = r->genOrder[i];
+        buf = (uint8_t*) (cbb->addr2 + cbb->size);
+        if (cbb->endType == IT_JMP) {
+            if (cbb->genJump) {
+                buf_addr = (uint64_t) buf;
+                diff = cbb->nextBranch->addr2 - (buf_addr + 5);
+                buf[0] = 0xE9;
+                *(int32_t*)(buf+1) = diff;
+            }
+            continue;
+        }
         if (!instrIsJcc(cbb->endType)) continue;
 
-        buf = (uint8_t*) (cbb->addr2 + cbb->size);
         buf_addr = (uint64_t) buf;
         if (cbb->genJcc8) {
             diff = cbb->nextBranch->addr2 - (buf_addr + 2);
@@ -590,6 +1045,14 @@ void generateBinaryFromCaptured(RContext *c)
         }
     }
 
+    // fill jump tables with addresses of generated code
+    for(int i=genOrder0; i < r->genOrderCount; i++) {
+        cbb = r->genOrder[i];
+        if (cbb->endType != IT_JMPI) continue;
+        for(int k = 0; k < cbb->jtCount; k++)
+            cbb->jtTable[k] = ((CBB*) cbb->jtTable[k])->addr2;
+    }
+
     assert(r->cs != 0);
     assert(r->cs->used > 0);
 
@@ -597,6 +1060,17 @@ void generateBinaryFromCaptured(RContext *c)
         int usedBefore = (r->genOrder[0]->addr2 - (uint64_t) r->cs->buf);
         r->generatedCodeAddr = r->genOrder[0]->addr2;
         r->generatedCodeSize = r->cs->used - usedBefore;
+        if (r->budgetCodeBytes && (r->generatedCodeSize > r->budgetCodeBytes)) {
+            // drop generated code
+            r->cs->used = usedPass0;
+            r->genOrderCount = genOrder0;
+            r->generatedCodeAddr = 0;
+            r->generatedCodeSize = 0;
+            setBudgetError(c, BL_CodeBytes);
+            return;
+        }
+        r->stats.generatedBytes += r->generatedCodeSize;
+        perfRegisterCode(r, r->generatedCodeAddr, r->generatedCodeSize);
     }
     else {
         r->generatedCodeAddr = 0;
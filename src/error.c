@@ -51,7 +51,7 @@ void initError(Error* e)
 
 const char *errorString(Error* e)
 {
-    static char s[512];
+    static __thread char s[512];
 
     int o;
     const char* detail = 0;
@@ -118,7 +118,7 @@ void setDecodeError(DecodeError* de, Rewriter* r, char* d,
 
 const char *decodeErrorContext(Error* e)
 {
-    static char buf[100];
+    static __thread char buf[100];
     DecodeError* de = (DecodeError*)e;
 
     assert(e->em == EM_Decoder);
@@ -139,7 +139,7 @@ void setGenerateError(GenerateError* ge, Rewriter* r, char* d,
 
 const char *generateErrorContext(Error* e)
 {
-    static char buf[100];
+    static __thread char buf[100];
     GenerateError* ge = (GenerateError*)e;
 
     assert(e->em == EM_Generator);
@@ -23,19 +23,21 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-ExprPool* expr_allocPool(int s)
+#include "alloc.h"
+
+ExprPool* expr_allocPool(Rewriter* r, int s)
 {
     ExprPool* p;
 
-    p = (ExprPool*) malloc(sizeof(ExprPool) + s * sizeof(ExprNode));
+    p = (ExprPool*) memAlloc(r, sizeof(ExprPool) + s * sizeof(ExprNode));
     p->size = s;
     p->used = 0;
     return p;
 }
 
-void expr_freePool(ExprPool* p)
+void expr_freePool(Rewriter* r, ExprPool* p)
 {
-    free(p);
+    memFree(r, p);
 }
 
 ExprNode* expr_newNode(ExprPool* p, NodeType t)
@@ -162,7 +164,7 @@ int appendExpr(char* b, ExprNode* e)
 
 char *expr_toString(ExprNode *e)
 {
-    static char buf[200];
+    static __thread char buf[200];
     int off;
     off = appendExpr(buf, e);
     assert(off < 200);
@@ -21,9 +21,11 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 
+#include "alloc.h"
 #include "common.h"
 #include "printer.h"
 #include "error.h"
@@ -46,6 +48,11 @@ struct _GContext {
     OperandEncoding oe;
     ValType vt;
     int flags;
+
+    // RIP-relative memory operand: offset of disp32 in b / generated code
+    CodeStorage* cs;
+    int ripOff, ripFix;
+    uint64_t ripTarget;
 };
 
 static
@@ -102,6 +109,13 @@ int VRegEncoding(Reg r)
 }
 
 
+// is absolute address <a> RIP-relative reachable from the code storage?
+static
+bool ripReachable(GContext* c, uint64_t a)
+{
+    return (c->cs != 0) && isCodeStorageNear(c->cs, a);
+}
+
 // Generate bytes with ModRM encoding for operand <o> and 3-bit <digit>.
 // Sets info in GContext <c>: b/len/rex/so
 static
@@ -144,8 +158,30 @@ void calcModRMDigit(GContext* c, Operand* o1, int digit, int flags)
         int useDisp8 = 0, useDisp32 = 0, useSIB = 0;
         int sib = 0;
         int64_t v = (int64_t) o1->val;
+        // EVEX: disp8 is scaled by memory operand size (full vectors,
+        // or single element for broadcasts)
+        int n = (c->vp == VEX_512) ? 64 : 1;
+        if ((c->vp == VEX_512) && (c->instr->type == IT_VBROADCASTSS))
+            n = 4;
+        if ((c->vp == VEX_512) && (c->instr->type == IT_VBROADCASTSD))
+            n = 8;
+
+        if ((o1->reg.rt == RT_None) && (o1->scale == 0) &&
+            (o1->seg == OSO_None) && ripReachable(c, v)) {
+            // absolute address near code: shorter RIP-relative encoding
+            // (mod 00, rm 5). Displacement depends on instruction length,
+            // filled in by generate()
+            c->so = OSO_None;
+            c->b[o++] = modrm | 5;
+            c->ripOff = o;
+            c->ripTarget = v;
+            *(int32_t*)(c->b+o) = 0;
+            c->blen = o + 4;
+            return;
+        }
+
         if (v != 0) {
-            if ((v >= -128) && (v<128)) useDisp8 = 1;
+            if ((v % n == 0) && (v/n >= -128) && (v/n < 128)) useDisp8 = 1;
             else if ((v >= -((int64_t)1<<31)) &&
                      (v < ((int64_t)1<<31))) useDisp32 = 1;
             else assert(0);
@@ -246,7 +282,7 @@ void calcModRMDigit(GContext* c, Operand* o1, int digit, int flags)
         if (useSIB)
             c->b[o++] = sib;
         if (useDisp8)
-            c->b[o++] = (int8_t) v;
+            c->b[o++] = (int8_t) (v / n);
         if (useDisp32) {
             *(int32_t*)(c->b+o) = (int32_t) v;
             o += 4;
@@ -307,10 +343,47 @@ int genPrefix(GContext* c)
         return o;
     }
 
-    // Vex
+    if (c->vp == VEX_512) {
+        // EVEX: 512 bit, no masking, only zmm0-15 (R'/V' unset)
+        // map 0x0F: W is set for double precision and ignored otherwise,
+        // map 0x0F38: W given by REX.W
+        int map = 1;
+        if ((c->opc & 0xFFFF00) == 0x0F3800)
+            map = 2;
+        else
+            assert((c->opc & 0xFF00) == 0x0F00);
+        c->opc = c->opc & 0xFF;
+        uint8_t p0 = 0x10 | map; // R' inverted
+        p0 |= (c->rex & REX_MASK_R) ? 0:128; // inverted
+        p0 |= (c->rex & REX_MASK_X) ? 0:64; // inverted
+        p0 |= (c->rex & REX_MASK_B) ? 0:32; // inverted
+        uint8_t p1 = ((15 - c->vvvv) << 3) | 4;
+        switch(c->ps) {
+        case PS_66: p1 |= 1; break;
+        case PS_F3: p1 |= 2; break;
+        case PS_F2: p1 |= 3; break;
+        case PS_No: break;
+        default: assert(0);
+        }
+        if (map == 1)
+            p1 |= ((c->ps == PS_66) || (c->ps == PS_F2)) ? 0x80 : 0;
+        else
+            p1 |= (c->rex & REX_MASK_W) ? 0x80 : 0;
+        buf[o++] = 0x62;
+        buf[o++] = p0;
+        buf[o++] = p1;
+        buf[o++] = 0x48; // L'L = 2, V' inverted
+        return o;
+    }
+
+    // Vex: opcode map 0x0F (2 bytes) or 0x0F38 (3 bytes)
     assert((c->vp == VEX_128) || (c->vp == VEX_256));
-    assert((c->opc & 0xFF00) == 0x0F00); // opcode 2 byte starting with 0x0F
-    c->opc = c->opc & 0xFF; // do not generate the leading 0x0F
+    int map = 1;
+    if ((c->opc & 0xFFFF00) == 0x0F3800)
+        map = 2;
+    else
+        assert((c->opc & 0xFFFF00) == 0x0F00);
+    c->opc = c->opc & 0xFF; // do not generate the leading map bytes
     uint8_t b = ((15 - c->vvvv) << 3) | ((c->vp == VEX_128) ? 0:4);
     switch(c->ps) {
     case PS_66: b |= 1; break;
@@ -319,7 +392,7 @@ int genPrefix(GContext* c)
     case PS_No: break;
     default: assert(0);
     }
-    if ((c->rex & (REX_MASK_X | REX_MASK_B | REX_MASK_W)) == 0) {
+    if ((map == 1) && (c->rex & (REX_MASK_X | REX_MASK_B | REX_MASK_W)) == 0) {
         // 2-byte vex prefix enough
         b |= (c->rex & REX_MASK_R) ? 0:128; // inverted;
         buf[o++] = 0xC5;
@@ -327,11 +400,11 @@ int genPrefix(GContext* c)
     }
     else {
         // 3-byte vex prefix
-        int b0 = 1; // 0x0F leading opcode byte
+        int b0 = map;
         b0 |= (c->rex & REX_MASK_R) ? 0:128; // inverted;
         b0 |= (c->rex & REX_MASK_X) ? 0:64; // inverted;
         b0 |= (c->rex & REX_MASK_B) ? 0:32; // inverted;
-        b |= (c->rex & REX_MASK_W) ? 0:128; // inverted;
+        b |= (c->rex & REX_MASK_W) ? 128:0; // not inverted
         buf[o++] = 0xC4;
         buf[o++] = b0;
         buf[o++] = b;
@@ -345,8 +418,13 @@ int appendOO(GContext* c, int o)
 {
     uint8_t* buf = c->buf;
     int opc = c->opc;
-    if (opc > 255) {
-        assert(opc < 65536);
+    if (opc > 65535) {
+        assert(opc < 0x1000000);
+        buf[o++] = (uint8_t) (opc >> 16);
+        buf[o++] = (uint8_t) ((opc >> 8) & 255);
+        buf[o++] = (uint8_t) (opc & 255);
+    }
+    else if (opc > 255) {
         buf[o++] = (uint8_t) (opc >> 8);
         buf[o++] = (uint8_t) (opc & 255);
     }
@@ -354,6 +432,8 @@ int appendOO(GContext* c, int o)
         buf[o++] = (uint8_t) opc;
 
     // append bytes for encoded operands
+    if (c->ripOff >= 0)
+        c->ripFix = o + c->ripOff;
     for(int i=0; i < c->blen; i++)
         buf[o++] = c->b[i];
 
@@ -517,54 +597,52 @@ void setGenInfo(GContext* c,
 }
 
 
-// if imm64 and value fitting into imm32, return imm32 version
-// otherwise, or if operand is not imm, just return the original
+// if imm64 and value fitting into imm32, return imm32 version stored
+// in <newOp>, otherwise, or if operand is not imm, just return the original.
+// <newOp> may be the same as <o>
 static
-Operand* reduceImm64to32(Operand* o)
+Operand* reduceImm64to32(Operand* o, Operand* newOp)
 {
-    static Operand newOp;
-
     if (o->type == OT_Imm64) {
         // reduction possible if signed 64bit fits into signed 32bit
         int64_t v = (int64_t) o->val;
         if ((v > -(1l << 31)) && (v < (1l << 31))) {
-            newOp.type = OT_Imm32;
-            newOp.val = (uint32_t) (int32_t) v;
-            return &newOp;
+            *newOp = *o;
+            newOp->type = OT_Imm32;
+            newOp->val = (uint32_t) (int32_t) v;
+            return newOp;
         }
     }
     return o;
 }
 
 static
-Operand* reduceImm16to8(Operand* o)
+Operand* reduceImm16to8(Operand* o, Operand* newOp)
 {
-    static Operand newOp;
-
     if (o->type == OT_Imm16) {
         // reduction possible if signed 16bit fits into signed 8bit
         int16_t v = (int16_t) o->val;
         if ((v > -(1<<7)) && (v < (1<<7))) {
-            newOp.type = OT_Imm8;
-            newOp.val = (uint8_t) (int8_t) v;
-            return &newOp;
+            *newOp = *o;
+            newOp->type = OT_Imm8;
+            newOp->val = (uint8_t) (int8_t) v;
+            return newOp;
         }
     }
     return o;
 }
 
 static
-Operand* reduceImm32to8(Operand* o)
+Operand* reduceImm32to8(Operand* o, Operand* newOp)
 {
-    static Operand newOp;
-
     if (o->type == OT_Imm32) {
         // reduction possible if signed 32bit fits into signed 8bit
         int32_t v = (int32_t) o->val;
         if ((v > -(1<<7)) && (v < (1<<7))) {
-            newOp.type = OT_Imm8;
-            newOp.val = (uint8_t) (int8_t) v;
-            return &newOp;
+            *newOp = *o;
+            newOp->type = OT_Imm8;
+            newOp->val = (uint8_t) (int8_t) v;
+            return newOp;
         }
     }
     return o;
@@ -692,14 +770,40 @@ int genNeg(GContext* cxt)
     return 0;
 }
 
+static
+int genNot(GContext* cxt)
+{
+    Operand* dst =  &(cxt->instr->dst);
+
+    switch(dst->type) {
+    case OT_Ind8:
+    case OT_Reg8:
+        // use 'not r/m8' (0xF6/2)
+        return genDigitRM(cxt, 0xF6, 2, dst, 0);
+
+    case OT_Ind16:
+    case OT_Ind32:
+    case OT_Ind64:
+    case OT_Reg16:
+    case OT_Reg32:
+    case OT_Reg64:
+        // use 'not r/m 16/32/64' (0xF7/2)
+        return genDigitRM(cxt, 0xF7, 2, dst, GEN_66OnVT16);
+
+    default: return -1;
+    }
+    return 0;
+}
+
 
 static
 int genMov(GContext* cxt)
 {
     Operand* src =  &(cxt->instr->src);
     Operand* dst =  &(cxt->instr->dst);
+    Operand imm; // storage for reduced immediate
 
-    src = reduceImm64to32(src);
+    src = reduceImm64to32(src, &imm);
 
     switch(src->type) {
     case OT_Reg32:
@@ -810,22 +914,22 @@ int genCMov(GContext* cxt)
         case OT_Reg64:
             if (opValType(src) != opValType(dst)) return -1;
             switch(it) {
-            case IT_CMOVO:  opc = 0x40; break; // cmovo  r,r/m 32/64
-            case IT_CMOVNO: opc = 0x41; break; // cmovno r,r/m 32/64
-            case IT_CMOVC:  opc = 0x42; break; // cmovc  r,r/m 32/64
-            case IT_CMOVNC: opc = 0x43; break; // cmovnc r,r/m 32/64
-            case IT_CMOVZ:  opc = 0x44; break; // cmovz  r,r/m 32/64
-            case IT_CMOVNZ: opc = 0x45; break; // cmovnz r,r/m 32/64
-            case IT_CMOVBE: opc = 0x46; break; // cmovbe r,r/m 32/64
-            case IT_CMOVA:  opc = 0x47; break; // cmova  r,r/m 32/64
-            case IT_CMOVS:  opc = 0x48; break; // cmovs  r,r/m 32/64
-            case IT_CMOVNS: opc = 0x49; break; // cmovns r,r/m 32/64
-            case IT_CMOVP:  opc = 0x4A; break; // cmovp  r,r/m 32/64
-            case IT_CMOVNP: opc = 0x4B; break; // cmovnp r,r/m 32/64
-            case IT_CMOVL:  opc = 0x4C; break; // cmovl  r,r/m 32/64
-            case IT_CMOVGE: opc = 0x4D; break; // cmovge r,r/m 32/64
-            case IT_CMOVLE: opc = 0x4E; break; // cmovle r,r/m 32/64
-            case IT_CMOVG:  opc = 0x4F; break; // cmovg  r,r/m 32/64
+            case IT_CMOVO:  opc = 0x0F40; break; // cmovo  r,r/m 32/64
+            case IT_CMOVNO: opc = 0x0F41; break; // cmovno r,r/m 32/64
+            case IT_CMOVC:  opc = 0x0F42; break; // cmovc  r,r/m 32/64
+            case IT_CMOVNC: opc = 0x0F43; break; // cmovnc r,r/m 32/64
+            case IT_CMOVZ:  opc = 0x0F44; break; // cmovz  r,r/m 32/64
+            case IT_CMOVNZ: opc = 0x0F45; break; // cmovnz r,r/m 32/64
+            case IT_CMOVBE: opc = 0x0F46; break; // cmovbe r,r/m 32/64
+            case IT_CMOVA:  opc = 0x0F47; break; // cmova  r,r/m 32/64
+            case IT_CMOVS:  opc = 0x0F48; break; // cmovs  r,r/m 32/64
+            case IT_CMOVNS: opc = 0x0F49; break; // cmovns r,r/m 32/64
+            case IT_CMOVP:  opc = 0x0F4A; break; // cmovp  r,r/m 32/64
+            case IT_CMOVNP: opc = 0x0F4B; break; // cmovnp r,r/m 32/64
+            case IT_CMOVL:  opc = 0x0F4C; break; // cmovl  r,r/m 32/64
+            case IT_CMOVGE: opc = 0x0F4D; break; // cmovge r,r/m 32/64
+            case IT_CMOVLE: opc = 0x0F4E; break; // cmovle r,r/m 32/64
+            case IT_CMOVG:  opc = 0x0F4F; break; // cmovg  r,r/m 32/64
             default: assert(0);
             }
             // use 'cmov r,r/m 32/64' (opc RM)
@@ -841,16 +945,51 @@ int genCMov(GContext* cxt)
     return 0;
 }
 
+static
+int genSetcc(GContext* cxt)
+{
+    InstrType it = cxt->instr->type;
+    Operand* dst =  &(cxt->instr->dst);
+
+    assert((it >= IT_SETO) && (it <= IT_SETG));
+    switch(dst->type) {
+    case OT_Reg8:
+    case OT_Ind8:
+        // use 'setcc r/m8' (0x0F 0x90+cc /0), same condition order as Jcc
+        return genDigitRM(cxt, 0x0F90 + (it - IT_SETO), 0, dst, 0);
+
+    default: return -1;
+    }
+    return 0;
+}
+
+static
+int genJmpI(GContext* cxt)
+{
+    Operand* dst =  &(cxt->instr->dst);
+
+    switch(dst->type) {
+    case OT_Reg64:
+    case OT_Ind64:
+        // use 'jmp r/m64' (0xFF/4), 64bit operand size is default
+        return genDigitRM(cxt, 0xFF, 4, dst, GEN_DefOpVT64);
+
+    default: return -1;
+    }
+    return 0;
+}
+
 static
 int genAdd(GContext* cxt)
 {
     Operand* src =  &(cxt->instr->src);
     Operand* dst =  &(cxt->instr->dst);
+    Operand imm; // storage for reduced immediate
 
     // if src is imm, try to reduce width
-    src = reduceImm64to32(src);
-    src = reduceImm32to8(src);
-    src = reduceImm16to8(src);
+    src = reduceImm64to32(src, &imm);
+    src = reduceImm32to8(src, &imm);
+    src = reduceImm16to8(src, &imm);
 
     switch(src->type) {
     case OT_Reg8:
@@ -977,10 +1116,11 @@ int genSub(GContext* cxt)
 {
     Operand* src =  &(cxt->instr->src);
     Operand* dst =  &(cxt->instr->dst);
+    Operand imm; // storage for reduced immediate
 
     // if src is imm, try to reduce width
-    src = reduceImm64to32(src);
-    src = reduceImm32to8(src);
+    src = reduceImm64to32(src, &imm);
+    src = reduceImm32to8(src, &imm);
 
     switch(src->type) {
     case OT_Reg32:
@@ -1050,9 +1190,10 @@ int genTest(GContext* cxt)
 {
     Operand* src =  &(cxt->instr->src);
     Operand* dst =  &(cxt->instr->dst);
+    Operand imm; // storage for reduced immediate
 
     // if src is imm, try to reduce width
-    src = reduceImm64to32(src);
+    src = reduceImm64to32(src, &imm);
 
     switch(src->type) {
     case OT_Reg8:
@@ -1149,10 +1290,11 @@ int genIMul(GContext* cxt)
 {
     Operand* src =  &(cxt->instr->src);
     Operand* dst =  &(cxt->instr->dst);
+    Operand imm; // storage for reduced immediate
 
     // if src is imm, try to reduce width
-    src = reduceImm64to32(src);
-    src = reduceImm32to8(src);
+    src = reduceImm64to32(src, &imm);
+    src = reduceImm32to8(src, &imm);
 
     switch(src->type) {
     case OT_Reg32:
@@ -1182,7 +1324,7 @@ int genIMul(GContext* cxt)
         break;
 
     case OT_Imm32:
-        if (opValType(src) != opValType(dst)) return -1;
+        // imm32 gets sign-extended for 64-bit dst
         switch(dst->type) {
         case OT_Reg32:
         case OT_Reg64:
@@ -1222,10 +1364,11 @@ int genXor(GContext* cxt)
 {
     Operand* src =  &(cxt->instr->src);
     Operand* dst =  &(cxt->instr->dst);
+    Operand imm; // storage for reduced immediate
 
     // if src is imm, try to reduce width
-    src = reduceImm64to32(src);
-    src = reduceImm32to8(src);
+    src = reduceImm64to32(src, &imm);
+    src = reduceImm32to8(src, &imm);
 
     switch(src->type) {
     // src reg
@@ -1296,10 +1439,11 @@ int genOr(GContext* cxt)
 {
     Operand* src =  &(cxt->instr->src);
     Operand* dst =  &(cxt->instr->dst);
+    Operand imm; // storage for reduced immediate
 
     // if src is imm, try to reduce width
-    src = reduceImm64to32(src);
-    src = reduceImm32to8(src);
+    src = reduceImm64to32(src, &imm);
+    src = reduceImm32to8(src, &imm);
 
     switch(src->type) {
     // src reg
@@ -1370,11 +1514,12 @@ int genAnd(GContext* cxt)
 {
     Operand* src =  &(cxt->instr->src);
     Operand* dst =  &(cxt->instr->dst);
+    Operand imm; // storage for reduced immediate
 
     // if src is imm, try to reduce width
-    src = reduceImm64to32(src);
-    src = reduceImm32to8(src);
-    src = reduceImm16to8(src);
+    src = reduceImm64to32(src, &imm);
+    src = reduceImm32to8(src, &imm);
+    src = reduceImm16to8(src, &imm);
 
     switch(src->type) {
     // src reg
@@ -1520,6 +1665,20 @@ int genShl(GContext* cxt)
         }
         break;
 
+    case OT_Reg8:
+        if (src->reg.ri != RI_C) return -1;
+        switch(dst->type) {
+        case OT_Reg32:
+        case OT_Ind32:
+        case OT_Reg64:
+        case OT_Ind64:
+            // use 'shl r/m 32/64, cl' (0xD3/4 MC)
+            return genDigitRM(cxt, 0xD3, 4, dst, 0);
+
+        default: return -1;
+        }
+        break;
+
     default: return -1;
     }
     return 0;
@@ -1546,6 +1705,20 @@ int genShr(GContext* cxt)
         }
         break;
 
+    case OT_Reg8:
+        if (src->reg.ri != RI_C) return -1;
+        switch(dst->type) {
+        case OT_Reg32:
+        case OT_Ind32:
+        case OT_Reg64:
+        case OT_Ind64:
+            // use 'shr r/m 32/64, cl' (0xD3/5 MC)
+            return genDigitRM(cxt, 0xD3, 5, dst, 0);
+
+        default: return -1;
+        }
+        break;
+
     default: return -1;
     }
     return 0;
@@ -1572,6 +1745,20 @@ int genSar(GContext* cxt)
         }
         break;
 
+    case OT_Reg8:
+        if (src->reg.ri != RI_C) return -1;
+        switch(dst->type) {
+        case OT_Reg32:
+        case OT_Ind32:
+        case OT_Reg64:
+        case OT_Ind64:
+            // use 'sar r/m 32/64, cl' (0xD3/7 MC)
+            return genDigitRM(cxt, 0xD3, 7, dst, 0);
+
+        default: return -1;
+        }
+        break;
+
     default: return -1;
     }
     return 0;
@@ -1634,10 +1821,11 @@ int genCmp(GContext* cxt)
 {
     Operand* src =  &(cxt->instr->src);
     Operand* dst =  &(cxt->instr->dst);
+    Operand imm; // storage for reduced immediate
 
     // if src is imm, try to reduce width
-    src = reduceImm64to32(src);
-    src = reduceImm32to8(src);
+    src = reduceImm64to32(src, &imm);
+    src = reduceImm32to8(src, &imm);
 
     switch(src->type) {
     // src reg
@@ -1733,11 +1921,16 @@ int genPassThrough(GContext* cxt)
     cxt->ps = instr->ptPSet;
     cxt->vp = instr->ptVexP;
 
-    assert(instr->ptLen < 3);
-    if (instr->ptLen < 2)
-        opc = instr->ptOpc[0];
-    else
-        opc = (instr->ptOpc[0] << 8) | instr->ptOpc[1];
+    if (instr->ptEnc == OE_MI) {
+        // opcode digit given as 2nd byte
+        assert(instr->ptLen == 2);
+        return genDigitMI(cxt, instr->ptOpc[0], instr->ptOpc[1],
+                          &(instr->dst), &(instr->src), 0);
+    }
+
+    opc = instr->ptOpc[0];
+    for(int i = 1; i < instr->ptLen; i++)
+        opc = (opc << 8) | instr->ptOpc[i];
 
     switch(instr->ptEnc) {
     case OE_None:
@@ -1751,20 +1944,47 @@ int genPassThrough(GContext* cxt)
         break;
 
     case OE_RVM:
-        assert(opIsVReg(&(instr->src)));
+        assert(opIsReg(&(instr->src)));
         cxt->vvvv = instr->src.reg.ri;
         o += genModRM(cxt, opc, &(instr->src2), &(instr->dst), vt, 0);
         break;
 
+    case OE_RMV:
+        assert(opIsReg(&(instr->src2)));
+        cxt->vvvv = instr->src2.reg.ri;
+        o += genModRM(cxt, opc, &(instr->src), &(instr->dst), vt, 0);
+        break;
+
     case OE_RM:
         o += genModRM(cxt, opc, &(instr->src), &(instr->dst), vt, 0);
         break;
 
+    case OE_RMI:
+        // with VEX, use destructive form: vvvv is destination
+        if (cxt->vp != VEX_No) cxt->vvvv = instr->dst.reg.ri;
+        o += genModRMI(cxt, opc, &(instr->src), &(instr->dst),
+                       &(instr->src2), 0);
+        break;
+
     default: assert(0);
     }
     return o;
 }
 
+// remember address of RIP-relative displacement at <a> in generated code
+static
+void addRipFixup(Rewriter* r, uint64_t a)
+{
+    if (r->ripFixCount == r->ripFixCapacity) {
+        int old = r->ripFixCapacity;
+
+        r->ripFixCapacity = old ? 2 * old : 32;
+        r->ripFix = (uint64_t*) memRealloc(r, r->ripFix, old * sizeof(uint64_t),
+                                           r->ripFixCapacity * sizeof(uint64_t));
+    }
+    r->ripFix[r->ripFixCount++] = a;
+}
+
 // clear generation context for new instruction
 static
 void initGContext(GContext* c, uint8_t* buf, Instr* i)
@@ -1783,13 +2003,16 @@ void initGContext(GContext* c, uint8_t* buf, Instr* i)
     c->oe = OE_Invalid;
     c->flags = 0;
     c->vt = VT_None;
+
+    c->ripOff = -1;
+    c->ripFix = -1;
 }
 
 // generate code for a captured BB
 // this sets cbb->addr1/cbb->size
 GenerateError* generate(Rewriter* r, CBB* cbb)
 {
-    static GenerateError error;
+    GenerateError* error = &(r->generateError);
 
     uint64_t buf0;
     int used, i, usedTotal;
@@ -1797,14 +2020,15 @@ GenerateError* generate(Rewriter* r, CBB* cbb)
 
     assert(cbb != 0);
 
-    cxt.e = &error;
+    cxt.e = error;
+    cxt.cs = r->cs;
     setErrorNone((Error*) cxt.e);
 
     if (r->cs == 0) {
         markError(&cxt, ET_BufferOverflow, "no code buffer available");
-        error.e.r = r;
-        error.cbb = cbb;
-        return &error;
+        error->e.r = r;
+        error->cbb = cbb;
+        return error;
     }
 
     if (r->showEmuSteps)
@@ -1820,7 +2044,10 @@ GenerateError* generate(Rewriter* r, CBB* cbb)
         initGContext(&cxt, reserveCodeStorage(r->cs, 15), instr);
         used = 0;
 
-        if (instr->ptLen > 0) {
+        if (cxt.buf == 0) {
+            markError(&cxt, ET_BufferOverflow, "code buffer too small");
+        }
+        else if (instr->ptLen > 0) {
             used = genPassThrough(&cxt);
         }
         else {
@@ -1855,6 +2082,9 @@ GenerateError* generate(Rewriter* r, CBB* cbb)
             case IT_NEG:
                 used = genNeg(&cxt);
                 break;
+            case IT_NOT:
+                used = genNot(&cxt);
+                break;
             case IT_XOR:
                 used = genXor(&cxt);
                 break;
@@ -1898,6 +2128,27 @@ GenerateError* generate(Rewriter* r, CBB* cbb)
             case IT_CMOVG:
                 used = genCMov(&cxt);
                 break;
+            case IT_SETO:
+            case IT_SETNO:
+            case IT_SETC:
+            case IT_SETNC:
+            case IT_SETZ:
+            case IT_SETNZ:
+            case IT_SETBE:
+            case IT_SETA:
+            case IT_SETS:
+            case IT_SETNS:
+            case IT_SETP:
+            case IT_SETNP:
+            case IT_SETL:
+            case IT_SETGE:
+            case IT_SETLE:
+            case IT_SETG:
+                used = genSetcc(&cxt);
+                break;
+            case IT_JMPI:
+                used = genJmpI(&cxt);
+                break;
             case IT_POP:
                 used = genPop(&cxt);
                 break;
@@ -1938,14 +2189,22 @@ GenerateError* generate(Rewriter* r, CBB* cbb)
 
         if (isErrorSet((Error*)cxt.e)) {
             // fill-in error info
-            error.e.r = r;
-            error.cbb = cbb;
-            error.offset = i;
+            error->e.r = r;
+            error->cbb = cbb;
+            error->offset = i;
 
             // error: no code generated, reset used buffer
             cbb->size = -1;
             r->cs->used = buf0 - (uint64_t) r->cs->buf;
-            return &error;
+            return error;
+        }
+
+        if (cxt.ripFix >= 0) {
+            // displacement relative to end of instruction
+            uint8_t* fix = cxt.buf + cxt.ripFix;
+            *(int32_t*)fix = (int32_t) (cxt.ripTarget -
+                                        (uint64_t) (cxt.buf + used));
+            addRipFixup(r, (uint64_t) fix);
         }
 
         instr->addr = (uint64_t) cxt.buf;
@@ -1975,6 +2234,12 @@ GenerateError* generate(Rewriter* r, CBB* cbb)
         printf(" fall-through to (%s)\n",
                cbb_prettyName(cbb->nextFallThrough));
         }
+        else if (cbb->endType == IT_JMP) {
+            assert(cbb->nextBranch != 0);
+            printf("  I%2d : %s (%s)\n",
+                   i, instrName(cbb->endType, 0),
+                   cbb_prettyName(cbb->nextBranch));
+        }
     }
 
     cbb->size = usedTotal;
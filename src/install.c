@@ -0,0 +1,201 @@
+/**
+ * This file is part of DBrew, the dynamic binary rewriting library.
+ *
+ * (c) 2016, Josef Weidendorfer <josef.weidendorfer@gmx.de>
+ *
+ * DBrew is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License (LGPL)
+ * as published by the Free Software Foundation, either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * DBrew is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with DBrew.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dbrew.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+#include "buffers.h"
+#include "common.h"
+#include "error.h"
+
+/*
+ * Installing generated code: the entry of the original function gets
+ * patched with a jump to the generated code, redirecting all callers.
+ *
+ * The 5-byte 'jmp rel32' is written with one atomic store of the aligned
+ * 8-byte word containing it. Thus, a thread entering the function
+ * concurrently either executes the original or the new instructions,
+ * never a mix of both. The patch has to end at an instruction boundary
+ * of the first decoded BB, and no other decoded BB may start within it.
+ * If the generated code is out of reach of rel32, the jump goes to a
+ * trampoline allocated near the function.
+ *
+ * Restriction: no thread should be suspended within the first patched
+ * instructions of the function (usually part of the prologue) while
+ * installing or uninstalling.
+ */
+
+// current protection of the page containing <a> from /proc/self/maps,
+// -1 if not found
+static
+int pageProtection(uint64_t a)
+{
+    uint64_t start, end;
+    char perms[5], line[300];
+    int prot = -1;
+    FILE* f;
+
+    f = fopen("/proc/self/maps", "r");
+    if (!f) return -1;
+    while(fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%lx-%lx %4s", &start, &end, perms) != 3) continue;
+        if ((a < start) || (a >= end)) continue;
+        prot = PROT_NONE;
+        if (perms[0] == 'r') prot |= PROT_READ;
+        if (perms[1] == 'w') prot |= PROT_WRITE;
+        if (perms[2] == 'x') prot |= PROT_EXEC;
+        break;
+    }
+    fclose(f);
+    return prot;
+}
+
+// atomically replace 8-byte word at <a> with <v> if it still is <old>.
+// The page gets writable temporarily, its protection is restored afterwards
+static
+bool patchWord(uint64_t a, uint64_t old, uint64_t v)
+{
+    void* page = (void*) (a & ~4095ul);
+    int prot = pageProtection(a);
+    bool done;
+
+    if (prot < 0) return false;
+    if (!(prot & PROT_WRITE) &&
+        (mprotect(page, 4096, prot | PROT_WRITE) != 0))
+        return false;
+    done = __atomic_compare_exchange_n((uint64_t*) a, &old, v, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    if (!(prot & PROT_WRITE))
+        mprotect(page, 4096, prot);
+    return done;
+}
+
+// check that the first <len> bytes at function entry <f> can be replaced
+static
+bool canPatchEntry(Rewriter* r, uint64_t f, int len)
+{
+    DBB* first = 0;
+    int off = 0;
+
+    for(int i = 0; i < r->decBBCount; i++) {
+        DBB* dbb = r->decBB + i;
+        if (dbb->addr == f) first = dbb;
+        else if ((dbb->addr > f) && (dbb->addr < f + len))
+            return false; // jump target within patched bytes
+    }
+    if (!first) return false;
+
+    // patched bytes must not extend beyond the first BB
+    for(int i = 0; i < first->count; i++) {
+        off += first->instr[i].len;
+        if (off >= len) return true;
+    }
+    return false;
+}
+
+// get address to jump to from <f> reaching generated code at <target>
+static
+uint64_t reachableTarget(Rewriter* r, uint64_t f, uint64_t target)
+{
+    int64_t diff = (int64_t) (target - (f + 5));
+    uint8_t* buf;
+
+    if ((diff >= INT32_MIN) && (diff <= INT32_MAX)) return target;
+
+    // trampoline 'jmp *0(%rip)' with absolute address following
+    if (!r->installCS) {
+        r->installCS = initNearCodeStorage(f, 64);
+        if (!r->installCS) return 0;
+    }
+    r->installCS->used = 0;
+    buf = useCodeStorage(r->installCS, 14);
+    buf[0] = 0xFF;
+    buf[1] = 0x25;
+    *(int32_t*)(buf + 2) = 0;
+    *(uint64_t*)(buf + 6) = target;
+
+    return (uint64_t) buf;
+}
+
+bool dbrew_install(Rewriter* r)
+{
+    uint64_t f = r->func;
+    uint64_t word, old, patched, target;
+    int off = (int) (f & 7);
+    const char* d = 0;
+
+    if (r->installAddr) dbrew_uninstall(r);
+
+    if ((r->generatedCodeAddr == 0) || (r->generatedCodeAddr == f))
+        d = "No generated code to install";
+    else if (off > 3)
+        d = "Function entry not patchable with one aligned store";
+    else if (!canPatchEntry(r, f, 5))
+        d = "Instruction boundaries at function entry prevent patching";
+    if (d == 0) {
+        target = reachableTarget(r, f, r->generatedCodeAddr);
+        if (target == 0)
+            d = "Generated code not reachable from function entry";
+    }
+    if (d) {
+        setError(&(r->error), ET_InvalidRequest, EM_Rewriter, r, d);
+        logError(&(r->error), (char*) "Function not installed");
+        return false;
+    }
+
+    // build new word: 'jmp rel32' at offset <off>, other bytes unchanged
+    word = f & ~7ul;
+    old = *(uint64_t*) word;
+    patched = old;
+    uint8_t* p = ((uint8_t*) &patched) + off;
+    p[0] = 0xE9;
+    *(int32_t*)(p + 1) = (int32_t) (target - (f + 5));
+
+    if (!patchWord(word, old, patched)) {
+        setError(&(r->error), ET_InvalidRequest, EM_Rewriter, r,
+                 "Cannot patch function entry");
+        logError(&(r->error), (char*) "Function not installed");
+        return false;
+    }
+    r->installAddr = word;
+    r->installOrig = old;
+    r->installPatch = patched;
+
+    // decoded instructions of original function are stale now
+    dbrew_decode_cache_invalidate(word, 8);
+
+    if (r->showEmuSteps)
+        printf("Installed code at %lx for function %lx\n",
+               r->generatedCodeAddr, f);
+
+    return true;
+}
+
+void dbrew_uninstall(Rewriter* r)
+{
+    if (r->installAddr == 0) return;
+
+    // keep any patch done by others meanwhile
+    patchWord(r->installAddr, r->installPatch, r->installOrig);
+    dbrew_decode_cache_invalidate(r->installAddr, 8);
+    r->installAddr = 0;
+}
@@ -196,6 +196,9 @@ Reg getReg(RegType rt, RegIndex ri)
     case RT_YMM:
         assert(ri < 16);
         break;
+    case RT_ZMM:
+        assert(ri < 32);
+        break;
     default:
         assert(0);
     }
@@ -230,6 +233,9 @@ ValType opValType(Operand* o)
     case OT_Reg256:
     case OT_Ind256:
         return VT_256;
+    case OT_Reg512:
+    case OT_Ind512:
+        return VT_512;
 
     default: assert(0);
     }
@@ -245,6 +251,7 @@ int opTypeWidth(Operand* o)
     case VT_64: return 64;
     case VT_128: return 128;
     case VT_256: return 256;
+    case VT_512: return 512;
     default: assert(0);
     }
     return 0;
@@ -273,6 +280,7 @@ bool opIsReg(Operand* o)
     case OT_Reg64:
     case OT_Reg128:
     case OT_Reg256:
+    case OT_Reg512:
         return true;
     default:
         break;
@@ -302,6 +310,7 @@ bool opIsInd(Operand* o)
     case OT_Ind64:
     case OT_Ind128:
     case OT_Ind256:
+    case OT_Ind512:
         return true;
     default:
         break;
@@ -378,6 +387,7 @@ void setRegOp(Operand* o, Reg r)
         case VT_64:  o->type = OT_Reg64; break;
         case VT_128: o->type = OT_Reg128; break;
         case VT_256: o->type = OT_Reg256; break;
+        case VT_512: o->type = OT_Reg512; break;
         default: assert(0);
         }
         o->reg = r;
@@ -387,9 +397,10 @@ void setRegOp(Operand* o, Reg r)
 
 }
 
+// temporary operands, per thread as batch rewriting runs in parallel
 Operand* getRegOp(Reg r)
 {
-    static Operand o;
+    static __thread Operand o;
 
     setRegOp(&o, r);
     return &o;
@@ -397,7 +408,7 @@ Operand* getRegOp(Reg r)
 
 Operand* getImmOp(ValType t, uint64_t v)
 {
-    static Operand o;
+    static __thread Operand o;
 
     switch(t) {
     case VT_8:
@@ -449,6 +460,7 @@ void copyOperand(Operand* dst, Operand* src)
     case OT_Reg64:
     case OT_Reg128:
     case OT_Reg256:
+    case OT_Reg512:
         dst->reg = src->reg;
         break;
     case OT_Ind8:
@@ -457,6 +469,7 @@ void copyOperand(Operand* dst, Operand* src)
     case OT_Ind64:
     case OT_Ind128:
     case OT_Ind256:
+    case OT_Ind512:
         assert( (src->reg.rt == RT_None) ||
                 (src->reg.rt == RT_IP)   ||
                 (src->reg.rt == RT_GP64) );
@@ -533,6 +546,7 @@ void opOverwriteType(Operand* o, ValType vt)
         case VT_64:  o->type = OT_Ind64; break;
         case VT_128: o->type = OT_Ind128; break;
         case VT_256: o->type = OT_Ind256; break;
+        case VT_512: o->type = OT_Ind512; break;
         default: assert(0);
         }
     }
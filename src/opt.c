@@ -0,0 +1,1994 @@
+/**
+ * This file is part of DBrew, the dynamic binary rewriting library.
+ *
+ * (c) 2016, Josef Weidendorfer <josef.weidendorfer@gmx.de>
+ *
+ * DBrew is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License (LGPL)
+ * as published by the Free Software Foundation, either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * DBrew is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with DBrew.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "opt.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "alloc.h"
+#include "emulate.h"
+#include "instr.h"
+#include "printer.h"
+
+/*
+ * Optimization passes on captured instructions
+ *
+ * Passes work on the instructions of one CBB. If a pass changes the
+ * instruction sequence, it writes the new sequence into newly allocated
+ * capture instructions and lets the CBB point to these.
+ */
+
+bool flagsDeadAfter(CBB* cbb, int i)
+{
+    for(i = i + 1; i < cbb->count; i++) {
+        switch(cbb->instr[i].type) {
+        // neither reading nor writing flags
+        case IT_HINT_CALL: case IT_HINT_RET: case IT_NOP:
+        case IT_MOV: case IT_MOVSX: case IT_MOVZX: case IT_LEA:
+        case IT_PUSH: case IT_POP:
+        case IT_CLTQ: case IT_CWTL: case IT_CQTO:
+            break;
+        // writing all flags without reading
+        case IT_ADD: case IT_SUB: case IT_CMP: case IT_TEST:
+        case IT_AND: case IT_OR: case IT_XOR: case IT_NEG:
+            return true;
+        // flags are not preserved across calls and returns
+        case IT_CALL: case IT_RET:
+            return true;
+        default:
+            return false;
+        }
+    }
+    return (cbb->endType == IT_RET);
+}
+
+// append a copy of instruction <i> to new capture instructions
+static
+void emit(RContext* c, Instr* i)
+{
+    Instr* n = newCapInstr(c);
+    if (n) copyInstr(n, i);
+}
+
+static
+void emitBinary(RContext* c, InstrType it, ValType vt, Operand* o1, Operand* o2)
+{
+    Instr i;
+
+    initBinaryInstr(&i, it, vt, o1, o2);
+    emit(c, &i);
+}
+
+// value of immediate operand, sign-extended to 64 bit
+static
+int64_t immValue(Operand* o)
+{
+    switch(o->type) {
+    case OT_Imm8:  return (int8_t) o->val;
+    case OT_Imm16: return (int16_t) o->val;
+    case OT_Imm32: return (int32_t) o->val;
+    case OT_Imm64: return (int64_t) o->val;
+    default: assert(0);
+    }
+    return 0;
+}
+
+static
+bool fitsImm32(int64_t v)
+{
+    return (v >= INT32_MIN) && (v <= INT32_MAX);
+}
+
+// index of 64-bit GP register containing register <r>, RI_None if none
+static
+RegIndex gpIndex(Reg r)
+{
+    switch(r.rt) {
+    case RT_GP8Leg:
+        // ah, ch, dh, bh
+        if ((r.ri >= RI_AH) && (r.ri <= RI_BH)) return r.ri - RI_AH;
+        return r.ri;
+    case RT_GP8: case RT_GP16: case RT_GP32: case RT_GP64:
+        return r.ri;
+    default: break;
+    }
+    return RI_None;
+}
+
+// are all effects of <instr> on registers and memory given by its explicit
+// destination operand, besides implicit ones handled in gpWrittenBy()?
+static
+bool effectsKnown(Instr* instr)
+{
+    switch(instr->type) {
+    case IT_HINT_CALL: case IT_HINT_RET: case IT_NOP:
+    case IT_CMP: case IT_TEST:
+    case IT_JMP: case IT_RET:
+    case IT_CLTQ: case IT_CWTL: case IT_CQTO:
+    case IT_PUSH: case IT_POP: case IT_LEAVE:
+    case IT_IDIV1: case IT_DIV: case IT_MUL: case IT_IMUL:
+    case IT_MOV: case IT_MOVSX: case IT_MOVZX: case IT_LEA:
+    case IT_ADD: case IT_ADC: case IT_SUB: case IT_SBB:
+    case IT_AND: case IT_OR: case IT_XOR:
+    case IT_NEG: case IT_NOT: case IT_INC: case IT_DEC:
+    case IT_SHL: case IT_SHR: case IT_SAR: case IT_BSF:
+    case IT_ANDN: case IT_SHLX: case IT_SHRX: case IT_SARX:
+        return true;
+    default:
+        break;
+    }
+    if ((instr->type >= IT_CMOVO) && (instr->type <= IT_CMOVG)) return true;
+    if ((instr->type >= IT_SETO) && (instr->type <= IT_SETG)) return true;
+    // SSE/AVX instructions only write their destination
+    if ((instr->type >= IT_MOVSS) && (instr->type <= IT_VZEROALL)) return true;
+    return false;
+}
+
+// may instruction <instr> change GP register with index <ri>?
+bool gpWrittenBy(Instr* instr, RegIndex ri)
+{
+    if (!effectsKnown(instr)) return true;
+
+    switch(instr->type) {
+    case IT_CLTQ: case IT_CWTL:
+        return (ri == RI_A);
+    case IT_CQTO:
+        return (ri == RI_D);
+    case IT_PUSH:
+        return (ri == RI_SP);
+    case IT_POP:
+        if (ri == RI_SP) return true;
+        break;
+    case IT_LEAVE:
+        return (ri == RI_SP) || (ri == RI_BP);
+    case IT_IDIV1: case IT_DIV: case IT_MUL:
+        return (ri == RI_A) || (ri == RI_D);
+    case IT_IMUL:
+        if (instr->form == OF_1) return (ri == RI_A) || (ri == RI_D);
+        break;
+    case IT_CMP: case IT_TEST:
+        return false;
+    default:
+        break;
+    }
+    return opIsGPReg(&(instr->dst)) && (gpIndex(instr->dst.reg) == ri);
+}
+
+
+//----------------------------------------------------------
+// strength reduction
+//
+
+// magic number <m> and shift <s> for signed 32-bit division by a constant
+// with absolute value <ad> >= 2 via multiply-high (Hacker's Delight, 10-4):
+// n/d = ((n * m) >> (32 + s)) + (n < 0), negated for negative d
+static
+void divMagic(uint32_t ad, uint32_t* m, int* s)
+{
+    const uint32_t two31 = 0x80000000u;
+    uint32_t anc, delta, q1, r1, q2, r2;
+    int p = 31;
+
+    anc = two31 - 1 - two31 % ad;
+    q1 = two31 / anc;
+    r1 = two31 - q1 * anc;
+    q2 = two31 / ad;
+    r2 = two31 - q2 * ad;
+    do {
+        p++;
+        q1 = 2 * q1;
+        r1 = 2 * r1;
+        if (r1 >= anc) { q1++; r1 -= anc; }
+        q2 = 2 * q2;
+        r2 = 2 * r2;
+        if (r2 >= ad) { q2++; r2 -= ad; }
+        delta = ad - r2;
+    } while ((q1 < delta) || ((q1 == delta) && (r1 == 0)));
+
+    *m = q2 + 1;
+    *s = p - 32;
+}
+
+static
+bool opUsesReg(Operand* o, RegIndex ri)
+{
+    if (opIsReg(o)) return (o->reg.ri == ri);
+    if (!opIsInd(o)) return false;
+    if (o->reg.ri == ri) return true;
+    return (o->scale > 0) && (o->ireg.ri == ri);
+}
+
+// match signed 32-bit division of edx:eax by a constant at instruction <i>,
+// as captured for idiv with static divisor: 'cltd; mov $d,X; idiv X'.
+// X does not need to keep the divisor, and is used as scratch
+static
+bool matchDivConst(CBB* cbb, int i, int32_t* d)
+{
+    Instr *cltd, *mov, *idiv;
+
+    if (i + 2 >= cbb->count) return false;
+    cltd = cbb->instr + i;
+    mov = cltd + 1;
+    idiv = cltd + 2;
+
+    if ((cltd->type != IT_CQTO) || (cltd->vtype != VT_64)) return false;
+    if ((mov->type != IT_MOV) || (mov->src.type != OT_Imm32)) return false;
+    if ((idiv->type != IT_IDIV1) || !opIsEqual(&(mov->dst), &(idiv->dst)))
+        return false;
+    if ((idiv->dst.type != OT_Reg32) && (idiv->dst.type != OT_Ind32))
+        return false;
+    // rax/rdx get overwritten before X is used
+    if (opUsesReg(&(idiv->dst), RI_A) || opUsesReg(&(idiv->dst), RI_D))
+        return false;
+
+    *d = (int32_t) mov->src.val;
+    // avoid overflow for -1 and INT_MIN; division by 1 is removed on capture
+    if ((*d >= -1) && (*d <= 1)) return false;
+    if (*d == INT32_MIN) return false;
+    return true;
+}
+
+// quotient into eax, remainder into edx, using <x> as 32-bit scratch.
+// Flags are undefined after idiv, so they can be changed
+static
+void emitDivConst(RContext* c, Operand* x, int32_t d)
+{
+    Operand eax, edx, rax, rdx;
+    uint32_t ad = (d < 0) ? -(uint32_t) d : (uint32_t) d;
+    uint32_t m;
+    int s;
+    Instr i;
+
+    divMagic(ad, &m, &s);
+    setRegOp(&eax, getReg(RT_GP32, RI_A));
+    setRegOp(&edx, getReg(RT_GP32, RI_D));
+    setRegOp(&rax, getReg(RT_GP64, RI_A));
+    setRegOp(&rdx, getReg(RT_GP64, RI_D));
+
+    // rdx = (n * m) >> (32 + s), with rax = n sign-extended
+    initSimpleInstr(&i, IT_CLTQ);
+    emit(c, &i);
+    emitBinary(c, IT_MOV, VT_32, &edx, getImmOp(VT_32, m));
+    emitBinary(c, IT_IMUL, VT_64, &rdx, &rax);
+    emitBinary(c, IT_SAR, VT_64, &rdx, getImmOp(VT_8, 32 + s));
+    // quotient: add 1 for negative n
+    emitBinary(c, IT_MOV, VT_32, x, &eax);
+    emitBinary(c, IT_SHR, VT_32, x, getImmOp(VT_8, 31));
+    emitBinary(c, IT_ADD, VT_32, &edx, x);
+    // remainder: n - q * |d|
+    emitBinary(c, IT_MOV, VT_32, x, &edx);
+    emitBinary(c, IT_IMUL, VT_32, &edx, getImmOp(VT_32, ad));
+    emitBinary(c, IT_SUB, VT_32, &eax, &edx);
+    emitBinary(c, IT_MOV, VT_32, &edx, &eax);
+    emitBinary(c, IT_MOV, VT_32, &eax, x);
+    if (d < 0) {
+        initUnaryInstr(&i, IT_NEG, &eax);
+        emit(c, &i);
+    }
+}
+
+// match multiplication of a register with a constant which can be done
+// by lea and/or shift, with flags dead afterwards
+static
+bool matchMulConst(CBB* cbb, int i, int* k, int* f)
+{
+    Instr* instr = cbb->instr + i;
+    uint64_t v;
+
+    if ((instr->type != IT_IMUL) || (instr->form != OF_2)) return false;
+    if (!opIsImm(&(instr->src)) || !opIsGPReg(&(instr->dst))) return false;
+    if ((instr->dst.type != OT_Reg32) && (instr->dst.type != OT_Reg64))
+        return false;
+
+    // immediates are sign-extended
+    v = (uint64_t) immValue(&(instr->src));
+    if ((int64_t) v < 2) return false;
+
+    // v = f * 2^k, with factor f one of 1, 3, 5, 9
+    *k = 0;
+    while((v & 1) == 0) {
+        v = v >> 1;
+        (*k)++;
+    }
+    if ((v != 1) && (v != 3) && (v != 5) && (v != 9)) return false;
+    if (*k > 31) return false;
+    *f = (int) v;
+
+    // imul sets carry/overflow, lea does not touch flags
+    return flagsDeadAfter(cbb, i);
+}
+
+static
+void emitMulConst(RContext* c, Operand* dst, int k, int f)
+{
+    Operand o;
+    Reg r = getReg(RT_GP64, dst->reg.ri);
+
+    if (f > 1) {
+        // lea dst,[r + r * (f-1)]
+        o.type = (dst->type == OT_Reg32) ? OT_Ind32 : OT_Ind64;
+        o.reg = r;
+        o.ireg = r;
+        o.scale = f - 1;
+        o.val = 0;
+        o.seg = OSO_None;
+        emitBinary(c, IT_LEA, VT_None, dst, &o);
+    }
+    if (k > 0)
+        emitBinary(c, IT_SHL, opValType(dst), dst, getImmOp(VT_8, k));
+}
+
+// replace division/modulo and multiplication by constants with cheaper
+// instruction sequences
+void optStrengthReduction(RContext* c, CBB* cbb)
+{
+    Rewriter* r = c->r;
+    int i, k, f, start;
+    int32_t d;
+
+    for(i = 0; i < cbb->count; i++)
+        if (matchDivConst(cbb, i, &d) || matchMulConst(cbb, i, &k, &f))
+            break;
+    if (i == cbb->count) return;
+
+    if (r->showOptSteps)
+        printf("Run strength reduction for CBB (%s)\n", cbb_prettyName(cbb));
+
+    start = r->capInstrCount;
+    for(i = 0; i < cbb->count; i++) {
+        Instr* instr = cbb->instr + i;
+
+        if (matchDivConst(cbb, i, &d)) {
+            if (r->showOptSteps)
+                printf("  replacing %s by %d\n",
+                       instr2string(instr + 2, 0, cbb->fc), d);
+            emitDivConst(c, &(instr[2].dst), d);
+            i += 2;
+        }
+        else if (matchMulConst(cbb, i, &k, &f)) {
+            if (r->showOptSteps)
+                printf("  replacing %s\n", instr2string(instr, 0, cbb->fc));
+            emitMulConst(c, &(instr->dst), k, f);
+        }
+        else
+            emit(c, instr);
+        if (c->e) return;
+    }
+    cbb->instr = r->capInstr + start;
+    cbb->count = r->capInstrCount - start;
+}
+
+
+//----------------------------------------------------------
+// peephole optimization
+//
+
+// known constant values of GP registers while walking through a CBB
+typedef struct _ConstRegs {
+    bool known[RI_GPMax];
+    uint64_t val[RI_GPMax];
+} ConstRegs;
+
+// fold known base/index registers of memory operand <o> into displacement
+static
+bool foldAddress(ConstRegs* cr, Operand* o)
+{
+    RegIndex b, i;
+    int64_t v = (int64_t) o->val;
+    bool changed = false;
+
+    if (!opIsInd(o)) return false;
+    b = regGP64Index(o->reg);
+    i = (o->scale > 0) ? regGP64Index(o->ireg) : RI_None;
+
+    if ((i != RI_None) && cr->known[i] &&
+        fitsImm32(v + (int64_t) cr->val[i] * o->scale)) {
+        v += (int64_t) cr->val[i] * o->scale;
+        o->ireg = getReg(RT_None, (RegIndex) 0);
+        o->scale = 0;
+        i = RI_None;
+        changed = true;
+    }
+    if ((b != RI_None) && cr->known[b] && fitsImm32(v + cr->val[b])) {
+        v += cr->val[b];
+        o->reg = getReg(RT_None, (RegIndex) 0);
+        if ((i != RI_None) && (o->scale == 1)) {
+            // index without scaling becomes base
+            o->reg = o->ireg;
+            o->ireg = getReg(RT_None, (RegIndex) 0);
+            o->scale = 0;
+        }
+        changed = true;
+    }
+    o->val = (uint64_t) v;
+    return changed;
+}
+
+// replace register source of known value by immediate
+static
+bool foldSource(ConstRegs* cr, CBB* cbb, int idx)
+{
+    Instr* instr = cbb->instr + idx;
+    Operand* src = &(instr->src);
+    RegIndex ri;
+    int64_t v;
+
+    switch(instr->type) {
+    case IT_MOV: case IT_ADD: case IT_SUB: case IT_CMP:
+    case IT_AND: case IT_OR: case IT_XOR:
+        break;
+    default:
+        return false;
+    }
+    if ((src->type != OT_Reg32) && (src->type != OT_Reg64)) return false;
+    ri = gpIndex(src->reg);
+    if ((ri == RI_None) || !cr->known[ri]) return false;
+
+    v = (int64_t) cr->val[ri];
+    if (src->type == OT_Reg32) v = (int32_t) v;
+    else if (!fitsImm32(v)) return false;
+
+    // moving 0 into a register is generated as xor, changing flags
+    if ((instr->type == IT_MOV) && (v == 0) && opIsReg(&(instr->dst)) &&
+        !flagsDeadAfter(cbb, idx))
+        return false;
+
+    src->type = OT_Imm32;
+    src->val = (uint64_t) (uint32_t) v;
+    return true;
+}
+
+// update known register values <cr> with effect of <instr>
+static
+void trackConst(ConstRegs* cr, Instr* instr)
+{
+    RegIndex ri;
+
+    for(ri = RI_A; ri < RI_GPMax; ri++)
+        if (cr->known[ri] && gpWrittenBy(instr, ri))
+            cr->known[ri] = false;
+
+    if ((instr->type != IT_MOV) || !opIsImm(&(instr->src))) return;
+    ri = gpIndex(instr->dst.reg);
+    if (instr->dst.type == OT_Reg64) {
+        cr->known[ri] = true;
+        cr->val[ri] = (uint64_t) immValue(&(instr->src));
+    }
+    else if (instr->dst.type == OT_Reg32) {
+        // upper half gets zeroed
+        cr->known[ri] = true;
+        cr->val[ri] = (uint32_t) immValue(&(instr->src));
+    }
+}
+
+// propagate constants loaded into registers into immediates and
+// displacements of following instructions within <cbb>, in-place
+static
+int propagateConstants(Rewriter* r, CBB* cbb)
+{
+    ConstRegs cr;
+    int changes = 0;
+
+    for(int i = 0; i < RI_GPMax; i++)
+        cr.known[i] = false;
+
+    for(int i = 0; i < cbb->count; i++) {
+        Instr* instr = cbb->instr + i;
+        bool changed = false;
+
+        // pass-through instructions are encoded as given
+        if (instr->ptLen == 0) {
+            changed |= foldAddress(&cr, &(instr->dst));
+            changed |= foldAddress(&cr, &(instr->src));
+            changed |= foldSource(&cr, cbb, i);
+        }
+        if (changed) {
+            changes++;
+            if (r->showOptSteps)
+                printf("  constant propagation: %s\n",
+                       instr2string(instr, 0, cbb->fc));
+        }
+        trackConst(&cr, instr);
+    }
+    return changes;
+}
+
+/* Peephole patterns
+ *
+ * A pattern is given by a match function, returning the number of
+ * instructions matched starting at instruction <i> of a CBB (0 for no
+ * match), and an emit function producing the replacement.
+ */
+typedef struct _Peephole {
+    const char* name;
+    int (*match)(CBB* cbb, int i);
+    void (*emit)(RContext* c, CBB* cbb, int i);
+} Peephole;
+
+// 'add/sub/or/xor $0,X', 'and $-1,X', 'imul $1,X' on 64-bit registers
+// or memory: no effect besides flags
+static
+int matchNeutralOp(CBB* cbb, int i)
+{
+    Instr* instr = cbb->instr + i;
+    int64_t v;
+
+    if ((instr->ptLen > 0) || !opIsImm(&(instr->src))) return 0;
+    // on 32-bit registers, upper half gets zeroed
+    if (opIsReg(&(instr->dst)) && (instr->dst.type != OT_Reg64)) return 0;
+    if (!opIsReg(&(instr->dst)) && !opIsInd(&(instr->dst))) return 0;
+
+    v = immValue(&(instr->src));
+    switch(instr->type) {
+    case IT_ADD: case IT_SUB: case IT_OR: case IT_XOR:
+        if (v != 0) return 0;
+        break;
+    case IT_AND:
+        if (v != -1) return 0;
+        break;
+    case IT_IMUL:
+        if ((instr->form != OF_2) || (v != 1)) return 0;
+        break;
+    default:
+        return 0;
+    }
+    return flagsDeadAfter(cbb, i) ? 1 : 0;
+}
+
+static
+void emitNothing(RContext* c, CBB* cbb, int i)
+{
+    (void) c;
+    (void) cbb;
+    (void) i;
+}
+
+// 'mov $v,%reg; add/sub $w,%reg' => 'mov $(v+w),%reg'
+// 'add/sub $v,X; add/sub $w,X' => 'add $(v+w),X'
+static
+int matchImmChain(CBB* cbb, int i)
+{
+    Instr* i1 = cbb->instr + i;
+    Instr* i2 = i1 + 1;
+
+    if (i + 1 >= cbb->count) return 0;
+    if ((i1->ptLen > 0) || (i2->ptLen > 0)) return 0;
+    if (!opIsImm(&(i1->src)) || !opIsImm(&(i2->src))) return 0;
+    if ((i2->type != IT_ADD) && (i2->type != IT_SUB)) return 0;
+    if (!opIsEqual(&(i1->dst), &(i2->dst))) return 0;
+    if ((i1->dst.type != OT_Reg32) && (i1->dst.type != OT_Reg64) &&
+        (i1->dst.type != OT_Ind32) && (i1->dst.type != OT_Ind64)) return 0;
+
+    switch(i1->type) {
+    case IT_MOV:
+        if (!opIsReg(&(i1->dst))) return 0;
+        break;
+    case IT_ADD: case IT_SUB:
+        break;
+    default:
+        return 0;
+    }
+    return flagsDeadAfter(cbb, i + 1) ? 2 : 0;
+}
+
+static
+void emitImmChain(RContext* c, CBB* cbb, int i)
+{
+    Instr* i1 = cbb->instr + i;
+    Instr* i2 = i1 + 1;
+    Operand dst;
+    bool is64 = (opValType(&(i1->dst)) == VT_64);
+    int64_t v;
+
+    v = immValue(&(i1->src));
+    if (i1->type == IT_SUB) v = -v;
+    if (i2->type == IT_ADD)
+        v += immValue(&(i2->src));
+    else
+        v -= immValue(&(i2->src));
+    if (!is64) v = (int32_t) v;
+
+    copyOperand(&dst, &(i1->dst));
+    if (fitsImm32(v))
+        emitBinary(c, (i1->type == IT_MOV) ? IT_MOV : IT_ADD, VT_None,
+                   &dst, getImmOp(VT_32, (uint32_t) v));
+    else if (i1->type == IT_MOV)
+        emitBinary(c, IT_MOV, VT_None, &dst, getImmOp(VT_64, (uint64_t) v));
+    else {
+        // sum does not fit into imm32: keep as is
+        emit(c, i1);
+        emit(c, i2);
+    }
+}
+
+// 'mov $v,%reg' with <reg> known to already hold <v>, or 'mov %reg,%reg'
+// on 64-bit registers
+static
+int matchRedundantMov(CBB* cbb, int i)
+{
+    Instr* instr = cbb->instr + i;
+
+    if ((instr->type != IT_MOV) || (instr->ptLen > 0)) return 0;
+    if (instr->dst.type == OT_Reg64 && opIsEqual(&(instr->dst), &(instr->src)))
+        return 1;
+    if (!opIsGPReg(&(instr->dst)) || !opIsImm(&(instr->src))) return 0;
+
+    // search for same mov before, without modification of <reg> in between
+    for(int j = i - 1; j >= 0; j--) {
+        Instr* prev = cbb->instr + j;
+
+        if ((prev->type == IT_MOV) && (prev->ptLen == 0) &&
+            opIsEqual(&(prev->dst), &(instr->dst)) &&
+            opIsImm(&(prev->src)) &&
+            (immValue(&(prev->src)) == immValue(&(instr->src))))
+            return 1;
+        if (gpWrittenBy(prev, gpIndex(instr->dst.reg)))
+            return 0;
+    }
+    return 0;
+}
+
+// 'lea M1,%reg; lea d(%reg),%reg' => 'lea M1+d,%reg'
+static
+int matchLeaChain(CBB* cbb, int i)
+{
+    Instr* i1 = cbb->instr + i;
+    Instr* i2 = i1 + 1;
+
+    if (i + 1 >= cbb->count) return 0;
+    if ((i1->type != IT_LEA) || (i2->type != IT_LEA)) return 0;
+    if ((i1->ptLen > 0) || (i2->ptLen > 0)) return 0;
+    if ((i1->dst.type != OT_Reg64) || !opIsEqual(&(i1->dst), &(i2->dst)))
+        return 0;
+    if ((i2->src.scale > 0) || (i2->src.reg.rt != RT_GP64) ||
+        (i2->src.reg.ri != i1->dst.reg.ri)) return 0;
+    if (i1->src.reg.rt == RT_IP) return 0;
+    if (!fitsImm32((int64_t) i1->src.val + (int64_t) i2->src.val)) return 0;
+    return 2;
+}
+
+static
+void emitLeaChain(RContext* c, CBB* cbb, int i)
+{
+    Instr instr;
+
+    copyInstr(&instr, cbb->instr + i);
+    instr.src.val += cbb->instr[i + 1].src.val;
+    emit(c, &instr);
+}
+
+static Peephole peepholes[] = {
+    { "neutral operation",    matchNeutralOp,    emitNothing },
+    { "immediate chain",      matchImmChain,     emitImmChain },
+    { "redundant mov",        matchRedundantMov, emitNothing },
+    { "lea chain",            matchLeaChain,     emitLeaChain },
+    { 0, 0, 0 }
+};
+
+// returns number of instructions matched by a peephole pattern at <i>
+static
+int matchPeephole(CBB* cbb, int i, Peephole** p)
+{
+    int n;
+
+    for(*p = peepholes; (*p)->name; (*p)++) {
+        n = (*p)->match(cbb, i);
+        if (n > 0) return n;
+    }
+    return 0;
+}
+
+// constant propagation followed by peephole patterns
+void optPeephole(RContext* c, CBB* cbb)
+{
+    Rewriter* r = c->r;
+    Peephole* p;
+    int i, n, start;
+
+    if (r->showOptSteps)
+        printf("Run peephole optimization for CBB (%s)\n",
+               cbb_prettyName(cbb));
+
+    propagateConstants(r, cbb);
+
+    for(i = 0; i < cbb->count; i++)
+        if (matchPeephole(cbb, i, &p) > 0) break;
+    if (i == cbb->count) return;
+
+    start = r->capInstrCount;
+    for(i = 0; i < cbb->count; i += n) {
+        n = matchPeephole(cbb, i, &p);
+        if (n == 0) {
+            emit(c, cbb->instr + i);
+            n = 1;
+        }
+        else {
+            if (r->showOptSteps)
+                printf("  %s: %s%s\n", p->name,
+                       instr2string(cbb->instr + i, 0, cbb->fc),
+                       (n > 1) ? " ..." : "");
+            p->emit(c, cbb, i);
+        }
+        if (c->e) return;
+    }
+    cbb->instr = r->capInstr + start;
+    cbb->count = r->capInstrCount - start;
+}
+
+
+//----------------------------------------------------------
+// value numbering: redundant load and common subexpression elimination
+//
+
+#define VN_ENTRIES 64
+
+// symbolic memory address: value numbers of base/index register (0: none)
+typedef struct _VNAddr {
+    int base, index, scale;
+    int64_t disp;
+    int size;
+} VNAddr;
+
+// value computed by an operation, or loaded from memory
+typedef struct _VNEntry {
+    InstrType it; // IT_MOV: immediate or zero-extension of 32-bit value
+    OpType type;  // type of destination
+    int a, b;     // value numbers of operands (b = 0: immediate)
+    int64_t imm;
+    VNAddr addr;  // for IT_LEA and memory contents
+    bool constMem; // memory configured to be constant
+    int vn;
+} VNEntry;
+
+typedef struct _VNState {
+    int next;
+    int reg[RI_GPMax]; // value numbers of GP registers
+    int exprCount, memCount;
+    VNEntry expr[VN_ENTRIES];
+    VNEntry mem[VN_ENTRIES];
+} VNState;
+
+// actions for instructions
+#define VN_Keep   -1
+#define VN_Remove -2
+// values >= 0: replace by move from GP register with this index
+
+static
+bool vnAddr(VNState* s, Operand* o, VNAddr* a)
+{
+    if (!opIsInd(o) || (o->seg != OSO_None)) return false;
+    if ((o->reg.rt != RT_None) && (o->reg.rt != RT_GP64)) return false;
+
+    a->base = (o->reg.rt == RT_GP64) ? s->reg[o->reg.ri] : 0;
+    a->index = 0;
+    a->scale = 0;
+    if ((o->scale > 0) && (o->ireg.rt == RT_GP64)) {
+        a->index = s->reg[o->ireg.ri];
+        a->scale = o->scale;
+    }
+    a->disp = (int64_t) o->val;
+    switch(o->type) {
+    case OT_Ind8:   a->size = 1; break;
+    case OT_Ind16:  a->size = 2; break;
+    case OT_Ind32:  a->size = 4; break;
+    case OT_Ind64:  a->size = 8; break;
+    case OT_Ind128: a->size = 16; break;
+    case OT_Ind256: a->size = 32; break;
+    case OT_Ind512: a->size = 64; break;
+    default: return false;
+    }
+    return true;
+}
+
+static
+bool vnAddrEqual(VNAddr* a1, VNAddr* a2)
+{
+    return (a1->base == a2->base) && (a1->index == a2->index) &&
+           (a1->scale == a2->scale) && (a1->disp == a2->disp) &&
+           (a1->size == a2->size);
+}
+
+// may accesses to <a1> and <a2> overlap?
+static
+bool vnMayAlias(VNAddr* a1, VNAddr* a2)
+{
+    // with same base and index, only displacements differ
+    if ((a1->base != a2->base) || (a1->index != a2->index) ||
+        (a1->scale != a2->scale))
+        return true;
+    return (a1->disp < a2->disp + a2->size) &&
+           (a2->disp < a1->disp + a1->size);
+}
+
+// find GP register holding value <vn>, RI_None if none
+static
+RegIndex vnHolder(VNState* s, int vn, RegIndex not)
+{
+    for(RegIndex ri = RI_A; ri < RI_GPMax; ri++)
+        if ((ri != not) && (s->reg[ri] == vn)) return ri;
+    return RI_None;
+}
+
+static
+VNEntry* vnAdd(VNEntry* e, int* count)
+{
+    // when full, replace oldest entries
+    if (*count == VN_ENTRIES) {
+        for(int i = 1; i < VN_ENTRIES; i++)
+            e[i - 1] = e[i];
+        (*count)--;
+    }
+    return e + (*count)++;
+}
+
+// value number for operation <it> on <a>/<b> or immediate <imm> (b = 0)
+static
+int vnExpr(VNState* s, InstrType it, OpType type, int a, int b,
+           int64_t imm, VNAddr* addr)
+{
+    VNEntry* e;
+
+    // normalize commutative operations
+    if ((b > 0) && (a > b)) {
+        switch(it) {
+        case IT_ADD: case IT_AND: case IT_OR: case IT_XOR: case IT_IMUL: {
+            int t = a; a = b; b = t;
+            break;
+        }
+        default: break;
+        }
+    }
+
+    for(int i = 0; i < s->exprCount; i++) {
+        e = s->expr + i;
+        if ((e->it != it) || (e->type != type)) continue;
+        if ((e->a != a) || (e->b != b) || (e->imm != imm)) continue;
+        if (addr && !vnAddrEqual(&(e->addr), addr)) continue;
+        return e->vn;
+    }
+    e = vnAdd(s->expr, &(s->exprCount));
+    e->it = it;
+    e->type = type;
+    e->a = a;
+    e->b = b;
+    e->imm = imm;
+    if (addr) e->addr = *addr;
+    e->vn = s->next++;
+    return e->vn;
+}
+
+// value number of memory contents at <a> with <type>, 0 if unknown
+static
+int vnLoad(VNState* s, VNAddr* a, OpType type)
+{
+    for(int i = 0; i < s->memCount; i++)
+        if ((s->mem[i].type == type) && vnAddrEqual(&(s->mem[i].addr), a))
+            return s->mem[i].vn;
+    return 0;
+}
+
+static
+void vnSetMem(Rewriter* r, VNState* s, VNAddr* a, OpType type, int vn)
+{
+    VNEntry* e = vnAdd(s->mem, &(s->memCount));
+
+    e->type = type;
+    e->addr = *a;
+    e->vn = vn;
+    e->constMem = (a->base == 0) && (a->index == 0) &&
+                  config_is_constant(r, (uint64_t) a->disp);
+}
+
+// invalidate memory contents possibly overwritten by write to <a>,
+// or all non-constant contents if <a> is 0
+static
+void vnKillMem(VNState* s, VNAddr* a)
+{
+    int j = 0;
+
+    for(int i = 0; i < s->memCount; i++) {
+        if (!s->mem[i].constMem && (!a || vnMayAlias(&(s->mem[i].addr), a)))
+            continue;
+        s->mem[j++] = s->mem[i];
+    }
+    s->memCount = j;
+}
+
+// value number of register operand <o> (read with its width)
+static
+int vnRegOp(VNState* s, Operand* o)
+{
+    int vn = s->reg[gpIndex(o->reg)];
+
+    // 32-bit registers as source: upper half zero
+    if (o->type == OT_Reg32)
+        vn = vnExpr(s, IT_MOV, OT_Reg32, vn, 0, 0, 0);
+    return vn;
+}
+
+// value numbering for instruction <i> of <cbb>, returns action
+static
+int vnInstr(Rewriter* r, VNState* s, CBB* cbb, int i)
+{
+    Instr* instr = cbb->instr + i;
+    Operand* dst = &(instr->dst);
+    Operand* src = &(instr->src);
+    bool dstIsReg = (dst->type == OT_Reg32) || (dst->type == OT_Reg64);
+    bool flagsDead = false;
+    RegIndex ri = dstIsReg ? gpIndex(dst->reg) : RI_None;
+    RegIndex holder;
+    VNAddr a;
+    int vn = 0;
+
+    if (instr->ptLen > 0) goto generic;
+
+    switch(instr->type) {
+    case IT_MOV:
+        if (dstIsReg && (src->type == dst->type) && opIsReg(src)) {
+            vn = vnRegOp(s, src);
+            break;
+        }
+        if (dstIsReg && opIsImm(src)) {
+            int64_t v = immValue(src);
+            if (dst->type == OT_Reg32) v = (uint32_t) v;
+            vn = vnExpr(s, IT_MOV, dst->type, 0, 0, v, 0);
+            break;
+        }
+        if (dstIsReg && vnAddr(s, src, &a) &&
+            (opValType(src) == opValType(dst))) {
+            // load
+            vn = vnLoad(s, &a, dst->type);
+            if (vn == 0) {
+                vn = s->next++;
+                vnSetMem(r, s, &a, dst->type, vn);
+            }
+            break;
+        }
+        if (vnAddr(s, dst, &a)) {
+            // store: value as seen by a load of same width
+            vnKillMem(s, &a);
+            if ((dst->type == OT_Ind64) && (src->type == OT_Reg64))
+                vnSetMem(r, s, &a, OT_Reg64, vnRegOp(s, src));
+            else if ((dst->type == OT_Ind32) && (src->type == OT_Reg32))
+                vnSetMem(r, s, &a, OT_Reg32, vnRegOp(s, src));
+            else if ((dst->type == OT_Ind64) && opIsImm(src))
+                vnSetMem(r, s, &a, OT_Reg64,
+                         vnExpr(s, IT_MOV, OT_Reg64, 0, 0, immValue(src), 0));
+            else if ((dst->type == OT_Ind32) && opIsImm(src))
+                vnSetMem(r, s, &a, OT_Reg32,
+                         vnExpr(s, IT_MOV, OT_Reg32, 0, 0,
+                                (uint32_t) immValue(src), 0));
+            return VN_Keep;
+        }
+        goto generic;
+
+    case IT_LEA:
+        if (!dstIsReg || !vnAddr(s, src, &a)) goto generic;
+        a.size = 0;
+        vn = vnExpr(s, IT_LEA, dst->type, 0, 0, 0, &a);
+        break;
+
+    case IT_ADD: case IT_SUB: case IT_AND: case IT_OR: case IT_XOR:
+    case IT_SHL: case IT_SHR: case IT_SAR:
+        if (!dstIsReg) goto generic;
+        flagsDead = flagsDeadAfter(cbb, i);
+        if (((instr->type == IT_SUB) || (instr->type == IT_XOR)) &&
+            opIsEqual(dst, src)) {
+            // zeroing idiom
+            vn = vnExpr(s, IT_MOV, dst->type, 0, 0, 0, 0);
+        }
+        else if (opIsImm(src))
+            vn = vnExpr(s, instr->type, dst->type, s->reg[ri], 0,
+                        immValue(src), 0);
+        else if (src->type == dst->type)
+            vn = vnExpr(s, instr->type, dst->type, s->reg[ri],
+                        s->reg[gpIndex(src->reg)], 0, 0);
+        else
+            goto generic;
+        break;
+
+    case IT_IMUL:
+        if (!dstIsReg || (instr->form != OF_2)) goto generic;
+        flagsDead = flagsDeadAfter(cbb, i);
+        if (opIsImm(src))
+            vn = vnExpr(s, IT_IMUL, dst->type, s->reg[ri], 0,
+                        immValue(src), 0);
+        else if (src->type == dst->type)
+            vn = vnExpr(s, IT_IMUL, dst->type, s->reg[ri],
+                        s->reg[gpIndex(src->reg)], 0, 0);
+        else
+            goto generic;
+        break;
+
+    default:
+        goto generic;
+    }
+
+    // value <vn> computed into GP register <ri>
+    assert(vn > 0);
+    if ((instr->type != IT_MOV) && (instr->type != IT_LEA) && !flagsDead) {
+        // instruction needed for its flags
+        s->reg[ri] = vn;
+        return VN_Keep;
+    }
+    if (s->reg[ri] == vn)
+        return VN_Remove;
+    s->reg[ri] = vn;
+    holder = vnHolder(s, vn, ri);
+    // only replace memory accesses and arithmetic, not moves
+    if ((holder == RI_None) || ((instr->type == IT_MOV) && !opIsInd(src)))
+        return VN_Keep;
+    return holder;
+
+generic:
+    if (!effectsKnown(instr) || (instr->type == IT_PUSH) ||
+        (instr->type == IT_LEAVE)) {
+        // TODO: track stack accesses of push/pop
+        vnKillMem(s, 0);
+    }
+    else if (vnAddr(s, dst, &a)) {
+        if ((instr->type != IT_CMP) && (instr->type != IT_TEST))
+            vnKillMem(s, &a);
+    }
+    else if (opIsInd(dst))
+        vnKillMem(s, 0);
+
+    for(ri = RI_A; ri < RI_GPMax; ri++)
+        if (gpWrittenBy(instr, ri))
+            s->reg[ri] = s->next++;
+    return VN_Keep;
+}
+
+// remove loads of values already available in registers, and
+// recalculations of values already calculated
+void optValueNumbering(RContext* c, CBB* cbb)
+{
+    Rewriter* r = c->r;
+    VNState s;
+    int *action, changes = 0, start;
+
+    if (cbb->count == 0) return;
+
+    s.next = 1;
+    for(int i = 0; i < RI_GPMax; i++)
+        s.reg[i] = s.next++;
+    s.exprCount = 0;
+    s.memCount = 0;
+
+    action = (int*) arenaAlloc(r, &(r->tempArena), sizeof(int) * cbb->count);
+    for(int i = 0; i < cbb->count; i++) {
+        action[i] = vnInstr(r, &s, cbb, i);
+        if (action[i] != VN_Keep) changes++;
+    }
+    if (changes == 0) return;
+
+    if (r->showOptSteps)
+        printf("Run value numbering for CBB (%s)\n", cbb_prettyName(cbb));
+
+    start = r->capInstrCount;
+    for(int i = 0; i < cbb->count; i++) {
+        Instr* instr = cbb->instr + i;
+        Operand o;
+
+        if ((action[i] != VN_Keep) && r->showOptSteps)
+            printf("  %s %s\n", (action[i] == VN_Remove) ? "removing" : "replacing",
+                   instr2string(instr, 0, cbb->fc));
+
+        if (action[i] == VN_Keep)
+            emit(c, instr);
+        else if (action[i] >= 0) {
+            RegType rt = (instr->dst.type == OT_Reg32) ? RT_GP32 : RT_GP64;
+            setRegOp(&o, getReg(rt, (RegIndex) action[i]));
+            emitBinary(c, IT_MOV, VT_None, &(instr->dst), &o);
+        }
+        if (c->e) break;
+    }
+    if (c->e) return;
+
+    cbb->instr = r->capInstr + start;
+    cbb->count = r->capInstrCount - start;
+}
+
+
+//----------------------------------------------------------
+// if-conversion: branch diamonds into cmov/setcc
+//
+
+/* A CBB ending with a dynamic conditional branch is merged with both its
+ * successors if these are only reached from it, leave to the same CBBs,
+ * and only differ in a few register moves in front of a common tail.
+ * As the emulator follows static jumps, the code behind the join point
+ * of an if/else in the original function shows up as such a common tail.
+ * The moves are replaced by cmov/setcc on the flags of the branch.
+ */
+
+#define IF_SELMAX 16
+
+// value selected for register <ri>; OT_None in <dst> for unchanged
+typedef struct _IfSel {
+    RegIndex ri;
+    Operand dst[2], src[2]; // [0]: branch taken, [1]: fall-through
+} IfSel;
+
+static
+bool ifInstrEqual(Instr* i1, Instr* i2)
+{
+    if ((i1->type != i2->type) || (i1->form != i2->form) ||
+        (i1->vtype != i2->vtype) || (i1->ptLen != i2->ptLen))
+        return false;
+    if (i1->ptLen > 0) {
+        if ((i1->ptEnc != i2->ptEnc) || (i1->ptPSet != i2->ptPSet) ||
+            (i1->ptVexP != i2->ptVexP))
+            return false;
+        for(int j = 0; j < i1->ptLen; j++)
+            if (i1->ptOpc[j] != i2->ptOpc[j]) return false;
+    }
+    if ((i1->dst.type != i2->dst.type) || (i1->src.type != i2->src.type) ||
+        (i1->src2.type != i2->src2.type))
+        return false;
+    if ((i1->dst.type != OT_None) && !opIsEqual(&(i1->dst), &(i2->dst)))
+        return false;
+    if ((i1->src.type != OT_None) && !opIsEqual(&(i1->src), &(i2->src)))
+        return false;
+    if ((i1->src2.type != OT_None) && !opIsEqual(&(i1->src2), &(i2->src2)))
+        return false;
+    return true;
+}
+
+static
+bool ifIsHint(Instr* instr)
+{
+    return (instr->type == IT_HINT_CALL) || (instr->type == IT_HINT_RET);
+}
+
+// do first <c1>/<c2> instructions of <cbb1>/<cbb2> have the same hints?
+static
+bool ifHintsEqual(CBB* cbb1, int c1, CBB* cbb2, int c2)
+{
+    int i1 = 0, i2 = 0;
+
+    while(1) {
+        while((i1 < c1) && !ifIsHint(cbb1->instr + i1)) i1++;
+        while((i2 < c2) && !ifIsHint(cbb2->instr + i2)) i2++;
+        if ((i1 == c1) || (i2 == c2)) break;
+        if (cbb1->instr[i1].type != cbb2->instr[i2].type) return false;
+        i1++;
+        i2++;
+    }
+    return (i1 == c1) && (i2 == c2);
+}
+
+// collect register moves of the first <count> instructions of <cbb>
+// into <sel> as side <side>, return false if not convertible
+static
+bool ifCollect(IfSel* sel, int* selCount, CBB* cbb, int count, int side,
+               int max)
+{
+    int moves = 0;
+
+    for(int i = 0; i < count; i++) {
+        Instr* instr = cbb->instr + i;
+        RegIndex ri;
+        int j;
+
+        if (ifIsHint(instr)) continue;
+        if (instr->type != IT_MOV) return false;
+        if (++moves > max) return false;
+        // only allow flag-preserving 'mov r/m,imm32' as pass-through
+        if ((instr->ptLen > 0) &&
+            ((instr->ptEnc != OE_MI) || (instr->ptOpc[0] != 0xC7)))
+            return false;
+        if ((instr->dst.type != OT_Reg32) && (instr->dst.type != OT_Reg64))
+            return false;
+        if (!opIsImm(&(instr->src)) && (instr->src.type != instr->dst.type))
+            return false;
+        ri = gpIndex(instr->dst.reg);
+        if (ri == RI_None) return false;
+
+        for(j = 0; j < *selCount; j++)
+            if (sel[j].ri == ri) break;
+        if (j == *selCount) {
+            if (j == IF_SELMAX) return false;
+            sel[j].ri = ri;
+            sel[j].dst[0].type = OT_None;
+            sel[j].dst[1].type = OT_None;
+            (*selCount)++;
+        }
+        // register written twice on one side
+        if (sel[j].dst[side].type != OT_None) return false;
+        sel[j].dst[side] = instr->dst;
+        sel[j].src[side] = instr->src;
+    }
+    return true;
+}
+
+// immediate of side <side> as value of the 32/64-bit destination,
+// returns false if not encodable as sign-extended imm32
+static
+bool ifImm(IfSel* s, int side, int64_t* v)
+{
+    *v = immValue(&(s->src[side]));
+    if (s->dst[side].type == OT_Reg32) {
+        *v = (uint32_t) *v;
+        return true;
+    }
+    return fitsImm32(*v);
+}
+
+// can all selections be done with cmov/setcc?
+static
+bool ifCheck(IfSel* sel, int selCount)
+{
+    for(int i = 0; i < selCount; i++) {
+        IfSel* s = sel + i;
+        int64_t v0, v1;
+
+        // a source must not be changed by a selection
+        for(int side = 0; side < 2; side++) {
+            if (!opIsReg(&(s->src[side]))) continue;
+            for(int j = 0; j < selCount; j++)
+                if (gpIndex(s->src[side].reg) == sel[j].ri) return false;
+        }
+
+        if ((s->dst[0].type == OT_None) || (s->dst[1].type == OT_None)) {
+            // cmov with 32-bit operands clears upper half also if not moving
+            int side = (s->dst[0].type == OT_None) ? 1 : 0;
+            if (s->dst[side].type != OT_Reg64) return false;
+            if (!opIsReg(&(s->src[side]))) return false;
+            continue;
+        }
+        if (s->dst[0].type != s->dst[1].type) return false;
+        if (opIsReg(&(s->src[0])) || opIsReg(&(s->src[1]))) {
+            if (opIsImm(&(s->src[0])) && !ifImm(s, 0, &v0)) return false;
+            if (opIsImm(&(s->src[1])) && !ifImm(s, 1, &v1)) return false;
+            continue;
+        }
+        // two immediates: same value, or 0/1 via setcc
+        if (!ifImm(s, 0, &v0) || !ifImm(s, 1, &v1)) return false;
+        if ((v0 != v1) && ((v0 | v1) != 1)) return false;
+    }
+    return true;
+}
+
+// flag-preserving 'mov $v,dst' (generator uses 'xor' for 0)
+static
+void ifEmitMovImm(RContext* c, Operand* dst, int64_t v)
+{
+    Instr i;
+
+    initBinaryInstr(&i, IT_MOV, opValType(dst), dst,
+                    getImmOp(VT_32, (uint32_t) v));
+    attachPassthrough(&i, VEX_No, PS_No, OE_MI, SC_None, 0xC7, 0, -1);
+    emit(c, &i);
+}
+
+// emit selection <s>, with <cc> as condition for branch taken
+// (offset from IT_JO, negated by toggling lowest bit)
+static
+void ifEmitSel(RContext* c, IfSel* s, int cc)
+{
+    int64_t v0, v1;
+    Operand o;
+    Instr i;
+
+    if (s->dst[1].type == OT_None) {
+        emitBinary(c, IT_CMOVO + cc, VT_None, &(s->dst[0]), &(s->src[0]));
+        return;
+    }
+    if (s->dst[0].type == OT_None) {
+        emitBinary(c, IT_CMOVO + (cc ^ 1), VT_None,
+                   &(s->dst[1]), &(s->src[1]));
+        return;
+    }
+    if (opIsEqual(&(s->src[0]), &(s->src[1]))) {
+        if (opIsImm(&(s->src[0]))) {
+            ifImm(s, 0, &v0);
+            ifEmitMovImm(c, &(s->dst[0]), v0);
+        }
+        else
+            emitBinary(c, IT_MOV, VT_None, &(s->dst[0]), &(s->src[0]));
+        return;
+    }
+    if (opIsReg(&(s->src[0]))) {
+        // set to fall-through value, overwrite if branch taken
+        if (opIsImm(&(s->src[1]))) {
+            ifImm(s, 1, &v1);
+            ifEmitMovImm(c, &(s->dst[1]), v1);
+        }
+        else
+            emitBinary(c, IT_MOV, VT_None, &(s->dst[1]), &(s->src[1]));
+        emitBinary(c, IT_CMOVO + cc, VT_None, &(s->dst[0]), &(s->src[0]));
+        return;
+    }
+    if (opIsReg(&(s->src[1]))) {
+        ifImm(s, 0, &v0);
+        ifEmitMovImm(c, &(s->dst[0]), v0);
+        emitBinary(c, IT_CMOVO + (cc ^ 1), VT_None,
+                   &(s->dst[1]), &(s->src[1]));
+        return;
+    }
+    // values 0/1: clear, then set lowest byte by condition
+    ifImm(s, 0, &v0);
+    ifEmitMovImm(c, &(s->dst[0]), 0);
+    setRegOp(&o, getReg(RT_GP8, s->ri));
+    initUnaryInstr(&i, IT_SETO + ((v0 == 1) ? cc : (cc ^ 1)), &o);
+    emit(c, &i);
+}
+
+// count predecessors of CBBs reachable from the first one into <preds>
+static
+void ifCountPreds(Rewriter* r, int* preds, CBB** stack)
+{
+    int top = 0;
+
+    for(int i = 0; i < r->capBBCount; i++)
+        preds[i] = 0;
+    preds[0] = 1; // entry
+    stack[top++] = r->capBB;
+    while(top > 0) {
+        CBB* cbb = stack[--top];
+        CBB* next[2] = { 0, 0 };
+        CBB** succ = next;
+        int succCount = 2;
+
+        if (instrIsJcc(cbb->endType)) {
+            next[0] = cbb->nextBranch;
+            next[1] = cbb->nextFallThrough;
+        }
+        else if (cbb->endType == IT_JMP)
+            next[0] = cbb->nextBranch;
+        else if (cbb->endType == IT_JMPI) {
+            // jump table entries still point to CBBs
+            succ = (CBB**) cbb->jtTable;
+            succCount = cbb->jtCount;
+        }
+
+        for(int j = 0; j < succCount; j++) {
+            if (!succ[j]) continue;
+            // push when reached first time
+            if (preds[succ[j] - r->capBB]++ == 0)
+                stack[top++] = succ[j];
+        }
+    }
+}
+
+// try to merge successors of <a> into <a>, return true if done
+static
+bool ifConvert(RContext* c, CBB* a, int* preds)
+{
+    Rewriter* r = c->r;
+    CBB* t = a->nextBranch;
+    CBB* f = a->nextFallThrough;
+    IfSel sel[IF_SELMAX];
+    int selCount = 0, tail, start;
+
+    if (!instrIsJcc(a->endType) || (preds[a - r->capBB] == 0)) return false;
+    if ((t == f) || (t == a) || (f == a)) return false;
+    if ((preds[t - r->capBB] != 1) || (preds[f - r->capBB] != 1)) return false;
+    if ((t->endType == IT_JMPI) || (t->endType != f->endType) ||
+        (t->nextBranch != f->nextBranch) ||
+        (t->nextFallThrough != f->nextFallThrough))
+        return false;
+
+    for(tail = 0; (tail < t->count) && (tail < f->count); tail++)
+        if (!ifInstrEqual(t->instr + t->count - 1 - tail,
+                          f->instr + f->count - 1 - tail)) break;
+    if (!ifHintsEqual(t, t->count - tail, f, f->count - tail)) return false;
+    if (!ifCollect(sel, &selCount, t, t->count - tail, 0, r->ifConvMax) ||
+        !ifCollect(sel, &selCount, f, f->count - tail, 1, r->ifConvMax) ||
+        !ifCheck(sel, selCount))
+        return false;
+
+    if (r->showOptSteps)
+        printf("Run if-conversion for CBB (%s): %d selects\n",
+               cbb_prettyName(a), selCount);
+
+    start = r->capInstrCount;
+    for(int i = 0; i < a->count; i++)
+        emit(c, a->instr + i);
+    for(int i = 0; i < t->count - tail; i++)
+        if (ifIsHint(t->instr + i)) emit(c, t->instr + i);
+    for(int i = 0; i < selCount; i++)
+        ifEmitSel(c, sel + i, a->endType - IT_JO);
+    for(int i = t->count - tail; i < t->count; i++)
+        emit(c, t->instr + i);
+    if (c->e) return false;
+
+    a->instr = r->capInstr + start;
+    a->count = r->capInstrCount - start;
+    a->endType = t->endType;
+    a->nextBranch = t->nextBranch;
+    a->nextFallThrough = t->nextFallThrough;
+    a->preferBranch = t->preferBranch;
+    return true;
+}
+
+void optIfConversion(RContext* c)
+{
+    Rewriter* r = c->r;
+    int* preds;
+    CBB** stack;
+
+    if ((r->ifConvMax < 0) || (r->capBBCount < 3)) return;
+
+    preds = (int*) arenaAlloc(r, &(r->tempArena), sizeof(int) * r->capBBCount);
+    stack = (CBB**) arenaAlloc(r, &(r->tempArena),
+                               sizeof(CBB*) * r->capBBCount);
+    ifCountPreds(r, preds, stack);
+    for(int i = 0; i < r->capBBCount; i++) {
+        if (!ifConvert(c, r->capBB + i, preds)) {
+            if (c->e) break;
+            continue;
+        }
+        // merged CBB may be head of another diamond
+        ifCountPreds(r, preds, stack);
+        i--;
+    }
+}
+
+
+//----------------------------------------------------------
+// VEX transcoding of legacy SSE instructions
+//
+
+// how to re-encode an SSE instruction with VEX prefix
+typedef enum _VexKind {
+    VK_None,  // keep legacy encoding
+    VK_Plain, // same operands and encoding, only using VEX prefix
+    VK_Merge, // destructive 2-operand form into RVM with vvvv = destination
+} VexKind;
+
+// VEX variant <it> of legacy SSE instruction <i>
+static
+VexKind vexKind(Instr* i, InstrType* it)
+{
+    bool regs = opIsVReg(&(i->dst)) && opIsVReg(&(i->src));
+
+    switch(i->type) {
+    case IT_MOVUPS:  *it = IT_VMOVUPS; return VK_Plain;
+    case IT_MOVUPD:  *it = IT_VMOVUPD; return VK_Plain;
+    case IT_MOVAPS:  *it = IT_VMOVAPS; return VK_Plain;
+    case IT_MOVAPD:  *it = IT_VMOVAPD; return VK_Plain;
+    case IT_MOVDQU:  *it = IT_VMOVDQU; return VK_Plain;
+    case IT_MOVDQA:  *it = IT_VMOVDQA; return VK_Plain;
+    case IT_SQRTPS:  *it = IT_VSQRTPS; return VK_Plain;
+    case IT_SQRTPD:  *it = IT_VSQRTPD; return VK_Plain;
+    case IT_UCOMISS: *it = IT_VUCOMISS; return VK_Plain;
+    case IT_UCOMISD: *it = IT_VUCOMISD; return VK_Plain;
+    // with VEX, generator uses destination as vvvv for RMI
+    case IT_CMPSS:   *it = IT_VCMPSS; return VK_Plain;
+    case IT_CMPSD:   *it = IT_VCMPSD; return VK_Plain;
+    case IT_CMPPS:   *it = IT_VCMPPS; return VK_Plain;
+    case IT_CMPPD:   *it = IT_VCMPPD; return VK_Plain;
+
+    // scalar moves between registers keep upper part of destination
+    case IT_MOVSS:   *it = IT_VMOVSS; return regs ? VK_Merge : VK_Plain;
+    case IT_MOVSD:   *it = IT_VMOVSD; return regs ? VK_Merge : VK_Plain;
+
+    case IT_ADDSS:   *it = IT_VADDSS; return VK_Merge;
+    case IT_ADDSD:   *it = IT_VADDSD; return VK_Merge;
+    case IT_ADDPS:   *it = IT_VADDPS; return VK_Merge;
+    case IT_ADDPD:   *it = IT_VADDPD; return VK_Merge;
+    case IT_SUBSS:   *it = IT_VSUBSS; return VK_Merge;
+    case IT_SUBSD:   *it = IT_VSUBSD; return VK_Merge;
+    case IT_SUBPS:   *it = IT_VSUBPS; return VK_Merge;
+    case IT_SUBPD:   *it = IT_VSUBPD; return VK_Merge;
+    case IT_MULSS:   *it = IT_VMULSS; return VK_Merge;
+    case IT_MULSD:   *it = IT_VMULSD; return VK_Merge;
+    case IT_MULPS:   *it = IT_VMULPS; return VK_Merge;
+    case IT_MULPD:   *it = IT_VMULPD; return VK_Merge;
+    case IT_DIVSS:   *it = IT_VDIVSS; return VK_Merge;
+    case IT_DIVSD:   *it = IT_VDIVSD; return VK_Merge;
+    case IT_DIVPS:   *it = IT_VDIVPS; return VK_Merge;
+    case IT_DIVPD:   *it = IT_VDIVPD; return VK_Merge;
+    case IT_MINSS:   *it = IT_VMINSS; return VK_Merge;
+    case IT_MINSD:   *it = IT_VMINSD; return VK_Merge;
+    case IT_MINPS:   *it = IT_VMINPS; return VK_Merge;
+    case IT_MINPD:   *it = IT_VMINPD; return VK_Merge;
+    case IT_MAXSS:   *it = IT_VMAXSS; return VK_Merge;
+    case IT_MAXSD:   *it = IT_VMAXSD; return VK_Merge;
+    case IT_MAXPS:   *it = IT_VMAXPS; return VK_Merge;
+    case IT_MAXPD:   *it = IT_VMAXPD; return VK_Merge;
+    case IT_SQRTSS:  *it = IT_VSQRTSS; return VK_Merge;
+    case IT_SQRTSD:  *it = IT_VSQRTSD; return VK_Merge;
+    case IT_ANDPS:   *it = IT_VANDPS; return VK_Merge;
+    case IT_ANDPD:   *it = IT_VANDPD; return VK_Merge;
+    case IT_ANDNPS:  *it = IT_VANDNPS; return VK_Merge;
+    case IT_ANDNPD:  *it = IT_VANDNPD; return VK_Merge;
+    case IT_ORPS:    *it = IT_VORPS; return VK_Merge;
+    case IT_ORPD:    *it = IT_VORPD; return VK_Merge;
+    case IT_XORPS:   *it = IT_VXORPS; return VK_Merge;
+    case IT_XORPD:   *it = IT_VXORPD; return VK_Merge;
+    default: break;
+    }
+    return VK_None;
+}
+
+// re-encode legacy SSE instruction <i> with VEX prefix into <n>.
+// Returns false if <i> is kept as is
+static
+bool vexTranscode(Instr* i, Instr* n)
+{
+    InstrType it;
+    VexKind k;
+
+    if (i->ptLen == 0) {
+        // captured without pass-through info (no emulation of these)
+        PrefixSet ps;
+        switch(i->type) {
+        case IT_ADDSS: ps = PS_F3; break;
+        case IT_ADDSD: ps = PS_F2; break;
+        case IT_ADDPS: ps = PS_No; break;
+        case IT_ADDPD: ps = PS_66; break;
+        default: return false;
+        }
+        copyInstr(n, i);
+        attachPassthrough(n, VEX_No, ps, OE_RM, SC_None, 0x0F, 0x58, -1);
+        i = n;
+    }
+    if ((i->ptLen != 2) || (i->ptOpc[0] != 0x0F) || (i->ptVexP != VEX_No))
+        return false;
+    k = vexKind(i, &it);
+    if (k == VK_None) return false;
+    if (i != n) copyInstr(n, i);
+
+    n->type = it;
+    n->ptVexP = VEX_128;
+    if (k == VK_Merge) {
+        // ternary form with first source being the destination.
+        // A register-register MR move (store form 0x11) uses load opcode
+        if (n->ptEnc == OE_MR) n->ptOpc[1] = 0x10;
+        copyOperand(&(n->src2), &(i->src));
+        copyOperand(&(n->src), &(i->dst));
+        n->form = OF_3;
+        n->ptEnc = OE_RVM;
+    }
+    return true;
+}
+
+// is <i> a full copy of a 128-bit vector register (VEX encoded)?
+static
+bool isVexRegCopy(Instr* i)
+{
+    switch(i->type) {
+    case IT_VMOVAPS: case IT_VMOVAPD: case IT_VMOVUPS: case IT_VMOVUPD:
+        break;
+    default:
+        return false;
+    }
+    return (i->ptLen > 0) && (i->ptVexP == VEX_128) &&
+            (i->dst.type == OT_Reg128) && (i->src.type == OT_Reg128);
+}
+
+// is <i> an FMA instruction (destination also is input)?
+static
+bool isFma(Instr* i)
+{
+    return (i->type >= IT_VFMADD132SS) && (i->type <= IT_VFMSUB213SD);
+}
+
+// re-encode legacy SSE instructions with VEX prefix to avoid penalties for
+// transitions between SSE and AVX code. Copies into the destination of a
+// following destructive operation are merged using the 3-operand form
+void optVexTranscoding(RContext* c, CBB* cbb)
+{
+    Rewriter* r = c->r;
+    Instr *n, *prev = 0;
+    int i, start;
+
+    for(i = 0; i < cbb->count; i++) {
+        Instr tmp;
+        if (vexTranscode(cbb->instr + i, &tmp)) break;
+    }
+    if (i == cbb->count) return;
+
+    if (r->showOptSteps)
+        printf("Run VEX transcoding for CBB (%s)\n", cbb_prettyName(cbb));
+
+    start = r->capInstrCount;
+    for(i = 0; i < cbb->count; i++) {
+        n = newCapInstr(c);
+        if (!n) return;
+        if (!vexTranscode(cbb->instr + i, n))
+            copyInstr(n, cbb->instr + i);
+
+        // mov T,S; op T,T,X => op T,S,X (if X is not T and op does
+        // not read T as third input, as FMA does)
+        if (prev && isVexRegCopy(prev) && (n->ptEnc == OE_RVM) &&
+            (n->ptVexP == VEX_128) && !isFma(n) &&
+            opIsEqual(&(n->dst), &(prev->dst)) &&
+            opIsEqual(&(n->src), &(prev->dst)) &&
+            !opIsEqual(&(n->src2), &(prev->dst))) {
+            if (r->showOptSteps)
+                printf("  merging copy %s\n", instr2string(prev, 0, cbb->fc));
+            copyOperand(&(n->src), &(prev->src));
+            copyInstr(prev, n);
+            r->capInstrCount--;
+            n = prev;
+        }
+        prev = n;
+    }
+    cbb->instr = r->capInstr + start;
+    cbb->count = r->capInstrCount - start;
+}
+
+
+//----------------------------------------------------------
+// vzeroupper insertion
+//
+
+// may instruction <i> make upper parts of vector registers dirty?
+static
+bool usesUpperVector(Instr* i)
+{
+    return (i->ptLen > 0) &&
+            ((i->ptVexP == VEX_256) || (i->ptVexP == VEX_512));
+}
+
+// vector registers possibly holding 256/512-bit values are tracked in a bit
+// mask (bit n: ymm<n>/zmm<n>). Update mask <m> for effect of <i>
+static
+uint32_t upperVectorWrites(Instr* i, uint32_t m)
+{
+    uint32_t bit;
+
+    switch(i->type) {
+    case IT_VZEROUPPER:
+        return 0;
+    case IT_CALL:
+        // callee may return __m256/__m512 in ymm0/zmm0
+        return 1;
+    default:
+        break;
+    }
+    // legacy SSE writes keep upper parts as they are
+    if ((i->ptLen == 0) || (i->ptVexP == VEX_No) || !opIsVReg(&(i->dst)))
+        return m;
+    bit = 1u << regVIndex(i->dst.reg);
+    if ((i->dst.type == OT_Reg256) || (i->dst.type == OT_Reg512))
+        return m | bit;
+    return m & ~bit;
+}
+
+// needs vzeroupper to be inserted before instruction <i> of <cbb>, with
+// <m> the registers possibly holding 256/512-bit values? Not if these are
+// passed to a call (ymm0-7) or returned (ymm0)
+static
+bool needsVZeroUpper(CBB* cbb, int i, uint32_t m)
+{
+    InstrType it = cbb->instr[i].type;
+
+    if (it == IT_RET) {
+        if (m & 1) return false;
+    }
+    else if (it == IT_CALL) {
+        if (m & 0xFF) return false;
+    }
+    else
+        return false;
+    return (i == 0) || (cbb->instr[i-1].type != IT_VZEROUPPER);
+}
+
+// merge mask <m> into start mask of <cbb>, returns true if changed
+static
+bool mergeUpperStart(Rewriter* r, uint32_t* start, CBB* cbb, uint32_t m)
+{
+    int b;
+
+    if (!cbb) return false;
+    b = cbb - r->capBB;
+    assert((b >= 0) && (b < r->capBBCount));
+    if ((start[b] | m) == start[b]) return false;
+    start[b] |= m;
+    return true;
+}
+
+// if generated code uses 256/512-bit registers, clear upper parts of
+// vector registers before leaving to (or calling) code which may use
+// legacy SSE instructions. Register contents reaching a return or call
+// as 256/512-bit values may be results/arguments and are kept
+void optVZeroUpper(RContext* c)
+{
+    Rewriter* r = c->r;
+    bool used = false, changed;
+    uint32_t* start;
+
+    // vectorized kernels return expanded values in full registers
+    if (r->vreq != VR_None) return;
+
+    for(int b = 0; (b < r->capBBCount) && !used; b++) {
+        CBB* cbb = r->capBB + b;
+        for(int i = 0; i < cbb->count; i++)
+            if (usesUpperVector(cbb->instr + i)) used = true;
+    }
+    if (!used) return;
+
+    // registers possibly holding 256/512-bit values at start of each CBB.
+    // On entry, arguments ymm0-7 may be 256-bit values
+    start = (uint32_t*) memAlloc(r, sizeof(uint32_t) * r->capBBCount);
+    for(int b = 0; b < r->capBBCount; b++)
+        start[b] = 0;
+    start[0] = 0xFF;
+    do {
+        changed = false;
+        for(int b = 0; b < r->capBBCount; b++) {
+            CBB* cbb = r->capBB + b;
+            uint32_t m = start[b];
+
+            for(int i = 0; i < cbb->count; i++)
+                m = upperVectorWrites(cbb->instr + i, m);
+            changed |= mergeUpperStart(r, start, cbb->nextBranch, m);
+            changed |= mergeUpperStart(r, start, cbb->nextFallThrough, m);
+            for(int j = 0; j < cbb->jtCount; j++)
+                changed |= mergeUpperStart(r, start,
+                                           (CBB*) cbb->jtTable[j], m);
+        }
+    } while(changed);
+
+    for(int b = 0; b < r->capBBCount; b++) {
+        CBB* cbb = r->capBB + b;
+        uint32_t m = start[b];
+        int i, first;
+
+        for(i = 0; i < cbb->count; i++) {
+            if (needsVZeroUpper(cbb, i, m)) break;
+            m = upperVectorWrites(cbb->instr + i, m);
+        }
+        if (i == cbb->count) continue;
+
+        if (r->showOptSteps)
+            printf("Insert vzeroupper into CBB (%s)\n", cbb_prettyName(cbb));
+
+        m = start[b];
+        first = r->capInstrCount;
+        for(i = 0; i < cbb->count; i++) {
+            if (needsVZeroUpper(cbb, i, m)) {
+                Instr vz;
+                initSimpleInstr(&vz, IT_VZEROUPPER);
+                attachPassthrough(&vz, VEX_128, PS_No, OE_None, SC_None,
+                                  0x0F, 0x77, -1);
+                emit(c, &vz);
+            }
+            m = upperVectorWrites(cbb->instr + i, m);
+            emit(c, cbb->instr + i);
+            if (c->e) break;
+        }
+        if (c->e) break;
+        cbb->instr = r->capInstr + first;
+        cbb->count = r->capInstrCount - first;
+    }
+    memFree(r, start);
+}
+
+
+//----------------------------------------------------------
+// FMA fusion
+//
+
+// kind of legacy scalar SSE arithmetic <i> with vector register destination
+typedef enum _FpOp { FO_None, FO_Mul, FO_Add, FO_Sub } FpOp;
+
+static
+FpOp scalarFpOp(Instr* i, bool* dbl)
+{
+    FpOp op;
+
+    switch(i->type) {
+    case IT_MULSS: op = FO_Mul; *dbl = false; break;
+    case IT_MULSD: op = FO_Mul; *dbl = true;  break;
+    case IT_ADDSS: op = FO_Add; *dbl = false; break;
+    case IT_ADDSD: op = FO_Add; *dbl = true;  break;
+    case IT_SUBSS: op = FO_Sub; *dbl = false; break;
+    case IT_SUBSD: op = FO_Sub; *dbl = true;  break;
+    default: return FO_None;
+    }
+    // adds may be captured without pass-through info
+    if ((i->ptLen > 0) && (i->ptVexP != VEX_No)) return FO_None;
+    if ((i->form != OF_2) || !opIsVReg(&(i->dst))) return FO_None;
+    return op;
+}
+
+// fuse 'mul B,T; add/sub C,T' into FMA instruction <n>.
+// Returns false if not possible
+static
+bool fmaFuse(Instr* mul, Instr* op, Instr* n)
+{
+    Operand *t = &(mul->dst), *b = &(mul->src), *c = &(op->src);
+    bool d1, d2;
+    FpOp k;
+    int opc;
+
+    if (scalarFpOp(mul, &d1) != FO_Mul) return false;
+    k = scalarFpOp(op, &d2);
+    if ((k != FO_Add) && (k != FO_Sub)) return false;
+    if ((d1 != d2) || !opIsEqual(&(op->dst), t) || opIsEqual(c, t))
+        return false;
+
+    if (opIsVReg(b)) {
+        // vfmadd213: T = B * T + C
+        if (k == FO_Add)
+            initTernaryInstr(n, d1 ? IT_VFMADD213SD : IT_VFMADD213SS, t, b, c);
+        else
+            initTernaryInstr(n, d1 ? IT_VFMSUB213SD : IT_VFMSUB213SS, t, b, c);
+        opc = (k == FO_Add) ? 0xA9 : 0xAB;
+    }
+    else if (opIsVReg(c)) {
+        // vfmadd132: T = T * B + C, with C in vvvv
+        if (k == FO_Add)
+            initTernaryInstr(n, d1 ? IT_VFMADD132SD : IT_VFMADD132SS, t, c, b);
+        else
+            initTernaryInstr(n, d1 ? IT_VFMSUB132SD : IT_VFMSUB132SS, t, c, b);
+        opc = (k == FO_Add) ? 0x99 : 0x9B;
+    }
+    else
+        return false;
+
+    // precision given by VEX.W
+    n->vtype = VT_Implicit;
+    attachPassthrough(n, VEX_128, d1 ? (PS_66 | PS_REXW) : PS_66,
+                      OE_RVM, SC_None, 0x0F, 0x38, opc);
+    return true;
+}
+
+// fuse scalar multiplications with directly following addition or
+// subtraction of the product into FMA instructions (skips rounding step)
+void optFmaFusion(RContext* c, CBB* cbb)
+{
+    Rewriter* r = c->r;
+    Instr tmp, *n;
+    int i, start;
+
+    for(i = 0; i + 1 < cbb->count; i++)
+        if (fmaFuse(cbb->instr + i, cbb->instr + i + 1, &tmp)) break;
+    if (i + 1 >= cbb->count) return;
+
+    if (r->showOptSteps)
+        printf("Run FMA fusion for CBB (%s)\n", cbb_prettyName(cbb));
+
+    start = r->capInstrCount;
+    for(i = 0; i < cbb->count; i++) {
+        n = newCapInstr(c);
+        if (!n) return;
+        if ((i + 1 < cbb->count) &&
+            fmaFuse(cbb->instr + i, cbb->instr + i + 1, n)) {
+            if (r->showOptSteps)
+                printf("  fusing %s\n", instr2string(cbb->instr + i, 0, cbb->fc));
+            i++;
+            continue;
+        }
+        copyInstr(n, cbb->instr + i);
+    }
+    cbb->instr = r->capInstr + start;
+    cbb->count = r->capInstrCount - start;
+}
+
+
+//----------------------------------------------------------
+// BMI1/BMI2 instruction selection
+//
+
+// is <o> a 32/64-bit GP register?
+static
+bool isGPReg3264(Operand* o)
+{
+    return (o->type == OT_Reg32) || (o->type == OT_Reg64);
+}
+
+// fuse instructions starting at <i> of <cbb> into a BMI instruction <n>:
+// - 'not R; and S,R' => 'andn S,R,R' (BMI1)
+// - 'shl/shr/sar %cl,R' => 'shlx/shrx/sarx %rcx,R,R' (BMI2)
+// Both forms may take over a preceding register copy 'mov A,R' as source.
+// BMI instructions set flags differently or not at all, thus flags must
+// be dead afterwards. Returns number of instructions replaced, 0 if none
+static
+int bmiFuse(Rewriter* r, CBB* cbb, int i, Instr* n)
+{
+    Instr *in = cbb->instr + i, *mov = 0;
+    Operand *dst, *x, cnt;
+    int len = 1;
+
+    if ((in->type == IT_MOV) && (i + 1 < cbb->count) &&
+        isGPReg3264(&(in->dst)) && (in->src.type == in->dst.type)) {
+        mov = in;
+        in++;
+        len++;
+    }
+    dst = &(in->dst);
+    if (!isGPReg3264(dst) || (mov && !opIsEqual(&(mov->dst), dst)))
+        return 0;
+    x = mov ? &(mov->src) : dst;
+
+    if ((in->type == IT_NOT) && (r->cpuFeatures & CF_BMI1) &&
+        (i + len < cbb->count)) {
+        Instr* and = in + 1;
+        Operand* s = &(and->src);
+
+        // S must be read before writing to R
+        if ((and->type != IT_AND) || !opIsEqual(&(and->dst), dst) ||
+            (s->type == OT_Imm8) || (s->type == OT_Imm32) ||
+            opUsesReg(s, dst->reg.ri) || !flagsDeadAfter(cbb, i + len))
+            return 0;
+        initTernaryInstr(n, IT_ANDN, dst, x, s);
+        n->vtype = and->vtype;
+        attachPassthrough(n, VEX_128, PS_No, OE_RVM, SC_None,
+                          0x0F, 0x38, 0xF2);
+        return len + 1;
+    }
+
+    if (((in->type == IT_SHL) || (in->type == IT_SHR) ||
+         (in->type == IT_SAR)) && (r->cpuFeatures & CF_BMI2)) {
+        InstrType it;
+        PrefixSet ps;
+
+        if ((in->src.type != OT_Reg8) || (in->src.reg.ri != RI_C) ||
+            !flagsDeadAfter(cbb, i + len - 1))
+            return 0;
+        // a copy into rcx changes the shift count
+        if (mov && (dst->reg.ri == RI_C)) return 0;
+        switch(in->type) {
+        case IT_SHL: it = IT_SHLX; ps = PS_66; break;
+        case IT_SHR: it = IT_SHRX; ps = PS_F2; break;
+        default:     it = IT_SARX; ps = PS_F3; break;
+        }
+        setRegOp(&cnt, getReg((dst->type == OT_Reg32) ? RT_GP32 : RT_GP64,
+                              RI_C));
+        initTernaryInstr(n, it, dst, x, &cnt);
+        n->vtype = in->vtype;
+        attachPassthrough(n, VEX_128, ps, OE_RMV, SC_None,
+                          0x0F, 0x38, 0xF7);
+        return len;
+    }
+    return 0;
+}
+
+// use non-destructive BMI instructions without flag dependencies for
+// bit operations and variable shifts
+void optBmi(RContext* c, CBB* cbb)
+{
+    Rewriter* r = c->r;
+    Instr tmp, *n;
+    int i, start, len;
+
+    for(i = 0; i < cbb->count; i++)
+        if (bmiFuse(r, cbb, i, &tmp) > 0) break;
+    if (i == cbb->count) return;
+
+    if (r->showOptSteps)
+        printf("Run BMI selection for CBB (%s)\n", cbb_prettyName(cbb));
+
+    start = r->capInstrCount;
+    for(i = 0; i < cbb->count; i++) {
+        n = newCapInstr(c);
+        if (!n) return;
+        len = bmiFuse(r, cbb, i, n);
+        if (len > 0) {
+            if (r->showOptSteps)
+                printf("  replacing %d instructions by %s\n",
+                       len, instr2string(n, 0, cbb->fc));
+            i += len - 1;
+            continue;
+        }
+        copyInstr(n, cbb->instr + i);
+    }
+    cbb->instr = r->capInstr + start;
+    cbb->count = r->capInstrCount - start;
+}
@@ -0,0 +1,168 @@
+/**
+ * This file is part of DBrew, the dynamic binary rewriting library.
+ *
+ * (c) 2016, Josef Weidendorfer <josef.weidendorfer@gmx.de>
+ *
+ * DBrew is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License (LGPL)
+ * as published by the Free Software Foundation, either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * DBrew is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with DBrew.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "perfmap.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+/*
+ * Make generated code known to the Linux "perf" profiler
+ *
+ * - perf map: text lines "<start> <size> <name>" appended to
+ *   /tmp/perf-<pid>.map, read by "perf report" for anonymous memory
+ * - jitdump: binary records including the code bytes, written to
+ *   /tmp/jit-<pid>.dump. Use "perf record -k mono" and "perf inject --jit"
+ *
+ * Both files are shared by all rewriters of the process. Each generated
+ * function gets a unique specialization ID.
+ */
+
+#define JITDUMP_MAGIC   0x4A695444
+#define JITDUMP_VERSION 1
+#define JIT_CODE_LOAD   0
+#define ELF_MACH_X86_64 62
+
+typedef struct _JitHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t totalSize;
+    uint32_t elfMach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} JitHeader;
+
+typedef struct _JitCodeLoad {
+    uint32_t id;
+    uint32_t totalSize;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t codeAddr;
+    uint64_t codeSize;
+    uint64_t codeIndex;
+    // followed by 0-terminated name and code bytes
+} JitCodeLoad;
+
+static pthread_mutex_t perfLock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* perfMapFile = 0;
+static FILE* jitdumpFile = 0;
+static uint64_t specID = 0;
+
+static
+FILE* openPerfMap(void)
+{
+    char fname[64];
+
+    if (perfMapFile) return perfMapFile;
+
+    sprintf(fname, "/tmp/perf-%d.map", getpid());
+    perfMapFile = fopen(fname, "a");
+    return perfMapFile;
+}
+
+static
+FILE* openJitdump(void)
+{
+    char fname[64];
+    JitHeader h;
+    void* marker;
+
+    if (jitdumpFile) return jitdumpFile;
+
+    sprintf(fname, "/tmp/jit-%d.dump", getpid());
+    jitdumpFile = fopen(fname, "w+");
+    if (!jitdumpFile) return 0;
+
+    // perf detects a jitdump file by an executable mapping of it
+    marker = mmap(0, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC,
+                  MAP_PRIVATE, fileno(jitdumpFile), 0);
+    if (marker == MAP_FAILED) {
+        fclose(jitdumpFile);
+        jitdumpFile = 0;
+        return 0;
+    }
+
+    memset(&h, 0, sizeof(JitHeader));
+    h.magic = JITDUMP_MAGIC;
+    h.version = JITDUMP_VERSION;
+    h.totalSize = sizeof(JitHeader);
+    h.elfMach = ELF_MACH_X86_64;
+    h.pid = getpid();
+    h.timestamp = timeNs();
+    fwrite(&h, sizeof(JitHeader), 1, jitdumpFile);
+    fflush(jitdumpFile);
+
+    return jitdumpFile;
+}
+
+void perfRegisterCode(Rewriter* r, uint64_t addr, int size)
+{
+    FunctionConfig* fc;
+    char name[128];
+    uint64_t id;
+    FILE* f;
+
+    if (!r->perfMap && !r->perfJitdump) return;
+    if (size <= 0) return;
+
+    pthread_mutex_lock(&perfLock);
+
+    id = specID++;
+    fc = config_find_function(r, r->func);
+    if (fc && fc->name && (fc->start == r->func))
+        snprintf(name, sizeof(name), "dbrew:%s#%lu", fc->name, id);
+    else
+        snprintf(name, sizeof(name), "dbrew:0x%lx#%lu", r->func, id);
+
+    if (r->perfMap && ((f = openPerfMap()) != 0)) {
+        fprintf(f, "%lx %x %s\n", addr, size, name);
+        fflush(f);
+    }
+
+    if (r->perfJitdump && ((f = openJitdump()) != 0)) {
+        JitCodeLoad rec;
+        int nameLen = strlen(name) + 1;
+
+        rec.id = JIT_CODE_LOAD;
+        rec.totalSize = sizeof(JitCodeLoad) + nameLen + size;
+        rec.timestamp = timeNs();
+        rec.pid = getpid();
+        rec.tid = syscall(SYS_gettid);
+        rec.vma = addr;
+        rec.codeAddr = addr;
+        rec.codeSize = size;
+        rec.codeIndex = id;
+        fwrite(&rec, sizeof(JitCodeLoad), 1, f);
+        fwrite(name, nameLen, 1, f);
+        fwrite((void*) addr, size, 1, f);
+        fflush(f);
+    }
+
+    pthread_mutex_unlock(&perfLock);
+}
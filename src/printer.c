@@ -38,6 +38,7 @@ bool opTypeVisible(Operand* o)
     case OT_Reg64:
     case OT_Reg128:
     case OT_Reg256:
+    case OT_Reg512:
         return true;
     default: break;
     }
@@ -272,7 +273,7 @@ const char* regName(Reg r)
 
 char* prettyAddress(uint64_t a, FunctionConfig* fc)
 {
-    static char buf[100];
+    static __thread char buf[100];
 
     if (fc) {
         // use name from registered, labeled memory ranges
@@ -301,7 +302,7 @@ char* prettyAddress(uint64_t a, FunctionConfig* fc)
 // if <fc> is not-null, use it to print immediates/displacement
 char* op2string(Operand* o, Instr* instr, FunctionConfig* fc)
 {
-    static char buf[30];
+    static __thread char buf[30];
     int off = 0;
     ValType t = instr->vtype;
     uint64_t val;
@@ -323,6 +324,7 @@ char* op2string(Operand* o, Instr* instr, FunctionConfig* fc)
         switch(t) {
         case VT_None:
         case VT_8:
+        case VT_Implicit:
             break;
         case VT_16:
         case VT_32:
@@ -501,6 +503,10 @@ const char* instrName(InstrType it, int* pOpCount)
     case IT_SHL:     n = "shl";     opCount = 2; break;
     case IT_SHR:     n = "shr";     opCount = 2; break;
     case IT_SAR:     n = "sar";     opCount = 2; break;
+    case IT_ANDN:    n = "andn";    opCount = 3; break;
+    case IT_SHLX:    n = "shlx";    opCount = 3; break;
+    case IT_SHRX:    n = "shrx";    opCount = 3; break;
+    case IT_SARX:    n = "sarx";    opCount = 3; break;
     case IT_LEA:     n = "lea";     opCount = 2; break;
     case IT_CMP:     n = "cmp";     opCount = 2; break;
     case IT_TEST:    n = "test";    opCount = 2; break;
@@ -570,6 +576,10 @@ const char* instrName(InstrType it, int* pOpCount)
     case IT_COMISD:  n = "comisd";  opCount = 2; break;
     case IT_UCOMISS: n = "ucomiss"; opCount = 2; break;
     case IT_UCOMISD: n = "ucomisd"; opCount = 2; break;
+    case IT_CMPSS:   n = "cmpss";   opCount = 3; break;
+    case IT_CMPSD:   n = "cmpsd";   opCount = 3; break;
+    case IT_CMPPS:   n = "cmpps";   opCount = 3; break;
+    case IT_CMPPD:   n = "cmppd";   opCount = 3; break;
     case IT_PCMPEQB: n = "pcmpeqb"; opCount = 2; break;
     case IT_PCMPEQW: n = "pcmpeqw"; opCount = 2; break;
     case IT_PCMPEQD: n = "pcmpeqd"; opCount = 2; break;
@@ -615,6 +625,49 @@ const char* instrName(InstrType it, int* pOpCount)
     case IT_VMULPD:  n = "vmulpd";  opCount = 3; break;
     case IT_VXORPS:  n = "vxorps";  opCount = 3; break;
     case IT_VXORPD:  n = "vxorpd";  opCount = 3; break;
+    case IT_VSUBPD:  n = "vsubpd";  opCount = 3; break;
+    case IT_VDIVPD:  n = "vdivpd";  opCount = 3; break;
+    case IT_VMINPD:  n = "vminpd";  opCount = 3; break;
+    case IT_VMAXPD:  n = "vmaxpd";  opCount = 3; break;
+    case IT_VSQRTPD: n = "vsqrtpd"; opCount = 2; break;
+    case IT_VANDPD:  n = "vandpd";  opCount = 3; break;
+    case IT_VANDNPD: n = "vandnpd"; opCount = 3; break;
+    case IT_VORPD:   n = "vorpd";   opCount = 3; break;
+    case IT_VCMPPD:  n = "vcmppd";  opCount = 3; break;
+    case IT_VSUBPS:  n = "vsubps";  opCount = 3; break;
+    case IT_VDIVPS:  n = "vdivps";  opCount = 3; break;
+    case IT_VMINPS:  n = "vminps";  opCount = 3; break;
+    case IT_VMAXPS:  n = "vmaxps";  opCount = 3; break;
+    case IT_VSQRTPS: n = "vsqrtps"; opCount = 2; break;
+    case IT_VANDPS:  n = "vandps";  opCount = 3; break;
+    case IT_VANDNPS: n = "vandnps"; opCount = 3; break;
+    case IT_VORPS:   n = "vorps";   opCount = 3; break;
+    case IT_VCMPPS:  n = "vcmpps";  opCount = 3; break;
+    case IT_VSUBSS:  n = "vsubss";  opCount = 3; break;
+    case IT_VSUBSD:  n = "vsubsd";  opCount = 3; break;
+    case IT_VDIVSS:  n = "vdivss";  opCount = 3; break;
+    case IT_VDIVSD:  n = "vdivsd";  opCount = 3; break;
+    case IT_VMINSS:  n = "vminss";  opCount = 3; break;
+    case IT_VMINSD:  n = "vminsd";  opCount = 3; break;
+    case IT_VMAXSS:  n = "vmaxss";  opCount = 3; break;
+    case IT_VMAXSD:  n = "vmaxsd";  opCount = 3; break;
+    case IT_VSQRTSS: n = "vsqrtss"; opCount = 3; break;
+    case IT_VSQRTSD: n = "vsqrtsd"; opCount = 3; break;
+    case IT_VCMPSS:  n = "vcmpss";  opCount = 3; break;
+    case IT_VCMPSD:  n = "vcmpsd";  opCount = 3; break;
+    case IT_VUCOMISS:n = "vucomiss";opCount = 2; break;
+    case IT_VUCOMISD:n = "vucomisd";opCount = 2; break;
+    case IT_VMOVDDUP: n = "vmovddup"; opCount = 2; break;
+    case IT_VBROADCASTSS: n = "vbroadcastss"; opCount = 2; break;
+    case IT_VBROADCASTSD: n = "vbroadcastsd"; opCount = 2; break;
+    case IT_VFMADD132SS: n = "vfmadd132ss"; opCount = 3; break;
+    case IT_VFMADD132SD: n = "vfmadd132sd"; opCount = 3; break;
+    case IT_VFMADD213SS: n = "vfmadd213ss"; opCount = 3; break;
+    case IT_VFMADD213SD: n = "vfmadd213sd"; opCount = 3; break;
+    case IT_VFMSUB132SS: n = "vfmsub132ss"; opCount = 3; break;
+    case IT_VFMSUB132SD: n = "vfmsub132sd"; opCount = 3; break;
+    case IT_VFMSUB213SS: n = "vfmsub213ss"; opCount = 3; break;
+    case IT_VFMSUB213SD: n = "vfmsub213sd"; opCount = 3; break;
     case IT_VZEROALL:n = "vzeroall";opCount = 0; break;
     case IT_VZEROUPPER: n = "vzeroupper"; opCount = 0; break;
 
@@ -627,7 +680,7 @@ const char* instrName(InstrType it, int* pOpCount)
 
 char* instr2string(Instr* instr, int align, FunctionConfig* fc)
 {
-    static char buf[100];
+    static __thread char buf[100];
     const char* n;
     int oc = 0, off = 0;
 
@@ -743,7 +796,7 @@ char* instr2string(Instr* instr, int align, FunctionConfig* fc)
 
 char* bytes2string(Instr* instr, int start, int count)
 {
-    static char buf[100];
+    static __thread char buf[100];
     int off = 0, i, j;
     for(i = start, j=0; (i < instr->len) && (j<count); i++, j++) {
         uint8_t b = ((uint8_t*) instr->addr)[i];
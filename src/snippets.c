@@ -19,6 +19,7 @@
 
 
 #include "dbrew.h"
+#include "cpu.h"
 #include "vector.h"
 
 #include <assert.h>
@@ -111,8 +112,9 @@ void apply4_R8V8_X2(uint64_t f, double* ov, double* iv)
     // ov[2] = (f)(iv[2]);
     // ov[3] = (f)(iv[3]);
     dbrew_func_R8V8_X2_t vf = (dbrew_func_R8V8_X2_t) f;
-    ((__m128d*)ov)[0] = (*vf)( ((__m128d*)iv)[0] );
-    ((__m128d*)ov)[1] = (*vf)( ((__m128d*)iv)[1] );
+    // iv/ov may be unaligned
+    _mm_storeu_pd(ov,     (*vf)( _mm_loadu_pd(iv) ));
+    _mm_storeu_pd(ov + 2, (*vf)( _mm_loadu_pd(iv + 2) ));
 }
 
 #ifdef __AVX__
@@ -143,8 +145,9 @@ void apply4_R8V8V8_X2(uint64_t f, double* ov, double* i1v, double* i2v)
     // ov[2] = (f)(i1v[2], i2v[2]);
     // ov[3] = (f)(i1v[3], i2v[3]);
     dbrew_func_R8V8V8_X2_t vf = (dbrew_func_R8V8V8_X2_t) f;
-    ((__m128d*)ov)[0] = (*vf)( ((__m128d*)i1v)[0], ((__m128d*)i2v)[0] );
-    ((__m128d*)ov)[1] = (*vf)( ((__m128d*)i1v)[1], ((__m128d*)i2v)[1] );
+    // i1v/i2v/ov may be unaligned
+    _mm_storeu_pd(ov,     (*vf)( _mm_loadu_pd(i1v), _mm_loadu_pd(i2v) ));
+    _mm_storeu_pd(ov + 2, (*vf)( _mm_loadu_pd(i1v + 2), _mm_loadu_pd(i2v + 2) ));
 }
 
 #ifdef __AVX__
@@ -176,8 +179,9 @@ void apply4_R8P8_X2(uint64_t f, double* ov, double* iv)
     // ov[2] = (f)(iv + 2);
     // ov[3] = (f)(iv + 3);
     dbrew_func_R8P8_X2_t vf = (dbrew_func_R8P8_X2_t) f;
-    ((__m128d*)ov)[0] = (*vf)( ((__m128d*)iv) + 0 );
-    ((__m128d*)ov)[1] = (*vf)( ((__m128d*)iv) + 1 );
+    // ov may be unaligned
+    _mm_storeu_pd(ov,     (*vf)( ((__m128d*)iv) + 0 ));
+    _mm_storeu_pd(ov + 2, (*vf)( ((__m128d*)iv) + 1 ));
 }
 
 #ifdef __AVX__
@@ -198,20 +202,470 @@ void apply4_R8P8_X4(uint64_t f, double* ov, double* iv)
 
 
 
+// loops for dbrew_apply_* over arbitrary number of elements
+//
+// All loop state is made dynamic: when inlined by the rewriter, the loop
+// is captured once instead of being unrolled. The scalar kernel <f> of
+// vectorized variants handles the remaining elements at the end.
+
+// scalar loops, used if vector expansion fails
+
+void apply_R8V8_X1(uint64_t f, double* ov, double* iv, int n)
+{
+    dbrew_func_R8V8_t sf = (dbrew_func_R8V8_t) f;
+
+    ov = (double*) makeDynamic((uint64_t) ov);
+    iv = (double*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n > 0) {
+        *ov++ = (*sf)(*iv++);
+        n--;
+    }
+}
+
+void apply_R8V8V8_X1(uint64_t f, double* ov, double* i1v, double* i2v, int n)
+{
+    dbrew_func_R8V8V8_t sf = (dbrew_func_R8V8V8_t) f;
+
+    ov = (double*) makeDynamic((uint64_t) ov);
+    i1v = (double*) makeDynamic((uint64_t) i1v);
+    i2v = (double*) makeDynamic((uint64_t) i2v);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n > 0) {
+        *ov++ = (*sf)(*i1v++, *i2v++);
+        n--;
+    }
+}
+
+void apply_R8P8_X1(uint64_t f, double* ov, double* iv, int n)
+{
+    dbrew_func_R8P8_t sf = (dbrew_func_R8P8_t) f;
+
+    ov = (double*) makeDynamic((uint64_t) ov);
+    iv = (double*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n > 0) {
+        *ov++ = (*sf)(iv++);
+        n--;
+    }
+}
+
+// vectorized loops: vectorized kernel <vf>, scalar kernel <f> for tail
+
+void apply_R8V8_X2(uint64_t vf, double* ov, double* iv, int n, uint64_t f)
+{
+    dbrew_func_R8V8_X2_t vf2 = (dbrew_func_R8V8_X2_t) vf;
+
+    ov = (double*) makeDynamic((uint64_t) ov);
+    iv = (double*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 2) {
+        _mm_storeu_pd(ov, (*vf2)( _mm_loadu_pd(iv) ));
+        ov += 2;
+        iv += 2;
+        n -= 2;
+    }
+    apply_R8V8_X1(f, ov, iv, n);
+}
+
+void apply_R8V8V8_X2(uint64_t vf, double* ov, double* i1v, double* i2v,
+                     int n, uint64_t f)
+{
+    dbrew_func_R8V8V8_X2_t vf2 = (dbrew_func_R8V8V8_X2_t) vf;
+
+    ov = (double*) makeDynamic((uint64_t) ov);
+    i1v = (double*) makeDynamic((uint64_t) i1v);
+    i2v = (double*) makeDynamic((uint64_t) i2v);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 2) {
+        _mm_storeu_pd(ov, (*vf2)( _mm_loadu_pd(i1v), _mm_loadu_pd(i2v) ));
+        ov += 2;
+        i1v += 2;
+        i2v += 2;
+        n -= 2;
+    }
+    apply_R8V8V8_X1(f, ov, i1v, i2v, n);
+}
+
+void apply_R8P8_X2(uint64_t vf, double* ov, double* iv, int n, uint64_t f)
+{
+    dbrew_func_R8P8_X2_t vf2 = (dbrew_func_R8P8_X2_t) vf;
+
+    ov = (double*) makeDynamic((uint64_t) ov);
+    iv = (double*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 2) {
+        _mm_storeu_pd(ov, (*vf2)( (__m128d*) iv ));
+        ov += 2;
+        iv += 2;
+        n -= 2;
+    }
+    apply_R8P8_X1(f, ov, iv, n);
+}
+
+#ifdef __AVX__
+void apply_R8V8_X4(uint64_t vf, double* ov, double* iv, int n, uint64_t f)
+{
+    dbrew_func_R8V8_X4_t vf4 = (dbrew_func_R8V8_X4_t) vf;
+
+    ov = (double*) makeDynamic((uint64_t) ov);
+    iv = (double*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 4) {
+        _mm256_storeu_pd(ov, (*vf4)( _mm256_loadu_pd(iv) ));
+        ov += 4;
+        iv += 4;
+        n -= 4;
+    }
+    apply_R8V8_X1(f, ov, iv, n);
+}
+
+void apply_R8V8V8_X4(uint64_t vf, double* ov, double* i1v, double* i2v,
+                     int n, uint64_t f)
+{
+    dbrew_func_R8V8V8_X4_t vf4 = (dbrew_func_R8V8V8_X4_t) vf;
+
+    ov = (double*) makeDynamic((uint64_t) ov);
+    i1v = (double*) makeDynamic((uint64_t) i1v);
+    i2v = (double*) makeDynamic((uint64_t) i2v);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 4) {
+        _mm256_storeu_pd(ov, (*vf4)( _mm256_loadu_pd(i1v),
+                                     _mm256_loadu_pd(i2v) ));
+        ov += 4;
+        i1v += 4;
+        i2v += 4;
+        n -= 4;
+    }
+    apply_R8V8V8_X1(f, ov, i1v, i2v, n);
+}
+
+void apply_R8P8_X4(uint64_t vf, double* ov, double* iv, int n, uint64_t f)
+{
+    dbrew_func_R8P8_X4_t vf4 = (dbrew_func_R8P8_X4_t) vf;
+
+    ov = (double*) makeDynamic((uint64_t) ov);
+    iv = (double*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 4) {
+        _mm256_storeu_pd(ov, (*vf4)( (__m256d*) iv ));
+        ov += 4;
+        iv += 4;
+        n -= 4;
+    }
+    apply_R8P8_X1(f, ov, iv, n);
+}
+#endif // __AVX__
+
+#ifdef __AVX__
+// AVX-512 variants, only used if supported by the CPU (see maxVectorBytes)
+#define AVX512 __attribute__ ((target("avx512f,avx512dq")))
+
+typedef __m512d (*dbrew_func_R8V8_X8_t)(__m512d);
+typedef __m512d (*dbrew_func_R8V8V8_X8_t)(__m512d,__m512d);
+typedef __m512d (*dbrew_func_R8P8_X8_t)(__m512d*);
+
+AVX512
+void apply_R8V8_X8(uint64_t vf, double* ov, double* iv, int n, uint64_t f)
+{
+    dbrew_func_R8V8_X8_t vf8 = (dbrew_func_R8V8_X8_t) vf;
+
+    ov = (double*) makeDynamic((uint64_t) ov);
+    iv = (double*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 8) {
+        _mm512_storeu_pd(ov, (*vf8)( _mm512_loadu_pd(iv) ));
+        ov += 8;
+        iv += 8;
+        n -= 8;
+    }
+    apply_R8V8_X1(f, ov, iv, n);
+}
+
+AVX512
+void apply_R8V8V8_X8(uint64_t vf, double* ov, double* i1v, double* i2v,
+                     int n, uint64_t f)
+{
+    dbrew_func_R8V8V8_X8_t vf8 = (dbrew_func_R8V8V8_X8_t) vf;
+
+    ov = (double*) makeDynamic((uint64_t) ov);
+    i1v = (double*) makeDynamic((uint64_t) i1v);
+    i2v = (double*) makeDynamic((uint64_t) i2v);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 8) {
+        _mm512_storeu_pd(ov, (*vf8)( _mm512_loadu_pd(i1v),
+                                     _mm512_loadu_pd(i2v) ));
+        ov += 8;
+        i1v += 8;
+        i2v += 8;
+        n -= 8;
+    }
+    apply_R8V8V8_X1(f, ov, i1v, i2v, n);
+}
+
+AVX512
+void apply_R8P8_X8(uint64_t vf, double* ov, double* iv, int n, uint64_t f)
+{
+    dbrew_func_R8P8_X8_t vf8 = (dbrew_func_R8P8_X8_t) vf;
+
+    ov = (double*) makeDynamic((uint64_t) ov);
+    iv = (double*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 8) {
+        _mm512_storeu_pd(ov, (*vf8)( (__m512d*) iv ));
+        ov += 8;
+        iv += 8;
+        n -= 8;
+    }
+    apply_R8P8_X1(f, ov, iv, n);
+}
+#endif // __AVX__
+
+
+// loops for dbrew_apply_R4* (single precision)
+
+void apply_R4V4_X1(uint64_t f, float* ov, float* iv, int n)
+{
+    dbrew_func_R4V4_t sf = (dbrew_func_R4V4_t) f;
+
+    ov = (float*) makeDynamic((uint64_t) ov);
+    iv = (float*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n > 0) {
+        *ov++ = (*sf)(*iv++);
+        n--;
+    }
+}
+
+void apply_R4V4V4_X1(uint64_t f, float* ov, float* i1v, float* i2v, int n)
+{
+    dbrew_func_R4V4V4_t sf = (dbrew_func_R4V4V4_t) f;
+
+    ov = (float*) makeDynamic((uint64_t) ov);
+    i1v = (float*) makeDynamic((uint64_t) i1v);
+    i2v = (float*) makeDynamic((uint64_t) i2v);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n > 0) {
+        *ov++ = (*sf)(*i1v++, *i2v++);
+        n--;
+    }
+}
+
+void apply_R4P4_X1(uint64_t f, float* ov, float* iv, int n)
+{
+    dbrew_func_R4P4_t sf = (dbrew_func_R4P4_t) f;
+
+    ov = (float*) makeDynamic((uint64_t) ov);
+    iv = (float*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n > 0) {
+        *ov++ = (*sf)(iv++);
+        n--;
+    }
+}
+
+typedef __m128 (*dbrew_func_R4V4_X4_t)(__m128);
+typedef __m128 (*dbrew_func_R4V4V4_X4_t)(__m128,__m128);
+typedef __m128 (*dbrew_func_R4P4_X4_t)(__m128*);
+
+void apply_R4V4_X4(uint64_t vf, float* ov, float* iv, int n, uint64_t f)
+{
+    dbrew_func_R4V4_X4_t vf4 = (dbrew_func_R4V4_X4_t) vf;
+
+    ov = (float*) makeDynamic((uint64_t) ov);
+    iv = (float*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 4) {
+        _mm_storeu_ps(ov, (*vf4)( _mm_loadu_ps(iv) ));
+        ov += 4;
+        iv += 4;
+        n -= 4;
+    }
+    apply_R4V4_X1(f, ov, iv, n);
+}
+
+void apply_R4V4V4_X4(uint64_t vf, float* ov, float* i1v, float* i2v,
+                     int n, uint64_t f)
+{
+    dbrew_func_R4V4V4_X4_t vf4 = (dbrew_func_R4V4V4_X4_t) vf;
+
+    ov = (float*) makeDynamic((uint64_t) ov);
+    i1v = (float*) makeDynamic((uint64_t) i1v);
+    i2v = (float*) makeDynamic((uint64_t) i2v);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 4) {
+        _mm_storeu_ps(ov, (*vf4)( _mm_loadu_ps(i1v), _mm_loadu_ps(i2v) ));
+        ov += 4;
+        i1v += 4;
+        i2v += 4;
+        n -= 4;
+    }
+    apply_R4V4V4_X1(f, ov, i1v, i2v, n);
+}
+
+void apply_R4P4_X4(uint64_t vf, float* ov, float* iv, int n, uint64_t f)
+{
+    dbrew_func_R4P4_X4_t vf4 = (dbrew_func_R4P4_X4_t) vf;
+
+    ov = (float*) makeDynamic((uint64_t) ov);
+    iv = (float*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 4) {
+        _mm_storeu_ps(ov, (*vf4)( (__m128*) iv ));
+        ov += 4;
+        iv += 4;
+        n -= 4;
+    }
+    apply_R4P4_X1(f, ov, iv, n);
+}
+
+#ifdef __AVX__
+typedef __m256 (*dbrew_func_R4V4_X8_t)(__m256);
+typedef __m256 (*dbrew_func_R4V4V4_X8_t)(__m256,__m256);
+typedef __m256 (*dbrew_func_R4P4_X8_t)(__m256*);
+
+void apply_R4V4_X8(uint64_t vf, float* ov, float* iv, int n, uint64_t f)
+{
+    dbrew_func_R4V4_X8_t vf8 = (dbrew_func_R4V4_X8_t) vf;
+
+    ov = (float*) makeDynamic((uint64_t) ov);
+    iv = (float*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 8) {
+        _mm256_storeu_ps(ov, (*vf8)( _mm256_loadu_ps(iv) ));
+        ov += 8;
+        iv += 8;
+        n -= 8;
+    }
+    apply_R4V4_X1(f, ov, iv, n);
+}
+
+void apply_R4V4V4_X8(uint64_t vf, float* ov, float* i1v, float* i2v,
+                     int n, uint64_t f)
+{
+    dbrew_func_R4V4V4_X8_t vf8 = (dbrew_func_R4V4V4_X8_t) vf;
+
+    ov = (float*) makeDynamic((uint64_t) ov);
+    i1v = (float*) makeDynamic((uint64_t) i1v);
+    i2v = (float*) makeDynamic((uint64_t) i2v);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 8) {
+        _mm256_storeu_ps(ov, (*vf8)( _mm256_loadu_ps(i1v),
+                                     _mm256_loadu_ps(i2v) ));
+        ov += 8;
+        i1v += 8;
+        i2v += 8;
+        n -= 8;
+    }
+    apply_R4V4V4_X1(f, ov, i1v, i2v, n);
+}
+
+void apply_R4P4_X8(uint64_t vf, float* ov, float* iv, int n, uint64_t f)
+{
+    dbrew_func_R4P4_X8_t vf8 = (dbrew_func_R4P4_X8_t) vf;
+
+    ov = (float*) makeDynamic((uint64_t) ov);
+    iv = (float*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 8) {
+        _mm256_storeu_ps(ov, (*vf8)( (__m256*) iv ));
+        ov += 8;
+        iv += 8;
+        n -= 8;
+    }
+    apply_R4P4_X1(f, ov, iv, n);
+}
+
+typedef __m512 (*dbrew_func_R4V4_X16_t)(__m512);
+typedef __m512 (*dbrew_func_R4V4V4_X16_t)(__m512,__m512);
+typedef __m512 (*dbrew_func_R4P4_X16_t)(__m512*);
+
+AVX512
+void apply_R4V4_X16(uint64_t vf, float* ov, float* iv, int n, uint64_t f)
+{
+    dbrew_func_R4V4_X16_t vf16 = (dbrew_func_R4V4_X16_t) vf;
+
+    ov = (float*) makeDynamic((uint64_t) ov);
+    iv = (float*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 16) {
+        _mm512_storeu_ps(ov, (*vf16)( _mm512_loadu_ps(iv) ));
+        ov += 16;
+        iv += 16;
+        n -= 16;
+    }
+    apply_R4V4_X1(f, ov, iv, n);
+}
+
+AVX512
+void apply_R4V4V4_X16(uint64_t vf, float* ov, float* i1v, float* i2v,
+                      int n, uint64_t f)
+{
+    dbrew_func_R4V4V4_X16_t vf16 = (dbrew_func_R4V4V4_X16_t) vf;
+
+    ov = (float*) makeDynamic((uint64_t) ov);
+    i1v = (float*) makeDynamic((uint64_t) i1v);
+    i2v = (float*) makeDynamic((uint64_t) i2v);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 16) {
+        _mm512_storeu_ps(ov, (*vf16)( _mm512_loadu_ps(i1v),
+                                      _mm512_loadu_ps(i2v) ));
+        ov += 16;
+        i1v += 16;
+        i2v += 16;
+        n -= 16;
+    }
+    apply_R4V4V4_X1(f, ov, i1v, i2v, n);
+}
+
+AVX512
+void apply_R4P4_X16(uint64_t vf, float* ov, float* iv, int n, uint64_t f)
+{
+    dbrew_func_R4P4_X16_t vf16 = (dbrew_func_R4P4_X16_t) vf;
+
+    ov = (float*) makeDynamic((uint64_t) ov);
+    iv = (float*) makeDynamic((uint64_t) iv);
+    n = (int) makeDynamic((uint64_t) n);
+    while(n >= 16) {
+        _mm512_storeu_ps(ov, (*vf16)( (__m512*) iv ));
+        ov += 16;
+        iv += 16;
+        n -= 16;
+    }
+    apply_R4P4_X1(f, ov, iv, n);
+}
+#endif // __AVX__
+
+
+
 // helper functions
 
-// used to restrict configuration of expansion factor
+// used to restrict configuration of expansion factor: checks CPU at runtime
 int maxVectorBytes(void)
 {
 #ifdef __AVX__
+    uint32_t f = hostCpuFeatures();
+
+    if (!(f & CF_AVX))
+        return 16;
+    if (f & CF_AVX512)
+        return 64;
     return 32;
 #else
     return 16; // SSE
 #endif
 }
 
+// variant of vector API function <f> for <s>-byte vectors, sets request
+// for the kernel expansion into <vr>
 uint64_t expandedVectorVariant(uint64_t f, int s, VectorizeReq* vr)
 {
+    // 4x variants only process 4 doubles
+    if ((s == 64) && ((f == (uint64_t)dbrew_apply4_R8V8) ||
+                      (f == (uint64_t)dbrew_apply4_R8V8V8) ||
+                      (f == (uint64_t)dbrew_apply4_R8P8)))
+        s = 32;
+
     if (s == 16) {
         if (f == (uint64_t)dbrew_apply4_R8V8) {
             *vr = VR_DoubleX2_RV;
@@ -225,6 +679,30 @@ uint64_t expandedVectorVariant(uint64_t f, int s, VectorizeReq* vr)
             *vr = VR_DoubleX2_RP;
             return (uint64_t) apply4_R8P8_X2;
         }
+        else if (f == (uint64_t)dbrew_apply_R8V8) {
+            *vr = VR_DoubleX2_RV;
+            return (uint64_t) apply_R8V8_X2;
+        }
+        else if (f == (uint64_t)dbrew_apply_R8V8V8) {
+            *vr = VR_DoubleX2_RVV;
+            return (uint64_t) apply_R8V8V8_X2;
+        }
+        else if (f == (uint64_t)dbrew_apply_R8P8) {
+            *vr = VR_DoubleX2_RP;
+            return (uint64_t) apply_R8P8_X2;
+        }
+        else if (f == (uint64_t)dbrew_apply_R4V4) {
+            *vr = VR_FloatX4_RV;
+            return (uint64_t) apply_R4V4_X4;
+        }
+        else if (f == (uint64_t)dbrew_apply_R4V4V4) {
+            *vr = VR_FloatX4_RVV;
+            return (uint64_t) apply_R4V4V4_X4;
+        }
+        else if (f == (uint64_t)dbrew_apply_R4P4) {
+            *vr = VR_FloatX4_RP;
+            return (uint64_t) apply_R4P4_X4;
+        }
     }
 #ifdef __AVX__
     else if (s == 32) {
@@ -240,8 +718,70 @@ uint64_t expandedVectorVariant(uint64_t f, int s, VectorizeReq* vr)
             *vr = VR_DoubleX4_RP;
             return (uint64_t) apply4_R8P8_X4;
         }
+        else if (f == (uint64_t)dbrew_apply_R8V8) {
+            *vr = VR_DoubleX4_RV;
+            return (uint64_t) apply_R8V8_X4;
+        }
+        else if (f == (uint64_t)dbrew_apply_R8V8V8) {
+            *vr = VR_DoubleX4_RVV;
+            return (uint64_t) apply_R8V8V8_X4;
+        }
+        else if (f == (uint64_t)dbrew_apply_R8P8) {
+            *vr = VR_DoubleX4_RP;
+            return (uint64_t) apply_R8P8_X4;
+        }
+        else if (f == (uint64_t)dbrew_apply_R4V4) {
+            *vr = VR_FloatX8_RV;
+            return (uint64_t) apply_R4V4_X8;
+        }
+        else if (f == (uint64_t)dbrew_apply_R4V4V4) {
+            *vr = VR_FloatX8_RVV;
+            return (uint64_t) apply_R4V4V4_X8;
+        }
+        else if (f == (uint64_t)dbrew_apply_R4P4) {
+            *vr = VR_FloatX8_RP;
+            return (uint64_t) apply_R4P4_X8;
+        }
+    }
+    else if (s == 64) {
+        if (f == (uint64_t)dbrew_apply_R8V8) {
+            *vr = VR_DoubleX8_RV;
+            return (uint64_t) apply_R8V8_X8;
+        }
+        else if (f == (uint64_t)dbrew_apply_R8V8V8) {
+            *vr = VR_DoubleX8_RVV;
+            return (uint64_t) apply_R8V8V8_X8;
+        }
+        else if (f == (uint64_t)dbrew_apply_R8P8) {
+            *vr = VR_DoubleX8_RP;
+            return (uint64_t) apply_R8P8_X8;
+        }
+        else if (f == (uint64_t)dbrew_apply_R4V4) {
+            *vr = VR_FloatX16_RV;
+            return (uint64_t) apply_R4V4_X16;
+        }
+        else if (f == (uint64_t)dbrew_apply_R4V4V4) {
+            *vr = VR_FloatX16_RVV;
+            return (uint64_t) apply_R4V4V4_X16;
+        }
+        else if (f == (uint64_t)dbrew_apply_R4P4) {
+            *vr = VR_FloatX16_RP;
+            return (uint64_t) apply_R4P4_X16;
+        }
     }
 #endif
     assert(0);
     return 0;
 }
+
+// scalar loop for dbrew_apply_* if vector expansion fails (0 for others)
+uint64_t scalarVectorVariant(uint64_t f)
+{
+    if (f == (uint64_t)dbrew_apply_R8V8) return (uint64_t) apply_R8V8_X1;
+    if (f == (uint64_t)dbrew_apply_R8V8V8) return (uint64_t) apply_R8V8V8_X1;
+    if (f == (uint64_t)dbrew_apply_R8P8) return (uint64_t) apply_R8P8_X1;
+    if (f == (uint64_t)dbrew_apply_R4V4) return (uint64_t) apply_R4V4_X1;
+    if (f == (uint64_t)dbrew_apply_R4V4V4) return (uint64_t) apply_R4V4V4_X1;
+    if (f == (uint64_t)dbrew_apply_R4P4) return (uint64_t) apply_R4P4_X1;
+    return 0;
+}
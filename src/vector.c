@@ -20,11 +20,17 @@
 #include "vector.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "alloc.h"
 #include "dbrew.h"
 #include "instr.h"
 #include "emulate.h"
+#include "error.h"
+#include "opt.h"
 
 /*
  *  Support for DBrew vector API
@@ -34,6 +40,57 @@
  */
 
 
+// parameters of kernels to expand
+typedef enum _VecPar {
+    VP_V,  // one value
+    VP_VV, // two values
+    VP_P   // pointer to value
+} VecPar;
+
+static
+VecPar vreqPar(VectorizeReq vr)
+{
+    switch(vr) {
+    case VR_DoubleX2_RV: case VR_DoubleX4_RV: case VR_DoubleX8_RV:
+    case VR_FloatX4_RV: case VR_FloatX8_RV: case VR_FloatX16_RV:
+        return VP_V;
+    case VR_DoubleX2_RVV: case VR_DoubleX4_RVV: case VR_DoubleX8_RVV:
+    case VR_FloatX4_RVV: case VR_FloatX8_RVV: case VR_FloatX16_RVV:
+        return VP_VV;
+    case VR_DoubleX2_RP: case VR_DoubleX4_RP: case VR_DoubleX8_RP:
+    case VR_FloatX4_RP: case VR_FloatX8_RP: case VR_FloatX16_RP:
+        return VP_P;
+    default: assert(0);
+    }
+    return VP_V;
+}
+
+// size of vectors in bytes for request <vr>
+static
+int vreqBytes(VectorizeReq vr)
+{
+    switch(vr) {
+    case VR_DoubleX2_RV: case VR_DoubleX2_RVV: case VR_DoubleX2_RP:
+    case VR_FloatX4_RV: case VR_FloatX4_RVV: case VR_FloatX4_RP:
+        return 16;
+    case VR_DoubleX4_RV: case VR_DoubleX4_RVV: case VR_DoubleX4_RP:
+    case VR_FloatX8_RV: case VR_FloatX8_RVV: case VR_FloatX8_RP:
+        return 32;
+    case VR_DoubleX8_RV: case VR_DoubleX8_RVV: case VR_DoubleX8_RP:
+    case VR_FloatX16_RV: case VR_FloatX16_RVV: case VR_FloatX16_RP:
+        return 64;
+    default: assert(0);
+    }
+    return 0;
+}
+
+// single precision elements for request <vr>?
+static
+bool vreqSingle(VectorizeReq vr)
+{
+    return (vr >= VR_FloatX4_RV) && (vr <= VR_FloatX16_RP);
+}
+
 // returns function pointer to rewritten, vectorized variant
 static
 uint64_t convertToVector(Rewriter* r, uint64_t func, VectorizeReq vreq)
@@ -55,24 +112,15 @@ uint64_t convertToVector(Rewriter* r, uint64_t func, VectorizeReq vreq)
     if (r->showEmuSteps) {
         dbrew_verbose(rr, true, true, true);
         printf("Generating vectorized variant of %lx for %d-byte vectors\n",
-               func, r->vectorsize);
+               func, vreqBytes(vreq));
     }
     dbrew_set_function(rr, func);
     rr->vreq = vreq;
+    // memory configured as constant may be replicated into vectors
+    config_copy_ranges(rr, r);
 
-    bool hasVReturn = false;
-    int pCount = 0;
-    switch(vreq) {
-    case VR_DoubleX2_RV:  pCount = 1; hasVReturn = true; break;
-    case VR_DoubleX2_RVV: pCount = 2; hasVReturn = true; break;
-    case VR_DoubleX2_RP:  pCount = 1; hasVReturn = true; break;
-    case VR_DoubleX4_RV:  pCount = 1; hasVReturn = true; break;
-    case VR_DoubleX4_RVV: pCount = 2; hasVReturn = true; break;
-    case VR_DoubleX4_RP:  pCount = 1; hasVReturn = true; break;
-    default: assert(0);
-    }
-    if (hasVReturn)
-        dbrew_config_returnfp(rr);
+    int pCount = (vreqPar(vreq) == VP_VV) ? 2 : 1;
+    dbrew_config_returnfp(rr);
     dbrew_config_parcount(rr, pCount);
     return dbrew_rewrite(rr, 0.0, 0.0);
 }
@@ -85,171 +133,1118 @@ uint64_t handleVectorCall(Rewriter* r, uint64_t f, EmuState* es)
      // redirect original vector API call to this variant
     rf = expandedVectorVariant(f, r->vectorsize, &vr);
 
+    // scalar loop for arbitrary-length variants (0 for 4x variants)
+    uint64_t sf = scalarVectorVariant(f);
+
     // re-direct from scalar to vectorized kernel (function pointer in par1)
     uint64_t func = es->reg[RI_DI];
     uint64_t vfunc = convertToVector(r, func, vr);
+    if ((vfunc == func) && (vreqBytes(vr) == 64)) {
+        // some operations (e.g. comparisons) cannot be expanded with
+        // AVX-512: try again with AVX
+        rf = expandedVectorVariant(f, 32, &vr);
+        vfunc = convertToVector(r, func, vr);
+    }
     if (vfunc == func) {
         // vector expansion did not work: error
         if (r->showEmuSteps)
             printf("Error: expansion of %lx failed; no redirection\n", func);
-        // call original DBrew snippet
-        return f;
+        // call original DBrew snippet, or scalar loop with dynamic state
+        return sf ? sf : f;
     }
     es->reg[RI_DI] = vfunc;
+    if (sf) {
+        // scalar kernel for the tail is passed after the last parameter
+        RegIndex ri = RI_8;
+        if ((f == (uint64_t) dbrew_apply_R8V8V8) ||
+            (f == (uint64_t) dbrew_apply_R4V4V4))
+            ri = RI_9;
+        es->reg[ri] = func;
+        initMetaState(&(es->reg_state[ri]), CS_STATIC);
+    }
     return rf;
 }
 
 
+//----------------------------------------------------------
+// direct calls of dbrew_apply_*
+//
+// A loop specialized for the scalar kernel is generated by rewriting a
+// wrapper calling the API function: this gets redirected to the vectorized
+// loop as in any other rewritten code. Generated loops are cached per
+// kernel. The element range is split into chunks which are processed by
+// multiple threads, if configured.
+//
+
+typedef enum _ApplyKind {
+    AK_R8V8, AK_R8V8V8, AK_R8P8,
+    AK_R4V4, AK_R4V4V4, AK_R4P4
+} ApplyKind;
+
+// generated loops, element arrays passed as untyped pointers
+typedef void (*apply_loop_t)(uint64_t, void*, void*, int);
+typedef void (*apply2_loop_t)(uint64_t, void*, void*, void*, int);
+
+typedef struct _ApplyLoop {
+    ApplyKind kind;
+    uint64_t f;     // scalar kernel
+    uint64_t loop;  // generated loop, 0 if rewriting failed
+    Rewriter* r;
+} ApplyLoop;
+
+typedef struct _ApplyJob {
+    ApplyKind kind;
+    uint64_t f;
+    uint64_t loop;
+    char* ov;
+    char* i1v;
+    char* i2v;
+    int esize; // element size in bytes
+    int n;
+    int chunk;
+    long next; // start of next chunk to process, shared among threads:
+               // may exceed <n> by up to one chunk per thread
+} ApplyJob;
+
+#define APPLY_LOOPS_MAX 64
+#define APPLY_THREADS_MAX 64
+
+static ApplyLoop applyLoops[APPLY_LOOPS_MAX];
+static int applyLoopCount = 0;
+static pthread_mutex_t applyLock = PTHREAD_MUTEX_INITIALIZER;
+
+// settings for direct calls, accessed atomically (may change concurrently)
+static int applyThreads = 1;
+static int applyChunk = 16384;
+
+// wrappers to be rewritten, with <f> as static parameter
+__attribute__ ((noinline))
+static void loop_R8V8(dbrew_func_R8V8_t f, double* ov, double* iv, int n)
+{
+    dbrew_apply_R8V8(f, ov, iv, n);
+}
+
+__attribute__ ((noinline))
+static void loop_R8V8V8(dbrew_func_R8V8V8_t f,
+                        double* ov, double* i1v, double* i2v, int n)
+{
+    dbrew_apply_R8V8V8(f, ov, i1v, i2v, n);
+}
+
+__attribute__ ((noinline))
+static void loop_R8P8(dbrew_func_R8P8_t f, double* ov, double* iv, int n)
+{
+    dbrew_apply_R8P8(f, ov, iv, n);
+}
+
+__attribute__ ((noinline))
+static void loop_R4V4(dbrew_func_R4V4_t f, float* ov, float* iv, int n)
+{
+    dbrew_apply_R4V4(f, ov, iv, n);
+}
+
+__attribute__ ((noinline))
+static void loop_R4V4V4(dbrew_func_R4V4V4_t f,
+                        float* ov, float* i1v, float* i2v, int n)
+{
+    dbrew_apply_R4V4V4(f, ov, i1v, i2v, n);
+}
+
+__attribute__ ((noinline))
+static void loop_R4P4(dbrew_func_R4P4_t f, float* ov, float* iv, int n)
+{
+    dbrew_apply_R4P4(f, ov, iv, n);
+}
+
+// generate loop for kernel <f>
+static
+uint64_t generateApplyLoop(ApplyLoop* l)
+{
+    uint64_t wrapper = 0;
+    int parCount = 4;
+
+    switch(l->kind) {
+    case AK_R8V8:   wrapper = (uint64_t) loop_R8V8; break;
+    case AK_R8V8V8: wrapper = (uint64_t) loop_R8V8V8; parCount = 5; break;
+    case AK_R8P8:   wrapper = (uint64_t) loop_R8P8; break;
+    case AK_R4V4:   wrapper = (uint64_t) loop_R4V4; break;
+    case AK_R4V4V4: wrapper = (uint64_t) loop_R4V4V4; parCount = 5; break;
+    case AK_R4P4:   wrapper = (uint64_t) loop_R4P4; break;
+    default: assert(0);
+    }
+
+    l->r = dbrew_new();
+    // inlined loops with kernels exceed default capacity
+    dbrew_set_capture_capacity(l->r, 5000, 200, 20000);
+    dbrew_set_function(l->r, wrapper);
+    dbrew_config_parcount(l->r, parCount);
+    dbrew_config_staticpar(l->r, 0);
+    dbrew_config_force_unknown(l->r, 0);
+    dbrew_set_vectorsize(l->r, maxVectorBytes());
+    uint64_t code = dbrew_rewrite(l->r, l->f, 0, 0, 0, 0);
+
+    // on failure, the wrapper itself is returned: avoid recursion
+    return (code == wrapper) ? 0 : code;
+}
+
+// get cached loop for kernel <f>, generate on first use
+static
+uint64_t getApplyLoop(ApplyKind kind, uint64_t f)
+{
+    uint64_t loop = 0;
+    int i;
+
+    pthread_mutex_lock(&applyLock);
+    for(i = 0; i < applyLoopCount; i++) {
+        if ((applyLoops[i].kind == kind) && (applyLoops[i].f == f))
+            break;
+    }
+    if (i < applyLoopCount)
+        loop = applyLoops[i].loop;
+    else if (applyLoopCount < APPLY_LOOPS_MAX) {
+        ApplyLoop* l = applyLoops + applyLoopCount;
+        l->kind = kind;
+        l->f = f;
+        l->loop = generateApplyLoop(l);
+        loop = l->loop;
+        applyLoopCount++;
+    }
+    pthread_mutex_unlock(&applyLock);
+
+    if (loop) return loop;
+
+    // no generated loop available: scalar loop
+    switch(kind) {
+    case AK_R8V8:   return (uint64_t) apply_R8V8_X1;
+    case AK_R8V8V8: return (uint64_t) apply_R8V8V8_X1;
+    case AK_R8P8:   return (uint64_t) apply_R8P8_X1;
+    case AK_R4V4:   return (uint64_t) apply_R4V4_X1;
+    case AK_R4V4V4: return (uint64_t) apply_R4V4V4_X1;
+    case AK_R4P4:   return (uint64_t) apply_R4P4_X1;
+    default: assert(0);
+    }
+    return 0;
+}
+
+static
+void runApplyChunk(ApplyJob* j, int start, int len)
+{
+    long o = (long) start * j->esize;
+
+    if ((j->kind == AK_R8V8V8) || (j->kind == AK_R4V4V4))
+        (*(apply2_loop_t)j->loop)(j->f, j->ov + o,
+                                  j->i1v + o, j->i2v + o, len);
+    else
+        (*(apply_loop_t)j->loop)(j->f, j->ov + o, j->i1v + o, len);
+}
+
+static
+void* applyWorker(void* arg)
+{
+    ApplyJob* j = (ApplyJob*) arg;
+
+    while(1) {
+        long start = __atomic_fetch_add(&(j->next), (long) j->chunk,
+                                        __ATOMIC_RELAXED);
+        if (start >= j->n) break;
+        long len = j->n - start;
+        if (len > j->chunk) len = j->chunk;
+        runApplyChunk(j, (int) start, (int) len);
+    }
+    return 0;
+}
+
+static
+void runApply(ApplyKind kind, uint64_t f, int esize,
+              void* ov, void* i1v, void* i2v, int n)
+{
+    ApplyJob j;
+    pthread_t t[APPLY_THREADS_MAX];
+    int threads, maxThreads, started = 0;
+
+    if (n <= 0) return;
+
+    j.kind = kind;
+    j.f = f;
+    j.loop = getApplyLoop(kind, f);
+    j.ov = (char*) ov;
+    j.i1v = (char*) i1v;
+    j.i2v = (char*) i2v;
+    j.esize = esize;
+    j.n = n;
+    j.chunk = __atomic_load_n(&applyChunk, __ATOMIC_RELAXED);
+    j.next = 0;
+    maxThreads = __atomic_load_n(&applyThreads, __ATOMIC_RELAXED);
+
+    // no more threads than chunks
+    long chunks = ((long) n + j.chunk - 1) / j.chunk;
+    threads = (chunks > maxThreads) ? maxThreads : (int) chunks;
+    if (threads <= 1) {
+        runApplyChunk(&j, 0, n);
+        return;
+    }
+
+    // calling thread works on chunks, too
+    for(int i = 1; i < threads; i++) {
+        if (pthread_create(&t[started], 0, applyWorker, &j) != 0) break;
+        started++;
+    }
+    applyWorker(&j);
+    for(int i = 0; i < started; i++)
+        pthread_join(t[i], 0);
+}
+
+void dbrew_set_apply_threads(int threads, int chunk)
+{
+    if (threads < 1) threads = 1;
+    if (threads > APPLY_THREADS_MAX) threads = APPLY_THREADS_MAX;
+    if (chunk < 1) chunk = 1;
+
+    __atomic_store_n(&applyThreads, threads, __ATOMIC_RELAXED);
+    __atomic_store_n(&applyChunk, chunk, __ATOMIC_RELAXED);
+}
+
+__attribute__ ((noinline))
+void dbrew_apply_R8V8(dbrew_func_R8V8_t f, double* ov, double* iv, int n)
+{
+    runApply(AK_R8V8, (uint64_t) f, 8, ov, iv, 0, n);
+}
+
+__attribute__ ((noinline))
+void dbrew_apply_R8V8V8(dbrew_func_R8V8V8_t f,
+                        double* ov, double* i1v, double* i2v, int n)
+{
+    runApply(AK_R8V8V8, (uint64_t) f, 8, ov, i1v, i2v, n);
+}
+
+__attribute__ ((noinline))
+void dbrew_apply_R8P8(dbrew_func_R8P8_t f, double* ov, double* iv, int n)
+{
+    runApply(AK_R8P8, (uint64_t) f, 8, ov, iv, 0, n);
+}
+
+__attribute__ ((noinline))
+void dbrew_apply_R4V4(dbrew_func_R4V4_t f, float* ov, float* iv, int n)
+{
+    runApply(AK_R4V4, (uint64_t) f, 4, ov, iv, 0, n);
+}
+
+__attribute__ ((noinline))
+void dbrew_apply_R4V4V4(dbrew_func_R4V4V4_t f,
+                        float* ov, float* i1v, float* i2v, int n)
+{
+    runApply(AK_R4V4V4, (uint64_t) f, 4, ov, i1v, i2v, n);
+}
+
+__attribute__ ((noinline))
+void dbrew_apply_R4P4(dbrew_func_R4P4_t f, float* ov, float* iv, int n)
+{
+    runApply(AK_R4P4, (uint64_t) f, 4, ov, iv, 0, n);
+}
+
+
 //----------------------------------------------------------
 // vectorization pass
 //
+// Scalar double/float operations are replaced by their packed variants.
+// Values in vector registers and pointers in GP registers are tagged with
+// their expansion type. Loads/stores via expanded pointers access successive
+// elements, constants at absolute addresses are replicated to all lanes.
+// Control flow is allowed as long as it does not depend on expanded values,
+// and tags are consistent at control flow joins. One pass expands to one
+// vector size (16, 32 or 64 bytes) and one element type.
+//
 
 typedef enum _VecRegType {
     VRT_Invalid = 0,
     VRT_Unknown,
-    VRT_Double,    // lower double set
-    VRT_DoubleX2,  // original scalar double vectorized to 2 doubles
-    VRT_DoubleX4,  // original scalar double vectorized to 4 doubles
-    VRT_PtrDoubleX2, // pointer to double => pointer to 2 doubles
-    VRT_PtrDoubleX4, // pointer to double => pointer to 4 doubles
+    VRT_Scalar,  // lower element set
+    VRT_Vector,  // original scalar element vectorized to full vector
+    VRT_Ptr,     // pointer to element => pointer to full vector
 } VecRegType;
 
-// maintain expansion state of 16 vector registers
-VecRegType vrt[16];
+// expansion state of 16 vector registers and 16 GP registers
+typedef struct _VecState {
+    VecRegType v[16];
+    VecRegType g[16];
+} VecState;
+
+typedef struct _VecContext {
+    RContext* c;
+    int bytes;        // vector size: 16, 32 or 64 (AVX-512)
+    bool single;      // expanding float instead of double elements
+    VexPrefix vp;     // encoding for current instruction (VEX_No: SSE)
+    RegIndex scratch; // vector register not used in captured code
+
+    // for traversal of CBBs: state at entry, pending CBBs
+    VecState* entry;
+    bool* seen;
+    int* stack;
+    int sp;
+} VecContext;
+
+// kind of operand with regard to expansion
+typedef enum _VecOpKind {
+    VOK_Invalid = 0,
+    VOK_Scalar,   // vector register with scalar or unknown value
+    VOK_Vector,   // vector register with expanded value
+    VOK_Memory,   // memory accessed via expanded pointer
+    VOK_Constant, // memory at absolute address, configured as constant
+    VOK_Broadcast // memory at absolute address, may change at runtime
+} VecOpKind;
 
 static
-void doVec(RContext* c, Instr* dst, Instr* src)
+void vecError(VecContext* vc, const char* d)
 {
-    static Error e;
-    RegIndex ri1, ri2;
-    VecRegType vrt1, vrt2;
 
-    copyInstr(dst, src);
+    setError(&(vc->c->r->error), ET_UnsupportedInstr, EM_Rewriter, vc->c->r, d);
+    vc->c->e = &(vc->c->r->error);
+}
 
-    switch(src->type) {
-    case IT_ADDSD:
-        ri1 = opIsVReg(&(src->dst)) ? regVIndex(src->dst.reg) : RI_None;
-        vrt1 = (ri1 != RI_None) ? vrt[ri1] : VRT_Unknown;
-        ri2 = opIsVReg(&(src->src)) ? regVIndex(src->src.reg) : RI_None;
-        vrt2 = (ri2 != RI_None) ? vrt[ri2] : VRT_Unknown;
+static
+bool vrtIsVector(VecRegType t)
+{
+    return (t == VRT_Vector);
+}
+
+static
+VecOpKind vecOpKind(VecContext* vc, VecState* s, Operand* o)
+{
+    Rewriter* r = vc->c->r;
+    int esize = vc->single ? 4 : 8;
+
+    if (opIsVReg(o))
+        return vrtIsVector(s->v[regVIndex(o->reg)]) ? VOK_Vector : VOK_Scalar;
+
+    if (!opIsInd(o) || (o->seg != OSO_None) || (o->scale > 0))
+        return VOK_Invalid;
+    if (o->reg.rt == RT_None) {
+        // only replicate at rewrite time if element is known to not change
+        if (config_is_constant(r, o->val) &&
+            config_is_constant(r, o->val + esize - 1))
+            return VOK_Constant;
+        return VOK_Broadcast;
+    }
+    if ((o->reg.rt == RT_GP64) && (s->g[o->reg.ri] != VRT_Unknown))
+        return VOK_Memory;
+    return VOK_Invalid;
+}
+
+// does operand <o> use an expanded pointer?
+static
+bool vecUsesPtr(VecState* s, Operand* o)
+{
+    if (opIsGPReg(o))
+        return s->g[regGP64Index(o->reg)] != VRT_Unknown;
+    if (!opIsInd(o)) return false;
+    if ((o->reg.rt == RT_GP64) && (s->g[o->reg.ri] != VRT_Unknown))
+        return true;
+    if ((o->scale > 0) && (s->g[o->ireg.ri] != VRT_Unknown))
+        return true;
+    return false;
+}
+
+// single precision variant of packed double operation <it>
+static
+InstrType psType(InstrType it)
+{
+    switch(it) {
+    case IT_ADDPD:  return IT_ADDPS;
+    case IT_SUBPD:  return IT_SUBPS;
+    case IT_MULPD:  return IT_MULPS;
+    case IT_DIVPD:  return IT_DIVPS;
+    case IT_MINPD:  return IT_MINPS;
+    case IT_MAXPD:  return IT_MAXPS;
+    case IT_SQRTPD: return IT_SQRTPS;
+    case IT_ANDPD:  return IT_ANDPS;
+    case IT_ANDNPD: return IT_ANDNPS;
+    case IT_ORPD:   return IT_ORPS;
+    case IT_XORPD:  return IT_XORPS;
+    case IT_CMPPD:  return IT_CMPPS;
+    case IT_MOVUPD: return IT_MOVUPS;
+    case IT_MOVAPD: return IT_MOVAPS;
+    default: assert(0);
+    }
+    return IT_None;
+}
+
+// instruction type of packed operation <it> in AVX encoding
+static
+InstrType vexType(InstrType it)
+{
+    switch(it) {
+    case IT_ADDPS:  return IT_VADDPS;
+    case IT_SUBPS:  return IT_VSUBPS;
+    case IT_MULPS:  return IT_VMULPS;
+    case IT_DIVPS:  return IT_VDIVPS;
+    case IT_MINPS:  return IT_VMINPS;
+    case IT_MAXPS:  return IT_VMAXPS;
+    case IT_SQRTPS: return IT_VSQRTPS;
+    case IT_ANDPS:  return IT_VANDPS;
+    case IT_ANDNPS: return IT_VANDNPS;
+    case IT_ORPS:   return IT_VORPS;
+    case IT_XORPS:  return IT_VXORPS;
+    case IT_CMPPS:  return IT_VCMPPS;
+    case IT_MOVUPS: return IT_VMOVUPS;
+    case IT_MOVAPS: return IT_VMOVAPS;
+    case IT_ADDPD:  return IT_VADDPD;
+    case IT_SUBPD:  return IT_VSUBPD;
+    case IT_MULPD:  return IT_VMULPD;
+    case IT_DIVPD:  return IT_VDIVPD;
+    case IT_MINPD:  return IT_VMINPD;
+    case IT_MAXPD:  return IT_VMAXPD;
+    case IT_SQRTPD: return IT_VSQRTPD;
+    case IT_ANDPD:  return IT_VANDPD;
+    case IT_ANDNPD: return IT_VANDNPD;
+    case IT_ORPD:   return IT_VORPD;
+    case IT_XORPD:  return IT_VXORPD;
+    case IT_CMPPD:  return IT_VCMPPD;
+    case IT_MOVUPD: return IT_VMOVUPD;
+    case IT_MOVAPD: return IT_VMOVAPD;
+    default: assert(0);
+    }
+    return IT_None;
+}
+
+// append copy of <in> to captured instructions
+static
+void vecCopy(VecContext* vc, Instr* in)
+{
+    Instr* i = newCapInstr(vc->c);
+    if (i) copyInstr(i, in);
+}
+
+// append packed instruction with opcode 0x0F<opc> and operand encoding <oe>.
+// Binary if <src2> is 0. For type <it>, give SSE packed double variant: the
+// single precision variant (without prefix 0x66) is used for float elements,
+// and the AVX variant with VEX/EVEX encoding
+static
+void vecEmit(VecContext* vc, InstrType it, int opc, OperandEncoding oe,
+             Operand* dst, Operand* src, Operand* src2)
+{
+    Instr* i = newCapInstr(vc->c);
+    if (!i) return;
+
+    if (vc->single) it = psType(it);
+    if (vc->vp != VEX_No) it = vexType(it);
+    if (src2)
+        initTernaryInstr(i, it, dst, src, src2);
+    else
+        initBinaryInstr(i, it, VT_None, dst, src);
+    i->vtype = VT_Implicit;
+    attachPassthrough(i, vc->vp, vc->single ? PS_No : PS_66, oe, SC_None,
+                      0x0F, opc, -1);
+}
+
+// expanded variant of vector register or memory operand <o>
+static
+void vecOperand(VecContext* vc, Operand* o, Operand* res)
+{
+    RegType rt = RT_XMM;
+    OpType ot = OT_Ind128;
+
+    if (vc->bytes == 32) {
+        rt = RT_YMM;
+        ot = OT_Ind256;
+    }
+    else if (vc->bytes == 64) {
+        rt = RT_ZMM;
+        ot = OT_Ind512;
+    }
+    copyOperand(res, o);
+    if (opIsVReg(o))
+        setRegOp(res, getReg(rt, regVIndex(o->reg)));
+    else
+        res->type = ot;
+}
 
-        if ((vrt1 == VRT_DoubleX2) && (vrt2 == VRT_DoubleX2)) {
-            dst->type = IT_ADDPD;
+// append move <it> from <src> to vector register <dst> with prefixes <ps>
+// and opcode 0x0F<b2>(<b3>), in the encoding of current expansion
+static
+void vecEmitMove(VecContext* vc, InstrType it, VexPrefix vp, PrefixSet ps,
+                 int b2, int b3, Operand* dst, Operand* src)
+{
+    Instr* i = newCapInstr(vc->c);
+    if (!i) return;
+
+    initBinaryInstr(i, it, VT_None, dst, src);
+    i->vtype = VT_Implicit;
+    attachPassthrough(i, vp, ps, OE_RM, SC_None, 0x0F, b2, b3);
+}
+
+// broadcast element at absolute address of <o> into vector register
+// <dst> at runtime, as the memory is not known to be constant
+static
+void vecBroadcast(VecContext* vc, Operand* o, Operand* dst)
+{
+    Operand m;
+
+    // same width as <dst> for encoding: only one element gets read
+    vecOperand(vc, o, &m);
+
+    switch(vc->vp) {
+    case VEX_No:
+        // load scalar, duplicate by unpacking with itself
+        if (vc->single) {
+            vecEmitMove(vc, IT_MOVSS, VEX_No, PS_F3, 0x10, -1, dst, &m);
+            vecEmitMove(vc, IT_UNPCKLPS, VEX_No, PS_No, 0x14, -1, dst, dst);
         }
-        else {
-            assert((vrt1 != VRT_DoubleX2) && (vrt1 != VRT_DoubleX4));
-            assert((vrt2 != VRT_DoubleX2) && (vrt2 != VRT_DoubleX4));
+        else
+            vecEmitMove(vc, IT_MOVSD, VEX_No, PS_F2, 0x10, -1, dst, &m);
+        vecEmitMove(vc, IT_UNPCKLPD, VEX_No, PS_66, 0x14, -1, dst, dst);
+        break;
+
+    case VEX_128:
+        if (vc->single)
+            vecEmitMove(vc, IT_VBROADCASTSS, VEX_128, PS_66, 0x38, 0x18, dst, &m);
+        else
+            vecEmitMove(vc, IT_VMOVDDUP, VEX_128, PS_F2, 0x12, -1, dst, &m);
+        break;
+
+    default:
+        // EVEX encoding of vbroadcastsd requires W1
+        if (vc->single)
+            vecEmitMove(vc, IT_VBROADCASTSS, vc->vp, PS_66, 0x38, 0x18, dst, &m);
+        else
+            vecEmitMove(vc, IT_VBROADCASTSD, vc->vp,
+                        (vc->vp == VEX_512) ? (PS_66 | PS_REXW) : PS_66,
+                        0x38, 0x19, dst, &m);
+        break;
+    }
+}
+
+// get expanded source operand <o> of kind <k> into <res>. Constants get
+// replicated into aligned table storage, other absolute addresses get
+// broadcast into scratch. As SSE instructions require aligned memory
+// operands, memory via pointers is loaded into scratch
+static
+bool vecSource(VecContext* vc, Operand* o, VecOpKind k, Operand* res)
+{
+    Operand tmp;
+    uint8_t* p;
+    int esize = vc->single ? 4 : 8;
+
+    switch(k) {
+    case VOK_Vector:
+        vecOperand(vc, o, res);
+        return true;
+
+    case VOK_Constant:
+        p = newTableData(vc->c, vc->bytes, vc->bytes);
+        if (!p) return false;
+        for(int i = 0; i < vc->bytes; i += esize)
+            memcpy(p + i, (void*) o->val, esize);
+        vecOperand(vc, o, res);
+        res->val = (uint64_t) p;
+        return true;
+
+    case VOK_Broadcast:
+        if (vc->scratch == RI_None) {
+            vecError(vc, "No scratch register for vector expansion");
+            return false;
+        }
+        setRegOp(&tmp, getReg(RT_XMM, vc->scratch));
+        vecOperand(vc, &tmp, res);
+        vecBroadcast(vc, o, res);
+        return true;
+
+    case VOK_Memory:
+        vecOperand(vc, o, res);
+        if (vc->vp != VEX_No) return true;
+        if (vc->scratch == RI_None) {
+            vecError(vc, "No scratch register for vector expansion");
+            return false;
+        }
+        setRegOp(&tmp, getReg(RT_XMM, vc->scratch));
+        vecEmit(vc, IT_MOVUPD, 0x10, OE_RM, &tmp, res, 0);
+        copyOperand(res, &tmp);
+        return true;
+
+    default: break;
+    }
+    vecError(vc, "Cannot handle operand for vector expansion");
+    return false;
+}
+
+// scalar arithmetic/logic <in> into packed double operation <it>/<opc>
+static
+void vecArith(VecContext* vc, VecState* s, Instr* in,
+              InstrType it, int opc, bool unary)
+{
+    Operand *a, *b, *imm = 0;
+    Operand od, oa, ob;
+    VecOpKind ka, kb;
+
+    // dst = a op b (imm)
+    if ((in->form == OF_3) && !opIsImm(&(in->src2))) {
+        a = &(in->src);
+        b = &(in->src2);
+    }
+    else {
+        a = &(in->dst);
+        b = &(in->src);
+        if (in->form == OF_3) imm = &(in->src2);
+    }
+    ka = unary ? VOK_Scalar : vecOpKind(vc, s, a);
+    kb = vecOpKind(vc, s, b);
+    assert(opIsVReg(&(in->dst)));
+
+    // zeroing idiom (xor with itself) results in expanded zeros
+    if ((opc == 0x57) && opIsEqual(a, b)) {
+        vecOperand(vc, &(in->dst), &od);
+        if (vc->vp == VEX_No)
+            vecEmit(vc, IT_XORPD, opc, OE_RM, &od, &od, 0);
+        else
+            vecEmit(vc, IT_XORPD, opc, OE_RVM, &od, &od, &od);
+        s->v[regVIndex(in->dst.reg)] = VRT_Vector;
+        return;
+    }
+
+    if ((ka != VOK_Vector) && (kb != VOK_Vector) && (kb != VOK_Memory)) {
+        if ((ka != VOK_Scalar) ||
+            ((kb != VOK_Scalar) && (kb != VOK_Constant) &&
+             (kb != VOK_Broadcast))) {
+            vecError(vc, "Cannot handle operand for vector expansion");
+            return;
+        }
+        // operation on scalar values only
+        vecCopy(vc, in);
+        s->v[regVIndex(in->dst.reg)] = VRT_Scalar;
+        return;
+    }
+    if (!unary && (ka != VOK_Vector)) {
+        vecError(vc, "Cannot mix scalar and expanded values");
+        return;
+    }
+
+    vecOperand(vc, &(in->dst), &od);
+    if (!vecSource(vc, b, kb, &ob)) return;
+    if (imm)
+        vecEmit(vc, it, opc, OE_RMI, &od, &ob, imm);
+    else if (unary || (vc->vp == VEX_No))
+        vecEmit(vc, it, opc, OE_RM, &od, &ob, 0);
+    else {
+        vecOperand(vc, a, &oa);
+        vecEmit(vc, it, opc, OE_RVM, &od, &oa, &ob);
+    }
+    s->v[regVIndex(in->dst.reg)] = VRT_Vector;
+}
+
+// moves between vector registers and memory
+static
+void vecMove(VecContext* vc, VecState* s, Instr* in)
+{
+    Operand od, os;
+    VecOpKind kd = vecOpKind(vc, s, &(in->dst));
+    VecOpKind ks = vecOpKind(vc, s, &(in->src));
+    bool scalar = (in->type == IT_MOVSD) || (in->type == IT_VMOVSD) ||
+                  (in->type == IT_MOVSS) || (in->type == IT_VMOVSS);
+
+    if (opIsVReg(&(in->dst))) {
+        RegIndex ri = regVIndex(in->dst.reg);
+
+        switch(ks) {
+        case VOK_Scalar:
+            vecCopy(vc, in);
+            s->v[ri] = VRT_Scalar;
+            return;
+
+        case VOK_Vector:
+        case VOK_Constant:
+            // full copy of register or replicated constant
+            vecOperand(vc, &(in->dst), &od);
+            if (!vecSource(vc, &(in->src), ks, &os)) return;
+            vecEmit(vc, IT_MOVAPD, 0x28, OE_RM, &od, &os, 0);
+            s->v[ri] = VRT_Vector;
+            return;
+
+        case VOK_Broadcast:
+            vecOperand(vc, &(in->dst), &od);
+            vecBroadcast(vc, &(in->src), &od);
+            s->v[ri] = VRT_Vector;
+            return;
+
+        case VOK_Memory:
+            // load of successive elements
+            if (!scalar) break;
+            vecOperand(vc, &(in->dst), &od);
+            vecOperand(vc, &(in->src), &os);
+            vecEmit(vc, IT_MOVUPD, 0x10, OE_RM, &od, &os, 0);
+            s->v[ri] = VRT_Vector;
+            return;
+
+        default: break;
         }
+    }
+    else if ((kd == VOK_Memory) && (ks == VOK_Vector) && scalar) {
+        // store of successive elements
+        vecOperand(vc, &(in->dst), &od);
+        vecOperand(vc, &(in->src), &os);
+        vecEmit(vc, IT_MOVUPD, 0x11, OE_MR, &od, &os, 0);
+        return;
+    }
+    else if ((kd == VOK_Invalid) && (ks == VOK_Scalar)) {
+        // store of scalar value
+        vecCopy(vc, in);
+        return;
+    }
+    vecError(vc, "Cannot handle move for vector expansion");
+}
+
+// any other instruction: must not use expanded values; track pointers
+static
+void vecOther(VecContext* vc, VecState* s, Instr* in)
+{
+    Operand* ops[3] = { &(in->dst), &(in->src), &(in->src2) };
+    int opCount = 0;
+    bool readsDst = true;
+
+    switch(in->form) {
+    case OF_0: opCount = 0; break;
+    case OF_1: opCount = 1; break;
+    case OF_2: opCount = 2; break;
+    case OF_3: opCount = 3; break;
+    default: assert(0);
+    }
+    for(int i = 0; i < opCount; i++) {
+        if (vecOpKind(vc, s, ops[i]) == VOK_Vector) {
+            vecError(vc, "Cannot handle instruction for vector expansion");
+            return;
+        }
+    }
+
+    switch(in->type) {
+    case IT_MOV:
+        if (opIsGPReg(&(in->dst)) && (in->dst.type == OT_Reg64) &&
+            opIsGPReg(&(in->src))) {
+            s->g[in->dst.reg.ri] = s->g[in->src.reg.ri];
+            vecCopy(vc, in);
+            return;
+        }
+        readsDst = false;
         break;
 
-    case IT_VADDSD:
-        ri1 = opIsVReg(&(src->dst)) ? regVIndex(src->dst.reg) : RI_None;
-        vrt1 = (ri1 != RI_None) ? vrt[ri1] : VRT_Unknown;
-        ri2 = opIsVReg(&(src->src)) ? regVIndex(src->src.reg) : RI_None;
-        vrt2 = (ri2 != RI_None) ? vrt[ri2] : VRT_Unknown;
+    case IT_LEA:
+        if ((in->dst.type == OT_Reg64) &&
+            (vecOpKind(vc, s, &(in->src)) == VOK_Memory)) {
+            s->g[in->dst.reg.ri] = s->g[in->src.reg.ri];
+            vecCopy(vc, in);
+            return;
+        }
+        readsDst = false;
+        break;
+
+    case IT_ADD:
+    case IT_SUB:
+        // moving pointer by elements still points to successive elements
+        if ((in->dst.type == OT_Reg64) && opIsImm(&(in->src))) {
+            vecCopy(vc, in);
+            return;
+        }
+        break;
+
+    case IT_MOVSX:
+    case IT_MOVZX:
+    case IT_POP:
+        readsDst = false;
+        break;
+
+    case IT_CALL:
+        vecError(vc, "Cannot expand call of unknown function");
+        return;
+
+    default: break;
+    }
+
+    if ((opCount > 1) && (vecUsesPtr(s, ops[1]) ||
+                          ((opCount > 2) && vecUsesPtr(s, ops[2])))) {
+        vecError(vc, "Cannot handle pointer use for vector expansion");
+        return;
+    }
+    if ((opCount > 0) && vecUsesPtr(s, ops[0]) &&
+        (opIsInd(ops[0]) || readsDst)) {
+        vecError(vc, "Cannot handle pointer use for vector expansion");
+        return;
+    }
+    for(RegIndex ri = RI_A; ri < RI_GPMax; ri++)
+        if ((s->g[ri] != VRT_Unknown) && gpWrittenBy(in, ri))
+            s->g[ri] = VRT_Unknown;
+    if ((opCount > 0) && opIsVReg(ops[0]))
+        s->v[regVIndex(ops[0]->reg)] = VRT_Scalar;
+
+    vecCopy(vc, in);
+}
+
+// element size of scalar floating point operation <it>, 0 if none
+static
+int scalarElementSize(InstrType it)
+{
+    switch(it) {
+    case IT_ADDSS: case IT_VADDSS: case IT_SUBSS: case IT_VSUBSS:
+    case IT_MULSS: case IT_VMULSS: case IT_DIVSS: case IT_VDIVSS:
+    case IT_MINSS: case IT_VMINSS: case IT_MAXSS: case IT_VMAXSS:
+    case IT_SQRTSS: case IT_VSQRTSS: case IT_CMPSS: case IT_VCMPSS:
+    case IT_MOVSS: case IT_VMOVSS:
+    case IT_COMISS: case IT_UCOMISS: case IT_VUCOMISS:
+        return 4;
+    case IT_ADDSD: case IT_VADDSD: case IT_SUBSD: case IT_VSUBSD:
+    case IT_MULSD: case IT_VMULSD: case IT_DIVSD: case IT_VDIVSD:
+    case IT_MINSD: case IT_VMINSD: case IT_MAXSD: case IT_VMAXSD:
+    case IT_SQRTSD: case IT_VSQRTSD: case IT_CMPSD: case IT_VCMPSD:
+    case IT_MOVSD: case IT_VMOVSD:
+    case IT_COMISD: case IT_UCOMISD: case IT_VUCOMISD:
+        return 8;
+    default: break;
+    }
+    return 0;
+}
+
+static
+void doVec(VecContext* vc, VecState* s, Instr* in)
+{
+    int esize = scalarElementSize(in->type);
+
+    if (vc->bytes == 64)
+        vc->vp = VEX_512;
+    else if (vc->bytes == 32)
+        vc->vp = VEX_256;
+    else if ((in->ptLen > 0) && (in->ptVexP != VEX_No))
+        vc->vp = VEX_128;
+    else
+        vc->vp = VEX_No;
 
-        if ((vrt1 == VRT_DoubleX2) && (vrt2 == VRT_DoubleX2)) {
-            dst->type = IT_VADDPD;
-            dst->ptLen = 0;
-            attachPassthrough(dst, VEX_128, PS_66, OE_RVM, SC_None, 0x0F, 0x58, -1);
+    if ((esize > 0) && (esize != (vc->single ? 4 : 8))) {
+        vecError(vc, "Element type does not match vector expansion");
+        return;
+    }
+
+    switch(in->type) {
+    case IT_ADDSD:
+    case IT_VADDSD:
+    case IT_ADDSS:
+    case IT_VADDSS:
+        vecArith(vc, s, in, IT_ADDPD, 0x58, false); break;
+    case IT_SUBSD:
+    case IT_VSUBSD:
+    case IT_SUBSS:
+    case IT_VSUBSS:
+        vecArith(vc, s, in, IT_SUBPD, 0x5C, false); break;
+    case IT_MULSD:
+    case IT_VMULSD:
+    case IT_MULSS:
+    case IT_VMULSS:
+        vecArith(vc, s, in, IT_MULPD, 0x59, false); break;
+    case IT_DIVSD:
+    case IT_VDIVSD:
+    case IT_DIVSS:
+    case IT_VDIVSS:
+        vecArith(vc, s, in, IT_DIVPD, 0x5E, false); break;
+    case IT_MINSD:
+    case IT_VMINSD:
+    case IT_MINSS:
+    case IT_VMINSS:
+        vecArith(vc, s, in, IT_MINPD, 0x5D, false); break;
+    case IT_MAXSD:
+    case IT_VMAXSD:
+    case IT_MAXSS:
+    case IT_VMAXSS:
+        vecArith(vc, s, in, IT_MAXPD, 0x5F, false); break;
+    case IT_SQRTSD:
+    case IT_VSQRTSD:
+    case IT_SQRTSS:
+    case IT_VSQRTSS:
+        vecArith(vc, s, in, IT_SQRTPD, 0x51, true); break;
+    case IT_CMPSD:
+    case IT_VCMPSD:
+    case IT_CMPSS:
+    case IT_VCMPSS:
+        // AVX-512 comparisons write mask registers
+        if (vc->bytes == 64) {
+            vecError(vc, "Cannot expand comparison with AVX-512");
+            break;
         }
-        else if ((vrt1 == VRT_DoubleX4) && (vrt2 == VRT_DoubleX4)) {
-            dst->type = IT_VADDPD;
-            dst->ptLen = 0;
-            attachPassthrough(dst, VEX_256, PS_66, OE_RVM, SC_None, 0x0F, 0x58, -1);
+        vecArith(vc, s, in, IT_CMPPD, 0xC2, false); break;
+
+    // bitwise operations, e.g. with masks from comparisons
+    case IT_ANDPD:
+    case IT_ANDPS:
+        vecArith(vc, s, in, IT_ANDPD, 0x54, false); break;
+    case IT_ANDNPD:
+    case IT_ANDNPS:
+        vecArith(vc, s, in, IT_ANDNPD, 0x55, false); break;
+    case IT_ORPD:
+    case IT_ORPS:
+        vecArith(vc, s, in, IT_ORPD, 0x56, false); break;
+    case IT_XORPD:
+    case IT_XORPS:
+    case IT_VXORPD:
+    case IT_VXORPS:
+    case IT_PXOR:
+        if (!opIsVReg(&(in->dst)) || (in->dst.type != OT_Reg128)) {
+            vecError(vc, "Cannot handle instruction for vector expansion");
+            break;
         }
-        else {
-            assert((vrt1 != VRT_DoubleX2) && (vrt1 != VRT_DoubleX4));
-            assert((vrt2 != VRT_DoubleX2) && (vrt2 != VRT_DoubleX4));
+        vecArith(vc, s, in, IT_XORPD, 0x57, false); break;
+
+    case IT_MOVSD:
+    case IT_VMOVSD:
+    case IT_MOVSS:
+    case IT_VMOVSS:
+    case IT_MOVAPD:
+    case IT_MOVAPS:
+    case IT_MOVUPD:
+    case IT_MOVUPS:
+    case IT_VMOVAPD:
+    case IT_VMOVAPS:
+    case IT_VMOVUPD:
+    case IT_VMOVUPS:
+        vecMove(vc, s, in);
+        break;
+
+    case IT_COMISD:
+    case IT_UCOMISD:
+    case IT_COMISS:
+    case IT_UCOMISS:
+    case IT_VUCOMISD:
+    case IT_VUCOMISS:
+        if ((vecOpKind(vc, s, &(in->dst)) == VOK_Vector) ||
+            (vecOpKind(vc, s, &(in->src)) == VOK_Vector) ||
+            (vecOpKind(vc, s, &(in->src)) == VOK_Memory)) {
+            vecError(vc, "Cannot expand branch depending on vector values");
+            break;
         }
+        vecCopy(vc, in);
         break;
 
-    case IT_HINT_CALL:
-    case IT_HINT_RET:
     case IT_RET:
+        if (!vrtIsVector(s->v[0])) {
+            vecError(vc, "Return value not expanded");
+            break;
+        }
+        vecCopy(vc, in);
         break;
+
     default:
-        setError(&e, ET_UnsupportedInstr, EM_Rewriter, c->r,
-                 "Cannot handle instruction for vector expansion");
-        c->e = &e;
-    break;
+        vecOther(vc, s, in);
+        break;
     }
 }
 
 static
-void vecPass(RContext* c, CBB* cbb)
+void vecPass(VecContext* vc, CBB* cbb, VecState* s)
 {
-    Instr *first = 0, *instr;
-    Rewriter* r = c->r;
-    int i;
-
-    if (cbb->count == 0) return;
+    Rewriter* r = vc->c->r;
+    int i, start;
 
     if (r->showOptSteps) {
         printf("Run Vectorization for CBB (%lx|%d)\n",
                cbb->dec_addr, cbb->esID);
     }
 
+    start = r->capInstrCount;
     for(i = 0; i < cbb->count; i++) {
-        instr = newCapInstr(c);
-        if (!instr) return;
-        if (!first) first = instr;
+        doVec(vc, s, cbb->instr + i);
+        if (vc->c->e) return;
+    }
+    cbb->instr = r->capInstr + start;
+    cbb->count = r->capInstrCount - start;
+}
 
-        doVec(c, instr, cbb->instr + i);
+// schedule <cbb> with entry state <s>, or check consistency if seen before
+static
+void vecFollow(VecContext* vc, CBB* cbb, VecState* s)
+{
+    int i;
+
+    if (!cbb) return;
+    i = cbb - vc->c->r->capBB;
+    if (vc->seen[i]) {
+        if (memcmp(vc->entry + i, s, sizeof(VecState)) != 0)
+            vecError(vc, "Inconsistent vector expansion at control flow join");
+        return;
     }
-    assert(first != 0);
-    cbb->instr = first;
+    vc->seen[i] = true;
+    vc->entry[i] = *s;
+    vc->stack[vc->sp++] = i;
 }
 
+// use highest vector register not used in captured code as scratch
+static
+RegIndex vecScratch(Rewriter* r)
+{
+    bool used[16] = { false };
+
+    for(int i = 0; i < r->capBBCount; i++) {
+        CBB* cbb = r->capBB + i;
+        for(int j = 0; j < cbb->count; j++) {
+            Instr* instr = cbb->instr + j;
+            if (opIsVReg(&(instr->dst))) used[regVIndex(instr->dst.reg)] = true;
+            if (opIsVReg(&(instr->src))) used[regVIndex(instr->src.reg)] = true;
+            if (opIsVReg(&(instr->src2))) used[regVIndex(instr->src2.reg)] = true;
+        }
+    }
+    for(int i = 15; i >= 0; i--)
+        if (!used[i]) return (RegIndex) i;
+    return RI_None;
+}
 
 void runVectorization(RContext* c)
 {
     int i;
-    VecRegType retType;
+    VecState s;
+    VecContext vc;
     Rewriter* r = c->r;
 
     assert(r->vreq != VR_None);
+    if (r->capBBCount == 0) return;
 
-    // tagging for xmm/ymm registers
-    for(i=0; i<16; i++) vrt[i] = VRT_Unknown;
-    retType = VRT_Unknown;
+    // tagging for xmm/ymm and GP registers
+    for(i=0; i<16; i++) {
+        s.v[i] = VRT_Unknown;
+        s.g[i] = VRT_Unknown;
+    }
 
-    switch(r->vreq) {
-    case VR_None: break;
-    case VR_DoubleX2_RV:
-        vrt[0] = VRT_DoubleX2;
-        retType = VRT_DoubleX2;
-        break;
-    case VR_DoubleX2_RVV:
-        vrt[0] = VRT_DoubleX2;
-        vrt[1] = VRT_DoubleX2;
-        retType = VRT_DoubleX2;
-        break;
-    case VR_DoubleX2_RP:
-        vrt[0] = VRT_PtrDoubleX2;
-        retType = VRT_DoubleX2;
-        break;
-    case VR_DoubleX4_RV:
-        vrt[0] = VRT_DoubleX4;
-        retType = VRT_DoubleX4;
+    switch(vreqPar(r->vreq)) {
+    case VP_V:
+        s.v[0] = VRT_Vector;
         break;
-    case VR_DoubleX4_RVV:
-        vrt[0] = VRT_DoubleX4;
-        vrt[1] = VRT_DoubleX4;
-        retType = VRT_DoubleX4;
+    case VP_VV:
+        s.v[0] = VRT_Vector;
+        s.v[1] = VRT_Vector;
         break;
-    case VR_DoubleX4_RP:
-        vrt[0] = VRT_PtrDoubleX4;
-        retType = VRT_DoubleX4;
+    case VP_P:
+        s.g[RI_DI] = VRT_Ptr;
         break;
     default: assert(0);
     }
 
-    assert(r->capBBCount == 1);
-    vecPass(c, r->capBB);
-    if (c->e) return;
+    vc.c = c;
+    vc.scratch = vecScratch(r);
+    vc.bytes = vreqBytes(r->vreq);
+    vc.single = vreqSingle(r->vreq);
 
-    // check for expanded return value
-    if (retType != VRT_Invalid)
-        assert(vrt[0] == retType);
+    // traverse CBBs reachable from entry, in depth-first order
+    vc.entry = (VecState*) arenaAlloc(r, &(r->tempArena),
+                                      sizeof(VecState) * r->capBBCount);
+    vc.seen = (bool*) arenaAlloc(r, &(r->tempArena),
+                                 sizeof(bool) * r->capBBCount);
+    memset(vc.seen, 0, sizeof(bool) * r->capBBCount);
+    vc.stack = (int*) arenaAlloc(r, &(r->tempArena),
+                                 sizeof(int) * r->capBBCount);
+    vc.sp = 0;
+    vecFollow(&vc, r->capBB, &s);
+    while((vc.sp > 0) && !c->e) {
+        CBB* cbb = r->capBB + vc.stack[--vc.sp];
+
+        s = vc.entry[cbb - r->capBB];
+        vecPass(&vc, cbb, &s);
+        if (c->e) break;
+
+        vecFollow(&vc, cbb->nextBranch, &s);
+        vecFollow(&vc, cbb->nextFallThrough, &s);
+        if (cbb->endType == IT_JMPI) {
+            for(i = 0; i < cbb->jtCount; i++)
+                vecFollow(&vc, (CBB*) cbb->jtTable[i], &s);
+        }
+    }
 }
@@ -0,0 +1,138 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "dbrew.h"
+
+// sum of a[0..n-1]
+long k_sum(long* a, long n);
+__asm__(
+    "    .text\n"
+    "    .globl k_sum\n"
+    "k_sum:\n"
+    "    xor %eax, %eax\n"
+    "    test %rsi, %rsi\n"
+    "    jle 2f\n"
+    "1:  add (%rdi), %rax\n"
+    "    add $8, %rdi\n"
+    "    dec %rsi\n"
+    "    jne 1b\n"
+    "2:  ret\n");
+
+typedef long (*sum_t)(long*, long);
+
+// counting hooks, with an arena for one rewriter
+typedef struct {
+    int allocs, frees, codeAllocs, codeFrees;
+    char* arena;
+    size_t used, size;
+    uint8_t* code;
+} Hooks;
+
+static
+void* hookAlloc(size_t size, void* user)
+{
+    Hooks* h = (Hooks*) user;
+
+    h->allocs++;
+    if (!h->arena) return malloc(size);
+    size = (size + 15) & ~15ul;
+    if (h->used + size > h->size) return 0;
+    h->used += size;
+    return h->arena + h->used - size;
+}
+
+static
+void hookFree(void* p, void* user)
+{
+    Hooks* h = (Hooks*) user;
+
+    h->frees++;
+    if (!h->arena) free(p);
+}
+
+static
+void* hookAllocCode(size_t size, uint64_t hint, void* user)
+{
+    Hooks* h = (Hooks*) user;
+
+    (void) hint;
+    if (!h->code || (size > 1 << 20)) return 0;
+    h->codeAllocs++;
+    return h->code;
+}
+
+static
+void hookFreeCode(void* p, size_t size, void* user)
+{
+    Hooks* h = (Hooks*) user;
+
+    (void) p;
+    (void) size;
+    h->codeFrees++;
+}
+
+int main()
+{
+    Hooks global = { 0 }, local = { 0 };
+    DBrewAllocator ga = { hookAlloc, hookFree, 0, 0, &global };
+    DBrewAllocator la = { hookAlloc, hookFree, hookAllocCode, hookFreeCode,
+                          &local };
+    long a[10];
+    Rewriter* r;
+    sum_t f;
+    int res = 0, globalAllocs;
+
+    for(int i = 0; i < 10; i++)
+        a[i] = i * i;
+
+    local.size = 1 << 22;
+    local.arena = (char*) malloc(local.size);
+    memset(local.arena, 0, local.size); // pre-fault
+    local.code = (uint8_t*) mmap(0, 1 << 20, PROT_READ | PROT_WRITE | PROT_EXEC,
+                                 MAP_ANONYMOUS | MAP_PRIVATE | MAP_POPULATE,
+                                 -1, 0);
+
+    dbrew_set_default_allocator(&ga);
+    r = dbrew_new();
+    dbrew_set_allocator(r, &la);
+    dbrew_set_function(r, (uint64_t) k_sum);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_force_unknown(r, 0);
+    printf("rewriter struct from global hooks: %s\n",
+           global.allocs > 0 ? "yes" : "no");
+
+    globalAllocs = global.allocs;
+    f = (sum_t) dbrew_rewrite(r, a, 10);
+    if (f(a, 10) != 285) res++;
+    if (f(a, 3) != 5) res++;
+    printf("rewrite: %s\n", res ? "wrong" : "correct");
+    printf("code from provider: %s\n",
+           (local.codeAllocs == 1) && ((uint8_t*) f >= local.code) &&
+           ((uint8_t*) f < local.code + (1 << 20)) ? "yes" : "no");
+    printf("buffers from rewriter hooks: %s, global hooks unused: %s\n",
+           (local.allocs > 0) && (local.used > 0) ? "yes" : "no",
+           global.allocs == globalAllocs ? "yes" : "no");
+
+    dbrew_free(r);
+    printf("all released: %s\n",
+           (local.allocs == local.frees) && (global.allocs == global.frees) &&
+           (local.codeFrees == 1) ? "yes" : "no");
+
+    // alloc without free hook is rejected, keeping the previous hooks
+    DBrewAllocator pa = { hookAlloc, 0, 0, 0, &global };
+    bool rejected = !dbrew_set_default_allocator(&pa);
+    r = dbrew_new();
+    rejected = rejected && !dbrew_set_allocator(r, &pa);
+    dbrew_free(r);
+    printf("partial hooks rejected: %s, all released: %s\n",
+           rejected ? "yes" : "no",
+           (global.allocs == global.frees) ? "yes" : "no");
+
+    dbrew_set_default_allocator(0);
+    return res;
+}
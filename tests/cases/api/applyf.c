@@ -0,0 +1,205 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+// x * x + 1
+float k_sq(float x);
+__asm__(
+    "    .text\n"
+    "    .globl k_sq\n"
+    "k_sq:\n"
+    "    mulss %xmm0, %xmm0\n"
+    "    addss c_one, %xmm0\n"
+    "    ret\n");
+
+// sqrt(min(fabs(x), 2)) / 2
+float k_clamp(float x);
+__asm__(
+    "    .text\n"
+    "    .globl k_clamp\n"
+    "k_clamp:\n"
+    "    andps c_absmask, %xmm0\n"
+    "    minss c_two, %xmm0\n"
+    "    sqrtss %xmm0, %xmm0\n"
+    "    divss c_two, %xmm0\n"
+    "    ret\n");
+
+// (a < b) ? a : 2 * b, using comparison mask (not expanded with AVX-512)
+float k_select(float a, float b);
+__asm__(
+    "    .text\n"
+    "    .globl k_select\n"
+    "k_select:\n"
+    "    movaps %xmm0, %xmm2\n"
+    "    cmpss $1, %xmm1, %xmm2\n"
+    "    addss %xmm1, %xmm1\n"
+    "    andps %xmm2, %xmm0\n"
+    "    andnps %xmm1, %xmm2\n"
+    "    orps %xmm2, %xmm0\n"
+    "    ret\n");
+
+// v[0] - v[1]
+float k_pair(float* v);
+__asm__(
+    "    .text\n"
+    "    .globl k_pair\n"
+    "k_pair:\n"
+    "    movss (%rdi), %xmm0\n"
+    "    subss 4(%rdi), %xmm0\n"
+    "    ret\n");
+
+// fabs via branch depending on value: not vectorizable
+float k_branch(float x);
+__asm__(
+    "    .text\n"
+    "    .globl k_branch\n"
+    "k_branch:\n"
+    "    xorps %xmm1, %xmm1\n"
+    "    ucomiss %xmm0, %xmm1\n"
+    "    jbe 1f\n"
+    "    xorps c_signmask, %xmm0\n"
+    "1:  ret\n"
+    "    .section .rodata\n"
+    "    .align 16\n"
+    "c_absmask:\n"
+    "    .long 0x7fffffff, 0x7fffffff, 0x7fffffff, 0x7fffffff\n"
+    "c_signmask:\n"
+    "    .long 0x80000000, 0x80000000, 0x80000000, 0x80000000\n"
+    "c_one:\n"
+    "    .float 1.0\n"
+    "c_two:\n"
+    "    .float 2.0\n"
+    "    .text\n");
+
+#define N 1003
+
+float a[N + 1], b[N], o1[N], o2[N];
+
+void sq(float* ov, float* iv, int n)     { dbrew_apply_R4V4(k_sq, ov, iv, n); }
+void clamp(float* ov, float* iv, int n)  { dbrew_apply_R4V4(k_clamp, ov, iv, n); }
+void pair(float* ov, float* iv, int n)   { dbrew_apply_R4P4(k_pair, ov, iv, n); }
+void branch(float* ov, float* iv, int n) { dbrew_apply_R4V4(k_branch, ov, iv, n); }
+void select2(float* ov, float* i1v, float* i2v, int n)
+{
+    dbrew_apply_R4V4V4(k_select, ov, i1v, i2v, n);
+}
+
+typedef void (*apply_t)(float*, float*, int);
+typedef void (*apply2_t)(float*, float*, float*, int);
+
+static
+int compare(int n)
+{
+    int res = 0;
+    for(int i = 0; i < n; i++)
+        if (o1[i] != o2[i]) res++;
+    return res;
+}
+
+// reference result via scalar kernel
+static
+void reference(int k, int n)
+{
+    for(int i = 0; i < n; i++) {
+        switch(k) {
+        case 0: o1[i] = k_sq(a[i]); break;
+        case 1: o1[i] = k_clamp(a[i]); break;
+        case 2: o1[i] = k_pair(a + i); break;
+        case 3: o1[i] = k_branch(a[i]); break;
+        default: o1[i] = k_select(a[i], b[i]); break;
+        }
+    }
+}
+
+static
+int check(const char* name, int k, apply_t f, int vs)
+{
+    Rewriter* r;
+    apply_t rf;
+    int res = 0;
+
+    r = dbrew_new();
+    dbrew_set_capture_capacity(r, 5000, 200, 20000);
+    dbrew_set_function(r, (uint64_t) f);
+    dbrew_config_parcount(r, 3);
+    dbrew_config_force_unknown(r, 0);
+    dbrew_set_vectorsize(r, vs);
+    rf = (apply_t) dbrew_rewrite(r, o2, a, N);
+
+    // different lengths, including tails and empty range
+    for(int n = 0; n < 20; n++) {
+        reference(k, n);
+        rf(o2, a, n);
+        res += compare(n);
+    }
+    reference(k, N);
+    rf(o2, a, N);
+    res += compare(N);
+    printf("%s (%d bytes): %s\n", name, vs, res ? "wrong" : "correct");
+    dbrew_free(r);
+    return res;
+}
+
+static
+int check2(const char* name, apply2_t f, int vs)
+{
+    Rewriter* r;
+    apply2_t rf;
+    int res = 0;
+
+    r = dbrew_new();
+    dbrew_set_capture_capacity(r, 5000, 200, 20000);
+    dbrew_set_function(r, (uint64_t) f);
+    dbrew_config_parcount(r, 4);
+    dbrew_config_force_unknown(r, 0);
+    dbrew_set_vectorsize(r, vs);
+    rf = (apply2_t) dbrew_rewrite(r, o2, a, b, N);
+
+    for(int n = 0; n < 20; n++) {
+        reference(4, n);
+        rf(o2, a, b, n);
+        res += compare(n);
+    }
+    reference(4, N);
+    rf(o2, a, b, N);
+    res += compare(N);
+    printf("%s (%d bytes): %s\n", name, vs, res ? "wrong" : "correct");
+    dbrew_free(r);
+    return res;
+}
+
+int main()
+{
+    int res = 0;
+
+    for(int i = 0; i <= N; i++)
+        a[i] = (i % 7) - 3.5f;
+    for(int i = 0; i < N; i++)
+        b[i] = (i % 5) - 2.0f;
+
+    // 64 bytes falls back to 32 without AVX-512
+    for(int vs = 16; vs <= 64; vs *= 2) {
+        res += check("R4V4", 0, sq, vs);
+        res += check("R4V4 clamp", 1, clamp, vs);
+        res += check("R4P4", 2, pair, vs);
+        res += check("R4V4 scalar fallback", 3, branch, vs);
+        res += check2("R4V4V4 select", select2, vs);
+    }
+
+    // direct calls, using generated loops
+    reference(0, N);
+    dbrew_apply_R4V4(k_sq, o2, a, N);
+    res += compare(N);
+    reference(2, N);
+    dbrew_apply_R4P4(k_pair, o2, a, N);
+    res += compare(N);
+    reference(4, N);
+    dbrew_apply_R4V4V4(k_select, o2, a, b, N);
+    res += compare(N);
+    printf("direct: %s\n", res ? "wrong" : "correct");
+
+    return res;
+}
@@ -0,0 +1,199 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+// x * x + 1
+double k_sq(double x);
+__asm__(
+    "    .text\n"
+    "    .globl k_sq\n"
+    "k_sq:\n"
+    "    mulsd %xmm0, %xmm0\n"
+    "    addsd c_one, %xmm0\n"
+    "    ret\n");
+
+// max(a, b) - a
+double k_diff(double a, double b);
+__asm__(
+    "    .text\n"
+    "    .globl k_diff\n"
+    "k_diff:\n"
+    "    movapd %xmm0, %xmm2\n"
+    "    maxsd %xmm1, %xmm0\n"
+    "    subsd %xmm2, %xmm0\n"
+    "    ret\n");
+
+// v[0] + v[1]
+double k_pair(double* v);
+__asm__(
+    "    .text\n"
+    "    .globl k_pair\n"
+    "k_pair:\n"
+    "    movsd (%rdi), %xmm0\n"
+    "    addsd 8(%rdi), %xmm0\n"
+    "    ret\n");
+
+// fabs via branch depending on value: not vectorizable
+double k_branch(double x);
+__asm__(
+    "    .text\n"
+    "    .globl k_branch\n"
+    "k_branch:\n"
+    "    xorpd %xmm1, %xmm1\n"
+    "    ucomisd %xmm0, %xmm1\n"
+    "    jbe 1f\n"
+    "    xorpd c_signmask, %xmm0\n"
+    "1:  ret\n"
+    "    .section .rodata\n"
+    "    .align 16\n"
+    "c_signmask:\n"
+    "    .quad 0x8000000000000000, 0x8000000000000000\n"
+    "c_one:\n"
+    "    .double 1.0\n"
+    "    .text\n");
+
+#define N 1003
+
+double a[N + 1], b[N], o1[N], o2[N];
+
+void sq(double* ov, double* iv, int n)     { dbrew_apply_R8V8(k_sq, ov, iv, n); }
+void pair(double* ov, double* iv, int n)   { dbrew_apply_R8P8(k_pair, ov, iv, n); }
+void branch(double* ov, double* iv, int n) { dbrew_apply_R8V8(k_branch, ov, iv, n); }
+void diff(double* ov, double* i1v, double* i2v, int n)
+{
+    dbrew_apply_R8V8V8(k_diff, ov, i1v, i2v, n);
+}
+
+typedef void (*apply_t)(double*, double*, int);
+typedef void (*apply2_t)(double*, double*, double*, int);
+
+static
+int compare(int n)
+{
+    int res = 0;
+    for(int i = 0; i < n; i++)
+        if (o1[i] != o2[i]) res++;
+    return res;
+}
+
+// reference result via scalar kernel
+static
+void reference(int k, int n)
+{
+    for(int i = 0; i < n; i++) {
+        switch(k) {
+        case 0: o1[i] = k_sq(a[i]); break;
+        case 1: o1[i] = k_pair(a + i); break;
+        case 2: o1[i] = k_branch(a[i]); break;
+        default: o1[i] = k_diff(a[i], b[i]); break;
+        }
+    }
+}
+
+static
+int check(const char* name, int k, apply_t f, int vs)
+{
+    Rewriter* r;
+    apply_t rf;
+    int res = 0;
+
+    r = dbrew_new();
+    dbrew_set_capture_capacity(r, 5000, 200, 20000);
+    dbrew_set_function(r, (uint64_t) f);
+    dbrew_config_parcount(r, 3);
+    dbrew_config_force_unknown(r, 0);
+    dbrew_set_vectorsize(r, vs);
+    rf = (apply_t) dbrew_rewrite(r, o2, a, N);
+
+    // different lengths, including tails and empty range
+    for(int n = 0; n < 8; n++) {
+        reference(k, n);
+        rf(o2, a, n);
+        res += compare(n);
+    }
+    reference(k, N);
+    rf(o2, a, N);
+    res += compare(N);
+    printf("%s (%d bytes): %s\n", name, vs, res ? "wrong" : "correct");
+    dbrew_free(r);
+    return res;
+}
+
+static
+int check2(const char* name, apply2_t f, int vs)
+{
+    Rewriter* r;
+    apply2_t rf;
+    int res = 0;
+
+    r = dbrew_new();
+    dbrew_set_capture_capacity(r, 5000, 200, 20000);
+    dbrew_set_function(r, (uint64_t) f);
+    dbrew_config_parcount(r, 4);
+    dbrew_config_force_unknown(r, 0);
+    dbrew_set_vectorsize(r, vs);
+    rf = (apply2_t) dbrew_rewrite(r, o2, a, b, N);
+
+    for(int n = 0; n < 8; n++) {
+        reference(3, n);
+        rf(o2, a, b, n);
+        res += compare(n);
+    }
+    reference(3, N);
+    rf(o2, a, b, N);
+    res += compare(N);
+    printf("%s (%d bytes): %s\n", name, vs, res ? "wrong" : "correct");
+    dbrew_free(r);
+    return res;
+}
+
+// direct calls, using generated loops
+static
+int direct(void)
+{
+    int res = 0;
+
+    reference(0, N);
+    dbrew_apply_R8V8(k_sq, o2, a, N);
+    res += compare(N);
+    reference(1, N);
+    dbrew_apply_R8P8(k_pair, o2, a, N);
+    res += compare(N);
+    reference(2, N);
+    dbrew_apply_R8V8(k_branch, o2, a, N);
+    res += compare(N);
+    reference(3, N);
+    dbrew_apply_R8V8V8(k_diff, o2, a, b, N);
+    res += compare(N);
+    return res;
+}
+
+int main()
+{
+    int res = 0;
+
+    for(int i = 0; i <= N; i++)
+        a[i] = (i % 7) - 3.5;
+    for(int i = 0; i < N; i++)
+        b[i] = (i % 5) - 2.0;
+
+    for(int vs = 16; vs <= 64; vs *= 2) {
+        res += check("R8V8", 0, sq, vs);
+        res += check("R8P8", 1, pair, vs);
+        res += check("R8V8 scalar fallback", 2, branch, vs);
+        res += check2("R8V8V8", diff, vs);
+    }
+
+    res += direct();
+    printf("direct: %s\n", res ? "wrong" : "correct");
+
+    // 4 threads, chunks of 100 elements
+    dbrew_set_apply_threads(4, 100);
+    res += direct();
+    printf("direct with threads: %s\n", res ? "wrong" : "correct");
+
+    return res;
+}
@@ -0,0 +1,77 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+typedef long (*f1_t)(long, long, long);
+
+// Horner evaluation of polynomial of degree <n> with all coefficients <c>
+__attribute__ ((noinline))
+long f1(long n, long c, long x)
+{
+    long s = c;
+    for(long i = 0; i < n; i++)
+        s = s * x + c;
+    return s;
+}
+
+#define COUNT 24
+
+static
+int check(const char* name, int ok, uint64_t* funcs, uint64_t* pars)
+{
+    int res = 0;
+
+    printf("%s: %d of %d rewritten\n", name, ok, COUNT);
+    for(int i = 0; i < COUNT; i++) {
+        long n = (long) pars[3*i];
+        long c = (long) pars[3*i + 1];
+        if (funcs[i] == (uint64_t) f1) res++;
+        for(long x = -2; x < 3; x++) {
+            long orig = f1(n, c, x);
+            long rewritten = ((f1_t) funcs[i])(n, c, x);
+            if (orig == rewritten) continue;
+            printf(" n = %ld, c = %ld, x = %ld: orig/rewritten: %ld/%ld\n",
+                   n, c, x, orig, rewritten);
+            res++;
+        }
+    }
+    return res;
+}
+
+int main(void)
+{
+    uint64_t pars[3 * COUNT], funcs[COUNT];
+    int res = 0, ok;
+
+    // distinct (degree, coefficient) tuples, degrees needing different
+    // amounts of code
+    for(int i = 0; i < COUNT; i++) {
+        pars[3*i] = i % 6 + 1;
+        pars[3*i + 1] = i / 6 - 2;
+        pars[3*i + 2] = 0;
+    }
+
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) f1);
+    dbrew_config_parcount(r, 3);
+    dbrew_config_staticpar(r, 0);
+    dbrew_config_staticpar(r, 1);
+
+    ok = dbrew_rewrite_batch(r, COUNT, pars, funcs, 1);
+    res += check("sequential", ok, funcs, pars);
+
+    // each specialization has its own code, even if more code storage
+    // was needed than estimated from the first one
+    for(int i = 0; i < COUNT; i++)
+        for(int j = 0; j < i; j++)
+            if (funcs[i] == funcs[j]) res++;
+
+    ok = dbrew_rewrite_batch(r, COUNT, pars, funcs, 3);
+    res += check("3 threads", ok, funcs, pars);
+
+    dbrew_free(r);
+    return res;
+}
@@ -0,0 +1,87 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+typedef long (*f1_t)(long, long);
+
+// nested loops with static trip counts get fully unrolled: emulated and
+// captured instructions as well as code size grow with n*n
+__attribute__ ((noinline))
+long f1(long n, long x)
+{
+    long s = 0;
+    for(long i = 0; i < n; i++)
+        for(long j = 0; j < n; j++)
+            s += (x ^ i) * j;
+    return s;
+}
+
+static
+const char* limitName(DBrewBudgetLimit l)
+{
+    switch(l) {
+    case BL_None:      return "none";
+    case BL_Emulated:  return "emulated";
+    case BL_Captured:  return "captured";
+    case BL_CodeBytes: return "code bytes";
+    case BL_Time:      return "time";
+    default: break;
+    }
+    return "?";
+}
+
+// rewrite f1 with static loop count <n>, check result
+static
+int check(const char* name, Rewriter* r, long n)
+{
+    f1_t f = (f1_t) dbrew_rewrite(r, n, 0);
+    int ok = (f(n, 3) == f1(n, 3));
+
+    printf("%s: %s, limit hit: %s%s\n", name,
+           (f == f1) ? "original" : "rewritten",
+           limitName(dbrew_budget_exceeded(r)), ok ? "" : ", wrong result");
+    return ok ? 0 : 1;
+}
+
+int main(void)
+{
+    int res = 0;
+
+    Rewriter* r = dbrew_new();
+    // room for full unrolling, such that only the budget can stop it
+    dbrew_set_capture_capacity(r, 100000, 10000, 1 << 20);
+    dbrew_set_function(r, (uint64_t) f1);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_staticpar(r, 0);
+
+    res += check("no budget", r, 10);
+    res += check("no budget, large", r, 40);
+
+    // each limit is below what unrolling 40*40 iterations needs
+    dbrew_set_budget(r, 2000, 0, 0, 0);
+    res += check("emulated", r, 40);
+    dbrew_set_budget(r, 0, 1000, 0, 0);
+    res += check("captured", r, 40);
+    dbrew_set_budget(r, 0, 0, 4096, 0);
+    res += check("code bytes", r, 40);
+    dbrew_set_budget(r, 0, 0, 0, 1);
+    res += check("time", r, 400);
+
+    // with degradation, the loops are not unrolled
+    dbrew_set_budget(r, 2000, 0, 0, 0);
+    dbrew_set_budget_degrade(r, true);
+    res += check("degrade", r, 40);
+
+    // sufficient budget
+    res += check("small", r, 4);
+
+    // no retry once the time is spent
+    dbrew_set_budget(r, 0, 0, 0, 1);
+    res += check("degrade time", r, 400);
+
+    dbrew_free(r);
+    return res;
+}
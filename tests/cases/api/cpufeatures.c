@@ -0,0 +1,148 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+// a * b + c
+double k_madd(double a, double b, double c);
+__asm__(
+    "    .text\n"
+    "    .globl k_madd\n"
+    "k_madd:\n"
+    "    mulsd %xmm1, %xmm0\n"
+    "    addsd %xmm2, %xmm0\n"
+    "    ret\n");
+
+// a * (*p) - c
+double k_msub(double* p, double a, double c);
+__asm__(
+    "    .text\n"
+    "    .globl k_msub\n"
+    "k_msub:\n"
+    "    mulsd (%rdi), %xmm0\n"
+    "    subsd %xmm1, %xmm0\n"
+    "    ret\n");
+
+// ((a << s) - (b >> s)) + (~a & b), arithmetic shift
+long k_bits(long a, long b, long s);
+__asm__(
+    "    .text\n"
+    "    .globl k_bits\n"
+    "k_bits:\n"
+    "    mov %edx, %ecx\n"
+    "    mov %rdi, %rax\n"
+    "    shl %cl, %rax\n"
+    "    mov %rsi, %rdx\n"
+    "    sar %cl, %rdx\n"
+    "    sub %rdx, %rax\n"
+    "    mov %rdi, %rdx\n"
+    "    not %rdx\n"
+    "    and %rsi, %rdx\n"
+    "    add %rdx, %rax\n"
+    "    ret\n");
+
+typedef double (*madd_t)(double, double, double);
+typedef double (*msub_t)(double*, double, double);
+typedef long (*bits_t)(long, long, long);
+
+// does generated code of <r> contain VEX 0F38 opcode <opc>?
+static
+bool hasOpcode0F38(Rewriter* r, int opc)
+{
+    uint8_t* p = (uint8_t*) dbrew_generated_code(r);
+    int size = dbrew_generated_size(r);
+
+    for(int i = 0; i + 3 < size; i++)
+        if ((p[i] == 0xC4) && ((p[i+1] & 31) == 2) && (p[i+3] == opc))
+            return true;
+    return false;
+}
+
+static
+Rewriter* newRewriter(uint64_t f, uint32_t features)
+{
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, f);
+    dbrew_config_parcount(r, 3);
+    dbrew_config_force_unknown(r, 0);
+    dbrew_set_cpu_features(r, features);
+    return r;
+}
+
+int main()
+{
+    uint32_t host = dbrew_cpu_features();
+    bool hasFma = (host & CF_FMA) != 0;
+    bool hasBmi = (host & (CF_BMI1 | CF_BMI2)) == (CF_BMI1 | CF_BMI2);
+    double x = 1.5, big = 1.0 + 0x1p-30, small = 1.0 - 0x1p-30;
+    Rewriter* r;
+    madd_t fm;
+    msub_t fs;
+    bits_t fb;
+    int res = 0;
+
+    printf("host features consistent: %s\n",
+           (((host & CF_AVX2) != 0) == !!__builtin_cpu_supports("avx2")) &&
+           (((host & CF_FMA) != 0) == !!__builtin_cpu_supports("fma")) &&
+           (((host & CF_BMI2) != 0) == !!__builtin_cpu_supports("bmi2"))
+           ? "yes" : "no");
+
+    // FMA only used if enabled
+    r = newRewriter((uint64_t) k_madd, host);
+    fm = (madd_t) dbrew_rewrite(r, 1.0, 2.0, 3.0);
+    printf("no FMA by default: %s\n",
+           !hasOpcode0F38(r, 0xA9) && (fm(big, small, -1.0) == 0.0)
+           ? "yes" : "no");
+    dbrew_set_fp_contract(r, true);
+    fm = (madd_t) dbrew_rewrite(r, 1.0, 2.0, 3.0);
+    if (fm(1.5, 2.0, 0.25) != 3.25) res++;
+    // with FMA, product is not rounded before the addition
+    printf("madd: %s, fused: %s\n", res ? "wrong" : "correct",
+           (hasOpcode0F38(r, 0xA9) == hasFma) &&
+           ((fm(big, small, -1.0) == -0x1p-60) == hasFma) ? "yes" : "no");
+    dbrew_free(r);
+
+    r = newRewriter((uint64_t) k_msub, host);
+    dbrew_set_fp_contract(r, true);
+    fs = (msub_t) dbrew_rewrite(r, &x, 1.0, 2.0);
+    if (fs(&x, 2.0, 0.5) != 2.5) res++;
+    printf("msub: %s, fused: %s\n", res ? "wrong" : "correct",
+           hasOpcode0F38(r, 0x9B) == hasFma ? "yes" : "no");
+    dbrew_free(r);
+
+    // BMI instructions only used with features allowing them
+    for(int bmi = 0; bmi < 2; bmi++) {
+        uint32_t f = bmi ? host : (host & ~(CF_BMI1 | CF_BMI2));
+        int wrong = 0;
+
+        r = newRewriter((uint64_t) k_bits, f);
+        fb = (bits_t) dbrew_rewrite(r, 1, 2, 3);
+        for(long s = 0; s < 64; s += 7)
+            if (fb(0x1234, -5678, s) != k_bits(0x1234, -5678, s)) wrong++;
+        printf("bits %s BMI: %s, andn/shlx: %s\n", bmi ? "with" : "without",
+               wrong ? "wrong" : "correct",
+               (hasOpcode0F38(r, 0xF2) && hasOpcode0F38(r, 0xF7)) ==
+               (bmi && hasBmi) ? "yes" : "no");
+        res += wrong;
+        dbrew_free(r);
+    }
+
+    // one version per feature level behind a stub
+    for(int all = 0; all < 2; all++) {
+        r = newRewriter((uint64_t) k_madd, all ? host : 0);
+        dbrew_set_fp_contract(r, true);
+        dbrew_set_multiversion(r, true);
+        fm = (madd_t) dbrew_rewrite(r, 1.0, 2.0, 3.0);
+        int wrong = (fm(1.5, 2.0, 0.25) != 3.25);
+        printf("multiversion, %s features: %s, fused: %s\n",
+               all ? "host" : "no", wrong ? "wrong" : "correct",
+               ((fm(big, small, -1.0) == -0x1p-60) == (all && hasFma))
+               ? "yes" : "no");
+        res += wrong;
+        dbrew_free(r);
+    }
+
+    return res;
+}
@@ -0,0 +1,101 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+typedef long (*f_t)(long, long);
+
+// helper called from both rewritten functions
+__attribute__ ((noinline))
+long shared(long a, long b)
+{
+    if (a > b)
+        return (a << 2) - b;
+    return a ^ (b + 7);
+}
+
+__attribute__ ((noinline))
+long f1(long n, long x)
+{
+    long s = 0;
+    for(long i = 0; i < n; i++)
+        s += shared(x, i);
+    return s;
+}
+
+__attribute__ ((noinline))
+long f2(long k, long x)
+{
+    return shared(x, k) * shared(k, x);
+}
+
+static
+Rewriter* newRewriter(uint64_t f, bool sharedCache)
+{
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, f);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_staticpar(r, 0);
+    dbrew_set_shared_decode_cache(r, sharedCache);
+    return r;
+}
+
+// rewrite with static first parameter <n>, return number of BBs decoded
+static
+long check(const char* name, Rewriter* r, f_t orig, long n, int* res)
+{
+    DBrewStats s1, s2;
+    int ok = 1;
+
+    dbrew_get_stats(r, &s1);
+    f_t f = (f_t) dbrew_rewrite(r, n, 0);
+    dbrew_get_stats(r, &s2);
+    for(long x = -3; x < 12; x += 5)
+        if (f(n, x) != orig(n, x)) ok = 0;
+
+    printf("%s: n = %ld, %s\n", name, n,
+           (f == orig) ? "not rewritten" : ok ? "ok" : "wrong result");
+    if ((f == orig) || !ok) (*res)++;
+    return (long) (s2.decodeCacheMisses - s1.decodeCacheMisses);
+}
+
+int main(void)
+{
+    int res = 0;
+    long own, misses1, misses2;
+
+    // without shared cache, every BB of f2 and helper gets decoded
+    Rewriter* r0 = newRewriter((uint64_t) f2, false);
+    own = check("r0", r0, f2, 3, &res);
+    dbrew_free(r0);
+
+    // first rewriter fills cache with BBs of helper, second one finds them
+    Rewriter* r1 = newRewriter((uint64_t) f1, true);
+    Rewriter* r2 = newRewriter((uint64_t) f2, true);
+    check("r1", r1, f1, 4, &res);
+    misses1 = check("r2", r2, f2, 3, &res);
+    printf("r2 decodes less than r0: %s\n", (misses1 < own) ? "yes" : "no");
+
+    // after invalidating the helper, r1 decodes it again into the shared
+    // cache, where r2 finds it
+    dbrew_decode_cache_invalidate((uint64_t) shared, 1);
+    misses1 = check("r1", r1, f1, 5, &res);
+    misses2 = check("r2", r2, f2, 7, &res);
+    printf("helper decoded again: %s, found in cache: %s\n",
+           (misses1 > 0) ? "yes" : "no", (misses2 == 0) ? "yes" : "no");
+
+    dbrew_free(r1);
+
+    // cache gets refilled after flush; decoded BBs of live rewriters
+    // do not point into the cache and stay valid
+    dbrew_decode_cache_flush();
+    Rewriter* r3 = newRewriter((uint64_t) f1, true);
+    check("r3", r3, f1, 3, &res);
+    check("r2", r2, f2, 8, &res);
+    dbrew_free(r2);
+    dbrew_free(r3);
+
+    return res;
+}
@@ -0,0 +1,109 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+typedef long (*f_t)(long, long*, long);
+
+// sum of first n elements of p, plus c
+__attribute__ ((noinline))
+long sum(long n, long* p, long c)
+{
+    long s = c;
+    for(long i = 0; i < n; i++)
+        s += p[i];
+    return s;
+}
+
+typedef long (*g_t)(long, long);
+
+// with narrow key parameter n
+__attribute__ ((noinline))
+long scaleInt(int n, long x)
+{
+    return n * x;
+}
+
+long asm_scaleChar(signed char n, long x);
+__asm__(
+    "    .text\n"
+    "    .globl asm_scaleChar\n"
+    "asm_scaleChar:\n"
+    "    movsbq %dil, %rax\n"
+    "    imul %rsi, %rax\n"
+    "    ret\n");
+
+// dispatch on key <n> of width <w> passed with garbage in upper bits
+static
+int checkNarrowKey(const char* name, uint64_t func, int w, long n)
+{
+    int res = 0;
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, func);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_staticpar(r, 0);
+    dbrew_config_par_width(r, 0, w);
+    Dispatcher* d = dbrew_dispatcher_new(r, 4);
+    // call via type with 64-bit parameter to control upper bits
+    g_t g = (g_t) dbrew_dispatcher_stub(d);
+    g_t orig = (g_t) func;
+
+    dbrew_dispatcher_add(d, n, 0);
+    if (!dbrew_dispatcher_set_auto(d, true)) res++;
+    for(long upper = 1; upper < 4; upper++) {
+        long par = (upper << 32) | (n & ((1l << (8 * w)) - 1));
+        if (g(par, 7) != orig(par, 7)) res++;
+    }
+    printf("%s key: %s, specializations: %d\n", name,
+           res ? "wrong" : "correct", dbrew_dispatcher_count(d));
+
+    dbrew_dispatcher_free(d);
+    dbrew_free(r);
+    return res;
+}
+
+int main()
+{
+    long a[10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    int res = 0;
+    Rewriter* r;
+    Dispatcher* d;
+    f_t f;
+
+    // key: n
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) sum);
+    dbrew_config_parcount(r, 3);
+    dbrew_config_staticpar(r, 0);
+    d = dbrew_dispatcher_new(r, 4);
+    f = (f_t) dbrew_dispatcher_stub(d);
+
+    printf("empty: %ld\n", f(3, a, 100));
+    dbrew_dispatcher_add(d, 3, a, 0);
+    dbrew_dispatcher_add(d, 5, a, 0);
+    printf("specializations: %d\n", dbrew_dispatcher_count(d));
+    for(long n = 0; n <= 10; n++)
+        if (f(n, a, n) != sum(n, a, n)) res++;
+    printf("dispatch with 2 specializations: %s\n",
+           res ? "wrong" : "correct");
+
+    // new key values get specialized until maximum is reached
+    dbrew_dispatcher_set_auto(d, true);
+    for(long n = 0; n <= 10; n++)
+        if (f(n, a, 1) != sum(n, a, 1)) res++;
+    printf("auto specialization: %s, specializations: %d\n",
+           res ? "wrong" : "correct", dbrew_dispatcher_count(d));
+    for(long n = 0; n <= 10; n++)
+        if (f(n, a, 2) != sum(n, a, 2)) res++;
+    printf("dispatch with maximum reached: %s\n",
+           res ? "wrong" : "correct");
+
+    dbrew_dispatcher_free(d);
+    dbrew_free(r);
+
+    res += checkNarrowKey("int", (uint64_t) scaleInt, 4, 3);
+    res += checkNarrowKey("char", (uint64_t) asm_scaleChar, 1, -2);
+    return res;
+}
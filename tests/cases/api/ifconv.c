@@ -0,0 +1,83 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+typedef long (*f_t)(long, long, long);
+
+// if/else selecting between registers, followed by an if without else
+long asm_sel(long a, long b, long c);
+__asm__(
+    "    .text\n"
+    "    .globl asm_sel\n"
+    "asm_sel:\n"
+    "    cmp %rsi, %rdi\n"
+    "    jl 1f\n"
+    "    mov %rdi, %rax\n"
+    "    jmp 2f\n"
+    "1:  mov %rsi, %rax\n"
+    "2:  test %rdx, %rdx\n"
+    "    jns 3f\n"
+    "    mov %rdx, %rax\n"
+    "3:  add %rdx, %rax\n"
+    "    ret\n");
+
+// comparison result as 0/1
+long asm_lt(long a, long b, long c);
+__asm__(
+    "    .text\n"
+    "    .globl asm_lt\n"
+    "asm_lt:\n"
+    "    xor %eax, %eax\n"
+    "    cmp %rsi, %rdi\n"
+    "    jge 1f\n"
+    "    mov $1, %eax\n"
+    "1:  ret\n");
+
+static
+f_t rewrite(f_t f, bool ifconv, int* size)
+{
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) f);
+    dbrew_config_parcount(r, 3);
+    dbrew_set_if_conversion(r, ifconv, 4);
+    f_t rf = (f_t) dbrew_rewrite(r, 0, 0, 0);
+    *size = dbrew_generated_size(r);
+    return rf;
+}
+
+static
+int check(const char* name, f_t f)
+{
+    int res = 0, s0, s1;
+    f_t f0 = rewrite(f, false, &s0);
+    f_t f1 = rewrite(f, true, &s1);
+
+    printf("%s with if-conversion: %s, %s\n", name,
+           (f1 == f) ? "original" : "rewritten",
+           (s1 < s0) ? "smaller code" : "no smaller code");
+    for(long a = -2; a <= 2; a++)
+        for(long b = -2; b <= 2; b++)
+            for(long c = -1; c <= 1; c++) {
+                long r = f(a, b, c);
+                long r0 = f0(a, b, c);
+                long r1 = f1(a, b, c);
+                if ((r0 != r) || (r1 != r)) {
+                    printf(" %ld/%ld/%ld: orig/rewritten: %ld/%ld/%ld\n",
+                           a, b, c, r, r0, r1);
+                    res++;
+                }
+            }
+    return res;
+}
+
+int main(void)
+{
+    int res = 0;
+
+    res += check("select", asm_sel);
+    res += check("compare", asm_lt);
+    return res;
+}
@@ -0,0 +1,101 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbrew.h"
+
+typedef long (*f_t)(long, long);
+
+// a * b + 1
+long asm_f(long a, long b);
+__asm__(
+    "    .text\n"
+    "    .align 16\n"
+    "    .globl asm_f\n"
+    "asm_f:\n"
+    "    mov %rdi, %rax\n"
+    "    imul %rsi, %rax\n"
+    "    add $1, %rax\n"
+    "    ret\n");
+
+// entry with a 1-byte instruction followed by a jump target
+long asm_g(long a, long b);
+__asm__(
+    "    .text\n"
+    "    .align 16\n"
+    "    .globl asm_g\n"
+    "asm_g:\n"
+    "    nop\n"
+    "1:  sub $1, %rdi\n"
+    "    jg 1b\n"
+    "    mov %rsi, %rax\n"
+    "    ret\n");
+
+// permissions of mapping containing <a> from /proc/self/maps into <perms>
+static
+void getPerms(uint64_t a, char* perms)
+{
+    uint64_t start, end;
+    char line[300];
+    FILE* f = fopen("/proc/self/maps", "r");
+
+    strcpy(perms, "?");
+    if (!f) return;
+    while(fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%lx-%lx %4s", &start, &end, perms) != 3) continue;
+        if ((a >= start) && (a < end)) break;
+        strcpy(perms, "?");
+    }
+    fclose(f);
+}
+
+int main()
+{
+    char perms0[5], perms1[5];
+    // call via pointer to prevent compiler from optimizing the calls
+    volatile f_t f = asm_f;
+    volatile f_t g = asm_g;
+    Rewriter* r;
+
+    // specialize for a = 2: installed code ignores a
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) asm_f);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_staticpar(r, 0);
+    dbrew_rewrite(r, 2, 0);
+    getPerms((uint64_t) asm_f, perms0);
+
+    printf("before install: f(3,5) = %ld\n", f(3, 5));
+    printf("install: %s\n", dbrew_install(r) ? "ok" : "failed");
+    printf("installed: f(3,5) = %ld\n", f(3, 5));
+    dbrew_uninstall(r);
+    printf("uninstalled: f(3,5) = %ld\n", f(3, 5));
+    getPerms((uint64_t) asm_f, perms1);
+    printf("protection of code restored: %s\n",
+           strcmp(perms0, perms1) ? "no" : "yes");
+
+    // rewriting again removes installation
+    dbrew_install(r);
+    dbrew_rewrite(r, 4, 0);
+    printf("rewritten again: f(3,5) = %ld\n", f(3, 5));
+    dbrew_install(r);
+    printf("installed again: f(3,5) = %ld\n", f(3, 5));
+    dbrew_free(r);
+    printf("rewriter freed: f(3,5) = %ld\n", f(3, 5));
+
+    // jump target within first bytes: patch not allowed
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) asm_g);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_staticpar(r, 0);
+    dbrew_rewrite(r, 3, 0);
+    printf("install with jump target at entry: %s\n",
+           dbrew_install(r) ? "ok" : "failed");
+    printf("g(3,5) = %ld\n", g(3, 5));
+    dbrew_free(r);
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+typedef long (*f_t)(long, long);
+
+// switch with bounds check and jump via register
+long asm_sw(long op, long x);
+__asm__(
+    "    .text\n"
+    "    .globl asm_sw\n"
+    "asm_sw:\n"
+    "    cmp $3, %rdi\n"
+    "    ja 9f\n"
+    "    mov sw_table(,%rdi,8), %rax\n"
+    "    jmp *%rax\n"
+    "1:  lea 1(%rsi), %rax\n"
+    "    ret\n"
+    "2:  lea (%rsi,%rsi), %rax\n"
+    "    ret\n"
+    "3:  mov %rsi, %rax\n"
+    "    neg %rax\n"
+    "    ret\n"
+    "9:  xor %eax, %eax\n"
+    "    ret\n"
+    "    .section .rodata\n"
+    "    .align 8\n"
+    "sw_table:\n"
+    "    .quad 1b, 2b, 3b, 9b\n"
+    "    .text\n");
+
+// jump via memory operand, without bounds check
+long asm_sw2(long op, long x);
+__asm__(
+    "    .text\n"
+    "    .globl asm_sw2\n"
+    "asm_sw2:\n"
+    "    mov %rsi, %rax\n"
+    "    and $1, %rdi\n"
+    "    jmp *sw2_table(,%rdi,8)\n"
+    "1:  add $10, %rax\n"
+    "    ret\n"
+    "2:  sub $10, %rax\n"
+    "    ret\n"
+    "    .section .rodata\n"
+    "    .align 8\n"
+    "    .globl sw2_table\n"
+    "sw2_table:\n"
+    "    .quad 1b, 2b\n"
+    "    .text\n");
+extern char sw2_table[];
+
+static
+int check(const char* name, f_t f, f_t rf, long from, long to)
+{
+    int res = 0;
+    for(long op = from; op <= to; op++)
+        if (rf(op, 5) != f(op, 5)) res++;
+    printf("%s: %s, %s\n", name, (rf == f) ? "original" : "rewritten",
+           res ? "wrong results" : "correct results");
+    return res;
+}
+
+int main()
+{
+    Rewriter* r;
+    f_t rf;
+    int res = 0;
+
+    // dynamic index: table size from bounds check
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) asm_sw);
+    dbrew_config_parcount(r, 2);
+    rf = (f_t) dbrew_rewrite(r, 0, 0);
+    res += check("dynamic index", asm_sw, rf, -2, 6);
+
+    // static index: only one case is kept
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) asm_sw);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_staticpar(r, 0);
+    rf = (f_t) dbrew_rewrite(r, 2, 0);
+    res += check("static index", asm_sw, rf, 2, 2);
+    printf("static index: %d bytes\n", dbrew_generated_size(r));
+
+    // table without bounds check needs configured size
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) asm_sw2);
+    dbrew_config_parcount(r, 2);
+    rf = (f_t) dbrew_rewrite(r, 0, 0);
+    printf("unknown table size: %s\n",
+           (rf == asm_sw2) ? "original" : "rewritten");
+
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) asm_sw2);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_jumptable(r, (uint64_t) sw2_table, 2);
+    rf = (f_t) dbrew_rewrite(r, 0, 0);
+    res += check("configured table", asm_sw2, rf, -3, 3);
+
+    return res;
+}
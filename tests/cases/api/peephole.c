@@ -0,0 +1,94 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+#include "priv/common.h" // DBB/Instr: check instructions in rewritten code
+
+typedef long (*f_t)(long, long*);
+
+uint64_t makeDynamic(uint64_t);
+
+// instruction sequences as found in captured code: the calls to
+// makeDynamic result in moves of immediates into registers
+long asm_f(long x, long* a);
+__asm__(
+    "    .text\n"
+    "    .globl asm_f\n"
+    "asm_f:\n"
+    "    lea 8(%rsi), %rdx\n"
+    "    lea 16(%rdx), %rdx\n"
+    "    mov (%rdx), %rax\n"
+    "    sub $1, %rdi\n"
+    "    sub $2, %rdi\n"
+    "    add %rdi, %rax\n"
+    "    push %rax\n"
+    "    mov $2, %edi\n"
+    "    call makeDynamic\n"
+    "    pop %rdx\n"
+    "    add (%rsi,%rax,8), %rdx\n"
+    "    add %rax, %rdx\n"
+    "    push %rdx\n"
+    "    mov $2, %edi\n"
+    "    call makeDynamic\n"
+    "    pop %rdx\n"
+    "    add %rax, %rdx\n"
+    "    addq $0, (%rsi)\n"
+    "    mov %rdx, %rax\n"
+    "    ret\n");
+
+// print instruction counts of rewritten code at <f>, a single basic block:
+// folded sub/lea chains and propagated constants show up here
+static
+void printInstrCounts(uint64_t f)
+{
+    int subs = 0, leas = 0, imms = 0;
+    Rewriter* d = dbrew_new();
+    DBB* bb = dbrew_decode(d, f);
+
+    for(int i = 0; i < bb->count; i++) {
+        Instr* instr = bb->instr + i;
+        if (instr->type == IT_SUB) subs++;
+        if (instr->type == IT_LEA) leas++;
+        if (opIsImm(&(instr->src))) imms++;
+    }
+    printf(" %d instructions, %d sub, %d lea, %d with immediate\n",
+           bb->count, subs, leas, imms);
+    dbrew_free(d);
+}
+
+long a[10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+
+static
+f_t rewrite(bool peephole, int* size)
+{
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) asm_f);
+    dbrew_config_parcount(r, 2);
+    dbrew_set_peephole(r, peephole);
+    f_t f = (f_t) dbrew_rewrite(r, 1, a);
+    *size = dbrew_generated_size(r);
+    return f;
+}
+
+int main(void)
+{
+    int res = 0, s0, s1;
+    f_t f0 = rewrite(false, &s0);
+    f_t f1 = rewrite(true, &s1);
+
+    printf("without peephole: %s\n", (f0 == asm_f) ? "original" : "rewritten");
+    printInstrCounts((uint64_t) f0);
+    printf("with peephole: %s, %s\n", (f1 == asm_f) ? "original" : "rewritten",
+           (s1 < s0) ? "smaller code" : "no smaller code");
+    printInstrCounts((uint64_t) f1);
+    for(long x = -10; x < 10; x += 3) {
+        if ((f0(x, a) != asm_f(x, a)) || (f1(x, a) != asm_f(x, a))) {
+            printf(" x = %ld: orig/rewritten: %ld/%ld/%ld\n",
+                   x, asm_f(x, a), f0(x, a), f1(x, a));
+            res++;
+        }
+    }
+    return res;
+}
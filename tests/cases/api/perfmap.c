@@ -0,0 +1,114 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dbrew.h"
+
+__attribute__ ((noinline))
+long scale(long k, long x)
+{
+    return k * x + k;
+}
+
+__attribute__ ((noinline))
+long sum(long n, long x)
+{
+    long s = 0;
+    for(long i = 0; i < n; i++)
+        s += x ^ i;
+    return s;
+}
+
+// code load record of jitdump file, followed by name and code bytes
+typedef struct {
+    uint32_t id, totalSize;
+    uint64_t timestamp;
+    uint32_t pid, tid;
+    uint64_t vma, codeAddr, codeSize, codeIndex;
+} CodeLoad;
+
+#define SPECS 3
+
+static
+Rewriter* newRewriter(uint64_t f, const char* name)
+{
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, f);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_staticpar(r, 0);
+    if (name)
+        dbrew_config_function_setname(r, f, name);
+    dbrew_set_perf_output(r, true, true);
+    return r;
+}
+
+int main(void)
+{
+    char fname[64], line[256], name[128], prefix[64];
+    unsigned long addr, size;
+    uint32_t header[10];
+    uint64_t gen[SPECS];
+    int found = 0, loads = 0, codeOk = 0;
+    Rewriter* r[SPECS];
+    CodeLoad rec;
+    FILE* f;
+
+    // two specializations of a named function, one of an unnamed one
+    r[0] = newRewriter((uint64_t) scale, "scale");
+    r[1] = newRewriter((uint64_t) scale, "scale");
+    r[2] = newRewriter((uint64_t) sum, 0);
+    gen[0] = dbrew_rewrite(r[0], 3, 0);
+    gen[1] = dbrew_rewrite(r[1], 10, 0);
+    gen[2] = dbrew_rewrite(r[2], 5, 0);
+
+    // unnamed functions are identified by address
+    sprintf(prefix, "dbrew:0x%lx#", (unsigned long) sum);
+    sprintf(fname, "/tmp/perf-%d.map", getpid());
+    f = fopen(fname, "r");
+    while(f && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%lx %lx %127s", &addr, &size, name) != 3) continue;
+        for(int i = 0; i < SPECS; i++)
+            if ((addr == gen[i]) &&
+                (size == (unsigned long) dbrew_generated_size(r[i])))
+                found++;
+        if (strncmp(name, prefix, strlen(prefix)) == 0)
+            printf("perf map entry: dbrew:<sum>#%s\n", name + strlen(prefix));
+        else
+            printf("perf map entry: %s\n", name);
+    }
+    printf("perf map entries for generated code: %d\n", found);
+    if (f) fclose(f);
+    unlink(fname);
+
+    // each code load record contains the generated bytes
+    sprintf(fname, "/tmp/jit-%d.dump", getpid());
+    f = fopen(fname, "r");
+    if (f && (fread(header, sizeof(header), 1, f) == 1))
+        printf("jitdump magic %x, version %d, header size %d\n",
+               header[0], header[1], header[2]);
+    while(f && (fread(&rec, sizeof(rec), 1, f) == 1)) {
+        char* rest = malloc(rec.totalSize - sizeof(rec));
+        if (fread(rest, rec.totalSize - sizeof(rec), 1, f) != 1) {
+            free(rest);
+            break;
+        }
+        loads++;
+        for(int i = 0; i < SPECS; i++) {
+            if (rec.codeAddr != gen[i]) continue;
+            if (memcmp(rest + strlen(rest) + 1, (void*) gen[i],
+                       rec.codeSize) == 0)
+                codeOk++;
+        }
+        free(rest);
+    }
+    printf("jitdump code loads: %d, with matching code: %d\n", loads, codeOk);
+    if (f) fclose(f);
+    unlink(fname);
+
+    for(int i = 0; i < SPECS; i++)
+        dbrew_free(r[i]);
+    return (found == SPECS) && (codeOk == SPECS) ? 0 : 1;
+}
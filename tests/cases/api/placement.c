@@ -0,0 +1,85 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+// last = bias + x
+long k_glob(long x);
+__asm__(
+    "    .text\n"
+    "    .globl k_glob\n"
+    "k_glob:\n"
+    "    mov bias, %rax\n"
+    "    add %rdi, %rax\n"
+    "    mov %rax, last\n"
+    "    ret\n");
+
+typedef long (*glob_t)(long);
+
+long bias = 100, last = 0;
+
+// distance of generated code of <r> from original function
+static
+long distance(Rewriter* r)
+{
+    long d = (long) (dbrew_generated_code(r) - (uint64_t) k_glob);
+    return (d < 0) ? -d : d;
+}
+
+// does generated code of <r> load %rax RIP-relative?
+static
+bool hasRipLoad(Rewriter* r)
+{
+    uint8_t* p = (uint8_t*) dbrew_generated_code(r);
+    int size = dbrew_generated_size(r);
+
+    for(int i = 0; i + 2 < size; i++)
+        if ((p[i] == 0x48) && (p[i+1] == 0x8B) && (p[i+2] == 0x05))
+            return true;
+    return false;
+}
+
+static
+int check(const char* name, bool nearCode, bool hugePages)
+{
+    Rewriter* r;
+    glob_t f;
+    int wrong = 0;
+
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) k_glob);
+    dbrew_config_parcount(r, 1);
+    dbrew_config_force_unknown(r, 0);
+    dbrew_set_code_placement(r, nearCode, hugePages);
+    f = (glob_t) dbrew_rewrite(r, 1);
+
+    for(long x = -3; x < 3; x++) {
+        bias = 10 * x;
+        if ((f(x) != 11 * x) || (last != 11 * x)) wrong++;
+    }
+    printf("%s: %s", name, wrong ? "wrong" : "correct");
+    if (nearCode)
+        printf(", near: %s, rip-relative: %s",
+               distance(r) < (1l << 31) ? "yes" : "no",
+               hasRipLoad(r) ? "yes" : "no");
+    if (hugePages)
+        printf(", 2MB aligned: %s",
+               (dbrew_generated_code(r) & ((2 << 20) - 1)) == 0 ? "yes" : "no");
+    printf("\n");
+    dbrew_free(r);
+    return wrong;
+}
+
+int main()
+{
+    int res = 0;
+
+    res += check("default", true, false);
+    res += check("anywhere", false, false);
+    res += check("huge pages", false, true);
+    res += check("near, huge pages", true, true);
+
+    return res;
+}
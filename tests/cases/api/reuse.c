@@ -0,0 +1,112 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "dbrew.h"
+
+// a + b
+long k_add(long a, long b);
+__asm__(
+    "    .text\n"
+    "    .globl k_add\n"
+    "k_add:\n"
+    "    lea (%rdi,%rsi), %rax\n"
+    "    ret\n");
+
+// (a > b) ? a : b
+long k_max(long a, long b);
+__asm__(
+    "    .text\n"
+    "    .globl k_max\n"
+    "k_max:\n"
+    "    mov %rdi, %rax\n"
+    "    cmp %rsi, %rdi\n"
+    "    jg 1f\n"
+    "    mov %rsi, %rax\n"
+    "1:  ret\n");
+
+typedef long (*func_t)(long, long);
+
+// counting allocation hooks
+static int allocs = 0;
+
+static
+void* countAlloc(size_t size, void* user)
+{
+    (void) user;
+    allocs++;
+    return malloc(size);
+}
+
+static
+void countFree(void* p, void* user)
+{
+    (void) user;
+    free(p);
+}
+
+int main()
+{
+    DBrewAllocator a = { countAlloc, countFree, 0, 0, 0 };
+    func_t funcs[2] = { k_add, k_max };
+    Rewriter* r;
+    func_t f;
+    int wrong = 0, warm;
+
+    r = dbrew_new();
+    dbrew_set_allocator(r, &a);
+    dbrew_set_function(r, (uint64_t) k_add);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_staticpar(r, 1);
+    f = (func_t) dbrew_rewrite(r, 0, 5);
+    if (f(3, 0) != 8) wrong++;
+    // buffers of passes only run on code with branches get allocated, too
+    dbrew_reuse(r, (uint64_t) k_max, true);
+    f = (func_t) dbrew_rewrite(r, 0, 5);
+    if (f(3, 0) != 5) wrong++;
+    warm = allocs;
+
+    // back to back with kept configuration: second parameter fixed to 5
+    for(int i = 0; i < 100; i++) {
+        dbrew_reuse(r, (uint64_t) funcs[i & 1], true);
+        f = (func_t) dbrew_rewrite(r, 0, 5);
+        if (f(i, 0) != funcs[i & 1](i, 5)) wrong++;
+    }
+    printf("reuse with config: %s, no allocations: %s\n",
+           wrong ? "wrong" : "correct", allocs == warm ? "yes" : "no");
+
+    // cleared configuration: both parameters dynamic
+    dbrew_reuse(r, (uint64_t) k_max, false);
+    dbrew_config_parcount(r, 2);
+    f = (func_t) dbrew_rewrite(r, 0, 5);
+    if ((f(7, 2) != 7) || (f(-1, 2) != 2)) wrong++;
+    printf("reuse without config: %s, no allocations: %s\n",
+           wrong ? "wrong" : "correct", allocs == warm ? "yes" : "no");
+
+    // with near placement, code storage gets moved for a function out of
+    // reach: use a copy of k_add far away from the binary
+    uint8_t* far = mmap((void*) (1ul << 45), 4096,
+                        PROT_READ | PROT_WRITE | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (far == MAP_FAILED) return 1;
+    memcpy(far, (void*) k_add, 5);
+    dbrew_set_code_placement(r, true, false);
+    dbrew_reuse(r, (uint64_t) k_add, false);
+    dbrew_config_parcount(r, 2);
+    dbrew_rewrite(r, 0, 5);
+    dbrew_reuse(r, (uint64_t) far, false);
+    dbrew_config_parcount(r, 2);
+    f = (func_t) dbrew_rewrite(r, 0, 5);
+    if (f(3, 4) != 7) wrong++;
+    long dist = (long) ((uint64_t) f - (uint64_t) far);
+    printf("reuse far away: %s, code near: %s\n", wrong ? "wrong" : "correct",
+           ((f != (func_t) far) && (labs(dist) < (1l << 31))) ? "yes" : "no");
+    munmap(far, 4096);
+
+    dbrew_free(r);
+    return wrong;
+}
@@ -0,0 +1,77 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+// dynamic branches on <x> result in multiple CBBs and emulator states
+__attribute__ ((noinline))
+long clamp(long x, long lo, long hi)
+{
+    if (x < lo) return lo;
+    if (x > hi) return hi;
+    return x;
+}
+
+// helper is called twice: second call finds its BBs already decoded
+__attribute__ ((noinline))
+long f1(long lo, long hi, long x)
+{
+    return clamp(x, lo, hi) + clamp(-x, lo, hi);
+}
+
+static
+const char* yesno(int b)
+{
+    return b ? "yes" : "no";
+}
+
+int main(void)
+{
+    DBrewStats s1, s2;
+    uint64_t size;
+
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) f1);
+    dbrew_config_parcount(r, 3);
+    dbrew_config_staticpar(r, 0);
+    dbrew_config_staticpar(r, 1);
+
+    dbrew_rewrite(r, 2, 10, 0);
+    size = dbrew_generated_size(r);
+    dbrew_get_stats(r, &s1);
+    printf("rewrites: %lu, fallbacks: %lu\n", s1.rewrites, s1.fallbacks);
+    printf("decoded/emulated/captured: %s/%s/%s\n",
+           yesno(s1.decodedInstrs > 0), yesno(s1.emulatedInstrs > 0),
+           yesno(s1.capturedInstrs > 0));
+    printf("multiple CBBs/states created: %s/%s\n",
+           yesno(s1.createdCBBs > 1), yesno(s1.savedStates > 1));
+    printf("decoding: hits within first rewrite: %s\n",
+           yesno(s1.decodeCacheHits > 0));
+    printf("generated bytes match: %s\n", yesno(s1.generatedBytes == size));
+    printf("phases within total time: %s\n",
+           yesno(s1.decodeNs + s1.emulateNs + s1.optNs + s1.generateNs
+                 <= s1.totalNs));
+
+    // second rewrite with other bounds reuses decoded BBs
+    dbrew_rewrite(r, 1, 100, 0);
+    dbrew_get_stats(r, &s2);
+    printf("rewrites: %lu, fallbacks: %lu\n", s2.rewrites, s2.fallbacks);
+    printf("decoding: cache misses unchanged: %s, more hits: %s\n",
+           yesno(s2.decodeCacheMisses == s1.decodeCacheMisses),
+           yesno(s2.decodeCacheHits > s1.decodeCacheHits));
+
+    // unsupported number of parameters: fall back to original
+    dbrew_config_parcount(r, 7);
+    dbrew_rewrite(r, 1, 100, 0, 0, 0, 0, 0);
+    dbrew_get_stats(r, &s2);
+    printf("rewrites: %lu, fallbacks: %lu\n", s2.rewrites, s2.fallbacks);
+
+    dbrew_reset_stats(r);
+    dbrew_get_stats(r, &s2);
+    printf("after reset: rewrites: %lu\n", s2.rewrites);
+
+    dbrew_free(r);
+    return 0;
+}
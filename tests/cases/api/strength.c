@@ -0,0 +1,97 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+#include "priv/common.h" // DBB/Instr: check instructions in rewritten code
+
+typedef int (*f1_t)(int, int);
+typedef long (*f2_t)(long, long);
+
+// number of instructions of type <it> in rewritten code at <f>,
+// which is a single basic block
+static
+int countInstr(uint64_t f, InstrType it)
+{
+    int n = 0;
+    Rewriter* d = dbrew_new();
+    DBB* bb = dbrew_decode(d, f);
+
+    for(int i = 0; i < bb->count; i++)
+        if (bb->instr[i].type == it) n++;
+    dbrew_free(d);
+    return n;
+}
+
+// division/modulo by static divisor d
+__attribute__ ((noinline))
+int f1(int d, int x)
+{
+    return x / d + (x % d) * 1000;
+}
+
+// multiplication by static factor c
+__attribute__ ((noinline))
+long f2(long c, long x)
+{
+    return x * c;
+}
+
+static
+int checkDiv(int d, bool sr)
+{
+    int res = 0;
+    int ex[] = { INT_MIN, INT_MIN + 1, INT_MAX, INT_MAX - 1, -1, 0, 1 };
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) f1);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_staticpar(r, 0);
+    dbrew_set_strength_reduction(r, sr);
+
+    f1_t f = (f1_t) dbrew_rewrite(r, d, 0);
+    for(int x = -100000; x < 100000; x += 7)
+        if (f(d, x) != f1(d, x)) res++;
+    for(int i = 0; i < 7; i++)
+        if (f(d, ex[i]) != f1(d, ex[i])) res++;
+    printf("div %d%s: %s, %d idiv, %d errors\n", d, sr ? "" : " (no reduction)",
+           ((uint64_t) f == (uint64_t) f1) ? "original" : "rewritten",
+           countInstr((uint64_t) f, IT_IDIV1), res);
+    dbrew_free(r);
+    return res;
+}
+
+static
+int checkMul(long c)
+{
+    int res = 0;
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) f2);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_staticpar(r, 0);
+
+    f2_t f = (f2_t) dbrew_rewrite(r, c, 0);
+    for(long x = -100000; x < 100000; x += 7)
+        if (f(c, x) != f2(c, x)) res++;
+    printf("mul %ld: %s, %d imul, %d errors\n", c,
+           ((uint64_t) f == (uint64_t) f2) ? "original" : "rewritten",
+           countInstr((uint64_t) f, IT_IMUL), res);
+    dbrew_free(r);
+    return res;
+}
+
+int main(void)
+{
+    int res = 0;
+    int d[] = { 7, -7, 3, -3, 16, 1000, INT_MAX };
+    long c[] = { 2, 3, 5, 9, 12, 40, 7, 1000 };
+
+    for(int i = 0; i < 7; i++)
+        res += checkDiv(d[i], true);
+    res += checkDiv(7, false);
+    for(int i = 0; i < 8; i++)
+        res += checkMul(c[i]);
+
+    return res;
+}
@@ -0,0 +1,108 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+typedef long (*sum_t)(long, long*);
+
+// sum of first n elements of array a
+__attribute__ ((noinline))
+long sum(long n, long* a)
+{
+    long s = 0;
+    for(long i = 0; i < n; i++)
+        s += a[i];
+    return s;
+}
+
+// same in assembly, to know address of loop header
+long asm_sum(long n, long* a);
+extern char asm_sum_loop[];
+__asm__(
+    "    .text\n"
+    "    .globl asm_sum\n"
+    "asm_sum:\n"
+    "    xor %eax, %eax\n"
+    "    xor %ecx, %ecx\n"
+    "    test %rdi, %rdi\n"
+    "    jle 1f\n"
+    "asm_sum_loop:\n"
+    "    add (%rsi,%rcx,8), %rax\n"
+    "    add $1, %rcx\n"
+    "    cmp %rdi, %rcx\n"
+    "    jl asm_sum_loop\n"
+    "1:  ret\n");
+
+long a[1000];
+
+// rewrite f for static n with unroll factor <u>, at <header> if not 0.
+// Returns code size, 0 on failure
+static
+int check(sum_t f, long n, int u, uint64_t header, bool nStatic)
+{
+    int size;
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) f);
+    dbrew_config_parcount(r, 2);
+    if (nStatic)
+        dbrew_config_staticpar(r, 0);
+    if (header)
+        dbrew_config_loop_unroll(r, header, u);
+    else
+        dbrew_config_unroll(r, u);
+
+    sum_t rf = (sum_t) dbrew_rewrite(r, n, a);
+    size = dbrew_generated_size(r);
+    if (rf == f) size = 0;
+    // with dynamic n, check other trip counts, too
+    for(long m = nStatic ? n : 0; m <= n; m++) {
+        if (rf(m, a) != f(m, a)) {
+            printf(" n = %ld: orig/rewritten: %ld/%ld\n", m, f(m, a), rf(m, a));
+            size = 0;
+        }
+    }
+    dbrew_free(r);
+    return size;
+}
+
+int main(void)
+{
+    int s0, s4, s8;
+
+    for(int i = 0; i < 1000; i++)
+        a[i] = 3 * i + 1;
+
+    // static trip count: no unrolling results in full unrolling
+    s0 = check(sum, 1000, 0, 0, true);
+    printf("static 1000 iterations, no unrolling: %s\n",
+           s0 ? "rewritten" : "original");
+    for(int n = 29; n <= 32; n++) {
+        s4 = check(sum, n, 4, 0, true);
+        printf("static %d iterations, unroll 4: %s\n",
+               n, s4 ? "rewritten" : "failed");
+    }
+    s0 = check(sum, 30, 0, 0, true);
+    s4 = check(sum, 30, 4, 0, true);
+    printf("static 30 iterations, unroll 4 smaller than full: %s\n",
+           (s4 > 0) && (s4 < s0) ? "yes" : "no");
+
+    // dynamic trip count: copies of loop body, with exits in each copy
+    s0 = check(sum, 13, 2, 0, false);
+    s4 = check(sum, 13, 4, 0, false);
+    s8 = check(sum, 13, 8, 0, false);
+    printf("dynamic trip count, unroll 2/4/8: %s\n",
+           (s0 > 0) && (s0 < s4) && (s4 < s8) ? "larger code" : "failed");
+
+    // unroll factor for a given loop header
+    s0 = check(asm_sum, 100, 0, 0, true);
+    s4 = check(asm_sum, 100, 4, (uint64_t) asm_sum_loop, true);
+    printf("unroll 4 at loop header: %s\n",
+           (s4 > 0) && (s4 < s0) ? "smaller code" : "failed");
+    s4 = check(asm_sum, 100, 4, (uint64_t) asm_sum, true);
+    printf("unroll 4 at other address: %s\n",
+           (s4 == s0) ? "full unrolling" : "failed");
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+#include "priv/common.h" // DBB/Instr: check instructions in rewritten code
+
+typedef long (*f_t)(long*, long*);
+
+// loads of the same struct member and array element, and repeated
+// address calculations, as seen in stencil codes after inlining
+long asm_f(long* p, long* m);
+__asm__(
+    "    .text\n"
+    "    .globl asm_f\n"
+    "asm_f:\n"
+    "    mov 8(%rdi), %rax\n"
+    "    mov (%rsi,%rax,8), %rcx\n"
+    "    mov 8(%rdi), %rdx\n"
+    "    mov (%rsi,%rdx,8), %r8\n"
+    "    lea 8(%rsi,%rax,8), %r9\n"
+    "    lea 8(%rsi,%rdx,8), %r10\n"
+    "    mov %rcx, 16(%rdi)\n"
+    "    mov 8(%rdi), %r11\n"
+    "    add %r8, %rcx\n"
+    "    add (%r9), %rcx\n"
+    "    add (%r10), %rcx\n"
+    "    mov %r11, %rax\n"
+    "    imul %rdx, %rax\n"
+    "    mov %r11, %rdx\n"
+    "    imul %rax, %rdx\n"
+    "    mov 16(%rdi), %r8\n"
+    "    mov %r11, %rax\n"
+    "    imul %r11, %rax\n"
+    "    add %rdx, %rax\n"
+    "    add %r8, %rax\n"
+    "    add %rcx, %rax\n"
+    "    ret\n");
+
+// count memory loads and address calculations in rewritten code at <f>,
+// which is a single basic block
+static
+void countInstr(uint64_t f, int* loads, int* leas)
+{
+    Rewriter* d = dbrew_new();
+    DBB* bb = dbrew_decode(d, f);
+
+    *loads = 0;
+    *leas = 0;
+    for(int i = 0; i < bb->count; i++) {
+        Instr* instr = bb->instr + i;
+        if (instr->type == IT_LEA)
+            (*leas)++;
+        else if (opIsInd(&(instr->src)))
+            (*loads)++;
+    }
+    dbrew_free(d);
+}
+
+long p[3] = { 0, 2, 0 };
+long m[10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+
+static
+f_t rewrite(bool vn, int* size)
+{
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) asm_f);
+    dbrew_config_parcount(r, 2);
+    dbrew_set_value_numbering(r, vn);
+    f_t f = (f_t) dbrew_rewrite(r, p, m);
+    *size = dbrew_generated_size(r);
+    return f;
+}
+
+int main(void)
+{
+    int res = 0, s0, s1, loads, leas;
+    f_t f0 = rewrite(false, &s0);
+    f_t f1 = rewrite(true, &s1);
+
+    countInstr((uint64_t) f0, &loads, &leas);
+    printf("without value numbering: %s, %d loads, %d lea\n",
+           (f0 == asm_f) ? "original" : "rewritten", loads, leas);
+    countInstr((uint64_t) f1, &loads, &leas);
+    printf("with value numbering: %s, %d loads, %d lea, %s\n",
+           (f1 == asm_f) ? "original" : "rewritten", loads, leas,
+           (s1 < s0) ? "smaller code" : "no smaller code");
+    for(long x = 0; x < 8; x++) {
+        long r, r0, r1;
+        p[1] = x;
+        r = asm_f(p, m);
+        r0 = f0(p, m);
+        r1 = f1(p, m);
+        if ((r0 != r) || (r1 != r)) {
+            printf(" x = %ld: orig/rewritten: %ld/%ld/%ld\n", x, r, r0, r1);
+            res++;
+        }
+    }
+    return res;
+}
@@ -0,0 +1,216 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+// x / sqrt(x * x + 1)
+double k_arith(double x);
+__asm__(
+    "    .text\n"
+    "    .globl k_arith\n"
+    "k_arith:\n"
+    "    movapd %xmm0, %xmm1\n"
+    "    mulsd %xmm0, %xmm1\n"
+    "    addsd c_one, %xmm1\n"
+    "    sqrtsd %xmm1, %xmm1\n"
+    "    subsd c_zero, %xmm0\n"
+    "    divsd %xmm1, %xmm0\n"
+    "    ret\n");
+
+// min(fabs(x), 2) with bitmask constant, and max(x,0) via zero idiom
+double k_clamp(double x);
+__asm__(
+    "    .text\n"
+    "    .globl k_clamp\n"
+    "k_clamp:\n"
+    "    andpd c_absmask, %xmm0\n"
+    "    minsd c_two, %xmm0\n"
+    "    xorpd %xmm2, %xmm2\n"
+    "    maxsd %xmm2, %xmm0\n"
+    "    ret\n");
+
+// (a < b) ? a : 2 * b, using comparison mask
+double k_select(double a, double b);
+__asm__(
+    "    .text\n"
+    "    .globl k_select\n"
+    "k_select:\n"
+    "    movapd %xmm0, %xmm2\n"
+    "    cmpsd $1, %xmm1, %xmm2\n"
+    "    addsd %xmm1, %xmm1\n"
+    "    andpd %xmm2, %xmm0\n"
+    "    andnpd %xmm1, %xmm2\n"
+    "    orpd %xmm2, %xmm0\n"
+    "    ret\n");
+
+// 0.5 * (v[-1] + v[1]), loading via pointer
+double k_stencil(double* v);
+__asm__(
+    "    .text\n"
+    "    .globl k_stencil\n"
+    "k_stencil:\n"
+    "    lea 8(%rdi), %rax\n"
+    "    movsd -16(%rax), %xmm0\n"
+    "    addsd (%rax), %xmm0\n"
+    "    mulsd c_half, %xmm0\n"
+    "    ret\n");
+
+// x * x if flag is set: branch not depending on vector values
+double k_flag(double x);
+__asm__(
+    "    .text\n"
+    "    .globl k_flag\n"
+    "k_flag:\n"
+    "    cmpl $0, flag\n"
+    "    je 1f\n"
+    "    mulsd %xmm0, %xmm0\n"
+    "1:  ret\n");
+
+// x * factor, with factor in writable memory
+double k_scale(double x);
+__asm__(
+    "    .text\n"
+    "    .globl k_scale\n"
+    "k_scale:\n"
+    "    mulsd factor, %xmm0\n"
+    "    ret\n");
+
+// fabs via branch depending on value: not vectorizable
+double k_branch(double x);
+__asm__(
+    "    .text\n"
+    "    .globl k_branch\n"
+    "k_branch:\n"
+    "    xorpd %xmm1, %xmm1\n"
+    "    ucomisd %xmm0, %xmm1\n"
+    "    jbe 1f\n"
+    "    xorpd c_signmask, %xmm0\n"
+    "1:  ret\n"
+    "    .section .rodata\n"
+    "    .align 16\n"
+    "c_absmask:\n"
+    "    .quad 0x7fffffffffffffff, 0x7fffffffffffffff\n"
+    "c_signmask:\n"
+    "    .quad 0x8000000000000000, 0x8000000000000000\n"
+    "c_zero:\n"
+    "    .double 0.0\n"
+    "c_one:\n"
+    "    .double 1.0\n"
+    "c_two:\n"
+    "    .double 2.0\n"
+    "c_half:\n"
+    "    .double 0.5\n"
+    "    .text\n");
+
+int flag = 1;
+double factor = 2.0;
+
+void arith(double* ov, double* iv)  { dbrew_apply4_R8V8(k_arith, ov, iv); }
+void clamp(double* ov, double* iv)  { dbrew_apply4_R8V8(k_clamp, ov, iv); }
+void stencil(double* ov, double* iv) { dbrew_apply4_R8P8(k_stencil, ov, iv); }
+void fflag(double* ov, double* iv)  { dbrew_apply4_R8V8(k_flag, ov, iv); }
+void branch(double* ov, double* iv) { dbrew_apply4_R8V8(k_branch, ov, iv); }
+void scale(double* ov, double* iv)  { dbrew_apply4_R8V8(k_scale, ov, iv); }
+void select2(double* ov, double* i1v, double* i2v)
+{
+    dbrew_apply4_R8V8V8(k_select, ov, i1v, i2v);
+}
+
+typedef void (*apply_t)(double*, double*);
+typedef void (*apply2_t)(double*, double*, double*);
+
+static
+int check(const char* name, apply_t f, double* in)
+{
+    double o1[4], o2[4];
+    Rewriter* r;
+    apply_t rf;
+    int res = 0;
+
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) f);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_force_unknown(r, 0);
+    dbrew_set_vectorsize(r, 16);
+    rf = (apply_t) dbrew_rewrite(r, o1, in);
+
+    f(o1, in);
+    rf(o2, in);
+    for(int i = 0; i < 4; i++)
+        if (o1[i] != o2[i]) res++;
+    printf("%s: %s\n", name, res ? "wrong" : "correct");
+    dbrew_free(r);
+    return res;
+}
+
+// factor changes after rewriting: must be read at runtime unless
+// configured as constant
+static
+int checkScale(int vs, bool constant, double* in)
+{
+    double o1[4], o2[4];
+    Rewriter* r;
+    apply_t rf;
+    int res = 0;
+
+    r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) scale);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_force_unknown(r, 0);
+    if (constant)
+        dbrew_config_set_memrange(r, (char*) "factor", false,
+                                  (uint64_t) &factor, sizeof(factor));
+    vs = dbrew_set_vectorsize(r, vs);
+    rf = (apply_t) dbrew_rewrite(r, o1, in);
+
+    factor = 3.0;
+    scale(o1, in);
+    rf(o2, in);
+    for(int i = 0; i < 4; i++)
+        if (o1[i] != o2[i]) res++;
+    factor = 2.0;
+    dbrew_free(r);
+    return res;
+}
+
+int main()
+{
+    // one element before and after for stencil
+    double a[6] = { 1.0, -3.0, 0.5, 4.0, -1.5, 2.0 };
+    double b[4] = { 2.0, -4.0, 0.5, 1.0 };
+    double o1[4], o2[4];
+    int res = 0;
+
+    res += check("arith", arith, a + 1);
+    res += check("clamp", clamp, a + 1);
+    res += check("stencil", stencil, a + 1);
+    res += check("flag", fflag, a + 1);
+    res += check("branch", branch, a + 1);
+
+    int changed = 0;
+    changed += checkScale(16, false, a + 1);
+    changed += checkScale(32, false, a + 1);
+    changed += checkScale(64, false, a + 1);
+    printf("scale with changed factor: %s\n", changed ? "wrong" : "correct");
+    res += changed;
+    printf("scale with factor configured as constant: %s\n",
+           checkScale(16, true, a + 1) ? "replicated" : "read at runtime");
+
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) select2);
+    dbrew_config_parcount(r, 3);
+    dbrew_config_force_unknown(r, 0);
+    dbrew_set_vectorsize(r, 16);
+    apply2_t rf = (apply2_t) dbrew_rewrite(r, o1, a, b);
+    select2(o1, a, b);
+    rf(o2, a, b);
+    int wrong = 0;
+    for(int i = 0; i < 4; i++)
+        if (o1[i] != o2[i]) wrong++;
+    printf("select: %s\n", wrong ? "wrong" : "correct");
+    dbrew_free(r);
+
+    return res + wrong;
+}
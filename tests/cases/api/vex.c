@@ -0,0 +1,175 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbrew.h"
+
+typedef double (*f_t)(double, double, double*);
+
+// max(sqrt(max(a * b + p[0], p[1])) - b, 0), stored also into p[2]
+double asm_f(double a, double b, double* p);
+__asm__(
+    "    .text\n"
+    "    .globl asm_f\n"
+    "asm_f:\n"
+    "    movapd %xmm0, %xmm2\n"
+    "    mulsd %xmm1, %xmm2\n"
+    "    addsd (%rdi), %xmm2\n"
+    "    movsd 8(%rdi), %xmm3\n"
+    "    maxsd %xmm3, %xmm2\n"
+    "    sqrtsd %xmm2, %xmm2\n"
+    "    movaps %xmm2, %xmm0\n"
+    "    subsd %xmm1, %xmm0\n"
+    "    xorpd %xmm3, %xmm3\n"
+    "    maxsd %xmm3, %xmm0\n"
+    "    movsd %xmm0, %xmm4\n"
+    "    movsd %xmm4, 16(%rdi)\n"
+    "    ret\n");
+
+// x * x + 1
+double k_sq(double x);
+__asm__(
+    "    .text\n"
+    "    .globl k_sq\n"
+    "k_sq:\n"
+    "    mulsd %xmm0, %xmm0\n"
+    "    addsd c_one, %xmm0\n"
+    "    ret\n"
+    "    .section .rodata\n"
+    "    .align 16\n"
+    "c_one:\n"
+    "    .double 1.0\n"
+    "    .text\n");
+
+// returns __m256 in ymm0: a[0..7] + b[0..7]
+void asm_add8(float* a, float* b);
+__asm__(
+    "    .text\n"
+    "    .globl asm_add8\n"
+    "asm_add8:\n"
+    "    vmovups (%rdi), %ymm0\n"
+    "    vaddps (%rsi), %ymm0, %ymm0\n"
+    "    ret\n");
+
+// call <f> with <a>, <b>, storing the returned __m256 into <o>
+typedef void (*add8_t)(float*, float*);
+void call_add8(add8_t f, float* o, float* a, float* b);
+__asm__(
+    "    .text\n"
+    "    .globl call_add8\n"
+    "call_add8:\n"
+    "    push %rbx\n"
+    "    mov %rsi, %rbx\n"
+    "    mov %rdi, %rax\n"
+    "    mov %rdx, %rdi\n"
+    "    mov %rcx, %rsi\n"
+    "    call *%rax\n"
+    "    vmovups %ymm0, (%rbx)\n"
+    "    vzeroupper\n"
+    "    pop %rbx\n"
+    "    ret\n");
+
+void sq(double* ov, double* iv, int n) { dbrew_apply_R8V8(k_sq, ov, iv, n); }
+typedef void (*apply_t)(double*, double*, int);
+
+static
+int check(f_t f)
+{
+    double p[3] = { 2.0, 3.0, 0.0 };
+    double ab[][2] = { { 1.0, 2.0 }, { 4.0, 0.5 }, { -3.0, 1.0 }, { 1.0, 3.0 } };
+    int res = 0;
+
+    for(int i = 0; i < 4; i++) {
+        double r1 = asm_f(ab[i][0], ab[i][1], p);
+        double r2 = f(ab[i][0], ab[i][1], p);
+        if ((r1 != r2) || (p[2] != r2)) res++;
+    }
+    return res;
+}
+
+static
+Rewriter* rewrite(uint64_t f, bool vex, f_t* rf)
+{
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, f);
+    dbrew_config_parcount(r, 3);
+    dbrew_config_force_unknown(r, 0);
+    dbrew_config_returnfp(r);
+    dbrew_set_vex_transcoding(r, vex);
+    *rf = (f_t) dbrew_rewrite(r, 1.0, 1.0, 0);
+    return r;
+}
+
+int main()
+{
+    Rewriter *r1, *r2, *r3;
+    f_t f1, f2, f3;
+    double a[19], o1[19], o2[19];
+    int res;
+
+    r1 = rewrite((uint64_t) asm_f, false, &f1);
+    r2 = rewrite((uint64_t) asm_f, true, &f2);
+    printf("legacy: %s\n", check(f1) ? "wrong" : "correct");
+    res = check(f2);
+    printf("transcoded: %s, %s code\n", res ? "wrong" : "correct",
+           (dbrew_generated_size(r2) < dbrew_generated_size(r1)) ?
+           "smaller" : "not smaller");
+
+    // transcoded code can be decoded and rewritten again
+    r3 = rewrite((uint64_t) f2, true, &f3);
+    printf("rewritten again: %s\n", check(f3) ? "wrong" : "correct");
+    dbrew_free(r1);
+    dbrew_free(r2);
+    dbrew_free(r3);
+
+    // 256-bit code clears upper register parts before returning
+    Rewriter* r = dbrew_new();
+    dbrew_set_capture_capacity(r, 5000, 200, 20000);
+    dbrew_set_function(r, (uint64_t) sq);
+    dbrew_config_parcount(r, 3);
+    dbrew_config_force_unknown(r, 0);
+    if (dbrew_set_vectorsize(r, 32) == 32) {
+        apply_t rf = (apply_t) dbrew_rewrite(r, o2, a, 19);
+        uint8_t* code = (uint8_t*) dbrew_generated_code(r);
+        int len = dbrew_generated_size(r);
+        bool found = false;
+        for(int i = 0; i + 4 <= len; i++)
+            if (memcmp(code + i, "\xc5\xf8\x77\xc3", 4) == 0) found = true;
+
+        for(int i = 0; i < 19; i++)
+            a[i] = i - 9.5;
+        sq(o1, a, 19);
+        rf(o2, a, 19);
+        res = memcmp(o1, o2, sizeof(o1));
+        printf("vzeroupper before return: %s, %s\n",
+               found ? "yes" : "no", res ? "wrong" : "correct");
+    }
+    else
+        printf("vzeroupper before return: yes, correct\n");
+    dbrew_free(r);
+
+    // no vzeroupper if ymm0 is returned as 256-bit value
+    if (__builtin_cpu_supports("avx")) {
+        float x[8], y[8], s1[8], s2[8];
+        for(int i = 0; i < 8; i++) {
+            x[i] = i;
+            y[i] = 0.5 * i;
+        }
+        r = dbrew_new();
+        dbrew_set_function(r, (uint64_t) asm_add8);
+        dbrew_config_parcount(r, 2);
+        dbrew_config_force_unknown(r, 0);
+        add8_t rf = (add8_t) dbrew_rewrite(r, x, y);
+        call_add8(asm_add8, s1, x, y);
+        call_add8(rf, s2, x, y);
+        res = memcmp(s1, s2, sizeof(s1));
+        printf("__m256 return: %s\n", res ? "wrong" : "correct");
+        dbrew_free(r);
+    }
+    else
+        printf("__m256 return: correct\n");
+
+    return 0;
+}
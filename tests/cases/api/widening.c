@@ -0,0 +1,63 @@
+//!compile = {cc} {ccflags} -o {outfile} {infile} {dbrew} -pthread
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbrew.h"
+
+typedef long (*f1_t)(long, long);
+
+// loop with static trip count and a dynamic branch in the loop body
+__attribute__ ((noinline))
+long f1(long n, long x)
+{
+    long s = 0;
+    for(long i = 0; i < n; i++) {
+        if (x & i)
+            s += i;
+        else
+            s -= 1;
+    }
+    return s;
+}
+
+// rewrite with widening after <widen> states, return saved states in <states>
+static
+int check(const char* name, int widen, uint64_t* states)
+{
+    DBrewStats s;
+    int res = 0;
+    Rewriter* r = dbrew_new();
+    dbrew_set_function(r, (uint64_t) f1);
+    dbrew_config_parcount(r, 2);
+    dbrew_config_staticpar(r, 0);
+    dbrew_config_widening(r, widen);
+
+    f1_t f = (f1_t) dbrew_rewrite(r, 30, 0);
+    printf("%s: %s\n", name, (f == f1) ? "original" : "rewritten");
+    dbrew_get_stats(r, &s);
+    *states = s.savedStates;
+    for(long x = 0; x < 40; x += 7) {
+        if (f(30, x) != f1(30, x)) {
+            printf(" x = %ld: orig/rewritten: %ld/%ld\n", x, f1(30, x), f(30, x));
+            res++;
+        }
+    }
+    dbrew_free(r);
+    return res;
+}
+
+int main(void)
+{
+    uint64_t states0, states2, states4;
+    int res = 0;
+
+    // without widening, each iteration needs its own emulator state
+    res += check("no widening", 0, &states0);
+    res += check("widening after 2 states", 2, &states2);
+    res += check("widening after 4 states", 4, &states4);
+    printf("fewer states with earlier widening: %s\n",
+           (states2 < states4) ? "yes" : "no");
+
+    return res;
+}
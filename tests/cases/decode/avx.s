@@ -74,4 +74,19 @@ f1:
     vmovntdq [rax], xmm0
     vmovntdq [rax], ymm0
 
+    vsubss xmm2, xmm0, xmm1
+    vsubsd xmm2, xmm0, [rax]
+    vdivss xmm2, xmm0, xmm1
+    vdivsd xmm2, xmm0, [rax]
+    vminss xmm2, xmm0, xmm1
+    vminsd xmm2, xmm0, [rax]
+    vmaxss xmm2, xmm0, xmm1
+    vmaxsd xmm2, xmm0, [rax]
+    vsqrtss xmm2, xmm0, xmm1
+    vsqrtsd xmm2, xmm0, [rax]
+    vcmpss xmm0, xmm0, xmm1, 1
+    vcmpsd xmm0, xmm0, [rax], 2
+    vucomiss xmm0, xmm1
+    vucomisd xmm0, [rax]
+
     ret
@@ -0,0 +1,35 @@
+//!driver = test-driver-decode.c
+.intel_syntax noprefix
+    .text
+    .globl  f1
+    .type   f1, @function
+f1:
+    vaddps zmm2, zmm0, zmm1
+    vaddpd zmm2, zmm0, zmm1
+    vaddpd zmm2, zmm0, [rax]
+    vmulps zmm2, zmm0, [rax+64]
+    vmulpd zmm2, zmm0, [rax-128]
+    vsubpd zmm2, zmm0, [rax+8]
+    vdivps zmm10, zmm8, zmm15
+    vminpd zmm2, zmm0, [r9+rcx*8+256]
+    vmaxps zmm2, zmm0, zmm1
+    vsqrtpd zmm1, [rax]
+    vandpd zmm2, zmm0, zmm1
+    vandnps zmm2, zmm0, zmm1
+    vorpd zmm2, zmm0, zmm1
+    vxorps zmm2, zmm0, zmm1
+
+    vmovups zmm0, [rax]
+    vmovupd zmm0, [rax+64]
+    vmovaps zmm0, [rax]
+    vmovapd zmm0, zmm1
+    vmovups [rax], zmm0
+    vmovupd [rax+192], zmm9
+    vmovaps [rax], zmm0
+    vmovapd [rax], zmm0
+
+    vsubps ymm2, ymm0, ymm1
+    vsqrtps xmm1, [rax]
+    vcmpps ymm1, ymm1, ymm2, 1
+
+    ret